@@ -11,6 +11,7 @@ WrapAccelerationStructure createAcceleration(Graphics* _p_gfx,
     //printf("createAcceleration (6)\n");
     WrapAccelerationStructure result;
     // Allocating the buffer to hold the acceleration structure
+    DeviceAllocator::OwnerScope owner(_p_gfx->GetAllocator(), "acceleration structures");
     result.bw = _p_gfx->CreateBufferWrap(accel_.size, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddress,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
 
@@ -89,6 +90,7 @@ void RaytracingBuilderKHR::BuildBlas(const std::vector<BlasInput>& input, vk::Bu
     }
 
     // Allocate the scratch buffers holding the temporary data of the acceleration structure builder
+    DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), "acceleration structure scratch");
     BufferWrap scratch_buff = p_gfx->CreateBufferWrap(maxScratchSize,
         vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
@@ -151,7 +153,7 @@ void RaytracingBuilderKHR::BuildBlas(const std::vector<BlasInput>& input, vk::Bu
     // Keeping all the created acceleration structures
     for (auto& b : buildAs)
     {
-        m_blas.emplace_back(b.as);
+        m_blas.emplace_back(std::move(b.as));
     }
 
     // Clean up
@@ -245,7 +247,7 @@ void RaytracingBuilderKHR::CmdCompactBlas(vk::CommandBuffer cmdBuf, std::vector<
 
     for (auto idx : indices)
     {
-        buildAs[idx].cleanupAS = buildAs[idx].as.accel;           // previous AS to destroy
+        buildAs[idx].cleanupAS = std::move(buildAs[idx].as);      // previous AS to destroy
         buildAs[idx].sizeInfo.accelerationStructureSize = compactSizes[queryCtn++];  // new reduced size
 
         // Creating a compact version of the AS
@@ -267,7 +269,8 @@ void RaytracingBuilderKHR::DestroyNonCompacted(std::vector<uint32_t> indices, st
     printf("RaytracingBuilderKHR::destroyNonCompacted\n");
     for (auto& i : indices)
     {
-        p_gfx->GetDeviceRef().destroyAccelerationStructureKHR(buildAs[i].cleanupAS, nullptr);
+        p_gfx->GetDeviceRef().destroyAccelerationStructureKHR(buildAs[i].cleanupAS.accel, nullptr);
+        buildAs[i].cleanupAS.bw.destroy(p_gfx->GetDeviceRef());
     }
 }
 
@@ -296,6 +299,14 @@ void RaytracingBuilderKHR::CmdCreateTlas(vk::CommandBuffer cmdBuf, uint32_t coun
     // Create TLAS
     if (update == false)
     {
+        // A rebuild replaces the TLAS, which frames in flight may still trace against
+        if (m_tlas.accel)
+        {
+            vk::Device device = p_gfx->GetDeviceRef();
+            vk::AccelerationStructureKHR old = m_tlas.accel;
+            p_gfx->Retire([device, old]() { device.destroyAccelerationStructureKHR(old, nullptr); });
+            p_gfx->Retire(std::move(m_tlas.bw));
+        }
 
         vk::AccelerationStructureCreateInfoKHR createInfo;
         createInfo.setType(vk::AccelerationStructureTypeKHR::eTopLevel);
@@ -304,6 +315,7 @@ void RaytracingBuilderKHR::CmdCreateTlas(vk::CommandBuffer cmdBuf, uint32_t coun
     }
 
     // Allocate the scratch memory
+    DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), "acceleration structure scratch");
     scratch_buffer = p_gfx->CreateBufferWrap(sizeInfo.buildScratchSize,
         vk::BufferUsageFlagBits::eShaderDeviceAddress | vk::BufferUsageFlagBits::eStorageBuffer,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
@@ -91,7 +91,7 @@ protected:
         vk::AccelerationStructureBuildSizesInfoKHR sizeInfo;
         const vk::AccelerationStructureBuildRangeInfoKHR* rangeInfo;
         WrapAccelerationStructure as;  // result acceleration structure
-        vk::AccelerationStructureKHR cleanupAS;
+        WrapAccelerationStructure cleanupAS;  // Non-compacted AS, until the compacted copy is done
     };
 
 
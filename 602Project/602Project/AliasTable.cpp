@@ -0,0 +1,56 @@
+#include "AliasTable.h"
+
+std::vector<EmitterAlias> BuildAliasTable(const std::vector<float>& weights) {
+    const size_t count = weights.size();
+    double total = 0.0;
+    for (float weight : weights)
+        total += weight > 0.0f ? weight : 0.0f;
+    if (count == 0 || total <= 0.0)
+        return {};
+
+    std::vector<EmitterAlias> table(count);
+    // Weights scaled so the average slot holds exactly 1
+    std::vector<double> scaled(count);
+    std::vector<uint32_t> small, large;
+    small.reserve(count);
+    large.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        double weight = weights[i] > 0.0f ? weights[i] : 0.0f;
+        table[i].pdf = static_cast<float>(weight / total);
+        table[i].alias = static_cast<uint32_t>(i);
+        scaled[i] = weight * count / total;
+        if (scaled[i] < 1.0)
+            small.push_back(static_cast<uint32_t>(i));
+        else
+            large.push_back(static_cast<uint32_t>(i));
+    }
+
+    // Vose: top up each under full slot with the remainder of an over full one
+    while (!small.empty() && !large.empty()) {
+        uint32_t less = small.back();
+        small.pop_back();
+        uint32_t more = large.back();
+
+        table[less].prob = static_cast<float>(scaled[less]);
+        table[less].alias = more;
+
+        scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+        if (scaled[more] < 1.0) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+
+    // Whatever is left is full up to rounding error
+    for (uint32_t i : large)
+        table[i].prob = 1.0f;
+    for (uint32_t i : small)
+        table[i].prob = 1.0f;
+
+    return table;
+}
+
+float EmitterWeight(const Emitter& emitter) {
+    float luminance = glm::dot(emitter.emission, vec3(0.2126f, 0.7152f, 0.0722f));
+    return emitter.area * luminance;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// Walker/Vose alias table for O(1) sampling of a discrete distribution.
+// Sampling picks a slot i uniformly, keeps it with probability prob
+// and otherwise takes alias. pdf holds the normalized weight of slot i
+// so the shader can weight its sample without another lookup.
+// Returns an empty table if no weight is positive.
+std::vector<EmitterAlias> BuildAliasTable(const std::vector<float>& weights);
+
+//Sampling weight of an emitter triangle: its power, area * luminance(emission)
+float EmitterWeight(const Emitter& emitter);
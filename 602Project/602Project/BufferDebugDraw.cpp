@@ -120,14 +120,10 @@ void BufferDebugDraw::SetupPipeline() {
 
     vk::PipelineInputAssemblyStateCreateInfo inputAssembly({}, vk::PrimitiveTopology::eTriangleList);
 
-    vk::Viewport viewport;
-    viewport.setWidth(p_gfx->GetWindowSize().x);
-    viewport.setHeight(p_gfx->GetWindowSize().y);
-    viewport.setMaxDepth(1.0f);
-
-    vk::Rect2D scissor({ 0, 0 }, p_gfx->GetWindowExtent());
-
-    vk::PipelineViewportStateCreateInfo viewportState({}, 1, &viewport, 1, &scissor);
+    // Set when drawing (Graphics::CommandSetViewport)
+    vk::PipelineViewportStateCreateInfo viewportState({}, 1, nullptr, 1, nullptr);
+    std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamicState({}, dynamicStates);
 
     vk::PipelineRasterizationStateCreateInfo rasterizer;
     rasterizer.setLineWidth(1.0f);
@@ -158,6 +154,7 @@ void BufferDebugDraw::SetupPipeline() {
     pipelineCreateInfo.setPMultisampleState(&multiSampling);
     pipelineCreateInfo.setPDepthStencilState(&depthStencil);
     pipelineCreateInfo.setPColorBlendState(&colorBlending);
+    pipelineCreateInfo.setPDynamicState(&dynamicState);
     pipelineCreateInfo.setLayout(m_pipeline_layout);
     pipelineCreateInfo.setRenderPass(m_render_pass);
     pipelineCreateInfo.setSubpass(0);
@@ -180,8 +177,10 @@ void BufferDebugDraw::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(vertShaderModule);
 }
 
-BufferDebugDraw::BufferDebugDraw(Graphics* _p_gfx, RenderPass* p_prev_pass) :
+BufferDebugDraw::BufferDebugDraw(Graphics* _p_gfx) :
     RenderPass(_p_gfx), draw_buffer(DrawBuffer::DISABLE) {
+    m_clear_values[0].color = vk::ClearColorValue(std::array<float, 4>({ { 1.0f, 1.0f, 1.0f, 1.0f } }));
+    m_clear_values[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
     SetupRenderPass();
     SetupFramebuffer();
     SetupDescriptor();
@@ -190,6 +189,7 @@ BufferDebugDraw::BufferDebugDraw(Graphics* _p_gfx, RenderPass* p_prev_pass) :
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.dof_coc_sample_scale = 800.0f;
     m_push_consts.alignmentTest = 1234;
+    m_push_consts.uv_scale = vec2(1.0f);
 }
 
 BufferDebugDraw::~BufferDebugDraw() {
@@ -203,27 +203,55 @@ BufferDebugDraw::~BufferDebugDraw() {
     m_descriptor.destroy(p_gfx->GetDeviceRef());
 }
 
-void BufferDebugDraw::Setup() {
+void BufferDebugDraw::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eFragmentShader;
+    builder.DrawsOutside();
+    p_velocity_buffer = &builder.Peek("velocity", stages);
+    p_depth_buffer = &builder.Peek("depth", stages);
+    p_tile_max_buffer = &builder.Peek("tile_max", stages);
+    p_neighbour_max_buffer = &builder.Peek("neighbour_max", stages);
+    p_pre_dof_buffer = &builder.Peek("pre_dof", stages);
+    p_pre_dof_params_buffer = &builder.Peek("pre_dof_params", stages);
+    p_dof_buffer = &builder.Peek("dof", stages);
+    p_median_bg_buffer = &builder.Peek("median_bg", stages);
+    p_median_fg_buffer = &builder.Peek("median_fg", stages);
+    p_upscaled_buffer = &builder.Peek("upscaled", stages);
+    p_edge_buffer = &builder.Peek("edge", stages);
+    p_raycast_bg_buffer = &builder.Peek("median_rt", stages);
+    p_raymask_buffer = &builder.Peek("dof_raymask", stages);
 }
 
-void BufferDebugDraw::Render() {
-    if (draw_buffer == DrawBuffer::DISABLE)
-        return;
-
-    m_push_consts.dof_coc_sample_scale = p_dof_pass->GetDOFParams().coc_sample_scale;
+void BufferDebugDraw::Resize() {
+    vk::Device device = p_gfx->GetDeviceRef();
+    for (auto framebuffer : m_framebuffers)
+        p_gfx->Retire([device, framebuffer]() { device.destroyFramebuffer(framebuffer); });
+    m_framebuffers.clear();
+    SetupFramebuffer();
+    p_gfx->RenewDescriptor(m_descriptor);
+}
 
-    std::array<vk::ClearValue, 2> clearValues;
-    clearValues[0].color = vk::ClearColorValue(std::array<float, 4>({ { 1.0f, 1.0f, 1.0f, 1.0f } }));
-    clearValues[1].depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
+void BufferDebugDraw::Setup() {
+    // After a resize the image on screen has a new view
+    if (p_draw_image)
+        SetDrawBuffer(*p_draw_image);
+}
 
-    vk::RenderPassBeginInfo renderPassBeginInfo(
+bool BufferDebugDraw::GetRenderPassBegin(vk::RenderPassBeginInfo& info) const {
+    info = vk::RenderPassBeginInfo(
         m_render_pass, m_framebuffers[p_gfx->GetCurrentSwapchainIndex()],
-        vk::Rect2D(vk::Offset2D(0, 0), p_gfx->GetWindowExtent()), clearValues);
+        vk::Rect2D(vk::Offset2D(0, 0), p_gfx->GetWindowExtent()), m_clear_values);
+    return true;
+}
 
-    p_gfx->GetCommandBuffer().beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-    {   // extra indent for renderpass commands
+void BufferDebugDraw::Render() {
+    m_push_consts.dof_coc_sample_scale = p_dof_pass->GetDOFParams().coc_sample_scale;
+    // Only the upscaled buffer fills the window
+    m_push_consts.uv_scale = p_draw_image == p_upscaled_buffer ? vec2(1.0f) : p_gfx->GetRenderScale();
+
+    {   // extra indent for renderpass commands, which the render graph begins
 
         p_gfx->GetCommandBuffer().bindPipeline(vk::PipelineBindPoint::eGraphics, m_pipeline);
+        p_gfx->CommandSetViewport(p_gfx->GetWindowExtent());
 
         p_gfx->GetCommandBuffer().bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
             m_pipeline_layout, 0, 1, &m_descriptor.descSet, 0, nullptr);
@@ -241,63 +269,15 @@ void BufferDebugDraw::Render() {
         ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), p_gfx->GetCommandBuffer());
 #endif
     }
-    p_gfx->GetCommandBuffer().endRenderPass();
 }
 
 void BufferDebugDraw::Teardown() {
 
 }
 
-void BufferDebugDraw::SetDrawBuffer(vk::DescriptorImageInfo& draw_descriptor) {
-    m_descriptor.write(p_gfx->GetDeviceRef(), 0, draw_descriptor);
-}
-
-void BufferDebugDraw::SetVeloDepthBuffer(const ImageWrap& draw_buffer) {
-    velo_depth_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetTileMaxBuffer(const ImageWrap& draw_buffer) {
-    tile_max_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetNeighbourMaxBuffer(const ImageWrap& draw_buffer) {
-    neighbour_max_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetPreDOFBuffer(const ImageWrap& draw_buffer) {
-    pre_dof_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetPreDOFParamsBuffer(const ImageWrap& draw_buffer) {
-    pre_dof_params_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetDOFBuffer(const ImageWrap& draw_buffer) {
-    dof_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetMedianBGBuffer(const ImageWrap& draw_buffer) {
-    median_bg_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetMedianFGBuffer(const ImageWrap& draw_buffer) {
-    median_fg_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetUpscaledBuffer(const ImageWrap& draw_buffer) {
-    upscaled_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetRaymaskBuffer(const ImageWrap& draw_buffer) {
-    raymask_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetRaycastBGBuffer(const ImageWrap& draw_buffer) {
-    raycast_bg_buffer_desc = draw_buffer.Descriptor();
-}
-
-void BufferDebugDraw::SetEdgeBuffer(const ImageWrap& draw_buffer) {
-    edge_buffer_desc = draw_buffer.Descriptor();
+void BufferDebugDraw::SetDrawBuffer(const ImageWrap& image) {
+    m_descriptor.write(p_gfx->GetDeviceRef(), 0, image.Descriptor());
+    p_draw_image = &image;
 }
 
 void BufferDebugDraw::DrawGUI() {
@@ -309,109 +289,109 @@ void BufferDebugDraw::DrawGUI() {
         if (ImGui::MenuItem("Draw Velocity Buffer", "", draw_buffer == DrawBuffer::VELOCITY)) {
             draw_buffer = DrawBuffer::VELOCITY;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(velo_depth_buffer_desc);
+            SetDrawBuffer(*p_velocity_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw Depth Buffer", "", draw_buffer == DrawBuffer::DEPTH)) {
             draw_buffer = DrawBuffer::DEPTH;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(velo_depth_buffer_desc);
+            SetDrawBuffer(*p_depth_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw TileMax CoC Buffer", "", draw_buffer == DrawBuffer::TILEMAX_COC)) {
             draw_buffer = DrawBuffer::TILEMAX_COC;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(tile_max_buffer_desc);
+            SetDrawBuffer(*p_tile_max_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw TileMax Velo Buffer", "", draw_buffer == DrawBuffer::TILEMAX_VELO)) {
             draw_buffer = DrawBuffer::TILEMAX_VELO;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(tile_max_buffer_desc);
+            SetDrawBuffer(*p_tile_max_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw NeighbourMax COC Buffer", "", draw_buffer == DrawBuffer::NEIGHBOURMAX_COC)) {
             draw_buffer = DrawBuffer::NEIGHBOURMAX_COC;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(neighbour_max_buffer_desc);
+            SetDrawBuffer(*p_neighbour_max_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw NeighbourMaxVelo Buffer", "", draw_buffer == DrawBuffer::NEIGHBOURMAX_VELO)) {
             draw_buffer = DrawBuffer::NEIGHBOURMAX_VELO;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(neighbour_max_buffer_desc);
+            SetDrawBuffer(*p_neighbour_max_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw PreDOF Buffer", "", draw_buffer == DrawBuffer::PRE_DOF)) {
             draw_buffer = DrawBuffer::PRE_DOF;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(pre_dof_buffer_desc);
+            SetDrawBuffer(*p_pre_dof_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw PreDOF Params CoC Buffer", "", draw_buffer == DrawBuffer::PRE_DOF_COC)) {
             draw_buffer = DrawBuffer::PRE_DOF_COC;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(pre_dof_params_buffer_desc);
+            SetDrawBuffer(*p_pre_dof_params_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw PreDOF Params BG Buffer", "", draw_buffer == DrawBuffer::PRE_DOF_BG)) {
             draw_buffer = DrawBuffer::PRE_DOF_BG;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(pre_dof_params_buffer_desc);
+            SetDrawBuffer(*p_pre_dof_params_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw PreDOF Params FG Buffer", "", draw_buffer == DrawBuffer::PRE_DOF_FG)) {
             draw_buffer = DrawBuffer::PRE_DOF_FG;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(pre_dof_params_buffer_desc);
+            SetDrawBuffer(*p_pre_dof_params_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw DOF BG Buffer", "", draw_buffer == DrawBuffer::DOF_BG)) {
             draw_buffer = DrawBuffer::DOF_BG;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(median_bg_buffer_desc);
+            SetDrawBuffer(*p_median_bg_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw DOF FG Buffer", "", draw_buffer == DrawBuffer::DOF_FG)) {
             draw_buffer = DrawBuffer::DOF_FG;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(median_fg_buffer_desc);
+            SetDrawBuffer(*p_median_fg_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw DOF Buffer", "", draw_buffer == DrawBuffer::DOF)) {
             draw_buffer = DrawBuffer::DOF;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(dof_buffer_desc);
+            SetDrawBuffer(*p_dof_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw DOF Alpha Buffer", "", draw_buffer == DrawBuffer::DOF_ALPHA)) {
             draw_buffer = DrawBuffer::DOF_ALPHA;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(dof_buffer_desc);
+            SetDrawBuffer(*p_dof_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw Upscaled Buffer", "", draw_buffer == DrawBuffer::UPSCALED)) {
             draw_buffer = DrawBuffer::UPSCALED;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(upscaled_buffer_desc);
+            SetDrawBuffer(*p_upscaled_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw Edge Buffer", "", draw_buffer == DrawBuffer::EDGE)) {
             draw_buffer = DrawBuffer::EDGE;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(edge_buffer_desc);
+            SetDrawBuffer(*p_edge_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw RayCast BG Buffer", "", draw_buffer == DrawBuffer::RAYCAST_BG)) {
             draw_buffer = DrawBuffer::RAYCAST_BG;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(raycast_bg_buffer_desc);
+            SetDrawBuffer(*p_raycast_bg_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         if (ImGui::MenuItem("Draw Raymask Buffer", "", draw_buffer == DrawBuffer::RAYMASK)) {
             draw_buffer = DrawBuffer::RAYMASK;
             p_gfx->DisablePostProcess();
-            SetDrawBuffer(raymask_buffer_desc);
+            SetDrawBuffer(*p_raymask_buffer);
             m_push_consts.draw_buffer = static_cast<int>(draw_buffer);
         }
         ImGui::EndMenu();
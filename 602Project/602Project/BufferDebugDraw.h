@@ -29,19 +29,21 @@ public:
 	};
 
 private:
-	vk::DescriptorImageInfo velo_depth_buffer_desc;
-	vk::DescriptorImageInfo tile_max_buffer_desc;
-	vk::DescriptorImageInfo neighbour_max_buffer_desc;
-	vk::DescriptorImageInfo pre_dof_buffer_desc;
-	vk::DescriptorImageInfo pre_dof_params_buffer_desc;
-	vk::DescriptorImageInfo median_bg_buffer_desc;
-	vk::DescriptorImageInfo median_fg_buffer_desc;
-	vk::DescriptorImageInfo dof_buffer_desc;
-	vk::DescriptorImageInfo upscaled_buffer_desc;
-	vk::DescriptorImageInfo edge_buffer_desc;
-	vk::DescriptorImageInfo raycast_bg_buffer_desc;
-	vk::DescriptorImageInfo raymask_buffer_desc;
-	void SetDrawBuffer(vk::DescriptorImageInfo& draw_descriptor);
+	const ImageWrap* p_velocity_buffer = nullptr;
+	const ImageWrap* p_depth_buffer = nullptr;
+	const ImageWrap* p_tile_max_buffer = nullptr;
+	const ImageWrap* p_neighbour_max_buffer = nullptr;
+	const ImageWrap* p_pre_dof_buffer = nullptr;
+	const ImageWrap* p_pre_dof_params_buffer = nullptr;
+	const ImageWrap* p_median_bg_buffer = nullptr;
+	const ImageWrap* p_median_fg_buffer = nullptr;
+	const ImageWrap* p_dof_buffer = nullptr;
+	const ImageWrap* p_upscaled_buffer = nullptr;
+	const ImageWrap* p_edge_buffer = nullptr;
+	const ImageWrap* p_raycast_bg_buffer = nullptr;
+	const ImageWrap* p_raymask_buffer = nullptr;
+	void SetDrawBuffer(const ImageWrap& image);
+	const ImageWrap* p_draw_image = nullptr;  // The one on screen
 
 	DescriptorWrap m_descriptor;
 	void SetupDescriptor();
@@ -51,6 +53,7 @@ private:
 
 	std::vector<vk::Framebuffer> m_framebuffers;
 	void SetupFramebuffer();
+	std::array<vk::ClearValue, 2> m_clear_values;
 
 	vk::PipelineLayout m_pipeline_layout;
 	vk::Pipeline m_pipeline;
@@ -62,26 +65,22 @@ private:
 
 	DOFPass* p_dof_pass;
 public:
-	BufferDebugDraw(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	BufferDebugDraw(Graphics* _p_gfx);
 	~BufferDebugDraw();
+	//Peeks at every image it can show, so it keeps none of them alive
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
 	void Render() override;
+	bool GetRenderPassBegin(vk::RenderPassBeginInfo& info) const override;
+	//Draws the GUI, which changes every frame
+	bool IsStatic() const override { return false; }
 	void Teardown() override;
 
-	void SetVeloDepthBuffer(const ImageWrap& draw_buffer);
-	void SetTileMaxBuffer(const ImageWrap& draw_buffer);
-	void SetNeighbourMaxBuffer(const ImageWrap& draw_buffer);
-	void SetPreDOFBuffer(const ImageWrap& draw_buffer);
-	void SetPreDOFParamsBuffer(const ImageWrap& draw_buffer);
-	void SetDOFBuffer(const ImageWrap& draw_buffer);
-	void SetMedianBGBuffer(const ImageWrap& draw_buffer);
-	void SetMedianFGBuffer(const ImageWrap& draw_buffer);
-	void SetUpscaledBuffer(const ImageWrap& draw_buffer);
-	void SetRaymaskBuffer(const ImageWrap& draw_buffer);
-	void SetRaycastBGBuffer(const ImageWrap& draw_buffer);
-	void SetEdgeBuffer(const ImageWrap& draw_buffer);
-
 	void DrawGUI();
+	bool IsEnabled() const override { return draw_buffer != DrawBuffer::DISABLE; }
+	//Only the image on screen
+	bool Uses(const ImageWrap& image) const override { return &image == p_draw_image; }
 
 	void SetDOFPass(DOFPass* _p_dof_pass);
 };
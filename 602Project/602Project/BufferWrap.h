@@ -2,15 +2,49 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <utility>
+
+#include "DeviceAllocator.h"
+
+/*
+* Owns a buffer and its memory. Move-only; whatever is still held when it
+* goes out of scope is destroyed right away, so a buffer the GPU may still be
+* using has to go to Graphics::Retire instead.
+*/
 struct BufferWrap
 {
     vk::Buffer buffer;
-    vk::DeviceMemory memory;
+    DeviceAllocation allocation;
+    vk::Device device;  // Set by Graphics::CreateBufferWrap
+
+    BufferWrap() = default;
+    BufferWrap(const BufferWrap&) = delete;
+    BufferWrap& operator=(const BufferWrap&) = delete;
+    BufferWrap(BufferWrap&& other) noexcept { *this = std::move(other); }
+    BufferWrap& operator=(BufferWrap&& other) noexcept
+    {
+        if (this != &other) {
+            destroy(device);
+            buffer = other.buffer;
+            allocation = other.allocation;
+            device = other.device;
+            other.buffer = nullptr;
+            other.allocation = DeviceAllocation();
+        }
+        return *this;
+    }
+    ~BufferWrap() { destroy(device); }
+
+    //Persistently mapped contents; only for host visible buffers
+    uint8_t* Mapped() const { return allocation.mapped; }
 
-    void destroy(const vk::Device& device)
+    //Destroys the buffer now; safe to call on an empty wrap
+    void destroy(const vk::Device& _device)
     {
-        device.destroyBuffer(buffer);
-        device.freeMemory(memory);
+        if (buffer)
+            _device.destroyBuffer(buffer);
+        buffer = nullptr;
+        allocation.Free();
     }
 
-};
\ No newline at end of file
+};
@@ -4,35 +4,28 @@
 #include "Camera.h"
 
 #include "DOFPass.h"
-#include "PreDOFPass.h"
 #include "TileMaxPass.h"
 
 void DOFPass::SetupBuffer() {
     m_buffer_bg.CreateTextureSampler();
-    m_buffer_bg.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_buffer_bg, TargetKind::Color);
 
     m_buffer_fg.CreateTextureSampler();
-    m_buffer_fg.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_buffer_fg, TargetKind::Color);
 
     m_buffer.CreateTextureSampler();
-    m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::Color);
 
+    // Not transient: the raycast keeps its accumulation count in b across frames
     m_raymask_buffer.CreateTextureSampler();
     m_raymask_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddPersistent(m_raymask_buffer, TargetKind::RayMask);
 }
 
 void DOFPass::WriteToDescriptor(glm::uint index, const vk::DescriptorImageInfo img_desc_info) {
     m_descriptor.write(p_gfx->GetDeviceRef(), index, img_desc_info);
 }
 
-void DOFPass::SetNeighbourMaxBufferDesc(const ImageWrap& buffer) {
-    neighbour_max_buffer_desc = buffer.Descriptor();
-}
-
-void DOFPass::SetEdgeBufferDesc(const ImageWrap& buffer) {
-    edge_buffer_desc = buffer.Descriptor();
-}
-
 const PushConstantDoF& DOFPass::GetDOFParams() {
     return m_push_consts;
 }
@@ -98,20 +91,15 @@ void DOFPass::SetupDescriptor() {
         {6, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {7, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {8, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute} });
 }
 
 void DOFPass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantDoF));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -133,9 +121,9 @@ void DOFPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-DOFPass::DOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx, _p_prev_pass),
+DOFPass::DOFPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
     m_buffer_bg(p_gfx->GetWindowSize().x/2, p_gfx->GetWindowSize().y/2,
-	            vk::Format::eR32G32B32A32Sfloat, 
+	            TargetFormat(TargetKind::Color), 
                 vk::ImageUsageFlagBits::eTransferDst |
                 vk::ImageUsageFlagBits::eSampled |
                 vk::ImageUsageFlagBits::eStorage |
@@ -143,9 +131,9 @@ DOFPass::DOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx
                 vk::ImageUsageFlagBits::eColorAttachment, 
                 vk::ImageAspectFlagBits::eColor, 
                 vk::MemoryPropertyFlagBits::eDeviceLocal, 
-                1, p_gfx), 
+                1, p_gfx, false), 
     m_buffer_fg(p_gfx->GetWindowSize().x/2, p_gfx->GetWindowSize().y/2,
-                vk::Format::eR32G32B32A32Sfloat,
+                TargetFormat(TargetKind::Color),
                 vk::ImageUsageFlagBits::eTransferDst |
                 vk::ImageUsageFlagBits::eSampled |
                 vk::ImageUsageFlagBits::eStorage |
@@ -153,9 +141,9 @@ DOFPass::DOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx
                 vk::ImageUsageFlagBits::eColorAttachment,
                 vk::ImageAspectFlagBits::eColor,
                 vk::MemoryPropertyFlagBits::eDeviceLocal,
-                1, p_gfx),
+                1, p_gfx, false),
     m_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -163,9 +151,9 @@ DOFPass::DOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     m_raymask_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::RayMask),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -182,6 +170,7 @@ DOFPass::DOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx
     m_push_consts.soft_z_extent = 0.001f;
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantDoF));
     SetupBuffer();
     SetupDescriptor();
 }
@@ -197,86 +186,67 @@ DOFPass::~DOFPass() {
     m_raymask_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void DOFPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("dof_bg", m_buffer_bg);
+    builder.Output("dof_fg", m_buffer_fg);
+    builder.Output("dof", m_buffer);
+    builder.Output("dof_raymask", m_raymask_buffer);
+    p_pre_dof_buffer = &builder.Read("pre_dof", stages);
+    p_pre_dof_params_buffer = &builder.Read("pre_dof_params", stages);
+    p_neighbour_max_buffer = &builder.Read("neighbour_max", stages);
+    p_edge_buffer = &builder.Read("edge", stages);
+    builder.Write("dof_bg", stages);
+    builder.Write("dof_fg", stages);
+    builder.Write("dof", stages);
+    builder.Write("dof_raymask", stages);
+    builder.AsyncCompute();
+}
+
+void DOFPass::Resize() {
+    m_buffer_bg.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_buffer_fg.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_raymask_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void DOFPass::Setup() {
     WriteToDescriptor(0, m_buffer_bg.Descriptor());
     WriteToDescriptor(1, m_buffer_fg.Descriptor());
-    WriteToDescriptor(2,
-        static_cast<PreDOFPass*>(p_prev_pass)->GetBuffer().Descriptor());
-    WriteToDescriptor(3, 
-        static_cast<PreDOFPass*>(p_prev_pass)->GetParamsBuffer().Descriptor());
-    WriteToDescriptor(4, neighbour_max_buffer_desc);
+    WriteToDescriptor(2, p_pre_dof_buffer->Descriptor());
+    WriteToDescriptor(3, p_pre_dof_params_buffer->Descriptor());
+    WriteToDescriptor(4, p_neighbour_max_buffer->Descriptor());
     WriteToDescriptor(5, m_buffer.Descriptor());
     WriteToDescriptor(6, m_raymask_buffer.Descriptor());
-    WriteToDescriptor(7, edge_buffer_desc);
-    SetupPipeline();
+    WriteToDescriptor(7, p_edge_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 8, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantDoF));
+    if (!m_pipeline)
+        SetupPipeline();
 }
 
-void DOFPass::Render() {
-    if (not enabled)
-        return;
-
-    PreDOFPass* p_pre_dof_pass = static_cast<PreDOFPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_pre_dof_pass->GetBuffer().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+void DOFPass::UpdateParams() {
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+}
 
-    // Select the compute shader, and its descriptor set and push constant
+void DOFPass::Render() {
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
+    // Select the compute shader and its descriptor set
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute, 
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0, 
-        sizeof(PushConstantDoF),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     // This MUST match the shaders's line:
     //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
     glm::uint group_size = 128;
     p_gfx->GetCommandBuffer().dispatch(
-        ((p_gfx->GetWindowSize().x / 2) + group_size - 1) / group_size,
-        (p_gfx->GetWindowSize().y / 2), 1);
-
-    img_mem_barrier.setImage(m_buffer_bg.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    img_mem_barrier.setImage(m_buffer_fg.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+        ((p_gfx->GetRenderSize().x / 2) + group_size - 1) / group_size,
+        (p_gfx->GetRenderSize().y / 2), 1);
 }
 
 void DOFPass::Teardown()
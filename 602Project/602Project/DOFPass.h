@@ -12,6 +12,7 @@ private:
 	void SetupBuffer();
 
 	PushConstantDoF m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 	
 	DescriptorWrap m_descriptor;
 	void SetupDescriptor();
@@ -20,20 +21,23 @@ private:
 	vk::Pipeline m_pipeline;
 	void SetupPipeline();
 
-	vk::DescriptorImageInfo neighbour_max_buffer_desc;
-	vk::DescriptorImageInfo edge_buffer_desc;
+	const ImageWrap* p_pre_dof_buffer = nullptr;
+	const ImageWrap* p_pre_dof_params_buffer = nullptr;
+	const ImageWrap* p_neighbour_max_buffer = nullptr;
+	const ImageWrap* p_edge_buffer = nullptr;
 
 	bool enabled;
 public:
-	DOFPass(Graphics* _p_gfx, RenderPass* p_prev_pass=nullptr);
+	DOFPass(Graphics* _p_gfx);
 	~DOFPass();
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
 	void WriteToDescriptor(glm::uint index, const vk::DescriptorImageInfo img_desc_info);
-	void SetNeighbourMaxBufferDesc(const ImageWrap& buffer);
-	void SetEdgeBufferDesc(const ImageWrap& buffer);
 
 	const PushConstantDoF& GetDOFParams();
 
@@ -43,5 +47,6 @@ public:
 	const ImageWrap& GetRaymaskBuffer() const;
 
 	void DrawGUI() override;
+	bool IsEnabled() const override { return enabled; }
 };
 
@@ -0,0 +1,63 @@
+#include "DeletionQueue.h"
+
+#include <cstdio>
+
+void DeletionQueue::Retire(BufferWrap&& buffer) {
+    if (!buffer.buffer)
+        return;
+    ++m_retired_count;
+    m_buffers.push_back({ UNSTAMPED, std::move(buffer) });
+}
+
+void DeletionQueue::Retire(ImageWrap&& image) {
+    if (!image.GetImage())
+        return;
+    ++m_retired_count;
+    m_images.push_back({ UNSTAMPED, std::move(image) });
+}
+
+void DeletionQueue::Retire(std::function<void()> release) {
+    ++m_retired_count;
+    m_handles.push_back({ UNSTAMPED, std::move(release) });
+}
+
+void DeletionQueue::Stamp(uint64_t value) {
+    Stamp(m_buffers, value);
+    Stamp(m_images, value);
+    Stamp(m_handles, value);
+}
+
+void DeletionQueue::RunAfter(uint64_t value, std::function<void()> fn) {
+    // Values only grow, so appending keeps the list in order
+    m_callbacks.push_back({ value, std::move(fn) });
+}
+
+void DeletionQueue::Collect(uint64_t completed) {
+    // Popping destroys the buffers and images. Unstamped ones stay until Destroy.
+    while (!m_buffers.empty() && m_buffers.front().value <= completed) {
+        m_buffers.pop_front();
+        ++m_deferred_count;
+    }
+    while (!m_images.empty() && m_images.front().value <= completed) {
+        m_images.pop_front();
+        ++m_deferred_count;
+    }
+    while (!m_handles.empty() && m_handles.front().value <= completed) {
+        m_handles.front().resource();
+        m_handles.pop_front();
+        ++m_deferred_count;
+    }
+    while (!m_callbacks.empty() && m_callbacks.front().value <= completed) {
+        // Popped first; the callback may queue more
+        std::function<void()> callback = std::move(m_callbacks.front().resource);
+        m_callbacks.pop_front();
+        callback();
+    }
+}
+
+void DeletionQueue::Destroy() {
+    printf("Deletion queue: %llu resources retired, %llu freed once the GPU was done, %llu at teardown\n",
+        (unsigned long long)m_retired_count, (unsigned long long)m_deferred_count,
+        (unsigned long long)GetPendingCount());
+    Collect(UINT64_MAX);
+}
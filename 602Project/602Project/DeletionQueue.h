@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <stdint.h>
+
+#include "BufferWrap.h"
+#include "GpuTimeline.h"
+#include "ImageWrap.h"
+
+/*
+* Holds on to resources released while the GPU may still be using them.
+* A resource retired now may be used by work recorded but not yet submitted,
+* and a frame may go out in several submissions, so it waits unstamped until
+* Stamp() gives it the timeline value of the submission that ends the frame.
+* Collect() destroys it once the timeline has reached that value. Values only
+* grow, so each list is kept in stamp order.
+*
+* Resources still being written by an Uploader batch must not be retired
+* before Uploader::IsAvailable says the upload is done.
+*/
+class DeletionQueue
+{
+public:
+	//Stamps with the values of the queue that uses the resources
+	void Init(GpuTimeline* timeline) { p_timeline = timeline; }
+
+	void Retire(BufferWrap&& buffer);
+	void Retire(ImageWrap&& image);
+	//For raw handles (pipelines, views, acceleration structures...)
+	void Retire(std::function<void()> release);
+	//Stamps everything retired since the last call
+	void Stamp(uint64_t value);
+	//Runs fn once the timeline reaches value, for work that is already submitted
+	void RunAfter(uint64_t value, std::function<void()> fn);
+
+	//Destroys everything the GPU is done with; never waits
+	void Collect() { Collect(p_timeline->GetCompleted()); }
+	//Destroys everything stamped with value completed or earlier
+	void Collect(uint64_t completed);
+
+	//Destroys everything; the device must be idle
+	void Destroy();
+
+	size_t GetPendingCount() const { return m_buffers.size() + m_images.size() + m_handles.size(); }
+private:
+	template <typename T>
+	struct Retired
+	{
+		uint64_t value;  // UNSTAMPED until Stamp
+		T resource;
+	};
+
+	static const uint64_t UNSTAMPED = UINT64_MAX;
+
+	template <typename T>
+	static void Stamp(std::deque<Retired<T>>& retired, uint64_t value) {
+		for (auto it = retired.rbegin(); it != retired.rend() && it->value == UNSTAMPED; ++it)
+			it->value = value;
+	}
+
+	GpuTimeline* p_timeline = nullptr;
+	std::deque<Retired<BufferWrap>> m_buffers;
+	std::deque<Retired<ImageWrap>> m_images;
+	std::deque<Retired<std::function<void()>>> m_handles;
+	std::deque<Retired<std::function<void()>>> m_callbacks;  // Stamped by RunAfter
+
+	// Stats printed by Destroy
+	uint64_t m_retired_count = 0;
+	uint64_t m_deferred_count = 0;  // Retired ones that were collected before Destroy
+};
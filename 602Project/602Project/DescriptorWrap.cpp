@@ -5,7 +5,6 @@
 
 void DescriptorWrap::setBindings(const vk::Device device,
     std::vector<vk::DescriptorSetLayoutBinding> _bt) {
-    glm::uint maxSets = 1;
     bindingTable = _bt;
     // Build descSetLayout
     vk::DescriptorSetLayoutCreateInfo createInfo;
@@ -14,51 +13,12 @@ void DescriptorWrap::setBindings(const vk::Device device,
 
     device.createDescriptorSetLayout(&createInfo, nullptr, &descSetLayout);
 
-    // Collect the size required for each descriptorType into a vector of poolSizes
-    std::vector<vk::DescriptorPoolSize> poolSizes;
-
-    for (auto it = bindingTable.cbegin(); it != bindingTable.cend(); ++it) {
-        bool found = false;
-        for (auto itpool = poolSizes.begin(); itpool != poolSizes.end(); ++itpool) {
-            if (itpool->type == it->descriptorType) {
-                itpool->descriptorCount += it->descriptorCount * maxSets;
-                found = true;
-                break;
-            }
-        }
-
-        if (!found) {
-            vk::DescriptorPoolSize poolSize;
-            poolSize.setType(it->descriptorType);
-            poolSize.setDescriptorCount(it->descriptorCount * maxSets);
-            poolSizes.push_back(poolSize);
-        }
-    }
-
-
-    // Build descPool
-    vk::DescriptorPoolCreateInfo descrPoolInfo;
-    descrPoolInfo.setMaxSets(maxSets);
-    descrPoolInfo.setPoolSizeCount(poolSizes.size());
-    descrPoolInfo.setPPoolSizes(poolSizes.data());
-    device.createDescriptorPool(&descrPoolInfo, nullptr, &descPool);
-
-    // Allocate DescriptorSet/
-    vk::DescriptorSetAllocateInfo allocInfo;
-    allocInfo.setDescriptorPool(descPool);
-    allocInfo.setDescriptorSetCount(1);
-    allocInfo.setPSetLayouts(&descSetLayout);
-
-    // Warning: The next line creates a single descriptor set from the
-    // above pool since that's all our program needs.  This is too
-    // restrictive in general, but fine for this program.
-    device.allocateDescriptorSets(&allocInfo, &descSet);
+    allocateSet(device);
 }
 
 void DescriptorWrap::setBindings(const vk::Device device, 
     std::vector<vk::DescriptorSetLayoutBinding> _bt, 
     std::vector<vk::DescriptorBindingFlags> _bt_flags) {
-    glm::uint maxSets = 1;
     bindingTable = _bt;
     // Build descSetLayout
     vk::DescriptorSetLayoutCreateInfo createInfo;
@@ -73,6 +33,12 @@ void DescriptorWrap::setBindings(const vk::Device device,
 
     device.createDescriptorSetLayout(&createInfo, nullptr, &descSetLayout);
 
+    updateAfterBind = true;
+    allocateSet(device);
+}
+
+void DescriptorWrap::allocateSet(const vk::Device& device) {
+    glm::uint maxSets = 1;
     // Collect the size required for each descriptorType into a vector of poolSizes
     std::vector<vk::DescriptorPoolSize> poolSizes;
 
@@ -100,7 +66,8 @@ void DescriptorWrap::setBindings(const vk::Device device,
     descrPoolInfo.setMaxSets(maxSets);
     descrPoolInfo.setPoolSizeCount(poolSizes.size());
     descrPoolInfo.setPPoolSizes(poolSizes.data());
-    descrPoolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
+    if (updateAfterBind)
+        descrPoolInfo.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
     device.createDescriptorPool(&descrPoolInfo, nullptr, &descPool);
 
     // Allocate DescriptorSet/
@@ -115,16 +82,23 @@ void DescriptorWrap::setBindings(const vk::Device device,
     device.allocateDescriptorSets(&allocInfo, &descSet);
 }
 
+vk::DescriptorPool DescriptorWrap::renew(const vk::Device& device) {
+    vk::DescriptorPool oldPool = descPool;
+    allocateSet(device);
+    return oldPool;
+}
+
 void DescriptorWrap::destroy(const vk::Device& device) {
     device.destroyDescriptorSetLayout(descSetLayout, nullptr);
     device.destroyDescriptorPool(descPool, nullptr);
 }
 
-void DescriptorWrap::write(const vk::Device& device, glm::uint index, const vk::Buffer& buffer) {
+void DescriptorWrap::write(const vk::Device& device, glm::uint index, const vk::Buffer& buffer,
+    vk::DeviceSize range) {
     vk::DescriptorBufferInfo desBuf;
     desBuf.setBuffer(buffer);
     desBuf.setOffset(0);
-    desBuf.setRange(VK_WHOLE_SIZE);
+    desBuf.setRange(range);
     
     vk::WriteDescriptorSet writeSet;
     writeSet.setDstSet(descSet);
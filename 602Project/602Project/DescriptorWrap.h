@@ -22,9 +22,18 @@ public:
         std::vector<vk::DescriptorSetLayoutBinding> _bt,
         std::vector<vk::DescriptorBindingFlags> _bt_flags);
     void destroy(const vk::Device& device);
+    //Allocates a fresh set with the same layout, so pipelines stay valid, and
+    //returns the old pool for the caller to retire; nothing is written yet
+    vk::DescriptorPool renew(const vk::Device& device);
 
-    void write(const vk::Device& device, glm::uint index, const vk::Buffer& buffer);
+    //range: bytes visible from the bound offset; dynamic buffers need less than the whole buffer
+    void write(const vk::Device& device, glm::uint index, const vk::Buffer& buffer,
+        vk::DeviceSize range = VK_WHOLE_SIZE);
     void write(const vk::Device& device, glm::uint index, const vk::DescriptorImageInfo& textureDesc);
     void write(const vk::Device& device, glm::uint index, const vk::AccelerationStructureKHR& tlas);
     void write(const vk::Device& device, glm::uint index, const std::vector<ImageWrap>& textures);
+private:
+    bool updateAfterBind = false;
+    //Builds descPool from bindingTable and allocates descSet from it
+    void allocateSet(const vk::Device& device);
 };
@@ -0,0 +1,450 @@
+#include "DeviceAllocator.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Owner tag of the allocations made on this thread
+static thread_local uint32_t t_owner_tag = 0;
+
+static double ToMB(vk::DeviceSize bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+void DeviceAllocation::Free() {
+    if (owner)
+        owner->Free(*this);
+}
+
+void DeviceAllocator::Init(vk::PhysicalDevice physical_device, vk::Device device, vk::DeviceSize block_size,
+    bool memory_budget) {
+    m_physical_device = physical_device;
+    m_device = device;
+    m_memory_properties = physical_device.getMemoryProperties();
+    m_block_size = block_size;
+    m_memory_budget = memory_budget;
+
+    uint32_t heaps = m_memory_properties.memoryHeapCount;
+    m_heap_allocated.assign(heaps, 0);
+    m_heap_used.assign(heaps, 0);
+    m_budget_warned.assign(heaps, false);
+    m_owners.assign(1, Owner());
+    m_owners[0].name = "untagged";
+    m_owners[0].heap_bytes.assign(heaps, 0);
+
+    vk::PhysicalDeviceLimits limits = physical_device.getProperties().limits;
+    m_granularity = limits.bufferImageGranularity;
+    m_max_allocations = limits.maxMemoryAllocationCount;
+
+    m_pools.resize(2 * m_memory_properties.memoryTypeCount);
+    for (uint32_t i = 0; i < m_pools.size(); ++i) {
+        m_pools[i].memory_type = i / 2;
+        m_pools[i].optimal = i % 2 == 1;
+    }
+}
+
+void DeviceAllocator::Destroy() {
+    PrintStats();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t leaked = m_dedicated_count;
+    for (auto& pool : m_pools) {
+        for (auto& block : pool.blocks) {
+            if (!block.memory)
+                continue;
+            leaked += block.tlsf.GetAllocationCount();
+            FreeMemory(block.memory, block.tlsf.GetSize(), pool.memory_type);
+        }
+        pool.blocks.clear();
+    }
+    if (leaked)
+        printf("Device memory: %u allocations were not freed\n", leaked);
+}
+
+uint32_t DeviceAllocator::FindMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags properties) const {
+    // The matching type with the fewest flags nobody asked for, so render targets
+    // don't land in the small host visible device local heap
+    uint32_t best = UINT32_MAX;
+    uint32_t bestExtra = UINT32_MAX;
+    for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; i++) {
+        vk::MemoryPropertyFlags flags = m_memory_properties.memoryTypes[i].propertyFlags;
+        if (!(type_bits & (1 << i)) || (flags & properties) != properties)
+            continue;
+        uint32_t extra = 0;
+        for (VkMemoryPropertyFlags bits = VkMemoryPropertyFlags(flags & ~properties); bits; bits &= bits - 1)
+            ++extra;
+        if (extra < bestExtra) {
+            best = i;
+            bestExtra = extra;
+        }
+    }
+    if (best == UINT32_MAX)
+        throw std::runtime_error("failed to find suitable memory type!");
+    return best;
+}
+
+vk::DeviceMemory DeviceAllocator::AllocateMemory(vk::DeviceSize size, uint32_t memory_type,
+    vk::Buffer dedicated_buffer, vk::Image dedicated_image, uint8_t*& mapped) {
+    if (m_memory_count >= m_max_allocations)
+        throw std::runtime_error("maxMemoryAllocationCount reached");
+
+    // Buffers in any block may need their device address
+    vk::MemoryAllocateFlagsInfo memFlags;
+    memFlags.setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
+    vk::MemoryDedicatedAllocateInfo dedicatedInfo(dedicated_image, dedicated_buffer);
+    if (dedicated_buffer || dedicated_image)
+        memFlags.setPNext(&dedicatedInfo);
+
+    vk::MemoryAllocateInfo allocInfo(size, memory_type);
+    allocInfo.setPNext(&memFlags);
+    vk::DeviceMemory memory;
+    if (m_device.allocateMemory(&allocInfo, nullptr, &memory) != vk::Result::eSuccess) {
+        printf("Device memory: allocating %.1f MB from heap %u failed\n", ToMB(size), HeapOf(memory_type));
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+    ++m_memory_count;
+    m_heap_allocated[HeapOf(memory_type)] += size;
+    CheckBudgetLocked();
+
+    mapped = nullptr;
+    if (m_memory_properties.memoryTypes[memory_type].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+        mapped = static_cast<uint8_t*>(m_device.mapMemory(memory, 0, VK_WHOLE_SIZE));
+    return memory;
+}
+
+void DeviceAllocator::FreeMemory(vk::DeviceMemory memory, vk::DeviceSize size, uint32_t memory_type) {
+    m_device.freeMemory(memory);
+    --m_memory_count;
+    m_heap_allocated[HeapOf(memory_type)] -= size;
+}
+
+void DeviceAllocator::Count(const DeviceAllocation& allocation, bool add) {
+    Owner& owner = m_owners[allocation.tag];
+    uint32_t heap = HeapOf(allocation.memory_type);
+    if (add) {
+        ++owner.count;
+        owner.heap_bytes[heap] += allocation.size;
+        m_heap_used[heap] += allocation.size;
+        vk::DeviceSize total = 0;
+        for (vk::DeviceSize bytes : owner.heap_bytes)
+            total += bytes;
+        owner.peak = std::max(owner.peak, total);
+    }
+    else {
+        --owner.count;
+        owner.heap_bytes[heap] -= allocation.size;
+        m_heap_used[heap] -= allocation.size;
+    }
+}
+
+DeviceAllocation DeviceAllocator::AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties) {
+    vk::StructureChain<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements> requirements =
+        m_device.getBufferMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::BufferMemoryRequirementsInfo2(buffer));
+    const vk::MemoryDedicatedRequirements& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+
+    DeviceAllocation allocation = Allocate(requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+        dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation,
+        properties, false, buffer, nullptr);
+    m_device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+DeviceAllocation DeviceAllocator::AllocateImage(vk::Image image, vk::MemoryPropertyFlags properties) {
+    vk::StructureChain<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements> requirements =
+        m_device.getImageMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements>(
+            vk::ImageMemoryRequirementsInfo2(image));
+    const vk::MemoryDedicatedRequirements& dedicated = requirements.get<vk::MemoryDedicatedRequirements>();
+
+    DeviceAllocation allocation = Allocate(requirements.get<vk::MemoryRequirements2>().memoryRequirements,
+        dedicated.prefersDedicatedAllocation || dedicated.requiresDedicatedAllocation,
+        properties, true, nullptr, image);
+    m_device.bindImageMemory(image, allocation.memory, allocation.offset);
+    return allocation;
+}
+
+DeviceAllocation DeviceAllocator::AllocateUnbound(const vk::MemoryRequirements& requirements,
+    vk::MemoryPropertyFlags properties) {
+    return Allocate(requirements, false, properties, true, nullptr, nullptr);
+}
+
+DeviceAllocation DeviceAllocator::Allocate(const vk::MemoryRequirements& requirements, bool dedicated,
+    vk::MemoryPropertyFlags properties, bool optimal, vk::Buffer buffer, vk::Image image) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    DeviceAllocation allocation;
+    allocation.owner = this;
+    allocation.size = requirements.size;
+    uint32_t memoryType = FindMemoryType(requirements.memoryTypeBits, properties);
+    allocation.memory_type = memoryType;
+    allocation.tag = t_owner_tag;
+
+    if (dedicated || requirements.size > m_block_size / 2) {
+        allocation.memory = AllocateMemory(requirements.size, memoryType, buffer, image, allocation.mapped);
+        ++m_dedicated_count;
+        m_dedicated_bytes += requirements.size;
+        Count(allocation, true);
+        return allocation;
+    }
+
+    // Optimal images go to blocks of their own whenever there is a granularity:
+    // an image's end isn't padded to it, so even a well aligned image could
+    // share its last page with the buffer placed after it
+    allocation.pool = 2 * memoryType + (optimal && m_granularity > 1 ? 1 : 0);
+    Pool& pool = m_pools[allocation.pool];
+
+    for (uint32_t b = 0; b < pool.blocks.size(); ++b) {
+        Block& block = pool.blocks[b];
+        if (!block.memory)
+            continue;
+        allocation.handle = block.tlsf.Allocate(requirements.size, requirements.alignment, allocation.offset);
+        if (allocation.handle != TlsfAllocator::invalid) {
+            allocation.block = b;
+            allocation.memory = block.memory;
+            allocation.mapped = block.mapped ? block.mapped + allocation.offset : nullptr;
+            Count(allocation, true);
+            return allocation;
+        }
+    }
+
+    // No room: open a new block, reusing a freed slot if there is one
+    uint32_t heap = m_memory_properties.memoryTypes[memoryType].heapIndex;
+    vk::DeviceSize blockSize = std::min(m_block_size, m_memory_properties.memoryHeaps[heap].size / 8);
+    // Big enough for the allocation whatever TLSF's size classes round it to
+    blockSize = std::max(blockSize, TlsfAllocator::GetFittingSize(requirements.size, requirements.alignment));
+    auto slot = std::find_if(pool.blocks.begin(), pool.blocks.end(), [](const Block& b) { return !b.memory; });
+    if (slot == pool.blocks.end())
+        slot = pool.blocks.insert(pool.blocks.end(), Block());
+    slot->memory = AllocateMemory(blockSize, memoryType, nullptr, nullptr, slot->mapped);
+    slot->tlsf = TlsfAllocator(blockSize);
+
+    allocation.block = static_cast<uint32_t>(slot - pool.blocks.begin());
+    allocation.handle = slot->tlsf.Allocate(requirements.size, requirements.alignment, allocation.offset);
+    if (allocation.handle == TlsfAllocator::invalid)
+        throw std::runtime_error("device allocator: allocation doesn't fit a new block!");
+    allocation.memory = slot->memory;
+    allocation.mapped = slot->mapped ? slot->mapped + allocation.offset : nullptr;
+    Count(allocation, true);
+    return allocation;
+}
+
+void DeviceAllocator::Free(DeviceAllocation& allocation) {
+    if (!allocation.memory)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Count(allocation, false);
+
+    if (allocation.handle == TlsfAllocator::invalid) {
+        FreeMemory(allocation.memory, allocation.size, allocation.memory_type);
+        --m_dedicated_count;
+        m_dedicated_bytes -= allocation.size;
+    }
+    else {
+        Pool& pool = m_pools[allocation.pool];
+        Block& block = pool.blocks[allocation.block];
+        block.tlsf.Free(allocation.handle);
+
+        // Give empty blocks back, but keep one per pool to avoid churn
+        uint32_t live = static_cast<uint32_t>(std::count_if(pool.blocks.begin(), pool.blocks.end(),
+            [](const Block& b) { return static_cast<bool>(b.memory); }));
+        if (block.tlsf.GetAllocationCount() == 0 && live > 1) {
+            FreeMemory(block.memory, block.tlsf.GetSize(), pool.memory_type);
+            block = Block();
+        }
+    }
+    allocation = DeviceAllocation();
+}
+
+void DeviceAllocator::PrintStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    printf("Device memory: %u vkDeviceMemory objects (limit %u), %u dedicated (%.1f MB)\n",
+        m_memory_count, m_max_allocations, m_dedicated_count, m_dedicated_bytes / (1024.0 * 1024.0));
+    for (const auto& pool : m_pools) {
+        uint32_t blocks = 0, allocations = 0, freeRanges = 0;
+        vk::DeviceSize size = 0, used = 0, largestFree = 0;
+        for (const auto& block : pool.blocks) {
+            if (!block.memory)
+                continue;
+            ++blocks;
+            size += block.tlsf.GetSize();
+            used += block.tlsf.GetUsed();
+            allocations += block.tlsf.GetAllocationCount();
+            freeRanges += block.tlsf.GetFreeRangeCount();
+            largestFree = std::max(largestFree, block.tlsf.GetLargestFreeRange());
+        }
+        if (!blocks)
+            continue;
+        // 0% when all the free space is one range
+        vk::DeviceSize freeBytes = size - used;
+        double fragmentation = freeBytes ? 100.0 * (1.0 - double(largestFree) / double(freeBytes)) : 0.0;
+        printf("  type %u %s (%s): %u blocks, %.1f / %.1f MB in %u allocations, %u free ranges, fragmentation %.0f%%\n",
+            pool.memory_type, pool.optimal ? "optimal" : "linear",
+            vk::to_string(m_memory_properties.memoryTypes[pool.memory_type].propertyFlags).c_str(),
+            blocks, used / (1024.0 * 1024.0), size / (1024.0 * 1024.0), allocations, freeRanges, fragmentation);
+    }
+    for (const auto& owner : m_owners) {
+        vk::DeviceSize total = 0;
+        for (vk::DeviceSize bytes : owner.heap_bytes)
+            total += bytes;
+        if (owner.count)
+            printf("  %s: %.1f MB in %u allocations\n", owner.name.c_str(), ToMB(total), owner.count);
+    }
+}
+
+uint32_t DeviceAllocator::SetOwner(const char* owner) {
+    uint32_t previous = t_owner_tag;
+    if (!owner) {
+        t_owner_tag = 0;
+        return previous;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = std::find_if(m_owners.begin(), m_owners.end(), [&](const Owner& o) { return o.name == owner; });
+    if (found == m_owners.end()) {
+        found = m_owners.insert(m_owners.end(), Owner());
+        found->name = owner;
+        found->heap_bytes.assign(m_memory_properties.memoryHeapCount, 0);
+    }
+    t_owner_tag = static_cast<uint32_t>(found - m_owners.begin());
+    return previous;
+}
+
+void DeviceAllocator::RestoreOwner(uint32_t tag) {
+    t_owner_tag = tag;
+}
+
+DeviceAllocator::OwnerScope::OwnerScope(DeviceAllocator& allocator, const char* owner) :
+    m_allocator(allocator), m_previous(allocator.SetOwner(owner)) {
+}
+
+DeviceAllocator::OwnerScope::~OwnerScope() {
+    m_allocator.RestoreOwner(m_previous);
+}
+
+std::vector<DeviceAllocator::Owner> DeviceAllocator::GetOwners() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_owners;
+}
+
+std::vector<DeviceAllocator::Heap> DeviceAllocator::GetHeaps() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return GetHeapsLocked();
+}
+
+std::vector<DeviceAllocator::Heap> DeviceAllocator::GetHeapsLocked() const {
+    std::vector<Heap> heaps(m_memory_properties.memoryHeapCount);
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+        heaps[i].flags = m_memory_properties.memoryHeaps[i].flags;
+        heaps[i].size = m_memory_properties.memoryHeaps[i].size;
+        heaps[i].budget = heaps[i].size;
+        heaps[i].usage = m_heap_allocated[i];
+        heaps[i].allocated = m_heap_allocated[i];
+        heaps[i].used = m_heap_used[i];
+    }
+    if (m_memory_budget) {
+        auto properties = m_physical_device.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+            vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        const auto& budget = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+        for (uint32_t i = 0; i < heaps.size(); ++i) {
+            heaps[i].budget = budget.heapBudget[i];
+            heaps[i].usage = budget.heapUsage[i];
+        }
+    }
+    return heaps;
+}
+
+void DeviceAllocator::SetBudget(vk::DeviceSize limit, float warn_fraction) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budget_limit = limit;
+    m_budget_warn_fraction = warn_fraction;
+}
+
+bool DeviceAllocator::CheckBudget() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return CheckBudgetLocked();
+}
+
+bool DeviceAllocator::CheckBudgetLocked() {
+    bool crossed = false;
+    std::vector<Heap> heaps = GetHeapsLocked();
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+        if (!(heaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal))
+            continue;
+        vk::DeviceSize budget = heaps[i].budget;
+        if (m_budget_limit)
+            budget = std::min(budget, m_budget_limit);
+        bool over = heaps[i].usage > vk::DeviceSize(double(budget) * m_budget_warn_fraction);
+        if (over && !m_budget_warned[i]) {
+            printf("Device memory: WARNING heap %u uses %.1f MB of a %.1f MB budget (%.0f%%)\n",
+                i, ToMB(heaps[i].usage), ToMB(budget), budget ? 100.0 * heaps[i].usage / budget : 100.0);
+            crossed = true;
+        }
+        m_budget_warned[i] = over;
+    }
+    return crossed;
+}
+
+// Owner names are file paths or pass names
+static std::string JsonString(const std::string& text) {
+    std::string result = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20)
+            result += c;
+    }
+    return result + "\"";
+}
+
+void DeviceAllocator::WriteReport(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Device memory: could not write %s\n", path.c_str());
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::vector<Heap> heaps = GetHeapsLocked();
+    fprintf(file, "{\n  \"memory_budget_ext\": %s,\n  \"budget_limit\": %llu,\n  \"warn_fraction\": %.3f,\n",
+        m_memory_budget ? "true" : "false", (unsigned long long)m_budget_limit, m_budget_warn_fraction);
+    fprintf(file, "  \"heaps\": [\n");
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+        fprintf(file, "    { \"index\": %u, \"device_local\": %s, \"size\": %llu, \"budget\": %llu, "
+            "\"usage\": %llu, \"allocated\": %llu, \"used\": %llu }%s\n",
+            i, (heaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? "true" : "false",
+            (unsigned long long)heaps[i].size, (unsigned long long)heaps[i].budget,
+            (unsigned long long)heaps[i].usage, (unsigned long long)heaps[i].allocated,
+            (unsigned long long)heaps[i].used, i + 1 < heaps.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"owners\": [\n");
+    for (size_t o = 0; o < m_owners.size(); ++o) {
+        const Owner& owner = m_owners[o];
+        fprintf(file, "    { \"name\": %s, \"allocations\": %u, \"peak\": %llu, \"heap_bytes\": [",
+            JsonString(owner.name).c_str(), owner.count, (unsigned long long)owner.peak);
+        for (size_t h = 0; h < owner.heap_bytes.size(); ++h)
+            fprintf(file, "%s%llu", h ? ", " : "", (unsigned long long)owner.heap_bytes[h]);
+        fprintf(file, "] }%s\n", o + 1 < m_owners.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"pools\": [\n");
+    bool first = true;
+    for (const auto& pool : m_pools) {
+        uint32_t blocks = 0, allocations = 0;
+        vk::DeviceSize size = 0, used = 0;
+        for (const auto& block : pool.blocks) {
+            if (!block.memory)
+                continue;
+            ++blocks;
+            size += block.tlsf.GetSize();
+            used += block.tlsf.GetUsed();
+            allocations += block.tlsf.GetAllocationCount();
+        }
+        if (!blocks)
+            continue;
+        fprintf(file, "%s    { \"memory_type\": %u, \"heap\": %u, \"optimal\": %s, \"blocks\": %u, "
+            "\"size\": %llu, \"used\": %llu, \"allocations\": %u }",
+            first ? "" : ",\n", pool.memory_type, HeapOf(pool.memory_type), pool.optimal ? "true" : "false",
+            blocks, (unsigned long long)size, (unsigned long long)used, allocations);
+        first = false;
+    }
+    fprintf(file, "%s  ],\n  \"dedicated\": { \"count\": %u, \"size\": %llu }\n}\n",
+        first ? "" : "\n", m_dedicated_count, (unsigned long long)m_dedicated_bytes);
+    fclose(file);
+    printf("Device memory: report written to %s\n", path.c_str());
+}
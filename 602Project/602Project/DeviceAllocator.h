@@ -0,0 +1,161 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "TlsfAllocator.h"
+
+class DeviceAllocator;
+
+// A resource's place in device memory, as handed out by DeviceAllocator
+struct DeviceAllocation
+{
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+	uint8_t* mapped = nullptr;  // Host visible memory stays mapped; already offset
+
+	DeviceAllocator* owner = nullptr;
+	uint32_t memory_type = 0;
+	uint32_t tag = 0;  // Index of the DeviceAllocator::Owner it is counted under
+	uint32_t pool = 0;
+	uint32_t block = 0;
+	uint32_t handle = TlsfAllocator::invalid;  // invalid for dedicated allocations
+
+	//Returns the memory to its owner; safe to call on an empty allocation
+	void Free();
+};
+
+/*
+* Sub-allocates buffers and images from large vk::DeviceMemory blocks, one
+* set of blocks per memory type, placed with a TlsfAllocator. Optimally tiled
+* images get blocks of their own whenever the device's bufferImageGranularity
+* is above 1, so linear and optimal resources can never share a granularity
+* page.
+* Resources the driver wants dedicated memory for, or that are larger than
+* half a block (big render targets, the staging ring), get their own
+* allocation.
+*
+* Every allocation is counted under the owner tag set on the calling thread
+* (SetOwner / OwnerScope), so the memory can be broken down by pass or asset.
+*/
+class DeviceAllocator
+{
+public:
+	//memory_budget: VK_EXT_memory_budget is enabled on the device
+	void Init(vk::PhysicalDevice physical_device, vk::Device device, vk::DeviceSize block_size,
+		bool memory_budget);
+	//Frees every block; reports allocations that were never freed
+	void Destroy();
+
+	//Allocates and binds memory for the resource
+	DeviceAllocation AllocateBuffer(vk::Buffer buffer, vk::MemoryPropertyFlags properties);
+	DeviceAllocation AllocateImage(vk::Image image, vk::MemoryPropertyFlags properties);
+	//Allocates without binding, for callers that place several (aliased) images themselves
+	DeviceAllocation AllocateUnbound(const vk::MemoryRequirements& requirements,
+		vk::MemoryPropertyFlags properties);
+
+	void Free(DeviceAllocation& allocation);
+
+	//Prints block usage and fragmentation per memory type
+	void PrintStats() const;
+
+	//Counts this thread's allocations under owner (untagged for nullptr) until the
+	//next call; returns the previous tag for RestoreOwner
+	uint32_t SetOwner(const char* owner);
+	void RestoreOwner(uint32_t tag);
+
+	//Tags the allocations made while it lives
+	class OwnerScope
+	{
+	public:
+		OwnerScope(DeviceAllocator& allocator, const char* owner);
+		~OwnerScope();
+	private:
+		DeviceAllocator& m_allocator;
+		uint32_t m_previous;
+	};
+
+	struct Owner
+	{
+		std::string name;
+		uint32_t count = 0;
+		std::vector<vk::DeviceSize> heap_bytes;  // Per memory heap
+		vk::DeviceSize peak = 0;                 // Of the sum over heaps
+	};
+	std::vector<Owner> GetOwners() const;
+
+	struct Heap
+	{
+		vk::MemoryHeapFlags flags;
+		vk::DeviceSize size = 0;
+		vk::DeviceSize budget = 0;     // What the driver says the process may use
+		vk::DeviceSize usage = 0;      // The whole process, as the driver sees it
+		vk::DeviceSize allocated = 0;  // vk::DeviceMemory made by this allocator
+		vk::DeviceSize used = 0;       // Of allocated, handed out to resources
+	};
+	//Without VK_EXT_memory_budget budget is the heap size and usage is allocated
+	std::vector<Heap> GetHeaps() const;
+	bool HasMemoryBudget() const { return m_memory_budget; }
+
+	//Warns when a device local heap passes warn_fraction of its budget, capped at
+	//limit bytes when limit isn't 0. Checked whenever device memory is allocated.
+	void SetBudget(vk::DeviceSize limit, float warn_fraction);
+	//Returns true the first time a heap crosses the warning line (again after
+	//having dropped below it)
+	bool CheckBudget();
+
+	//Heaps, owners and pools as JSON
+	void WriteReport(const std::string& path) const;
+private:
+	struct Block
+	{
+		vk::DeviceMemory memory;
+		uint8_t* mapped = nullptr;
+		TlsfAllocator tlsf;
+	};
+
+	struct Pool
+	{
+		uint32_t memory_type = 0;
+		bool optimal = false;
+		std::vector<Block> blocks;  // Freed blocks keep their slot with a null memory
+	};
+
+	DeviceAllocation Allocate(const vk::MemoryRequirements& requirements, bool dedicated,
+		vk::MemoryPropertyFlags properties, bool optimal, vk::Buffer buffer, vk::Image image);
+	uint32_t FindMemoryType(uint32_t type_bits, vk::MemoryPropertyFlags properties) const;
+	vk::DeviceMemory AllocateMemory(vk::DeviceSize size, uint32_t memory_type,
+		vk::Buffer dedicated_buffer, vk::Image dedicated_image, uint8_t*& mapped);
+	void FreeMemory(vk::DeviceMemory memory, vk::DeviceSize size, uint32_t memory_type);
+	void Count(const DeviceAllocation& allocation, bool add);
+	uint32_t HeapOf(uint32_t memory_type) const { return m_memory_properties.memoryTypes[memory_type].heapIndex; }
+	std::vector<Heap> GetHeapsLocked() const;
+	bool CheckBudgetLocked();
+
+	vk::PhysicalDevice m_physical_device;
+	vk::Device m_device;
+	vk::PhysicalDeviceMemoryProperties m_memory_properties;
+	bool m_memory_budget = false;
+	vk::DeviceSize m_block_size = 0;
+	vk::DeviceSize m_granularity = 1;
+	uint32_t m_max_allocations = 0;
+
+	mutable std::mutex m_mutex;
+	std::vector<Pool> m_pools;  // Two per memory type: linear, then optimal
+
+	uint32_t m_memory_count = 0;  // Live vk::DeviceMemory objects
+	uint32_t m_dedicated_count = 0;
+	vk::DeviceSize m_dedicated_bytes = 0;
+
+	std::vector<Owner> m_owners;  // [0] is untagged
+	std::vector<vk::DeviceSize> m_heap_allocated;
+	std::vector<vk::DeviceSize> m_heap_used;
+	vk::DeviceSize m_budget_limit = 0;
+	float m_budget_warn_fraction = 0.9f;
+	std::vector<bool> m_budget_warned;  // Per heap
+};
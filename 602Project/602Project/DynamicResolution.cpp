@@ -0,0 +1,80 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+void DynamicResolution::Init(vk::Device device, const vk::PhysicalDevice& physical_device,
+    uint32_t queue_family, uint32_t frame_count) {
+    m_device = device;
+    m_written.assign(frame_count, false);
+    m_scale = 1.0f;
+    m_gpu_ms = 0.0f;
+    m_samples = 0;
+
+    uint32_t valid_bits = physical_device.getQueueFamilyProperties()[queue_family].timestampValidBits;
+    vk::PhysicalDeviceLimits limits = physical_device.getProperties().limits;
+    if (!valid_bits || !limits.timestampComputeAndGraphics) {
+        printf("Dynamic resolution: no timestamps on the graphics queue, rendering at full size\n");
+        return;
+    }
+    m_period = limits.timestampPeriod;
+    m_mask = valid_bits >= 64 ? UINT64_MAX : (uint64_t(1) << valid_bits) - 1;
+    m_pool = m_device.createQueryPool(vk::QueryPoolCreateInfo(
+        vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, frame_count * 2));
+}
+
+void DynamicResolution::Destroy() {
+    if (m_pool)
+        m_device.destroyQueryPool(m_pool);
+    m_pool = nullptr;
+}
+
+void DynamicResolution::BeginFrame(vk::CommandBuffer cmd, uint32_t frame) {
+    if (!m_pool)
+        return;
+    cmd.resetQueryPool(m_pool, frame * 2, 2);
+    // Bottom of pipe: once the previous frame's work is done, which may still be
+    // running when this frame's first commands start
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_pool, frame * 2);
+}
+
+void DynamicResolution::EndFrame(vk::CommandBuffer cmd, uint32_t frame) {
+    if (!m_pool)
+        return;
+    cmd.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, m_pool, frame * 2 + 1);
+    m_written[frame] = true;
+}
+
+bool DynamicResolution::Update(uint32_t frame, bool enabled, float target_ms, float min_scale) {
+    if (m_pool && m_written[frame]) {
+        m_written[frame] = false;
+        uint64_t stamps[2];
+        vk::Result result = m_device.getQueryPoolResults(m_pool, frame * 2, 2, sizeof(stamps), stamps,
+            sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+        if (result == vk::Result::eSuccess) {
+            float ms = static_cast<float>(double((stamps[1] - stamps[0]) & m_mask) * m_period * 1e-6);
+            m_gpu_ms = m_gpu_ms > 0.0f ? m_gpu_ms + SMOOTHING * (ms - m_gpu_ms) : ms;
+            ++m_samples;
+        }
+    }
+
+    float scale = m_scale;
+    if (!enabled || !m_pool)
+        scale = 1.0f;
+    else if (m_samples >= SETTLE_FRAMES && m_gpu_ms > 0.0f) {
+        float ratio = target_ms / m_gpu_ms;
+        if (ratio < 1.0f || ratio > HEADROOM) {
+            scale = std::round(m_scale * std::sqrt(ratio) * STEPS) / STEPS;
+            // Rounding may land back on the current step; move at least one
+            if (scale == m_scale)
+                scale += ratio < 1.0f ? -1.0f / STEPS : 1.0f / STEPS;
+        }
+        scale = std::clamp(scale, std::min(min_scale, 1.0f), 1.0f);
+    }
+    if (scale == m_scale)
+        return false;
+    m_scale = scale;
+    m_samples = 0;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+/*
+* Picks the scale the scene is rendered at from the GPU time of the frames.
+* Each frame writes a timestamp before the render graph and one after it, into
+* the pair of queries of its frame in flight. When the frame's context comes
+* back its pair has been written, so Update reads it without waiting and folds
+* it into a smoothed frame time.
+*
+* GPU time is taken to grow with the pixel count, i.e. with the square of the
+* scale. Over the target the scale drops by the square root of the ratio; it
+* only rises again with clear headroom, so it doesn't hop between two steps.
+* The scale moves in steps of 1/STEPS and waits for the smoothed time to catch
+* up after each change, since every change records the passes again.
+*
+* Without timestamps on the graphics queue the scale stays at 1.
+*/
+class DynamicResolution
+{
+public:
+	void Init(vk::Device device, const vk::PhysicalDevice& physical_device, uint32_t queue_family,
+		uint32_t frame_count);
+	void Destroy();
+
+	//Resets the frame's queries and writes its first timestamp; in the frame's
+	//first command buffer, before its own work
+	void BeginFrame(vk::CommandBuffer cmd, uint32_t frame);
+	//Writes the frame's last timestamp once everything before it is done
+	void EndFrame(vk::CommandBuffer cmd, uint32_t frame);
+
+	//Once the GPU is done with the frame's previous use: reads its time and
+	//moves the scale toward target_ms. Disabled, the scale goes back to 1.
+	//Returns whether the scale changed.
+	bool Update(uint32_t frame, bool enabled, float target_ms, float min_scale);
+
+	bool IsSupported() const { return static_cast<bool>(m_pool); }
+	float GetScale() const { return m_scale; }
+	//Smoothed GPU time of the render graph
+	float GetGpuMs() const { return m_gpu_ms; }
+private:
+	static const uint32_t STEPS = 32;
+	static const uint32_t SETTLE_FRAMES = 20;  // Samples after a change before the next
+	static constexpr float SMOOTHING = 0.1f;
+	static constexpr float HEADROOM = 1.1f;    // Target over time needed to raise the scale
+
+	vk::Device m_device;
+	vk::QueryPool m_pool;
+	double m_period = 0.0;   // Nanoseconds per tick
+	uint64_t m_mask = 0;     // Of the valid timestamp bits
+	std::vector<bool> m_written;  // Per frame in flight, its pair has been written
+
+	float m_scale = 1.0f;
+	float m_gpu_ms = 0.0f;
+	uint32_t m_samples = 0;  // Since the last change
+};
@@ -0,0 +1,31 @@
+#include "GpuTimeline.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void GpuTimeline::Init(vk::Device device) {
+    m_device = device;
+    vk::SemaphoreTypeCreateInfo typeInfo(vk::SemaphoreType::eTimeline, 0);
+    m_semaphore = m_device.createSemaphore(vk::SemaphoreCreateInfo(vk::SemaphoreCreateFlags(), &typeInfo));
+    m_submitted = 0;
+    m_completed = 0;
+}
+
+void GpuTimeline::Destroy() {
+    m_device.destroySemaphore(m_semaphore);
+    m_semaphore = nullptr;
+}
+
+uint64_t GpuTimeline::GetCompleted() {
+    m_completed = std::max(m_completed, m_device.getSemaphoreCounterValue(m_semaphore));
+    return m_completed;
+}
+
+void GpuTimeline::Wait(uint64_t value) {
+    if (value <= m_completed)
+        return;
+    vk::SemaphoreWaitInfo waitInfo(vk::SemaphoreWaitFlags(), 1, &m_semaphore, &value);
+    if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess)
+        throw std::runtime_error("failed waiting for the GPU timeline!");
+    m_completed = std::max(m_completed, value);
+}
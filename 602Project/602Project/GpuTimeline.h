@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <stdint.h>
+
+/*
+* A timeline semaphore counting the submissions to one queue. Each submission
+* signals the value Advance() handed out for it; submissions on a queue finish
+* in order, so once the semaphore reaches a value every submission up to it
+* is done. Anything that needs to know when GPU work is over keeps the value
+* of the submission that used it and asks IsComplete, which never blocks.
+* Wait blocks inside the driver instead of polling.
+*
+* One timeline per queue: two queues signaling one semaphore could reach their
+* values out of order, which timeline semaphores don't allow.
+*/
+class GpuTimeline
+{
+public:
+	void Init(vk::Device device);
+	void Destroy();
+
+	//Value for the next submission to signal; call once per submission
+	uint64_t Advance() { return ++m_submitted; }
+	//Value of the latest submission; work recorded now finishes at GetSubmitted() + 1 at the earliest
+	uint64_t GetSubmitted() const { return m_submitted; }
+
+	//Latest value the GPU has reached
+	uint64_t GetCompleted();
+	bool IsComplete(uint64_t value) { return value <= m_completed || value <= GetCompleted(); }
+
+	//Blocks until the GPU reaches value
+	void Wait(uint64_t value);
+	//Blocks until every submission so far has finished
+	void WaitIdle() { Wait(m_submitted); }
+
+	vk::Semaphore GetSemaphore() const { return m_semaphore; }
+private:
+	vk::Device m_device;
+	vk::Semaphore m_semaphore;
+	uint64_t m_submitted = 0;
+	uint64_t m_completed = 0;  // Last value read back
+};
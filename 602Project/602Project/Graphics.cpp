@@ -17,6 +17,8 @@
 #include "RayMaskPass.h"
 #include "RayCastPass.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include "extensions_vk.hpp"
 
@@ -141,6 +143,20 @@ void Graphics::ChooseQueueIndex() {
             if (properties.queueFlags & required_queue_flags)
                 m_graphics_queue_index = j;
         }
+
+        // Uploads go to a transfer-only family that can copy whole mip tails
+        bool transfer_only = (properties.queueFlags & vk::QueueFlagBits::eTransfer) &&
+            !(properties.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute));
+        if (transfer_only && m_transfer_queue_index == VK_QUEUE_FAMILY_IGNORED &&
+            properties.minImageTransferGranularity == vk::Extent3D(1, 1, 1))
+            m_transfer_queue_index = j;
+
+        // Async compute goes to a compute family without graphics, which the
+        // hardware can run next to the graphics queue
+        bool compute_only = (properties.queueFlags & vk::QueueFlagBits::eCompute) &&
+            !(properties.queueFlags & vk::QueueFlagBits::eGraphics);
+        if (compute_only && m_compute_queue_index == VK_QUEUE_FAMILY_IGNORED)
+            m_compute_queue_index = j;
     }
 
     if (m_graphics_queue_index == VK_QUEUE_FAMILY_IGNORED) {
@@ -149,6 +165,15 @@ void Graphics::ChooseQueueIndex() {
     else {
         std::cout << "Choosing Queue index: " << m_graphics_queue_index << std::endl;
     }
+
+    if (m_transfer_queue_index == VK_QUEUE_FAMILY_IGNORED)
+        m_transfer_queue_index = m_graphics_queue_index;
+    std::cout << "Choosing Transfer Queue index: " << m_transfer_queue_index << std::endl;
+
+    if (!async_compute || m_compute_queue_index == VK_QUEUE_FAMILY_IGNORED)
+        m_compute_queue_index = m_graphics_queue_index;
+    std::cout << "Choosing Compute Queue index: " << m_compute_queue_index
+        << (m_compute_queue_index == m_graphics_queue_index ? " (no async compute)" : "") << std::endl;
 }
 
 void Graphics::CreateDevice() {
@@ -157,6 +182,22 @@ void Graphics::CreateDevice() {
 
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR rtPipelineFeature;
 
+    // Mesh shaders are optional; LightingPass falls back to the vertex pipeline without them
+    vk::PhysicalDeviceMeshShaderFeaturesEXT meshFeature;
+    for (const auto& extensionProperty : m_physical_device.enumerateDeviceExtensionProperties()) {
+        if (strcmp(extensionProperty.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0) {
+            device_extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+            rtPipelineFeature.setPNext(&meshFeature);
+            m_mesh_shader_supported = true;
+        }
+        // Heap budgets and usage for the memory report; optional
+        if (strcmp(extensionProperty.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            m_memory_budget_supported = true;
+        }
+    }
+    std::cout << "Memory budget : " << (m_memory_budget_supported ? "supported" : "not supported") << std::endl;
+
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR accelFeature;
     accelFeature.setPNext(&rtPipelineFeature);
 
@@ -174,15 +215,48 @@ void Graphics::CreateDevice() {
 
     m_physical_device.getFeatures2(&feature2);
 
+    // Scene textures are block compressed when the device can sample BC1 and BC7
+    m_bc_supported = feature2.features.textureCompressionBC;
+    for (vk::Format format : { vk::Format::eBc1RgbUnormBlock, vk::Format::eBc7UnormBlock }) {
+        vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eSampledImage |
+            vk::FormatFeatureFlagBits::eSampledImageFilterLinear | vk::FormatFeatureFlagBits::eTransferDst;
+        if ((m_physical_device.getFormatProperties(format).optimalTilingFeatures & needed) != needed)
+            m_bc_supported = false;
+    }
+    std::cout << "BC texture compression : " << (m_bc_supported ? "supported" : "not supported") << std::endl;
+
+    // rg16f, rg32f and r11g11b10 storage images; every feature queried is enabled below
+    if (!feature2.features.shaderStorageImageExtendedFormats)
+        throw std::runtime_error("shaderStorageImageExtendedFormats is required by the render target formats!");
+    ValidateTargetFormats(m_physical_device);
+    std::cout << "Render target precision : " << TargetPrecisionName(TARGET_PRECISION) << std::endl;
+
+    // Frames, init submissions, uploads and the deletion queue all track the GPU with timelines
+    if (!feature12.timelineSemaphore)
+        throw std::runtime_error("timelineSemaphore is required for GPU synchronization!");
+
+    if (m_mesh_shader_supported) {
+        m_mesh_shader_supported = meshFeature.taskShader && meshFeature.meshShader;
+        // These depend on features that are not enabled
+        meshFeature.setPrimitiveFragmentShadingRateMeshShader(VK_FALSE);
+        meshFeature.setMeshShaderQueries(VK_FALSE);
+        std::cout << "Mesh shaders : " << (m_mesh_shader_supported ? "supported" : "not supported") << std::endl;
+    }
+
     float priority = 0.0f;
-    vk::DeviceQueueCreateInfo deviceQueueCreateInfo(vk::DeviceQueueCreateFlags(),
-        static_cast<uint32_t>(m_graphics_queue_index), 1, &priority);
+    std::vector<vk::DeviceQueueCreateInfo> deviceQueueCreateInfos = { vk::DeviceQueueCreateInfo(
+        vk::DeviceQueueCreateFlags(), static_cast<uint32_t>(m_graphics_queue_index), 1, &priority) };
+    if (m_transfer_queue_index != m_graphics_queue_index)
+        deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo(
+            vk::DeviceQueueCreateFlags(), m_transfer_queue_index, 1, &priority));
+    if (m_compute_queue_index != m_graphics_queue_index)
+        deviceQueueCreateInfos.push_back(vk::DeviceQueueCreateInfo(
+            vk::DeviceQueueCreateFlags(), m_compute_queue_index, 1, &priority));
 
     vk::DeviceCreateInfo deviceCreateInfo;
     deviceCreateInfo.setFlags(vk::DeviceCreateFlags());
 
-    deviceCreateInfo.setQueueCreateInfoCount(1);
-    deviceCreateInfo.setQueueCreateInfos(deviceQueueCreateInfo);
+    deviceCreateInfo.setQueueCreateInfos(deviceQueueCreateInfos);
 
     deviceCreateInfo.setEnabledLayerCount(instance_layers.size());
     deviceCreateInfo.setPpEnabledLayerNames(instance_layers.data());
@@ -197,6 +271,13 @@ void Graphics::CreateDevice() {
 
 void Graphics::GetCommandQueue() {
     m_queue = m_device.getQueue(m_graphics_queue_index, 0);
+    m_compute_queue = m_device.getQueue(m_compute_queue_index, 0);
+
+    // Storage images are what both queues touch; concurrent sharing saves an
+    // ownership transfer every time a render target changes queue
+    m_shared_families.clear();
+    if (m_compute_queue_index != m_graphics_queue_index)
+        m_shared_families = { m_graphics_queue_index, m_compute_queue_index };
 }
 
 vk::Format Graphics::GetSupportedDepthFormat() {
@@ -250,15 +331,27 @@ void Graphics::CreateCommandPool() {
     m_cmd_pool = m_device.createCommandPool(
         vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
             m_graphics_queue_index));
-
-    // Create a command buffer
-    m_cmd_buffer = m_device.allocateCommandBuffers(
-        vk::CommandBufferAllocateInfo(m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1)).front();
+    m_compute_cmd_pool = m_device.createCommandPool(
+        vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+            m_compute_queue_index));
+
+    // A command buffer and acquire semaphore per frame in flight; the graphics
+    // timeline says when a context can be reused. Frames split across queues get
+    // more command buffers as BeginBatch needs them.
+    frames_in_flight = std::clamp(frames_in_flight, 1u, 3u);
+    std::vector<vk::CommandBuffer> cmd_buffers = m_device.allocateCommandBuffers(
+        vk::CommandBufferAllocateInfo(m_cmd_pool, vk::CommandBufferLevel::ePrimary, frames_in_flight));
+    m_frames.resize(frames_in_flight);
+    for (uint32_t i = 0; i < frames_in_flight; ++i) {
+        m_frames[i].cmd = cmd_buffers[i];
+        m_frames[i].acquired = m_device.createSemaphore(vk::SemaphoreCreateInfo());
+    }
+    m_frame_index = 0;
+    m_cmd_buffer = m_frames[0].cmd;
+    printf("Frames in flight: %u\n", frames_in_flight);
 }
 
 void Graphics::CreateSwapchain() {
-    m_device.waitIdle();
-
     // Get the surface's capabilities
     vk::SurfaceCapabilitiesKHR surfaceCapabilities =
         m_physical_device.getSurfaceCapabilitiesKHR(m_surface);
@@ -270,11 +363,11 @@ void Graphics::CreateSwapchain() {
         int width, height;
         glfwGetFramebufferSize(p_parent_window->GetGLFWPointer(), &width, &height);
         
-        swapchainExtent.width = glm::clamp(swapchainExtent.width,
+        swapchainExtent.width = glm::clamp(static_cast<uint32_t>(width),
             surfaceCapabilities.minImageExtent.width,
             surfaceCapabilities.maxImageExtent.width);
 
-        swapchainExtent.height = glm::clamp(swapchainExtent.height,
+        swapchainExtent.height = glm::clamp(static_cast<uint32_t>(height),
             surfaceCapabilities.minImageExtent.height,
             surfaceCapabilities.maxImageExtent.height);
     }
@@ -285,7 +378,7 @@ void Graphics::CreateSwapchain() {
     }
 
     // Test against valid size, typically hit when windows are minimized.
-    // The app must prevent triggering this code in such a case
+    // RecreateSwapchain waits until the window has a size again
     assert(swapchainExtent.width && swapchainExtent.height);
 
     std::vector<vk::PresentModeKHR> present_modes =
@@ -348,7 +441,7 @@ void Graphics::CreateSwapchain() {
         vk::CompositeAlphaFlagBitsKHR::eOpaque,
         swapchainPresentMode,
         true,
-        nullptr);
+        m_swapchain);  // The one being replaced, if any
 
     m_swapchain = m_device.createSwapchainKHR(swapChainCreateInfo);
 
@@ -385,35 +478,88 @@ void Graphics::CreateSwapchain() {
 
     // Create a temporary command buffer. submit the layout conversion
     // command, submit and destroy the command buffer.
-    vk::CommandBuffer cmd = CreateTempCommandBuffer();
+    vk::CommandBuffer cmd = CreateInitCommandBuffer();
     cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTopOfPipe,
         vk::DependencyFlagBits::eByRegion, 0, nullptr, 0, nullptr, m_image_count, m_barriers.data());
 
-    SubmitTempCommandBuffer(cmd);
+    SubmitInitCommandBuffer(cmd);
 
-    // Create the three synchronization objects.  These are not
-    // technically part of the swap chain, but they are used
-    // exclusively for synchronizing the swap chain, so I include them
-    // here.
-    m_waitfence = m_device.createFence(
-        vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled));
-
-    m_read_semaphore = m_device.createSemaphore(vk::SemaphoreCreateInfo());
-    m_written_semaphore = m_device.createSemaphore(vk::SemaphoreCreateInfo());
+    // The per image semaphores that presentation waits on; the acquire
+    // semaphores belong to the frame contexts
+    for (size_t i = 0; i < m_swapchain_images.size(); ++i)
+        m_written_semaphores.push_back(m_device.createSemaphore(vk::SemaphoreCreateInfo()));
 
     window_size = swapchainExtent;
+    UpdateRenderExtent();
     // To destroy:  Complete and call function destroySwapchain
 }
 
+void Graphics::RecreateSwapchain() {
+    // A minimized window has no size to make a swapchain at
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(p_parent_window->GetGLFWPointer(), &width, &height);
+    while (width == 0 || height == 0) {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(p_parent_window->GetGLFWPointer(), &width, &height);
+    }
+    m_resize_pending = false;
+
+    // Nothing waits: the transitions and uploads go ahead of the next frame on the queue
+    BeginInitBatch("resize", false);
+    // Frames in flight still present the old images, wait on their semaphores
+    // and draw into the old framebuffers
+    vk::Device device = m_device;
+    vk::SwapchainKHR old_swapchain = m_swapchain;
+    std::vector<vk::ImageView> old_views;
+    std::vector<vk::Semaphore> old_semaphores;
+    std::vector<vk::Framebuffer> old_framebuffers;
+    old_views.swap(m_image_views);
+    old_semaphores.swap(m_written_semaphores);
+    old_framebuffers.swap(m_framebuffers);
+    m_barriers.clear();
+    CreateSwapchain();
+    Retire([device, old_swapchain, old_views, old_semaphores, old_framebuffers]() {
+        for (auto framebuffer : old_framebuffers)
+            device.destroyFramebuffer(framebuffer);
+        for (auto image_view : old_views)
+            device.destroyImageView(image_view);
+        for (auto semaphore : old_semaphores)
+            device.destroySemaphore(semaphore);
+        device.destroySwapchainKHR(old_swapchain);
+        });
+
+    m_allocator.SetOwner("swapchain");
+    m_depth_image.Resize(window_size.width, window_size.height);
+    CreatePostFrameBuffers();
+
+    m_render_graph.Resize();
+
+    // Binding 0 is the color buffer, which the lighting pass just resized
+    RenewDescriptor(m_post_proc_desc);
+    m_post_proc_desc.write(m_device, 0, p_post_input->Descriptor());
+    m_allocator.SetOwner(nullptr);
+    uint64_t value = EndInitBatch();
+    // The next frame isn't recorded yet, so everything retired since the last frame was
+    // last used by work before the resize submission; PrepareFrame frees it once that is done
+    m_deletion_queue.Stamp(value);
+    printf("Resized to %ux%u\n", window_size.width, window_size.height);
+}
+
+void Graphics::RenewDescriptor(DescriptorWrap& descriptor) {
+    vk::Device device = m_device;
+    vk::DescriptorPool pool = descriptor.renew(m_device);
+    Retire([device, pool]() { device.destroyDescriptorPool(pool); });
+}
+
 void Graphics::DestroySwapchain() {
     vkDeviceWaitIdle(m_device);
 
     for (auto image_view : m_image_views) {
         m_device.destroyImageView(image_view);
     }
-    m_device.destroyFence(m_waitfence);
-    m_device.destroySemaphore(m_read_semaphore);
-    m_device.destroySemaphore(m_written_semaphore);
+    for (auto semaphore : m_written_semaphores)
+        m_device.destroySemaphore(semaphore);
+    m_written_semaphores.clear();
     m_device.destroySwapchainKHR(m_swapchain);
     m_swapchain = VK_NULL_HANDLE;
     m_image_views.clear();
@@ -430,14 +576,115 @@ vk::CommandBuffer Graphics::CreateTempCommandBuffer() {
 }
 
 void Graphics::SubmitTempCommandBuffer(vk::CommandBuffer cmd_buffer) {
+    // Waits for this submission only, not for frames still in flight
+    uint64_t value = QueueTempCommandBuffer(cmd_buffer);
+    m_timeline.Wait(value);
+    m_uploader.Update();
+    // Frees the command buffers and runs the callbacks
+    m_deletion_queue.Collect();
+}
+
+uint64_t Graphics::QueueTempCommandBuffer(vk::CommandBuffer cmd_buffer) {
     cmd_buffer.end();
 
-    vk::SubmitInfo submitInfo;
-    submitInfo.setCommandBufferCount(1);
-    submitInfo.setPCommandBuffers(&cmd_buffer);
+    // Anything uploaded while recording has to be owned by this queue before cmd_buffer runs,
+    // and an open init batch goes ahead of it to keep the recording order. The submission
+    // waits for the transfer queue on its timeline rather than the CPU waiting for it.
+    std::vector<vk::CommandBuffer> cmd_buffers;
+    Uploader::Ticket uploads = m_uploader.SubmitForAcquire();
+    if (m_uploader.HasPendingAcquires()) {
+        vk::CommandBuffer acquire = CreateTempCommandBuffer();
+        m_uploader.RecordAcquires(acquire);
+        acquire.end();
+        cmd_buffers.push_back(acquire);
+    }
+    if (m_init_batch.cmd && m_init_batch.cmd != cmd_buffer) {
+        m_init_batch.cmd.end();
+        cmd_buffers.push_back(m_init_batch.cmd);
+        m_init_batch.cmd = nullptr;
+    }
+    cmd_buffers.push_back(cmd_buffer);
+
+    uint64_t value = m_timeline.Advance();
+    vk::Semaphore timeline = m_timeline.GetSemaphore();
+    vk::Semaphore transfer = m_uploader.GetTimeline().GetSemaphore();
+    vk::PipelineStageFlags transferStage = vk::PipelineStageFlagBits::eAllCommands;
+    uint32_t waitCount = uploads ? 1 : 0;
+    vk::TimelineSemaphoreSubmitInfo timelineInfo(waitCount, &uploads, 1, &value);
+    vk::SubmitInfo submitInfo(waitCount, &transfer, &transferStage,
+        static_cast<uint32_t>(cmd_buffers.size()), cmd_buffers.data(), 1, &timeline);
+    submitInfo.setPNext(&timelineInfo);
     m_queue.submit(1, &submitInfo, {});
-    m_queue.waitIdle();
-    m_device.freeCommandBuffers(m_cmd_pool, 1, &cmd_buffer);
+
+    // Everything recorded so far is done once value is reached
+    if (m_init_batch.open)
+        ++m_init_batch.submits;
+    vk::Device device = m_device;
+    vk::CommandPool pool = m_cmd_pool;
+    m_deletion_queue.RunAfter(value, [device, pool, cmd_buffers]() { device.freeCommandBuffers(pool, cmd_buffers); });
+    for (auto& callback : m_init_batch.on_complete)
+        m_deletion_queue.RunAfter(value, std::move(callback));
+    m_init_batch.on_complete.clear();
+    return value;
+}
+
+void Graphics::BeginInitBatch(const char* phase, bool wait) {
+    assert(!m_init_batch.open);
+    m_init_batch.open = true;
+    m_init_batch.batching = batch_startup;
+    m_init_batch.wait = wait;
+    m_init_batch.phase = phase;
+    m_init_batch.recordings = 0;
+    m_init_batch.submits = 0;
+    m_init_batch.timer.Reset();
+}
+
+uint64_t Graphics::EndInitBatch() {
+    assert(m_init_batch.open);
+    vk::CommandBuffer cmd = m_init_batch.cmd ? m_init_batch.cmd : CreateTempCommandBuffer();
+    m_init_batch.cmd = nullptr;
+    uint64_t value = QueueTempCommandBuffer(cmd);
+    if (m_init_batch.wait) {
+        m_timeline.Wait(value);
+        m_uploader.Update();
+        m_deletion_queue.Collect();
+    }
+
+    printf("Startup %s: %.1f ms, %u init command buffers in %u submits (%s)\n", m_init_batch.phase,
+        m_init_batch.timer.Mark() * 1000.0f, m_init_batch.recordings, m_init_batch.submits,
+        m_init_batch.batching ? "batched" : "unbatched");
+    m_init_batch.open = false;
+    m_init_batch.batching = false;
+    return value;
+}
+
+vk::CommandBuffer Graphics::CreateInitCommandBuffer() {
+    if (m_init_batch.open)
+        ++m_init_batch.recordings;
+    if (!m_init_batch.batching)
+        return CreateTempCommandBuffer();
+
+    if (!m_init_batch.cmd)
+        m_init_batch.cmd = CreateTempCommandBuffer();
+    return m_init_batch.cmd;
+}
+
+void Graphics::SubmitInitCommandBuffer(vk::CommandBuffer cmd_buffer) {
+    if (m_init_batch.batching && cmd_buffer == m_init_batch.cmd)
+        return;
+    if (m_init_batch.open && !m_init_batch.wait)
+        QueueTempCommandBuffer(cmd_buffer);
+    else
+        SubmitTempCommandBuffer(cmd_buffer);
+}
+
+void Graphics::RunAfterInit(std::function<void()> fn) {
+    if (m_init_batch.batching)
+        m_init_batch.on_complete.push_back(std::move(fn));
+    else if (m_init_batch.open && !m_init_batch.wait)
+        m_deletion_queue.RunAfter(m_timeline.GetSubmitted(), std::move(fn));
+    else
+        fn();
 }
 
 void Graphics::CreateDepthResource() {
@@ -536,6 +783,7 @@ void Graphics::CreatePostDescriptor(const ImageWrap& scanline_buffer) {
             {2, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment}
         });
     m_post_proc_desc.write(m_device, 0, scanline_buffer.Descriptor());
+    p_post_input = &scanline_buffer;
 }
 
 void Graphics::CreatePostPipeline() {
@@ -551,6 +799,10 @@ void Graphics::CreatePostPipeline() {
 
     createInfo.setSetLayoutCount(1);
     createInfo.setPSetLayouts(&m_post_proc_desc.descSetLayout);
+    // The part of the input the scene was rendered at (GetRenderScale)
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eFragment, 0, sizeof(vec2));
+    createInfo.setPushConstantRangeCount(1);
+    createInfo.setPPushConstantRanges(&pushConstantRange);
 
     // What we can do now as a first pass:
     m_post_proc_pipeline_layout = m_device.createPipelineLayout(createInfo);
@@ -581,15 +833,10 @@ void Graphics::CreatePostPipeline() {
 
     vk::PipelineInputAssemblyStateCreateInfo inputAssembly({}, vk::PrimitiveTopology::eTriangleList);
 
-    vk::Viewport viewport;
-    viewport.setWidth(window_size.width);
-    viewport.setHeight(window_size.height);
-    viewport.setMaxDepth(1.0f);
-
-    vk::Rect2D scissor({ 0, 0 },
-        vk::Extent2D(window_size.width, window_size.height));
-
-    vk::PipelineViewportStateCreateInfo viewportState({}, 1, &viewport, 1, &scissor);
+    // Dynamic, so the pipeline outlives a resize
+    vk::PipelineViewportStateCreateInfo viewportState({}, 1, nullptr, 1, nullptr);
+    std::array<vk::DynamicState, 2> dynamicStates = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamicState({}, dynamicStates);
 
     vk::PipelineRasterizationStateCreateInfo rasterizer;
     rasterizer.setLineWidth(1.0f);
@@ -620,6 +867,7 @@ void Graphics::CreatePostPipeline() {
     pipelineCreateInfo.setPMultisampleState(&multiSampling);
     pipelineCreateInfo.setPDepthStencilState(&depthStencil);
     pipelineCreateInfo.setPColorBlendState(&colorBlending);
+    pipelineCreateInfo.setPDynamicState(&dynamicState);
     pipelineCreateInfo.setLayout(m_post_proc_pipeline_layout);
     pipelineCreateInfo.setRenderPass(m_post_proc_render_pass);
     pipelineCreateInfo.setSubpass(0);
@@ -674,7 +922,9 @@ void Graphics::InitGUI() {
     init_info.DescriptorPool = m_imgui_descpool;
     init_info.Subpass = subpassID;
     init_info.MinImageCount = 2;
-    init_info.ImageCount = m_image_count;
+    // ImGui cycles its vertex buffers over ImageCount frames, so it has to
+    // cover every frame in flight
+    init_info.ImageCount = std::max(m_image_count, frames_in_flight);
     init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
     init_info.CheckVkResultFn = nullptr;
     init_info.Allocator = nullptr;
@@ -690,9 +940,69 @@ void Graphics::InitGUI() {
 }
 
 void Graphics::DrawGUI() {
-    for (auto& pass : render_passes) {
-        pass->DrawGUI();
+    m_render_graph.DrawGUI();
+    ImGui::Text("CPU wait: %.2f ms frame, %.2f ms acquire (%u frames in flight)",
+        m_frame_wait_ms, m_acquire_wait_ms, frames_in_flight);
+    if (m_dynamic_resolution.IsSupported()) {
+        ImGui::Text("GPU frame: %.2f ms, rendering %ux%u (%.0f%%)", m_dynamic_resolution.GetGpuMs(),
+            m_render_extent.width, m_render_extent.height, m_dynamic_resolution.GetScale() * 100.0f);
+        ImGui::Checkbox("Dynamic resolution", &dynamic_resolution);
+        ImGui::SliderFloat("Target GPU ms", &target_frame_ms, 4.0f, 33.3f);
+        ImGui::SliderFloat("Min render scale", &min_render_scale, 0.25f, 1.0f);
+    }
+    DrawMemoryGUI();
+}
+
+void Graphics::DrawMemoryGUI() {
+    if (!ImGui::BeginMenu("Device memory"))
+        return;
+    const double mb = 1024.0 * 1024.0;
+
+    std::vector<DeviceAllocator::Heap> heaps = m_allocator.GetHeaps();
+    if (!m_allocator.HasMemoryBudget())
+        ImGui::Text("VK_EXT_memory_budget unavailable: budget is the heap size");
+    for (uint32_t i = 0; i < heaps.size(); ++i) {
+        const auto& heap = heaps[i];
+        bool device_local = static_cast<bool>(heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+        vk::DeviceSize budget = heap.budget;
+        if (device_local && vram_budget_mb)
+            budget = std::min(budget, vk::DeviceSize(vram_budget_mb) * 1024 * 1024);
+        float fraction = budget ? float(double(heap.usage) / double(budget)) : 0.0f;
+        char overlay[64];
+        snprintf(overlay, sizeof(overlay), "%.0f / %.0f MB", heap.usage / mb, budget / mb);
+        ImGui::Text("Heap %u%s: ours %.1f MB allocated, %.1f MB used", i,
+            device_local ? " (device local)" : "", heap.allocated / mb, heap.used / mb);
+        bool warn = device_local && fraction > vram_warn_fraction;
+        if (warn)
+            ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(0.9f, 0.2f, 0.2f, 1.0f));
+        ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay);
+        if (warn)
+            ImGui::PopStyleColor();
     }
+
+    ImGui::Separator();
+    for (const auto& owner : m_allocator.GetOwners()) {
+        if (!owner.count)
+            continue;
+        vk::DeviceSize total = 0;
+        for (vk::DeviceSize bytes : owner.heap_bytes)
+            total += bytes;
+        ImGui::Text("%-28s %8.1f MB %5u allocs (peak %.1f MB)", owner.name.c_str(), total / mb,
+            owner.count, owner.peak / mb);
+    }
+
+    ImGui::Separator();
+    int budget_mb = static_cast<int>(vram_budget_mb);
+    bool budget_changed = ImGui::InputInt("Budget MB (0 = driver)", &budget_mb);
+    budget_changed |= ImGui::SliderFloat("Warn at", &vram_warn_fraction, 0.5f, 1.0f);
+    if (budget_changed) {
+        vram_budget_mb = static_cast<uint32_t>(std::max(budget_mb, 0));
+        m_allocator.SetBudget(vk::DeviceSize(vram_budget_mb) * 1024 * 1024, vram_warn_fraction);
+        m_allocator.CheckBudget();
+    }
+    if (ImGui::MenuItem("Write memory report"))
+        m_allocator.WriteReport(memory_report_path.empty() ? "memory_report.json" : memory_report_path);
+    ImGui::EndMenu();
 }
 
 
@@ -711,9 +1021,13 @@ void Graphics::PostProcess() {
             / static_cast<float>(window_size.height);
 
         m_cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, m_post_proc_pipeline);
+        CommandSetViewport(window_size);
 
         m_cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, 
             m_post_proc_pipeline_layout, 0, 1, &m_post_proc_desc.descSet, 0, nullptr);
+        vec2 uv_scale = GetRenderScale();
+        m_cmd_buffer.pushConstants(m_post_proc_pipeline_layout, vk::ShaderStageFlagBits::eFragment,
+            0, sizeof(vec2), &uv_scale);
         // Weird! This draws 3 vertices but with no vertices/triangles buffers bound in.
         // Hint: The vertex shader fabricates vertices from gl_VertexIndex
         m_cmd_buffer.draw(3, 1, 0, 0);
@@ -733,6 +1047,7 @@ void Graphics::Teardown() {
     ImGui_ImplVulkan_Shutdown();
 
     DestroyUniformData();
+    m_uploader.Destroy();
 
     m_device.destroyPipelineLayout(m_post_proc_pipeline_layout);
     m_device.destroyPipeline(m_post_proc_pipeline);
@@ -742,143 +1057,182 @@ void Graphics::Teardown() {
     }
     m_device.destroyRenderPass(m_post_proc_render_pass);
 
-    for (auto& render_pass : render_passes) {
-        render_pass.reset();
-    }
+    m_render_graph.Destroy();
+    m_render_targets.Destroy();
+    m_deletion_queue.Destroy();
+    m_timeline.Destroy();
+    m_compute_timeline.Destroy();
+    m_dynamic_resolution.Destroy();
 
     m_depth_image.destroy(m_device);
     m_post_proc_desc.destroy(m_device);
     DestroySwapchain();
+    printf("Frames: %llu drawn with %u in flight, CPU waited %.2f ms per frame\n",
+        (unsigned long long)m_frame_count, frames_in_flight,
+        m_frame_count ? m_total_wait_ms / m_frame_count : 0.0);
+    if (HasAsyncCompute())
+        printf("Async compute: %llu batches, %.2f per frame\n", (unsigned long long)m_compute_batch_count,
+            m_frame_count ? double(m_compute_batch_count) / m_frame_count : 0.0);
+    for (auto& frame : m_frames) {
+        m_device.destroySemaphore(frame.acquired);
+    }
+    m_frames.clear();
     m_device.destroyCommandPool(m_cmd_pool);
+    m_device.destroyCommandPool(m_compute_cmd_pool);
+    if (record_threads)
+        m_recorder.Destroy();
     m_instance.destroySurfaceKHR(m_surface);
+    m_allocator.Destroy();
     m_device.destroy();
     m_instance.destroy();
 }
 
 void Graphics::DestroyUniformData() {
-    for (auto ob : m_objData) ob.destroy(m_device);
-    for (auto t : m_objText) t.destroy(m_device);
+    for (auto& ob : m_objData) ob.destroy(m_device);
+    for (auto& materials : m_materialBWs) materials.destroy(m_device);
+    for (auto& t : m_objText) t.destroy(m_device);
     
     m_objDescriptionBW.destroy(m_device);
     m_matrixBW.destroy(m_device);
+    m_paramsBW.destroy(m_device);
     m_lightBW.destroy(m_device);
+    m_lightAliasBW.destroy(m_device);
 }
 
 Graphics::Graphics(Window* _p_parent_window, bool api_dump) :
     p_parent_window(_p_parent_window), do_post_process(true) {
+    TimerWrap startup_timer;
 	CreateInstance(api_dump);
     CreatePhysicalDevice();
     ChooseQueueIndex();
     CreateDevice();
     GetCommandQueue();
+    m_timeline.Init(m_device);
+    m_compute_timeline.Init(m_device);
+    m_deletion_queue.Init(&m_timeline);
+    m_allocator.Init(m_physical_device, m_device, 64 * 1024 * 1024, m_memory_budget_supported);
+    m_allocator.SetBudget(vk::DeviceSize(vram_budget_mb) * 1024 * 1024, vram_warn_fraction);
+    m_render_targets.Init(this);
 
     LoadExtensions();
 
     GetSurface();
     CreateCommandPool();
-
+    m_dynamic_resolution.Init(m_device, m_physical_device, m_graphics_queue_index, frames_in_flight);
+    record_threads = std::min(record_threads, std::max(1u, std::thread::hardware_concurrency()));
+    if (record_threads)
+        m_recorder.Init(m_device, m_graphics_queue_index, m_compute_queue_index, frames_in_flight, record_threads);
+    m_uploader.Init(this, m_transfer_queue_index, m_graphics_queue_index, 64 * 1024 * 1024);
+
+    BeginInitBatch("swapchain");
+    m_allocator.SetOwner("swapchain");
     CreateSwapchain();
     CreateDepthResource();
     CreatePostProcessRenderPass();
     CreatePostFrameBuffers();
+    EndInitBatch();
 
     InitGUI();
     
     /*
     * https://benedikt-bitterli.me/resources/
     */
+    BeginInitBatch("scene");
     LoadModel("models/fireplace_room/fireplace_room.obj", glm::mat4());
+    m_allocator.SetOwner("scene uniforms");
     CreateMatrixBuffer();
+    CreateParamsBuffer();
     CreateObjDescriptionBuffer();
-    
+    EndInitBatch();
+
+    //Each pass's memory is counted under its name
+    BeginInitBatch("passes");
+    m_allocator.SetOwner("LightingPass");
     std::unique_ptr<LightingPass> p_lighting_pass = std::make_unique<LightingPass>(this);
     CreatePostDescriptor(p_lighting_pass->GetBufferRef());
     CreatePostPipeline();
     
     //Add the TileMaxPass to the list of passes.
-    std::unique_ptr<TileMaxPass> p_tile_max_pass =
-        std::make_unique<TileMaxPass>(this, p_lighting_pass.get());
+    m_allocator.SetOwner("TileMaxPass");
+    std::unique_ptr<TileMaxPass> p_tile_max_pass = std::make_unique<TileMaxPass>(this);
     //Add the NeighbourMax to the list of passes.
-    std::unique_ptr<NeighbourMax> p_neighbour_max_pass =
-        std::make_unique<NeighbourMax>(this, p_tile_max_pass.get());
+    m_allocator.SetOwner("NeighbourMax");
+    std::unique_ptr<NeighbourMax> p_neighbour_max_pass = std::make_unique<NeighbourMax>(this);
 
     //Add the pre DOF pass
-    std::unique_ptr<PreDOFPass> p_pre_dof_pass = 
-        std::make_unique<PreDOFPass>(this, p_lighting_pass.get());
-    p_pre_dof_pass->SetNeighbourMaxBufferDesc(p_neighbour_max_pass->GetBuffer());
+    m_allocator.SetOwner("PreDOFPass");
+    std::unique_ptr<PreDOFPass> p_pre_dof_pass = std::make_unique<PreDOFPass>(this);
 
     //Add a raymask pass to the list of passes
-    std::unique_ptr<RayMaskPass> p_raymask_pass =
-        std::make_unique<RayMaskPass>(this, p_pre_dof_pass.get());
+    m_allocator.SetOwner("RayMaskPass");
+    std::unique_ptr<RayMaskPass> p_raymask_pass = std::make_unique<RayMaskPass>(this);
 
     //Add the depth of field pass to the list of passes.
-    std::unique_ptr<DOFPass> p_dof_pass = std::make_unique<DOFPass>(this, p_pre_dof_pass.get());
-    p_dof_pass->SetNeighbourMaxBufferDesc(p_neighbour_max_pass->GetBuffer());
-    p_dof_pass->SetEdgeBufferDesc(p_raymask_pass->GetBuffer());
-
-    //Make sure TileMaxPass can access DOFPass for the DOF parameters
-    p_tile_max_pass->SetDOFPass(p_dof_pass.get());
-    //Make sure PreDOFPass can access DOFPass for the DOF parameters
-    p_pre_dof_pass->SetDOFPass(p_dof_pass.get());
+    m_allocator.SetOwner("DOFPass");
+    std::unique_ptr<DOFPass> p_dof_pass = std::make_unique<DOFPass>(this);
 
     //Add the Raycast pass to the list of passes
-    std::unique_ptr<RayCastPass> p_raycast_pass =
-        std::make_unique<RayCastPass>(this, p_raymask_pass.get());
-    p_raycast_pass->SetLightingPass(p_lighting_pass.get());
-    p_raycast_pass->SetDOFPass(p_dof_pass.get());
+    m_allocator.SetOwner("RayCastPass");
+    std::unique_ptr<RayCastPass> p_raycast_pass = std::make_unique<RayCastPass>(this);
 
     //Add the median pass to the list of passes.
-    std::unique_ptr<MedianPass> p_median_pass =
-        std::make_unique<MedianPass>(this, p_dof_pass.get());
-    p_median_pass->SetRaycastBGDesc(p_raycast_pass->GetBGBuffer());
+    m_allocator.SetOwner("MedianPass");
+    std::unique_ptr<MedianPass> p_median_pass = std::make_unique<MedianPass>(this);
 
     //Add the upscale pass to the list of passes
-    std::unique_ptr<UpscalePass> p_upscale_pass = 
-        std::make_unique<UpscalePass>(this, p_median_pass.get());
-    p_upscale_pass->SetFullResBufferDesc(p_lighting_pass->GetBufferRef());
-    p_upscale_pass->SetFullResDepthBufferDesc(p_lighting_pass->GetVeloDepthBufferRef());
-    p_upscale_pass->SetNeighbourBufferDesc(p_neighbour_max_pass->GetBuffer());
-    p_upscale_pass->SetDOFPass(p_dof_pass.get());
-    p_upscale_pass->SetRaycastBGBufferDesc(p_median_pass->GetBGBuffer());
+    m_allocator.SetOwner("UpscalePass");
+    std::unique_ptr<UpscalePass> p_upscale_pass = std::make_unique<UpscalePass>(this);
 
     //Add the MBlur pass to the list of passes.
-    std::unique_ptr<MBlurPass> p_mblur_pass = std::make_unique<MBlurPass>(this, p_lighting_pass.get());
-    p_mblur_pass->SetNeighbourMaxDesc(p_neighbour_max_pass->GetBuffer());
+    m_allocator.SetOwner("MBlurPass");
+    std::unique_ptr<MBlurPass> p_mblur_pass = std::make_unique<MBlurPass>(this);
 
     //Add the debug buffer draw pass to the list of passes.
-    std::unique_ptr<BufferDebugDraw> p_debug_buffer_pass = 
-        std::make_unique<BufferDebugDraw>(this, p_dof_pass.get());
+    m_allocator.SetOwner("BufferDebugDraw");
+    std::unique_ptr<BufferDebugDraw> p_debug_buffer_pass = std::make_unique<BufferDebugDraw>(this);
+
+    //The DOF lens settings and the lighting parameters are shared by pointer;
+    //the images go through the render graph
+    p_tile_max_pass->SetDOFPass(p_dof_pass.get());
+    p_pre_dof_pass->SetDOFPass(p_dof_pass.get());
+    p_raycast_pass->SetLightingPass(p_lighting_pass.get());
+    p_raycast_pass->SetDOFPass(p_dof_pass.get());
+    p_upscale_pass->SetDOFPass(p_dof_pass.get());
     p_debug_buffer_pass->SetDOFPass(p_dof_pass.get());
-    p_debug_buffer_pass->SetVeloDepthBuffer(p_lighting_pass->GetVeloDepthBufferRef());
-    p_debug_buffer_pass->SetTileMaxBuffer(p_tile_max_pass->GetBuffer());
-    p_debug_buffer_pass->SetNeighbourMaxBuffer(p_neighbour_max_pass->GetBuffer());
-    p_debug_buffer_pass->SetPreDOFBuffer(p_pre_dof_pass->GetBuffer());
-    p_debug_buffer_pass->SetPreDOFParamsBuffer(p_pre_dof_pass->GetParamsBuffer());
-    p_debug_buffer_pass->SetDOFBuffer(p_dof_pass->GetBuffer());
-    p_debug_buffer_pass->SetMedianBGBuffer(p_median_pass->GetBGBuffer());
-    p_debug_buffer_pass->SetMedianFGBuffer(p_median_pass->GetFGBuffer());
-    p_debug_buffer_pass->SetUpscaledBuffer(p_upscale_pass->GetBuffer());
-    p_debug_buffer_pass->SetRaymaskBuffer(p_dof_pass->GetRaymaskBuffer());
-    p_debug_buffer_pass->SetRaycastBGBuffer(p_median_pass->GetRTBuffer());
-    p_debug_buffer_pass->SetEdgeBuffer(p_raymask_pass->GetBuffer());
-
-
-    render_passes.push_back(std::move(p_lighting_pass));
-    render_passes.push_back(std::move(p_tile_max_pass));
-    render_passes.push_back(std::move(p_neighbour_max_pass));
-    render_passes.push_back(std::move(p_pre_dof_pass));
-    render_passes.push_back(std::move(p_raymask_pass));
-    render_passes.push_back(std::move(p_dof_pass));
-    render_passes.push_back(std::move(p_raycast_pass));
-    render_passes.push_back(std::move(p_median_pass));
-    render_passes.push_back(std::move(p_upscale_pass));
-    render_passes.push_back(std::move(p_mblur_pass));
-    render_passes.push_back(std::move(p_debug_buffer_pass));
+
+    //Each pass declares its images as it's added, so a pass can only read what
+    //an earlier one makes
+    m_render_graph.Init(this, &m_render_targets);
+    m_render_graph.AddPass("LightingPass", std::move(p_lighting_pass));
+    m_render_graph.AddPass("TileMaxPass", std::move(p_tile_max_pass));
+    m_render_graph.AddPass("NeighbourMax", std::move(p_neighbour_max_pass));
+    m_render_graph.AddPass("PreDOFPass", std::move(p_pre_dof_pass));
+    m_render_graph.AddPass("RayMaskPass", std::move(p_raymask_pass));
+    m_render_graph.AddPass("DOFPass", std::move(p_dof_pass));
+    m_render_graph.AddPass("RayCastPass", std::move(p_raycast_pass));
+    m_render_graph.AddPass("MedianPass", std::move(p_median_pass));
+    m_render_graph.AddPass("UpscalePass", std::move(p_upscale_pass));
+    m_render_graph.AddPass("MBlurPass", std::move(p_mblur_pass));
+    m_render_graph.AddPass("BufferDebugDraw", std::move(p_debug_buffer_pass));
+    //The post process samples the color buffer
+    m_render_graph.AddOutput("color", vk::PipelineStageFlagBits::eFragmentShader);
+
+    //The transient targets have no memory until the graph is compiled, so
+    //nothing may take their descriptors before it
+    m_allocator.SetOwner("render targets (aliased)");
+    m_render_graph.Compile(alias_render_targets);
+    m_allocator.SetOwner(nullptr);
 
     //Setup all the render passes
-    for (auto& render_pass : render_passes) {
-        render_pass->Setup();
-    }
+    m_render_graph.Setup();
+    EndInitBatch();
+
+    printf("Startup: %.1f ms total\n", startup_timer.Mark() * 1000.0f);
+    m_allocator.PrintStats();
+    m_render_targets.PrintReport();
+    m_allocator.CheckBudget();
+    if (!memory_report_path.empty())
+        m_allocator.WriteReport(memory_report_path);
 }
 
 void Graphics::SetActiveCamPtr(Camera* p_cam) {
@@ -886,34 +1240,151 @@ void Graphics::SetActiveCamPtr(Camera* p_cam) {
 }
 
 void Graphics::PrepareFrame() {
-    m_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, m_read_semaphore,
+    FrameContext& frame = m_frames[m_frame_index];
+    m_cmd_buffer = frame.cmd;
+
+    // The context comes back once the frame that last used it has finished, which
+    // is frames_in_flight frames ago
+    TimerWrap wait_timer;
+    m_timeline.Wait(frame.value);
+    m_frame_wait_ms = wait_timer.Mark() * 1000.0f;
+    // Everything up to that frame has finished with what it used
+    m_deletion_queue.Collect();
+    // The frame's timestamps are written by now too
+    if (m_dynamic_resolution.Update(m_frame_index, dynamic_resolution, target_frame_ms, min_render_scale))
+        UpdateRenderExtent();
+
+    if (m_resize_pending)
+        RecreateSwapchain();
+    vk::Result result = m_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, frame.acquired,
         (VkFence)VK_NULL_HANDLE, &m_swapchain_index);
+    // An out of date swapchain signals nothing, so the semaphore can be used again
+    while (result == vk::Result::eErrorOutOfDateKHR) {
+        RecreateSwapchain();
+        result = m_device.acquireNextImageKHR(m_swapchain, UINT64_MAX, frame.acquired,
+            (VkFence)VK_NULL_HANDLE, &m_swapchain_index);
+    }
+    // A suboptimal image can still be presented; recreate before the next frame
+    if (result == vk::Result::eSuboptimalKHR)
+        m_resize_pending = true;
+    else if (result != vk::Result::eSuccess)
+        throw std::runtime_error("failed to acquire swapchain image!");
+    m_acquire_wait_ms = wait_timer.Mark() * 1000.0f;
+
+    m_total_wait_ms += m_frame_wait_ms + m_acquire_wait_ms;
+    ++m_frame_count;
+}
 
-    // Check if window has been resized -- or other(??) swapchain specific event
-    //if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-    //    recreateSizedResources(VkExtent2D(windowSize)); }
+uint32_t Graphics::BeginBatch(bool compute) {
+    m_cmd_buffer.end();
 
-    // Use a fence to wait until the command buffer has finished execution before using it again
-    while (vk::Result::eTimeout == m_device.waitForFences(1, &m_waitfence, VK_TRUE, 1'000'000))
-    {
+    FrameContext& frame = m_frames[m_frame_index];
+    std::vector<vk::CommandBuffer>& cmds = compute ? frame.compute_cmds : frame.graphics_cmds;
+    size_t used = 0;
+    for (const QueueBatch& batch : m_batches) {
+        if (batch.compute == compute)
+            ++used;
     }
+    // The first graphics batch is frame.cmd
+    if (!compute)
+        --used;
+    if (used == cmds.size()) {
+        cmds.push_back(m_device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(
+            compute ? m_compute_cmd_pool : m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1)).front());
+    }
+
+    QueueBatch batch;
+    batch.compute = compute;
+    batch.cmd = cmds[used];
+    batch.cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    m_cmd_buffer = batch.cmd;
+    m_batches.push_back(batch);
+    return GetBatch();
+}
+
+void Graphics::WaitForBatch(uint32_t batch, vk::PipelineStageFlags stages) {
+    // Waiting for a batch covers every batch before it on that queue
+    QueueBatch& current = m_batches.back();
+    if (!current.wait_stages || batch > current.wait_batch)
+        current.wait_batch = batch;
+    current.wait_stages |= stages;
 }
 
 void Graphics::SubmitFrame() {
-    m_device.resetFences(1, &m_waitfence);
-
-    // Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-    const vk::PipelineStageFlags waitStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-    // The submit info structure specifies a command buffer queue submission batch
-    vk::SubmitInfo submitInfo(1, &m_read_semaphore,
-        &waitStageMask,
-        1, &m_cmd_buffer,
-        1, &m_written_semaphore);
-    m_queue.submit(1, &submitInfo, m_waitfence);
-
-    vk::PresentInfoKHR presentInfo(1, &m_written_semaphore,
+    FrameContext& frame = m_frames[m_frame_index];
+
+    // The render graph ends the frame on the graphics queue. Its last value has to
+    // cover the compute work too, which a later graphics batch normally waits for.
+    uint32_t last_graphics = 0;
+    uint32_t last_compute = 0;
+    bool covered = true;
+    for (uint32_t i = 0; i < m_batches.size(); ++i) {
+        if (m_batches[i].compute) {
+            last_compute = i;
+            covered = false;
+        }
+        else {
+            last_graphics = i;
+            if (m_batches[i].wait_stages && m_batches[i].wait_batch == last_compute)
+                covered = true;
+        }
+    }
+    if (!covered) {
+        m_batches[last_graphics].wait_batch = last_compute;
+        m_batches[last_graphics].wait_stages |= vk::PipelineStageFlagBits::eAllCommands;
+    }
+
+    vk::Semaphore written = m_written_semaphores[m_swapchain_index];
+    for (uint32_t i = 0; i < m_batches.size(); ++i) {
+        QueueBatch& batch = m_batches[i];
+        GpuTimeline& timeline = batch.compute ? m_compute_timeline : m_timeline;
+        GpuTimeline& other = batch.compute ? m_timeline : m_compute_timeline;
+        batch.value = timeline.Advance();
+
+        // The binary semaphores ignore their timeline values
+        std::array<vk::Semaphore, 2> waits;
+        std::array<uint64_t, 2> waitValues = {};
+        std::array<vk::PipelineStageFlags, 2> waitStages;
+        std::array<vk::Semaphore, 2> signals = { timeline.GetSemaphore(), written };
+        std::array<uint64_t, 2> signalValues = { batch.value, 0 };
+        uint32_t waitCount = 0;
+        uint32_t signalCount = 1;
+        if (batch.wait_stages) {
+            waits[waitCount] = other.GetSemaphore();
+            waitValues[waitCount] = m_batches[batch.wait_batch].value;
+            waitStages[waitCount++] = batch.wait_stages;
+        }
+        // The last graphics batch draws to the swapchain image and presents it
+        if (i == last_graphics) {
+            waits[waitCount] = frame.acquired;
+            waitStages[waitCount++] = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+            signalCount = 2;
+            frame.value = batch.value;
+        }
+
+        vk::TimelineSemaphoreSubmitInfo timelineInfo(waitCount, waitValues.data(), signalCount, signalValues.data());
+        vk::SubmitInfo submitInfo(waitCount, waits.data(), waitStages.data(),
+            1, &batch.cmd,
+            signalCount, signals.data());
+        submitInfo.setPNext(&timelineInfo);
+        if (batch.compute) {
+            m_compute_queue.submit(1, &submitInfo, {});
+            ++m_compute_batch_count;
+        }
+        else
+            m_queue.submit(1, &submitInfo, {});
+    }
+    m_deletion_queue.Stamp(frame.value);
+
+    vk::PresentInfoKHR presentInfo(1, &written,
         1, &m_swapchain, &m_swapchain_index);
-    m_queue.presentKHR(presentInfo);
+    vk::Result result = m_queue.presentKHR(&presentInfo);
+    if (result == vk::Result::eErrorOutOfDateKHR || result == vk::Result::eSuboptimalKHR)
+        m_resize_pending = true;
+    else if (result != vk::Result::eSuccess)
+        throw std::runtime_error("failed to present swapchain image!");
+
+    m_frame_index = (m_frame_index + 1) % static_cast<uint32_t>(m_frames.size());
 }
 
 void Graphics::DrawFrame() {
@@ -921,12 +1392,31 @@ void Graphics::DrawFrame() {
 
     vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
     m_cmd_buffer.begin(beginInfo);
+    m_batches.clear();
+    m_batches.push_back(QueueBatch());
+    m_batches.back().cmd = m_cmd_buffer;
     {   // Extra indent for recording commands into m_commandBuffer
+        // The render targets and history images are shared by every frame, so the
+        // GPU still runs frames one after the other; only the CPU gets ahead
+        vk::MemoryBarrier frameBarrier(vk::AccessFlagBits::eMemoryWrite,
+            vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+        m_cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands,
+            vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), frameBarrier, nullptr, nullptr);
+        m_dynamic_resolution.BeginFrame(m_cmd_buffer, m_frame_index);
+
+        // Take ownership of the uploads that finished since the last frame
+        m_uploader.Update();
+        m_uploader.RecordAcquires(m_cmd_buffer);
+
         UpdateCameraBuffer();
 
-        for (auto& render_pass : render_passes) {
-            render_pass->Render();
-        }
+        // The post process reads the color buffer only when it runs. Passes on the
+        // async compute queue go into batches of their own; the graph leaves a
+        // graphics batch open at the end.
+        m_render_graph.Execute(do_post_process);
+        // The dynamic resolution times the graph only; the post process and the GUI
+        // wait for the swapchain image
+        m_dynamic_resolution.EndFrame(m_cmd_buffer, m_frame_index);
 
         if (do_post_process)
             PostProcess(); //  tone mapper and output to swapchain image.
@@ -935,6 +1425,15 @@ void Graphics::DrawFrame() {
     }   // Done recording;  Execute!
 
     SubmitFrame();
+
+    // Uploads made while recording start right away, off the frame's critical path
+    m_uploader.Submit();
+
+    // Other processes change the budget too
+    if (++m_frames_since_budget_check >= 120) {
+        m_frames_since_budget_check = 0;
+        m_allocator.CheckBudget();
+    }
 }
 
 Camera* Graphics::GetCamera() {
@@ -984,39 +1483,8 @@ void Graphics::UpdateCameraBuffer() {
     hostUBO.viewInverse = glm::inverse(view);
     hostUBO.projInverse = glm::inverse(proj);
 
-    // UBO on the device, and what stages access it.
-    vk::Buffer deviceUBO = m_matrixBW.buffer;
-    auto     uboUsageStages = vk::PipelineStageFlagBits::eVertexShader |
-        vk::PipelineStageFlagBits::eRayTracingShaderKHR;
-
-
-    // Ensure that the modified UBO is not visible to previous frames.
-    vk::BufferMemoryBarrier beforeBarrier;
-    beforeBarrier.setSrcAccessMask(vk::AccessFlagBits::eShaderRead);
-    beforeBarrier.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
-    beforeBarrier.setBuffer(deviceUBO);
-    beforeBarrier.setOffset(0);
-    beforeBarrier.setSize(sizeof(hostUBO));
-
-    m_cmd_buffer.pipelineBarrier(uboUsageStages, vk::PipelineStageFlagBits::eTransfer,
-        vk::DependencyFlagBits::eDeviceGroup, 0, nullptr,
-        1, &beforeBarrier, 0, nullptr);
-
-    // Schedule the host-to-device upload. (hostUBO is copied into the cmd
-    // buffer so it is okay to deallocate when the function returns).
-    m_cmd_buffer.updateBuffer(m_matrixBW.buffer, vk::DeviceSize(0), sizeof(MatrixUniforms), &hostUBO);
-
-    // Making sure the updated UBO will be visible.
-    vk::BufferMemoryBarrier afterBarrier;
-    afterBarrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
-    afterBarrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    afterBarrier.setBuffer(deviceUBO);
-    afterBarrier.setOffset(0);
-    afterBarrier.setSize(sizeof(hostUBO));
-    m_cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, uboUsageStages,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr,
-        1, &afterBarrier, 0, nullptr);
+    // Only this frame's slice is written; frames still on the GPU read their own
+    memcpy(m_matrixBW.Mapped() + GetMatrixOffset(), &hostUBO, sizeof(hostUBO));
 }
 
 vk::Sampler Graphics::CreateTextureSampler() {
@@ -1076,7 +1544,7 @@ void Graphics::ImageLayoutBarrier(vk::CommandBuffer cmdbuffer,
 void Graphics::TransitionImageLayout(vk::Image image, vk::Format format, 
     vk::ImageLayout oldLayout, vk::ImageLayout newLayout, 
     uint32_t mipLevels) {
-    vk::CommandBuffer commandBuffer = CreateTempCommandBuffer();
+    vk::CommandBuffer commandBuffer = CreateInitCommandBuffer();
 
     vk::ImageMemoryBarrier barrier;
     barrier.setOldLayout(oldLayout);
@@ -1100,7 +1568,7 @@ void Graphics::TransitionImageLayout(vk::Image image, vk::Format format,
 
     commandBuffer.pipelineBarrier(sourceStage, destinationStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
 
-    SubmitTempCommandBuffer(commandBuffer);
+    SubmitInitCommandBuffer(commandBuffer);
 }
 
 vk::ShaderModule Graphics::CreateShaderModule(std::string code) {
@@ -1112,21 +1580,11 @@ vk::ShaderModule Graphics::CreateShaderModule(std::string code) {
 
 BufferWrap Graphics::CreateStagedBufferWrap(const vk::CommandBuffer& cmdBuf, const vk::DeviceSize& size, 
     const void* data, vk::BufferUsageFlags usage) {
-    BufferWrap staging = CreateBufferWrap(size, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible
-        | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-    void* dest;
-    m_device.mapMemory(staging.memory, 0, size, vk::MemoryMapFlags(), &dest);
-    memcpy(dest, data, size);
-    m_device.unmapMemory(staging.memory);
-
-
+    // The copy goes through the uploader; it is acquired when cmdBuf is submitted
+    // with SubmitTempCommandBuffer
     BufferWrap bw = CreateBufferWrap(size, vk::BufferUsageFlagBits::eTransferDst | usage,
         vk::MemoryPropertyFlagBits::eDeviceLocal);
-    CopyBuffer(staging.buffer, bw.buffer, size);
-
-    staging.destroy(m_device);
+    m_uploader.UploadBuffer(bw.buffer, 0, data, size);
 
     return bw;
 }
@@ -1139,6 +1597,27 @@ const vk::Extent2D& Graphics::GetWindowExtent() const {
     return window_size;
 }
 
+vec2 Graphics::GetRenderSize() const {
+    return vec2(m_render_extent.width, m_render_extent.height);
+}
+
+const vk::Extent2D& Graphics::GetRenderExtent() const {
+    return m_render_extent;
+}
+
+vec2 Graphics::GetRenderScale() const {
+    return GetRenderSize() / GetWindowSize();
+}
+
+void Graphics::UpdateRenderExtent() {
+    float scale = m_dynamic_resolution.GetScale();
+    auto scaled = [scale](uint32_t size) {
+        uint32_t even = 2 * static_cast<uint32_t>(size * scale / 2.0f + 0.5f);
+        return std::min(size, std::max(even, 2u));
+    };
+    m_render_extent = vk::Extent2D(scaled(window_size.width), scaled(window_size.height));
+}
+
 uint32_t Graphics::GetCurrentSwapchainIndex() const {
     return m_swapchain_index;
 }
@@ -1159,7 +1638,7 @@ void Graphics::GenerateMipmaps(vk::Image image, vk::Format imageFormat,
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    vk::CommandBuffer commandBuffer = CreateTempCommandBuffer();
+    vk::CommandBuffer commandBuffer = CreateInitCommandBuffer();
 
 
     vk::ImageMemoryBarrier barrier;
@@ -1239,58 +1718,44 @@ void Graphics::GenerateMipmaps(vk::Image image, vk::Format imageFormat,
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(),
         0, nullptr, 0, nullptr, 1, &barrier);
 
-    SubmitTempCommandBuffer(commandBuffer);
+    SubmitInitCommandBuffer(commandBuffer);
 }
 
 BufferWrap Graphics::CreateBufferWrap(vk::DeviceSize size, vk::BufferUsageFlags usage, 
-    vk::MemoryPropertyFlags properties) {
+    vk::MemoryPropertyFlags properties, bool shared) {
     BufferWrap result;
 
     vk::BufferCreateInfo bufferInfo;
     bufferInfo.setSize(size);
     bufferInfo.setUsage(usage);
     bufferInfo.setSharingMode(vk::SharingMode::eExclusive);
+    if (shared && m_shared_families.size() > 1)
+        bufferInfo.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_shared_families);
 
     m_device.createBuffer(&bufferInfo, nullptr, &result.buffer);
+    result.device = m_device;
 
-    vk::MemoryRequirements memRequirements;
-    m_device.getBufferMemoryRequirements(result.buffer, &memRequirements);
-
-    vk::MemoryAllocateFlagsInfo memFlags;
-    memFlags.setFlags(vk::MemoryAllocateFlagBits::eDeviceAddress);
-    memFlags.setDeviceMask(0);
-
-    vk::MemoryAllocateInfo allocInfo;
-
-    allocInfo.setPNext(&memFlags);
-    allocInfo.setAllocationSize(memRequirements.size);
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (m_device.allocateMemory(&allocInfo, nullptr, &result.memory) != vk::Result::eSuccess) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-
-    m_device.bindBufferMemory(result.buffer, result.memory, 0);
+    result.allocation = m_allocator.AllocateBuffer(result.buffer, properties);
 
     return result;
 }
 
-void Graphics::CopyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size) {
-    vk::CommandBuffer commandBuffer = CreateTempCommandBuffer();
-
-    vk::BufferCopy copyRegion;
-    copyRegion.setSize(size);
-
-    commandBuffer.copyBuffer(srcBuffer, dstBuffer, 1, &copyRegion);
-
-    SubmitTempCommandBuffer(commandBuffer);
+const vk::CommandBuffer& Graphics::GetCommandBuffer() const {
+    // A pass recorded on a worker thread gets its own secondary
+    const vk::CommandBuffer& secondary = ParallelRecorder::GetCommandBuffer();
+    return secondary ? secondary : m_cmd_buffer;
 }
 
-const vk::CommandBuffer& Graphics::GetCommandBuffer() const {
-    return m_cmd_buffer;
+void Graphics::CommandSetViewport(const vk::Extent2D& extent) const {
+    vk::Viewport viewport(0.0f, 0.0f,
+        static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f);
+    vk::Rect2D scissor({ 0, 0 }, extent);
+    GetCommandBuffer().setViewport(0, 1, &viewport);
+    GetCommandBuffer().setScissor(0, 1, &scissor);
 }
 
-void Graphics::CommandCopyImage(const ImageWrap& src, const ImageWrap& dst) const {
+void Graphics::CommandCopyImage(const ImageWrap& src, const ImageWrap& dst,
+    vk::PipelineStageFlags after) const {
     vk::ImageCopy img_copy_region;
     img_copy_region.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
     img_copy_region.srcSubresource.layerCount = 1;
@@ -1300,19 +1765,17 @@ void Graphics::CommandCopyImage(const ImageWrap& src, const ImageWrap& dst) cons
     img_copy_region.extent.height = src.GetImageSize().height;
     img_copy_region.extent.depth = 1;
 
-    ImageLayoutBarrier(m_cmd_buffer, src.GetImage(),
-        vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferSrcOptimal);
-    ImageLayoutBarrier(m_cmd_buffer, dst.GetImage(),
-        vk::ImageLayout::eGeneral, vk::ImageLayout::eTransferDstOptimal);
+    // The pass's own shaders wrote src and may have read dst; the render graph
+    // orders the copy against the other passes
+    vk::MemoryBarrier barrier(vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eShaderRead,
+        vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+    const vk::CommandBuffer& cmd = GetCommandBuffer();
+    cmd.pipelineBarrier(after, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), barrier, nullptr, nullptr);
 
-    m_cmd_buffer.copyImage(src.GetImage(), vk::ImageLayout::eTransferSrcOptimal,
-        dst.GetImage(), vk::ImageLayout::eTransferDstOptimal,
+    cmd.copyImage(src.GetImage(), vk::ImageLayout::eGeneral,
+        dst.GetImage(), vk::ImageLayout::eGeneral,
         1, &img_copy_region);
-
-    ImageLayoutBarrier(m_cmd_buffer, dst.GetImage(),
-        vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eGeneral);
-    ImageLayoutBarrier(m_cmd_buffer, src.GetImage(),
-        vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eGeneral);
 }
 
 
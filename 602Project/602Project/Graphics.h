@@ -5,6 +5,8 @@
 
 #include <stdint.h>
 #include <memory>
+#include <functional>
+#include <cstring>
 
 // Imgui
 #define GUI
@@ -28,11 +30,24 @@
 #include "ImageWrap.h"
 #include "DescriptorWrap.h"
 #include "BufferWrap.h"
+#include "Uploader.h"
+#include "GpuTimeline.h"
+#include "DynamicResolution.h"
+#include "DeletionQueue.h"
+#include "TimerWrap.h"
 #include "Util.h"
+#include "TextureRegistry.h"
+#include "TextureCompress.h"
+#include "MipBuilder.h"
 #include "RenderPass.h"
+#include "RenderGraph.h"
+#include "ParallelRecorder.h"
+#include "RenderTargetAliaser.h"
+#include "TargetFormats.h"
 
 class Window;
 class Camera;
+struct ModelData;
 
 class Graphics
 {
@@ -56,22 +71,100 @@ private:
 	vk::Instance m_instance;
 	vk::PhysicalDevice m_physical_device;
 	uint32_t m_graphics_queue_index{ VK_QUEUE_FAMILY_IGNORED };
+	uint32_t m_transfer_queue_index{ VK_QUEUE_FAMILY_IGNORED };  // Transfer-only family, if any
+	uint32_t m_compute_queue_index{ VK_QUEUE_FAMILY_IGNORED };   // Compute family without graphics, if any
 	vk::Device m_device;
 	vk::Queue m_queue;
+	vk::Queue m_compute_queue;  // Same as m_queue without async compute
 	vk::SurfaceKHR m_surface;
 	vk::CommandPool m_cmd_pool;
-	vk::CommandBuffer m_cmd_buffer;
+	vk::CommandPool m_compute_cmd_pool;
+	vk::CommandBuffer m_cmd_buffer;  // The batch being recorded
+
+	//What each frame in flight owns, so the CPU can record one frame while the
+	//GPU still runs the ones before it
+	struct FrameContext
+	{
+		vk::CommandBuffer cmd;  // The first graphics batch
+		std::vector<vk::CommandBuffer> graphics_cmds;  // Later graphics batches, made as needed
+		std::vector<vk::CommandBuffer> compute_cmds;
+		vk::Semaphore acquired;  // Signaled when its swapchain image can be drawn to
+		uint64_t value = 0;      // Graphics timeline value of its last submission
+	};
+	std::vector<FrameContext> m_frames;
+	uint32_t m_frame_index = 0;
+
+	//A run of the frame's commands on one queue; SubmitFrame submits them in order
+	struct QueueBatch
+	{
+		bool compute = false;
+		vk::CommandBuffer cmd;
+		uint32_t wait_batch = 0;            // Latest batch on the other queue it needs
+		vk::PipelineStageFlags wait_stages;  // Empty when it needs none
+		uint64_t value = 0;                  // Set by SubmitFrame
+	};
+	std::vector<QueueBatch> m_batches;
+
+	//Records the render graph's passes on worker threads
+	ParallelRecorder m_recorder;
+
+	//Signaled by every async compute submission
+	GpuTimeline m_compute_timeline;
+	std::vector<uint32_t> m_shared_families;  // Graphics and compute, with async compute
+	uint64_t m_compute_batch_count = 0;
+
+	//CPU time blocked at the start of each frame
+	float m_frame_wait_ms = 0.0f;    // Last frame, waiting for its context to come back
+	float m_acquire_wait_ms = 0.0f;  // Last frame, in acquireNextImageKHR
+	double m_total_wait_ms = 0.0;
+	uint64_t m_frame_count = 0;
 	vk::SwapchainKHR m_swapchain;
 	uint32_t m_swapchain_index = 0;
 	uint32_t       m_image_count = 0;
 	std::vector<vk::Image>     m_swapchain_images;  // from vkGetSwapchainImagesKHR
 	std::vector<vk::ImageView> m_image_views;
 	std::vector<vk::ImageMemoryBarrier> m_barriers;  // Filled in  VkImageMemoryBarrier objects
-	vk::Fence m_waitfence;
-	vk::Semaphore m_read_semaphore;
-	vk::Semaphore m_written_semaphore;
+	//Per swapchain image: presenting an image waits on its semaphore, which can't
+	//be signaled again until that image comes back from acquireNextImageKHR
+	std::vector<vk::Semaphore> m_written_semaphores;
 	vk::Extent2D window_size{ 0, 0 }; // Size of the window
 	ImageWrap m_depth_image;
+	//Size the scene is rendered at inside the window sized targets
+	vk::Extent2D m_render_extent{ 0, 0 };
+	//Picks m_render_extent's scale from the GPU frame time
+	DynamicResolution m_dynamic_resolution;
+	//Set by RequestResize and by an out of date or suboptimal swapchain;
+	//PrepareFrame recreates the swapchain before acquiring
+	bool m_resize_pending = false;
+
+	//Places every buffer and image in shared vk::DeviceMemory blocks
+	DeviceAllocator m_allocator;
+
+	//Staging ring and transfer queue used for all buffer and texture uploads
+	Uploader m_uploader;
+
+	//Lets the passes' transient render targets share memory
+	RenderTargetAliaser m_render_targets;
+
+	//Signaled by every graphics queue submission
+	GpuTimeline m_timeline;
+
+	//Resources released while submitted work may still use them
+	DeletionQueue m_deletion_queue;
+
+	//Startup work collected between BeginInitBatch and EndInitBatch
+	struct InitBatch
+	{
+		bool open = false;
+		bool batching = false;  // Copy of batch_startup for this phase
+		bool wait = true;       // The CPU waits for the phase's submissions
+		const char* phase = "";
+		vk::CommandBuffer cmd;  // Shared by every CreateInitCommandBuffer caller
+		uint32_t recordings = 0;
+		uint32_t submits = 0;
+		std::vector<std::function<void()>> on_complete;
+		TimerWrap timer;
+	} m_init_batch;
 	
 	//Resources required for the post processing render pass
 	vk::RenderPass m_post_proc_render_pass;
@@ -79,14 +172,82 @@ private:
 	vk::Pipeline m_post_proc_pipeline;
 	vk::PipelineLayout m_post_proc_pipeline_layout;
 	DescriptorWrap m_post_proc_desc;
+	const ImageWrap* p_post_input = nullptr;  // Binding 0 of m_post_proc_desc
 	
 	//Resources required for the scanline render pass
 
 	glm::mat4 m_prior_viewproj;
 
-	std::vector<std::unique_ptr<RenderPass>> render_passes;
+	//Owns the render passes; derives their barriers and skips the ones nothing needs
+	RenderGraph m_render_graph;
 
 	bool do_post_process;
+
+	//Set in CreateDevice when VK_EXT_mesh_shader task and mesh shaders are available
+	bool m_mesh_shader_supported = false;
+
+	//Weld and reorder model meshes for the vertex cache after import
+	bool optimize_meshes = true;
+
+	//Import each Assimp mesh as its own object/BLAS, placed by ObjInst node transforms
+	bool keep_model_meshes = true;
+
+	//How scene textures are stored on the GPU; block compression needs m_bc_supported
+	TextureCompression texture_compression = TextureCompression::Auto;
+
+	//How RGBA8 texture mips are made; block compressed textures always use the CPU chain
+	MipGeneration mip_generation = MipGeneration::Cpu;
+
+	//Also runs the mip path not taken (CPU build or GPU blit) for every texture and
+	//logs both timings; skips the texture cache
+	bool benchmark_mip_generation = false;
+
+	//Set in CreateDevice when BC1/BC7 images can be sampled
+	bool m_bc_supported = false;
+
+	//Frames the CPU may record ahead of the GPU (1 to 3; 1 waits for every frame)
+	uint32_t frames_in_flight = 2;
+
+	//Record startup transitions, uploads and mip chains into one command buffer per
+	//phase with a single wait; false submits and drains the queue for each one
+	bool batch_startup = true;
+
+	//Pack pass render targets with disjoint lifetimes onto the same memory;
+	//false gives every transient its own range of the allocation
+	bool alias_render_targets = true;
+
+	//Run the passes that allow it on a compute-only queue family, overlapping the
+	//graphics queue; without such a family everything stays on the graphics queue
+	bool async_compute = true;
+
+	//Worker threads that record the render passes into secondary command buffers
+	//(capped at the hardware's thread count); 0 records every pass on the main
+	//thread, straight into the frame's command buffer unless it's cached
+	uint32_t record_threads = 4;
+
+	//Render the scene smaller when the render graph's GPU time passes
+	//target_frame_ms, down to min_render_scale of each side. The targets keep
+	//the window size and the passes draw into their corner; UpscalePass and the
+	//post process stretch it back over the window.
+	bool dynamic_resolution = true;
+	float target_frame_ms = 16.6f;
+	float min_render_scale = 0.5f;
+
+	//Keeps each pass's recorded commands between frames and only records them
+	//again when the pass changes (RenderPass::IsStatic)
+	bool cache_pass_commands = true;
+
+	//Set in CreateDevice when VK_EXT_memory_budget is available
+	bool m_memory_budget_supported = false;
+
+	//Warn when a device local heap passes vram_warn_fraction of its budget: the
+	//driver's budget, capped at vram_budget_mb when that isn't 0
+	uint32_t vram_budget_mb = 0;
+	float vram_warn_fraction = 0.9f;
+	uint32_t m_frames_since_budget_check = 0;
+
+	//JSON memory report written after startup and from the GUI; empty skips the startup one
+	std::string memory_report_path = "memory_report.json";
 private:
 	//Creates and intializes the vk::Instance
 	void CreateInstance(bool api_dump);
@@ -111,13 +272,20 @@ private:
 	//Create and initialize the vk::SurfaceKHR
 	void GetSurface();
 
-	//Create and initialize the vk::CommandPool and vk::CommandBuffer
+	//Create and initialize the vk::CommandPool and a FrameContext per frame in flight
 	void CreateCommandPool();
 
 	//Create and initialize the vk::SwapchainKHR
 	void CreateSwapchain();
 	//Destroy the created vk::SwapchainKHR
 	void DestroySwapchain();
+	//Makes a swapchain at the new window size from the old one and resizes
+	//everything sized by the window, retiring what frames in flight still use.
+	//Pipelines, acceleration structures and textures are kept.
+	void RecreateSwapchain();
+	//Scales the window size by the dynamic resolution scale, rounded to even
+	//sizes so the half resolution passes cover it exactly
+	void UpdateRenderExtent();
 
 	//Create the depth image wrap (aka the depth buffer)
 	void CreateDepthResource();
@@ -141,12 +309,22 @@ private:
 
 	void CreateMatrixBuffer();
 
+	void CreateParamsBuffer();
+
 	void LoadModel(const std::string& filename, glm::mat4 transform);
 
+	//Uploads one mesh as an ObjData/ObjDesc pair and appends its emitters (in object space).
+	//materialAddress is the model's material buffer, which its meshes share.
+	void CreateObject(const ModelData& meshdata, uint32_t txtOffset, vk::DeviceAddress materialAddress,
+		std::vector<Emitter>& emitterList);
+
 	//Required for ImGUI
 	VkDescriptorPool m_imgui_descpool{ VK_NULL_HANDLE };
 	void InitGUI();
 
+	//Heap budgets and memory per owner
+	void DrawMemoryGUI();
+
 	void PrepareFrame();
 
 	void SubmitFrame();
@@ -158,10 +336,18 @@ public:
 	std::vector<ObjDesc>  m_objDesc;  // Device-addresses of those buffers
 	std::vector<ImageWrap>  m_objText;  // All textures of the scene
 	std::vector<ObjInst>  m_objInst;  // Instances paring an object and a transform
+	TextureRegistry m_textureRegistry;  // Maps texture files to their index in m_objText
 
 	BufferWrap m_objDescriptionBW;  // Device buffer of the OBJ descriptions
-	BufferWrap m_matrixBW;  // Device-Host of the camera matrices
+	std::vector<BufferWrap> m_materialBWs;  // Each model's 'Wavefront material' array, shared by its objects
+	BufferWrap m_matrixBW;  // Camera matrices, one host written slice per frame in flight
+	vk::DeviceSize m_matrix_stride = 0;  // Bytes between the slices
+	BufferWrap m_paramsBW;  // The passes' parameters, one host written slice per frame in flight
+	static const vk::DeviceSize m_params_stride = 4096;  // Bytes between the slices
+	vk::DeviceSize m_params_size = 0;  // Bytes of each slice handed out by AddPassParams
 	BufferWrap m_lightBW; //BufferWrap for the emitter data
+	BufferWrap m_lightAliasBW; //Alias table for sampling m_lightBW by emitter power
+	uint32_t m_emitterCount = 0;
 
 	void DestroyUniformData();
 public:
@@ -177,6 +363,12 @@ public:
 
 	vec2 GetWindowSize() const;
 	const vk::Extent2D& GetWindowExtent() const;
+	//Part of the window sized targets the scene is rendered at this frame; the
+	//window size unless dynamic resolution lowered it
+	vec2 GetRenderSize() const;
+	const vk::Extent2D& GetRenderExtent() const;
+	//Render size over window size, per axis
+	vec2 GetRenderScale() const;
 
 	uint32_t GetCurrentSwapchainIndex() const;
 	const std::vector<vk::ImageView>& GetSwapChainImageViews() const;
@@ -184,6 +376,40 @@ public:
 
 	const vk::Device& GetDeviceRef() const { return m_device; }
 	const vk::PhysicalDevice& GetPhysicalDeviceRef() const { return m_physical_device; }
+	bool SupportsMeshShaders() const { return m_mesh_shader_supported; }
+	Uploader& GetUploader() { return m_uploader; }
+	GpuTimeline& GetTimeline() { return m_timeline; }
+	DeviceAllocator& GetAllocator() { return m_allocator; }
+	RenderTargetAliaser& GetRenderTargets() { return m_render_targets; }
+
+	bool HasAsyncCompute() const { return !m_shared_families.empty(); }
+	//Families storage images are shared between; empty without async compute
+	const std::vector<uint32_t>& GetSharedQueueFamilies() const { return m_shared_families; }
+	//Ends the batch being recorded and begins one on the graphics or compute
+	//queue; GetCommandBuffer records into it from then on. Returns its index.
+	uint32_t BeginBatch(bool compute);
+	//The batch being recorded waits for batch, which is on the other queue,
+	//before its stages start
+	void WaitForBatch(uint32_t batch, vk::PipelineStageFlags stages);
+	uint32_t GetBatch() const { return static_cast<uint32_t>(m_batches.size() - 1); }
+	//Null when the passes are recorded on the main thread
+	ParallelRecorder* GetRecorder() { return record_threads ? &m_recorder : nullptr; }
+	uint32_t GetFrameIndex() const { return m_frame_index; }
+	uint32_t GetFrameCount() const { return static_cast<uint32_t>(m_frames.size()); }
+	bool CachesPassCommands() const { return cache_pass_commands; }
+	uint32_t GetQueueFamily(bool compute) const { return compute ? m_compute_queue_index : m_graphics_queue_index; }
+
+	//Destroys the resource once every submission that may use it has finished,
+	//without waiting; use instead of destroy() for anything freed after startup
+	void Retire(BufferWrap&& buffer) { m_deletion_queue.Retire(std::move(buffer)); }
+	void Retire(ImageWrap&& image) { m_deletion_queue.Retire(std::move(image)); }
+	void Retire(std::function<void()> release) { m_deletion_queue.Retire(std::move(release)); }
+	//Gives the descriptor a fresh set (DescriptorWrap::renew) and retires the
+	//old one; for rewriting a set that frames in flight may have bound
+	void RenewDescriptor(DescriptorWrap& descriptor);
+
+	//The window's size changed; the swapchain is recreated before the next frame
+	void RequestResize() { m_resize_pending = true; }
 
 	Camera* GetCamera();
 
@@ -195,6 +421,11 @@ public:
 
 	vk::Sampler CreateTextureSampler();
 	ImageWrap CreateTextureImage(std::string fileName);
+	//Decodes all the images on worker threads and uploads them in a single submission
+	//fileContents and contentHashes, when given, hold each file's bytes and HashBytes of them,
+	//so the file is neither read nor hashed again for the decode and the texture cache
+	std::vector<ImageWrap> CreateTextureImages(const std::vector<std::string>& fileNames,
+		std::vector<std::string> fileContents = {}, std::vector<uint64_t> contentHashes = {});
 
 	void TransitionImageLayout(vk::Image image,
 		vk::Format format,
@@ -228,17 +459,61 @@ public:
 	//Create a temporary command buffer
 	vk::CommandBuffer CreateTempCommandBuffer();
 
-	//Submit a command through a temporary command buffer
+	//Starts a startup phase. Until EndInitBatch, init command buffers are one shared
+	//command buffer and uploads are not waited for. Without wait nothing in the phase
+	//blocks the CPU, for work done between frames.
+	void BeginInitBatch(const char* phase, bool wait = true);
+	//Submits the phase's work, waits for it unless the phase doesn't, and logs the phase
+	//time. The completion callbacks run once the returned timeline value is reached.
+	uint64_t EndInitBatch();
+
+	//Like Create/SubmitTempCommandBuffer, but inside an init batch the commands go into
+	//the batch's command buffer and nothing is submitted until EndInitBatch.
+	//Callers must not need the results before then (see RunAfterInit).
+	vk::CommandBuffer CreateInitCommandBuffer();
+	void SubmitInitCommandBuffer(vk::CommandBuffer cmd_buffer);
+	//Runs fn once the work recorded so far has finished (right away outside a batch)
+	void RunAfterInit(std::function<void()> fn);
+
+	//Submit a command through a temporary command buffer.
+	//Acquires pending uploads ahead of cmd_buffer; the GPU waits for them, not the CPU.
+	//Blocks until cmd_buffer is done; for startup only.
 	void SubmitTempCommandBuffer(vk::CommandBuffer cmd_buffer);
+	//Same without waiting. Returns the timeline value the submission signals; the command
+	//buffers are freed and the batch's callbacks run from the deletion queue once it passes.
+	uint64_t QueueTempCommandBuffer(vk::CommandBuffer cmd_buffer);
 
+	//shared makes the buffer concurrent over GetSharedQueueFamilies, for buffers
+	//both the graphics and the async compute queue read every frame
 	BufferWrap CreateBufferWrap(vk::DeviceSize size, vk::BufferUsageFlags usage,
-		vk::MemoryPropertyFlags properties);
-
-	void CopyBuffer(vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size);
+		vk::MemoryPropertyFlags properties, bool shared = false);
 
 	const vk::CommandBuffer& GetCommandBuffer() const;
+	//Dynamic offset of the current frame's slice of the camera matrices
+	uint32_t GetMatrixOffset() const { return static_cast<uint32_t>(m_matrix_stride * m_frame_index); }
+
+	//Reserves a region of every frame's slice of the parameter buffer for a
+	//pass's parameters and returns its offset in the slice. Passes bind it as a
+	//dynamic storage buffer, so their recorded commands don't change when the
+	//parameters do.
+	uint32_t AddPassParams(vk::DeviceSize size);
+	const BufferWrap& GetParamsBuffer() const { return m_paramsBW; }
+	//Dynamic offset of region in the current frame's slice
+	uint32_t GetParamsOffset(uint32_t region) const {
+		return static_cast<uint32_t>(m_params_stride * m_frame_index + region);
+	}
+	//Copies params into region of the current frame's slice
+	template <typename T>
+	void WriteParams(uint32_t region, const T& params) {
+		memcpy(m_paramsBW.Mapped() + GetParamsOffset(region), &params, sizeof(T));
+	}
 
-	void CommandCopyImage(const ImageWrap& src, const ImageWrap& dst) const;
+	//Copies in eGeneral once the after stages are done with src and dst
+	void CommandCopyImage(const ImageWrap& src, const ImageWrap& dst, vk::PipelineStageFlags after) const;
+	//Sets the viewport and scissor to the extent's corner of the target. The
+	//graphics pipelines take them as dynamic state so they survive a resize and
+	//a change of render size.
+	void CommandSetViewport(const vk::Extent2D& extent) const;
 };
 
 vk::AccessFlags AccessFlagsForImageLayout(vk::ImageLayout layout);
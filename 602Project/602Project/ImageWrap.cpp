@@ -4,9 +4,9 @@
 ImageWrap::ImageWrap(uint32_t width, uint32_t height, 
 	vk::Format format, vk::ImageUsageFlags usage, vk::ImageAspectFlags aspect,
 	vk::MemoryPropertyFlags properties, uint8_t mipLevels,
-    Graphics* gfx) : p_gfx(gfx), image_size(width, height),
+    Graphics* gfx, bool bind_memory) : p_gfx(gfx), image_size(width, height),
     image_layout(vk::ImageLayout::eUndefined), image_format(format), image_aspect(aspect),
-    image_view(VK_NULL_HANDLE), sampler(VK_NULL_HANDLE), mip_levels(mipLevels) {
+    image_usage(usage), memory_properties(properties), image_view(VK_NULL_HANDLE), sampler(VK_NULL_HANDLE), mip_levels(mipLevels) {
     vk::ImageCreateInfo imageCreateInfo(vk::ImageCreateFlags(),
         vk::ImageType::e2D,
         format,
@@ -16,29 +16,82 @@ ImageWrap::ImageWrap(uint32_t width, uint32_t height,
         vk::SampleCountFlagBits::e1,
         vk::ImageTiling::eOptimal,
         usage);
+    // Render targets may be used on the async compute queue as well; sharing
+    // them saves ownership transfers between the queues. Uploaded textures stay
+    // exclusive for the Uploader's transfers.
+    const std::vector<uint32_t>& families = gfx->GetSharedQueueFamilies();
+    if ((usage & vk::ImageUsageFlagBits::eStorage) && families.size() > 1)
+        imageCreateInfo.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(families);
     
     image = gfx->GetDeviceRef().createImage(imageCreateInfo);
+    if (!bind_memory)
+        return;
+    allocation = gfx->GetAllocator().AllocateImage(image, properties);
+    CreateView();
+}
 
-    vk::PhysicalDeviceMemoryProperties memoryProperties = gfx->GetPhysicalDeviceRef().getMemoryProperties();
-    vk::MemoryRequirements memoryRequirements = gfx->GetDeviceRef().getImageMemoryRequirements(image);
-    uint32_t typeIndex = gfx->FindMemoryType(memoryRequirements.memoryTypeBits, properties);
-
-    memory = gfx->GetDeviceRef().allocateMemory(
-        vk::MemoryAllocateInfo(memoryRequirements.size, typeIndex));
-
-    gfx->GetDeviceRef().bindImageMemory(image, memory, 0);
-
-    image_view = gfx->GetDeviceRef().createImageView(vk::ImageViewCreateInfo(
+void ImageWrap::CreateView() {
+    // Only sampled textures see their whole mip chain. Attachments and storage
+    // images need views of a single level.
+    const vk::ImageUsageFlags single_level = vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    uint32_t view_levels = (image_usage & single_level) ? 1 : mip_levels;
+    image_view = p_gfx->GetDeviceRef().createImageView(vk::ImageViewCreateInfo(
         vk::ImageViewCreateFlags(),
         image,
         vk::ImageViewType::e2D,
-        format, {},
-        { aspect, 0, 1, 0, 1 }));
+        image_format, {},
+        { image_aspect, 0, view_levels, 0, 1 }));
+}
+
+ImageWrap::ImageWrap(ImageWrap&& other) noexcept {
+    *this = std::move(other);
+}
+
+ImageWrap& ImageWrap::operator=(ImageWrap&& other) noexcept {
+    if (this == &other)
+        return *this;
+    if (image || image_view || sampler)
+        destroy(p_gfx->GetDeviceRef());
+
+    image = other.image;
+    allocation = other.allocation;
+    sampler = other.sampler;
+    image_view = other.image_view;
+    image_layout = other.image_layout;
+    image_aspect = other.image_aspect;
+    image_usage = other.image_usage;
+    memory_properties = other.memory_properties;
+    image_format = other.image_format;
+    image_size = other.image_size;
+    mip_levels = other.mip_levels;
+    p_gfx = other.p_gfx;
+
+    other.image = nullptr;
+    other.allocation = DeviceAllocation();
+    other.sampler = nullptr;
+    other.image_view = nullptr;
+    return *this;
+}
+
+ImageWrap::~ImageWrap() {
+    if (image || image_view || sampler)
+        destroy(p_gfx->GetDeviceRef());
+}
+
+void ImageWrap::BindMemory(vk::DeviceMemory memory, vk::DeviceSize offset) {
+    // The memory belongs to whoever aliases the image, so allocation stays empty
+    p_gfx->GetDeviceRef().bindImageMemory(image, memory, offset);
+    CreateView();
 }
 
 void ImageWrap::TransitionImageLayout(vk::ImageLayout new_layout) {
-    vk::CommandBuffer commandBuffer = p_gfx->CreateTempCommandBuffer();
+    vk::CommandBuffer commandBuffer = p_gfx->CreateInitCommandBuffer();
+    TransitionImageLayout(commandBuffer, new_layout);
+    p_gfx->SubmitInitCommandBuffer(commandBuffer);
+}
 
+void ImageWrap::TransitionImageLayout(vk::CommandBuffer commandBuffer, vk::ImageLayout new_layout) {
     vk::ImageMemoryBarrier barrier;
     barrier.setOldLayout(image_layout);
     barrier.setNewLayout(new_layout);
@@ -59,16 +112,23 @@ void ImageWrap::TransitionImageLayout(vk::ImageLayout new_layout) {
     vk::PipelineStageFlags sourceStage = vk::PipelineStageFlagBits::eTopOfPipe;
     vk::PipelineStageFlags destinationStage = vk::PipelineStageFlagBits::eTransfer;
 
+    // Finishing an upload: make the copies visible to shader reads
+    if (image_layout == vk::ImageLayout::eTransferDstOptimal &&
+        new_layout == vk::ImageLayout::eShaderReadOnlyOptimal) {
+        barrier.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+        barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+        sourceStage = vk::PipelineStageFlagBits::eTransfer;
+        destinationStage = vk::PipelineStageFlagBits::eFragmentShader;
+    }
+
     commandBuffer.pipelineBarrier(sourceStage, destinationStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
-    p_gfx->SubmitTempCommandBuffer(commandBuffer);
     image_layout = new_layout;
 }
 
-void ImageWrap::CopyFromBuffer(vk::Buffer buffer, uint32_t width, uint32_t height) {
-    vk::CommandBuffer commandBuffer = p_gfx->CreateTempCommandBuffer();
-
+void ImageWrap::CopyFromBuffer(vk::CommandBuffer commandBuffer, vk::Buffer buffer,
+    uint32_t width, uint32_t height, vk::DeviceSize offset) {
     vk::BufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = image_aspect;
@@ -79,19 +139,27 @@ void ImageWrap::CopyFromBuffer(vk::Buffer buffer, uint32_t width, uint32_t heigh
     region.imageExtent = vk::Extent3D(width, height, 1);
 
     commandBuffer.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+}
 
-    p_gfx->SubmitTempCommandBuffer(commandBuffer);
+void ImageWrap::CopyFromBuffer(vk::CommandBuffer commandBuffer, vk::Buffer buffer,
+    const std::vector<vk::BufferImageCopy>& regions) {
+    commandBuffer.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal,
+        static_cast<uint32_t>(regions.size()), regions.data());
 }
 
 void ImageWrap::GenerateMipMaps() {
+    vk::CommandBuffer commandBuffer = p_gfx->CreateInitCommandBuffer();
+    GenerateMipMaps(commandBuffer);
+    p_gfx->SubmitInitCommandBuffer(commandBuffer);
+}
+
+void ImageWrap::GenerateMipMaps(vk::CommandBuffer commandBuffer) {
     // Check if image format supports linear blitting
     vk::FormatProperties formatProperties = p_gfx->GetPhysicalDeviceRef().getFormatProperties(image_format);
     if (!(formatProperties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImageFilterLinear)) {
         throw std::runtime_error("texture image format does not support linear blitting!");
     }
 
-    vk::CommandBuffer commandBuffer = p_gfx->CreateTempCommandBuffer();
-
     vk::ImageMemoryBarrier barrier;
     barrier.setImage(image);
     barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
@@ -169,8 +237,6 @@ void ImageWrap::GenerateMipMaps() {
     commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlags(),
         0, nullptr, 0, nullptr, 1, &barrier);
 
-    p_gfx->SubmitTempCommandBuffer(commandBuffer);
-
     image_layout = vk::ImageLayout::eShaderReadOnlyOptimal;
 }
 
@@ -190,10 +256,29 @@ void ImageWrap::CreateTextureSampler() {
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = vk::CompareOp::eAlways;
     samplerInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(mip_levels);
 
     sampler = p_gfx->m_device.createSampler(samplerInfo);
 }
 
+void ImageWrap::Resize(uint32_t width, uint32_t height) {
+    // Transients have no allocation of their own, only the aliaser's memory
+    const bool bound = static_cast<bool>(allocation.memory);
+    ImageWrap resized(width, height, image_format, image_usage, image_aspect,
+        memory_properties, mip_levels, p_gfx, bound);
+    if (sampler)
+        resized.CreateTextureSampler();
+    if (bound && image_layout != vk::ImageLayout::eUndefined)
+        resized.TransitionImageLayout(image_layout);
+    else
+        resized.SetLayout(image_layout);
+
+    // Frames in flight may still use the old image
+    p_gfx->Retire(std::move(*this));
+    *this = std::move(resized);
+}
+
 vk::ImageView ImageWrap::GetImageView() const {
     return image_view;
 }
@@ -205,3 +290,7 @@ const vk::Format& ImageWrap::GetFormat() const {
 vk::Extent2D ImageWrap::GetImageSize() const {
     return image_size;
 }
+
+uint8_t ImageWrap::GetMipLevels() const {
+    return mip_levels;
+}
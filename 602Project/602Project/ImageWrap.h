@@ -2,46 +2,83 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include "DeviceAllocator.h"
+
 class Graphics;
 
 /*
-* A wrapper class around some related vulkan structures
+* A wrapper class around some related vulkan structures.
+* Move-only; the image, view, sampler and memory are destroyed with the
+* wrapper, so one the GPU may still be using has to go to Graphics::Retire.
 */
 class ImageWrap {
 private:
     vk::Image               image;
-    vk::DeviceMemory        memory;
+    DeviceAllocation        allocation;
     vk::Sampler             sampler;
     vk::ImageView           image_view;
-    vk::ImageLayout         image_layout;
+    vk::ImageLayout         image_layout = vk::ImageLayout::eUndefined;
     vk::ImageAspectFlags    image_aspect;
-    vk::Format              image_format;
+    vk::ImageUsageFlags     image_usage;
+    vk::MemoryPropertyFlags memory_properties;
+    vk::Format              image_format = vk::Format::eUndefined;
     vk::Extent2D            image_size;
-    uint8_t mip_levels;
+    uint8_t mip_levels = 0;
+
+    Graphics* p_gfx = nullptr;
 
-    Graphics* p_gfx;
+    //All mip levels for sampled textures, level 0 for anything also used as
+    //an attachment or storage image
+    void CreateView();
 public:
     ImageWrap() = default;
+    ImageWrap(const ImageWrap&) = delete;
+    ImageWrap& operator=(const ImageWrap&) = delete;
+    ImageWrap(ImageWrap&& other) noexcept;
+    //Destroys what this wrapper held before taking over other's image
+    ImageWrap& operator=(ImageWrap&& other) noexcept;
+    ~ImageWrap();
     ImageWrap(uint32_t width, uint32_t height,
         vk::Format format,
         vk::ImageUsageFlags usage,
         vk::ImageAspectFlags aspect,
         vk::MemoryPropertyFlags properties, uint8_t mipLevels,
-        Graphics* gfx);
+        Graphics* gfx, bool bind_memory = true);
+
+    //For images made with bind_memory = false (aliased render targets): binds
+    //the image at the given place and creates its view
+    void BindMemory(vk::DeviceMemory memory, vk::DeviceSize offset);
 
     void TransitionImageLayout(vk::ImageLayout new_layout);
+    //Records the transition into an existing command buffer instead of submitting it
+    void TransitionImageLayout(vk::CommandBuffer commandBuffer, vk::ImageLayout new_layout);
 
-    void CopyFromBuffer(vk::Buffer, uint32_t width, uint32_t height);
+    void CopyFromBuffer(vk::CommandBuffer commandBuffer, vk::Buffer,
+        uint32_t width, uint32_t height, vk::DeviceSize offset = 0);
+    //Copies several regions (e.g. every mip level) in one command
+    void CopyFromBuffer(vk::CommandBuffer commandBuffer, vk::Buffer,
+        const std::vector<vk::BufferImageCopy>& regions);
 
     void GenerateMipMaps();
+    void GenerateMipMaps(vk::CommandBuffer commandBuffer);
 
     void CreateTextureSampler();
 
+    //Replaces the image with one of the new size and otherwise the same
+    //settings, retiring the old one. A bound image gets memory, its sampler and
+    //its layout back; a transient stays unbound for the aliaser to place.
+    //Descriptors and framebuffers that held the old view have to be remade.
+    void Resize(uint32_t width, uint32_t height);
+
+    //Destroys everything now; safe to call on an empty wrapper
     void destroy(const vk::Device& device) {
         device.destroyImage(image);
         device.destroyImageView(image_view);
-        device.freeMemory(memory);
+        allocation.Free();
         device.destroySampler(sampler);
+        image = nullptr;
+        image_view = nullptr;
+        sampler = nullptr;
     }
 
     vk::DescriptorImageInfo Descriptor() const {
@@ -57,5 +94,14 @@ public:
     const vk::Format& GetFormat() const;
 
     vk::Extent2D GetImageSize() const;
+
+    uint8_t GetMipLevels() const;
+
+    vk::ImageAspectFlags GetAspect() const { return image_aspect; }
+
+    vk::ImageUsageFlags GetUsage() const { return image_usage; }
+
+    //Records a layout change made by barriers outside this class (e.g. by the Uploader)
+    void SetLayout(vk::ImageLayout layout) { image_layout = layout; }
 };
 
@@ -9,11 +9,18 @@ void LightingPass::SetupBuffer() {
 
     m_velocity_buffer.CreateTextureSampler();
     m_velocity_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+
+    m_depth_buffer.CreateTextureSampler();
+    m_depth_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+
+    p_gfx->GetRenderTargets().AddPersistent(m_buffer, TargetKind::SceneColor);
+    p_gfx->GetRenderTargets().AddPersistent(m_velocity_buffer, TargetKind::Velocity);
+    p_gfx->GetRenderTargets().AddPersistent(m_depth_buffer, TargetKind::Depth);
 }
 
 void LightingPass::SetupAttachments() {
     vk::AttachmentDescription color_attachment;
-    color_attachment.setFormat(vk::Format::eR32G32B32A32Sfloat);
+    color_attachment.setFormat(m_buffer.GetFormat());
     color_attachment.setSamples(vk::SampleCountFlagBits::e1);
     color_attachment.setLoadOp(vk::AttachmentLoadOp::eClear);
     color_attachment.setStoreOp(vk::AttachmentStoreOp::eStore);
@@ -24,7 +31,7 @@ void LightingPass::SetupAttachments() {
     m_framebuffer_attachments.push_back(color_attachment);
 
     vk::AttachmentDescription color_velo_attachment;
-    color_velo_attachment.setFormat(vk::Format::eR32G32B32A32Sfloat);
+    color_velo_attachment.setFormat(m_velocity_buffer.GetFormat());
     color_velo_attachment.setSamples(vk::SampleCountFlagBits::e1);
     color_velo_attachment.setLoadOp(vk::AttachmentLoadOp::eClear);
     color_velo_attachment.setStoreOp(vk::AttachmentStoreOp::eStore);
@@ -34,6 +41,17 @@ void LightingPass::SetupAttachments() {
     color_velo_attachment.setFinalLayout(vk::ImageLayout::eGeneral);
     m_framebuffer_attachments.push_back(color_velo_attachment);
 
+    vk::AttachmentDescription color_depth_attachment;
+    color_depth_attachment.setFormat(m_depth_buffer.GetFormat());
+    color_depth_attachment.setSamples(vk::SampleCountFlagBits::e1);
+    color_depth_attachment.setLoadOp(vk::AttachmentLoadOp::eClear);
+    color_depth_attachment.setStoreOp(vk::AttachmentStoreOp::eStore);
+    color_depth_attachment.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare);
+    color_depth_attachment.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare);
+    color_depth_attachment.setInitialLayout(vk::ImageLayout::eGeneral);
+    color_depth_attachment.setFinalLayout(vk::ImageLayout::eGeneral);
+    m_framebuffer_attachments.push_back(color_depth_attachment);
+
     vk::AttachmentDescription depth_attachment;
     depth_attachment.setFormat(p_gfx->GetDepthBuffer().GetFormat());
     depth_attachment.setSamples(vk::SampleCountFlagBits::e1);
@@ -55,15 +73,20 @@ void LightingPass::SetupRenderPass() {
     velo_attachment_ref.setAttachment(1);
     velo_attachment_ref.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
 
-    std::array<vk::AttachmentReference, 2> color_attachment_refs{ color_attachment_ref, velo_attachment_ref };
+    vk::AttachmentReference linear_depth_attachment_ref;
+    linear_depth_attachment_ref.setAttachment(2);
+    linear_depth_attachment_ref.setLayout(vk::ImageLayout::eColorAttachmentOptimal);
+
+    std::array<vk::AttachmentReference, 3> color_attachment_refs{
+        color_attachment_ref, velo_attachment_ref, linear_depth_attachment_ref };
 
     vk::AttachmentReference depth_attachment_ref;
-    depth_attachment_ref.setAttachment(2);
+    depth_attachment_ref.setAttachment(3);
     depth_attachment_ref.setLayout(vk::ImageLayout::eDepthStencilAttachmentOptimal);
 
     vk::SubpassDescription subpass;
     subpass.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics);
-    subpass.setColorAttachmentCount(2);
+    subpass.setColorAttachmentCount(static_cast<uint32_t>(color_attachment_refs.size()));
     subpass.setPColorAttachments(color_attachment_refs.data());
     subpass.setPDepthStencilAttachment(&depth_attachment_ref);
 
@@ -97,6 +120,7 @@ void LightingPass::SetupFramebuffer() {
     std::vector<vk::ImageView> attachments = { 
         m_buffer.GetImageView(), 
         m_velocity_buffer.GetImageView(),
+        m_depth_buffer.GetImageView(),
         p_gfx->GetDepthBuffer().GetImageView()};
 
     vk::FramebufferCreateInfo info;
@@ -116,31 +140,45 @@ void LightingPass::SetupFramebuffer() {
 void LightingPass::SetupDescriptor() {
     auto texture_count = static_cast<uint32_t>(p_gfx->m_objText.size());
 
+    vk::ShaderStageFlags mesh_stages;
+    if (p_gfx->SupportsMeshShaders())
+        mesh_stages = vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+
     auto device_ref = p_gfx->GetDeviceRef();
     m_descriptor.setBindings(device_ref, {
-            {ScBindings::eMatrices, vk::DescriptorType::eUniformBuffer, 1,
+            {ScBindings::eMatrices, vk::DescriptorType::eUniformBufferDynamic, 1,
                 vk::ShaderStageFlagBits::eVertex 
                 | vk::ShaderStageFlagBits::eRaygenKHR 
-                | vk::ShaderStageFlagBits::eClosestHitKHR},
+                | vk::ShaderStageFlagBits::eClosestHitKHR
+                | mesh_stages},
             {ScBindings::eObjDescs, vk::DescriptorType::eStorageBuffer, 1,
                 vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment
-                | vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR},
+                | vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR
+                | mesh_stages},
             {ScBindings::eTextures, vk::DescriptorType::eCombinedImageSampler, texture_count,
                 vk::ShaderStageFlagBits::eFragment
                 | vk::ShaderStageFlagBits::eRaygenKHR
-                | vk::ShaderStageFlagBits::eClosestHitKHR}
+                | vk::ShaderStageFlagBits::eClosestHitKHR},
+            {ScBindings::eRasterParams, vk::DescriptorType::eStorageBufferDynamic, 1,
+                vk::ShaderStageFlagBits::eFragment
+                | mesh_stages}
         });
 
-    m_descriptor.write(device_ref, ScBindings::eMatrices, p_gfx->m_matrixBW.buffer);
+    m_descriptor.write(device_ref, ScBindings::eMatrices, p_gfx->m_matrixBW.buffer, sizeof(MatrixUniforms));
     m_descriptor.write(device_ref, ScBindings::eObjDescs, p_gfx->m_objDescriptionBW.buffer);
     m_descriptor.write(device_ref, ScBindings::eTextures, p_gfx->m_objText);
+    m_descriptor.write(device_ref, ScBindings::eRasterParams, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantRaster));
 }
 
 void LightingPass::SetupPipeline() {
+    m_push_stages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment;
+    if (p_gfx->SupportsMeshShaders())
+        m_push_stages |= vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT;
+
     vk::PushConstantRange pushConstantRanges = {
-       vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 
+       m_push_stages, 
        0, 
-       sizeof(PushConstantRaster) };
+       sizeof(PushConstantInstance) };
 
     // Creating the Pipeline Layout
     vk::PipelineLayoutCreateInfo createInfo;
@@ -168,12 +206,25 @@ void LightingPass::SetupPipeline() {
 
     vk::PipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-    vk::VertexInputBindingDescription bindingDescription(0, sizeof(Vertex), vk::VertexInputRate::eVertex);
+    vk::VertexInputBindingDescription bindingDescription(0, sizeof(GpuVertex), vk::VertexInputRate::eVertex);
 
+    // Attribute formats follow the GpuVertex layout; scanline.vert decodes the rest
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
+    std::vector<vk::VertexInputAttributeDescription> attributeDescriptions{
+        {0, 0, vk::Format::eR32G32B32Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, pos))},
+        {1, 0, vk::Format::eR32G32B32Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, nrm))},
+        {2, 0, vk::Format::eR32G32Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, texCoord))} };
+#elif VERTEX_LAYOUT == VERTEX_LAYOUT_PACKED
+    std::vector<vk::VertexInputAttributeDescription> attributeDescriptions{
+        {0, 0, vk::Format::eR32G32B32Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, pos))},
+        {1, 0, vk::Format::eR16G16Snorm, static_cast<uint32_t>(offsetof(GpuVertex, nrm))},
+        {2, 0, vk::Format::eR16G16Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, texCoord))} };
+#else
     std::vector<vk::VertexInputAttributeDescription> attributeDescriptions{
-        {0, 0, vk::Format::eR32G32B32Sfloat, static_cast<uint32_t>(offsetof(Vertex, pos))},
-        {1, 0, vk::Format::eR32G32B32Sfloat, static_cast<uint32_t>(offsetof(Vertex, nrm))},
-        {2, 0, vk::Format::eR32G32Sfloat, static_cast<uint32_t>(offsetof(Vertex, texCoord))} };
+        {0, 0, vk::Format::eR16G16B16A16Snorm, static_cast<uint32_t>(offsetof(GpuVertex, posXY))},
+        {1, 0, vk::Format::eR16G16Snorm, static_cast<uint32_t>(offsetof(GpuVertex, nrm))},
+        {2, 0, vk::Format::eR16G16Sfloat, static_cast<uint32_t>(offsetof(GpuVertex, texCoord))} };
+#endif
 
 
     vk::PipelineVertexInputStateCreateInfo vertexInputInfo;
@@ -187,23 +238,14 @@ void LightingPass::SetupPipeline() {
     inputAssembly.setTopology(vk::PrimitiveTopology::eTriangleList);
     inputAssembly.setPrimitiveRestartEnable(VK_FALSE);
 
-    vk::Viewport viewport;
-    viewport.setX(0.0f);
-    viewport.setY(0.0f);
-    viewport.setWidth((float)p_gfx->GetWindowSize().x);
-    viewport.setHeight((float)p_gfx->GetWindowSize().y);
-    viewport.setMinDepth(0.0f);
-    viewport.setMaxDepth(1.0f);
-
-    vk::Rect2D scissor;
-    scissor.setOffset({ 0, 0 });
-    scissor.setExtent(p_gfx->GetWindowExtent());
-
+    // Set in Render (Graphics::CommandSetViewport), so a resize keeps both pipelines
     vk::PipelineViewportStateCreateInfo viewportState;
     viewportState.setViewportCount(1);
-    viewportState.setPViewports(&viewport);
     viewportState.setScissorCount(1);
-    viewportState.setPScissors(&scissor);
+
+    std::array<vk::DynamicState, 2> dynamic_states = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+    vk::PipelineDynamicStateCreateInfo dynamicState;
+    dynamicState.setDynamicStates(dynamic_states);
 
     vk::PipelineRasterizationStateCreateInfo rasterizer;
     rasterizer.setDepthClampEnable(VK_FALSE);
@@ -233,12 +275,17 @@ void LightingPass::SetupPipeline() {
     velo_blend_attachment.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA);
     velo_blend_attachment.setBlendEnable(VK_FALSE);
 
-    std::array< vk::PipelineColorBlendAttachmentState, 2> blend_attachments{ colorBlendAttachment, velo_blend_attachment };
+    vk::PipelineColorBlendAttachmentState depth_blend_attachment;
+    depth_blend_attachment.setColorWriteMask(vk::ColorComponentFlagBits::eR);
+    depth_blend_attachment.setBlendEnable(VK_FALSE);
+
+    std::array< vk::PipelineColorBlendAttachmentState, 3> blend_attachments{
+        colorBlendAttachment, velo_blend_attachment, depth_blend_attachment };
 
     vk::PipelineColorBlendStateCreateInfo colorBlending;
     colorBlending.setLogicOpEnable(VK_FALSE);
     colorBlending.setLogicOp(vk::LogicOp::eCopy);
-    colorBlending.setAttachmentCount(2);
+    colorBlending.setAttachmentCount(static_cast<uint32_t>(blend_attachments.size()));
     colorBlending.setPAttachments(blend_attachments.data());
     colorBlending.setBlendConstants({ 0.0f , 0.0f , 0.0f , 0.0f });
 
@@ -252,6 +299,7 @@ void LightingPass::SetupPipeline() {
     pipelineInfo.setPMultisampleState(&multisampling);
     pipelineInfo.setPDepthStencilState(&depthStencil);
     pipelineInfo.setPColorBlendState(&colorBlending);
+    pipelineInfo.setPDynamicState(&dynamicState);
     pipelineInfo.setLayout(m_pipeline_layout);
     pipelineInfo.setRenderPass(m_render_pass);
     pipelineInfo.setSubpass(0);
@@ -262,6 +310,44 @@ void LightingPass::SetupPipeline() {
         throw std::runtime_error("failed to create scanline pipeline!");
     }
 
+    // Same state for the mesh shader pipeline; the task and mesh stages
+    // replace the vertex input and assembly stages.
+    if (p_gfx->SupportsMeshShaders()) {
+        vk::ShaderModule taskShaderModule =
+            p_gfx->CreateShaderModule(LoadFileIntoString("spv/scanline.task.spv"));
+        vk::ShaderModule meshShaderModule =
+            p_gfx->CreateShaderModule(LoadFileIntoString("spv/scanline.mesh.spv"));
+
+        vk::PipelineShaderStageCreateInfo taskShaderStageInfo;
+        taskShaderStageInfo.setStage(vk::ShaderStageFlagBits::eTaskEXT);
+        taskShaderStageInfo.setModule(taskShaderModule);
+        taskShaderStageInfo.setPName("main");
+
+        vk::PipelineShaderStageCreateInfo meshShaderStageInfo;
+        meshShaderStageInfo.setStage(vk::ShaderStageFlagBits::eMeshEXT);
+        meshShaderStageInfo.setModule(meshShaderModule);
+        meshShaderStageInfo.setPName("main");
+
+        vk::PipelineShaderStageCreateInfo meshShaderStages[] = {
+            taskShaderStageInfo, meshShaderStageInfo, fragShaderStageInfo };
+
+        pipelineInfo.setStageCount(3);
+        pipelineInfo.setPStages(meshShaderStages);
+        pipelineInfo.setPVertexInputState(nullptr);
+        pipelineInfo.setPInputAssemblyState(nullptr);
+
+        if (p_gfx->GetDeviceRef().createGraphicsPipelines(
+            VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_mesh_pipeline) != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to create scanline mesh shader pipeline!");
+        }
+
+        m_draw_mesh_tasks = reinterpret_cast<PFN_vkCmdDrawMeshTasksEXT>(
+            vkGetDeviceProcAddr(p_gfx->GetDeviceRef(), "vkCmdDrawMeshTasksEXT"));
+
+        p_gfx->GetDeviceRef().destroyShaderModule(taskShaderModule);
+        p_gfx->GetDeviceRef().destroyShaderModule(meshShaderModule);
+    }
+
     // Done with the temporary spv shader modules.
     p_gfx->GetDeviceRef().destroyShaderModule(fragShaderModule);
     p_gfx->GetDeviceRef().destroyShaderModule(vertShaderModule);
@@ -269,9 +355,8 @@ void LightingPass::SetupPipeline() {
 }
 
 LightingPass::LightingPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
-    buffer_mip_levels(std::floor(std::log2(std::max(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y))) + 1),
     m_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::SceneColor),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -279,9 +364,19 @@ LightingPass::LightingPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        buffer_mip_levels, p_gfx),
+        1, p_gfx),
     m_velocity_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Velocity),
+        vk::ImageUsageFlagBits::eTransferDst |
+        vk::ImageUsageFlagBits::eSampled |
+        vk::ImageUsageFlagBits::eStorage |
+        vk::ImageUsageFlagBits::eTransferSrc |
+        vk::ImageUsageFlagBits::eColorAttachment,
+        vk::ImageAspectFlagBits::eColor,
+        vk::MemoryPropertyFlagBits::eDeviceLocal,
+        1, p_gfx),
+    m_depth_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
+        TargetFormat(TargetKind::Depth),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -289,7 +384,19 @@ LightingPass::LightingPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx) {
+        1, p_gfx),
+    use_mesh_shaders(p_gfx->SupportsMeshShaders()) {
+
+    vk::ClearColorValue colorVal;
+    colorVal.setFloat32({ 0.0f,0,0,1 });
+    vk::ClearColorValue depthVal;
+    depthVal.setFloat32({ 1.0f,0,0,0 });
+    m_clear_values[0].setColor(colorVal);
+    m_clear_values[1].setColor(colorVal);
+    m_clear_values[2].setColor(depthVal);
+    m_clear_values[3].setDepthStencil(vk::ClearDepthStencilValue({ 1.0f, 0 }));
+
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantRaster));
 
     SetupBuffer();
     SetupAttachments();
@@ -305,68 +412,113 @@ LightingPass::LightingPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
     m_push_consts.ambientIntensity = vec4(0.2f);
     m_push_consts.window_size = p_gfx->GetWindowSize();
     m_push_consts.tile_size = TileMaxPass::tile_size;
+    // Off by default: the pipelines don't cull back faces, so culling back facing
+    // meshlets would make the mesh path drop thin and open geometry the
+    // vertex path draws
+    m_push_consts.cone_culling = false;
 }
 
 LightingPass::~LightingPass() {
     p_gfx->GetDeviceRef().destroyPipelineLayout(m_pipeline_layout);
     p_gfx->GetDeviceRef().destroyPipeline(m_pipeline);
+    p_gfx->GetDeviceRef().destroyPipeline(m_mesh_pipeline);
     p_gfx->GetDeviceRef().destroyFramebuffer(m_framebuffer);
     p_gfx->GetDeviceRef().destroyRenderPass(m_render_pass);
     
     m_descriptor.destroy(p_gfx->GetDeviceRef());
     m_buffer.destroy(p_gfx->GetDeviceRef());
     m_velocity_buffer.destroy(p_gfx->GetDeviceRef());
+    m_depth_buffer.destroy(p_gfx->GetDeviceRef());
+}
+
+void LightingPass::Declare(RenderGraph::Builder& builder) {
+    // All three are color attachments of the scanline render pass
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+    builder.Output("color", m_buffer);
+    builder.Output("velocity", m_velocity_buffer);
+    builder.Output("depth", m_depth_buffer);
+    builder.Write("color", stages, vk::AccessFlagBits::eColorAttachmentWrite);
+    builder.Write("velocity", stages, vk::AccessFlagBits::eColorAttachmentWrite);
+    builder.Write("depth", stages, vk::AccessFlagBits::eColorAttachmentWrite);
+}
+
+void LightingPass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y);
+    m_velocity_buffer.Resize(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y);
+    m_depth_buffer.Resize(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y);
+
+    vk::Device device = p_gfx->GetDeviceRef();
+    vk::Framebuffer framebuffer = m_framebuffer;
+    p_gfx->Retire([device, framebuffer]() { device.destroyFramebuffer(framebuffer); });
+    SetupFramebuffer();
+
+    // The descriptor set only holds buffers and textures, which keep their size
 }
 
 void LightingPass::Setup() {
 }
 
-void LightingPass::Render() {
-    vk::DeviceSize offset{ 0 };
+bool LightingPass::GetRenderPassBegin(vk::RenderPassBeginInfo& info) const {
+    info.setClearValueCount(static_cast<uint32_t>(m_clear_values.size()));
+    info.setPClearValues(m_clear_values.data());
+    info.setRenderPass(m_render_pass);
+    info.setFramebuffer(m_framebuffer);
+    info.renderArea = { {0, 0}, p_gfx->GetRenderExtent() };
+    return true;
+}
 
-    std::array<vk::ClearValue, 3> clearValues;
-    vk::ClearColorValue colorVal;
-    colorVal.setFloat32({ 0.0f,0,0,1 });
-    clearValues[0].setColor(colorVal);
-    clearValues[1].setColor(colorVal);
-    clearValues[2].setDepthStencil(vk::ClearDepthStencilValue({ 1.0f, 0 }));
+bool LightingPass::UsesMeshPath() const {
+    return use_mesh_shaders && m_mesh_pipeline && m_draw_mesh_tasks;
+}
 
-    vk::RenderPassBeginInfo _i;
-    _i.setClearValueCount(3);
-    _i.setPClearValues(clearValues.data());
-    _i.setRenderPass(m_render_pass);
-    _i.setFramebuffer(m_framebuffer);
-    _i.renderArea = { {0, 0}, p_gfx->GetWindowExtent()};
+void LightingPass::UpdateParams() {
+    m_push_consts.frame_rate = 1.0f/ImGui::GetIO().Framerate;
+    // The velocities are in pixels of the size rendered at
+    m_push_consts.window_size = p_gfx->GetRenderSize();
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+}
 
+void LightingPass::Render() {
+    vk::DeviceSize offset{ 0 };
+
+    // The render graph begins m_render_pass
     auto gfx_command_buffer = p_gfx->GetCommandBuffer();
-    gfx_command_buffer.beginRenderPass(&_i, vk::SubpassContents::eInline);
 
+    bool mesh_path = UsesMeshPath();
     gfx_command_buffer.bindPipeline(
         vk::PipelineBindPoint::eGraphics, 
-        m_pipeline);
+        mesh_path ? m_mesh_pipeline : m_pipeline);
+    p_gfx->CommandSetViewport(p_gfx->GetRenderExtent());
 
+    // The matrices and the parameters, in binding order
+    uint32_t offsets[] = { p_gfx->GetMatrixOffset(), GetParamsOffset() };
     gfx_command_buffer.bindDescriptorSets(
         vk::PipelineBindPoint::eGraphics,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-
+        &m_descriptor.descSet, 2, offsets);
 
-    m_push_consts.frame_rate = 1.0f/ImGui::GetIO().Framerate;
+    PushConstantInstance instance;
     for (const ObjInst& inst : p_gfx->m_objInst) {
         auto& object = p_gfx->m_objData[inst.objIndex];
 
-        m_push_consts.modelMatrix = inst.transform;
-        m_push_consts.objIndex = inst.objIndex;
+        instance.modelMatrix = inst.transform;
+        instance.objIndex = inst.objIndex;
 
         gfx_command_buffer.pushConstants(m_pipeline_layout,
-            vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0,
-            sizeof(PushConstantRaster), &m_push_consts);
+            m_push_stages, 0,
+            sizeof(PushConstantInstance), &instance);
+
+        if (mesh_path) {
+            // One task workgroup culls MESHLET_TASK_GROUP_SIZE meshlets
+            uint32_t task_groups = (object.nbMeshlets + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE;
+            m_draw_mesh_tasks(gfx_command_buffer, task_groups, 1, 1);
+            continue;
+        }
 
         gfx_command_buffer.bindVertexBuffers(0, 1, &object.vertexBuffer.buffer, &offset);
         gfx_command_buffer.bindIndexBuffer(object.indexBuffer.buffer, 0, vk::IndexType::eUint32);
         gfx_command_buffer.drawIndexed(object.nbIndices, 1, 0, 0, 0);
     }
-    gfx_command_buffer.endRenderPass();
 }
 
 void LightingPass::Teardown() {
@@ -377,16 +529,27 @@ void LightingPass::DrawGUI() {
     ImGui::SliderFloat("Exposure time : ", &m_push_consts.exposure_time,
         1.0f, 100.0f);
     ImGui::Text("frame rate : %f", m_push_consts.frame_rate);
+    if (p_gfx->SupportsMeshShaders()) {
+        ImGui::Checkbox("Mesh shader path", &use_mesh_shaders);
+        ImGui::Checkbox("Meshlet cone culling", &m_push_consts.cone_culling);
+    }
+    else {
+        ImGui::Text("Mesh shaders not supported, using the vertex pipeline");
+    }
 }
 
 const ImageWrap& LightingPass::GetBufferRef() const {
     return m_buffer;
 }
 
-const ImageWrap& LightingPass::GetVeloDepthBufferRef() const {
+const ImageWrap& LightingPass::GetVelocityBufferRef() const {
     return m_velocity_buffer;
 }
 
+const ImageWrap& LightingPass::GetDepthBufferRef() const {
+    return m_depth_buffer;
+}
+
 const DescriptorWrap& LightingPass::GetDescriptor() const {
     return m_descriptor;
 }
@@ -394,3 +557,7 @@ const DescriptorWrap& LightingPass::GetDescriptor() const {
 const PushConstantRaster& LightingPass::GetPCParams() const {
     return m_push_consts;
 }
+
+uint32_t LightingPass::GetParamsOffset() const {
+    return p_gfx->GetParamsOffset(m_params_region);
+}
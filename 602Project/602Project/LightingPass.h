@@ -4,12 +4,14 @@
 class LightingPass : public RenderPass {
 private:
 	//Resources required for the scanline render pass
-	uint8_t buffer_mip_levels;
 	ImageWrap m_buffer;
 	ImageWrap m_velocity_buffer;
+	//Linear depth (clip w), kept apart so velocity can drop to half floats
+	ImageWrap m_depth_buffer;
 	void SetupBuffer();
 
 	PushConstantRaster m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 
 	std::vector<vk::AttachmentDescription> m_framebuffer_attachments;
 	void SetupAttachments();
@@ -26,18 +28,39 @@ private:
 	vk::PipelineLayout m_pipeline_layout;
 	vk::Pipeline m_pipeline;
 	void SetupPipeline();
+
+	//Task/mesh shader path with per meshlet frustum and cone culling.
+	//Only created when the device supports VK_EXT_mesh_shader.
+	vk::Pipeline m_mesh_pipeline;
+	PFN_vkCmdDrawMeshTasksEXT m_draw_mesh_tasks = nullptr;
+	bool use_mesh_shaders;
+
+	//Stages that see the per draw push constants; includes task/mesh when supported
+	vk::ShaderStageFlags m_push_stages;
+
+	bool UsesMeshPath() const;
+
+	std::array<vk::ClearValue, 4> m_clear_values;
 public:
 	LightingPass(Graphics* _p_gfx);
 	~LightingPass();
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
+	uint64_t GetRecordKey() const override { return UsesMeshPath(); }
+	bool GetRenderPassBegin(vk::RenderPassBeginInfo& info) const override;
 	void Teardown() override;
 	void DrawGUI() override;
 
 	const ImageWrap& GetBufferRef() const;
-	const ImageWrap& GetVeloDepthBufferRef() const;
+	const ImageWrap& GetVelocityBufferRef() const;
+	const ImageWrap& GetDepthBufferRef() const;
 
 	const DescriptorWrap& GetDescriptor() const;
 	const PushConstantRaster& GetPCParams() const;
+	//Dynamic offset of this frame's raster parameters, which are in the descriptor set
+	uint32_t GetParamsOffset() const;
 };
 
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <future>
+#include <algorithm>
 #include <math.h>
 
 #include <filesystem>
@@ -31,24 +33,29 @@ using namespace glm;
 
 #include "app.h"
 #include "shaders/shared_structs.h"
-
-// Local objects and procedures defined and used here:
-struct ModelData
-{
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indicies;
-    std::vector<Material> materials;
-    std::vector<int32_t>     matIndx;
-    std::vector<std::string> textures;
-
-    void readAssimpFile(const std::string& path, const mat4& M);
-};
-
+#include "ModelData.h"
+#include "MeshCache.h"
+#include "MeshOptimize.h"
+#include "Meshlets.h"
+#include "VertexPacking.h"
+#include "AliasTable.h"
+#include "TimerWrap.h"
+#include "ThreadPool.h"
+#include "TextureCompress.h"
+#include "MipBuilder.h"
+#include "TextureCache.h"
+
+// Local procedures defined and used here:
 void recurseModelNodes(ModelData* meshdata,
     const  aiScene* aiscene,
     const  aiNode* node,
     const aiMatrix4x4& parentTr,
     const int level = 0);
+void recurseModelInstances(ModelData* meshdata,
+    const  aiScene* aiscene,
+    const  aiNode* node,
+    const aiMatrix4x4& parentTr,
+    std::vector<int>& meshIndex);
 
 
 // Returns an address (as VkDeviceAddress=uint64_t) of a buffer on the GPU.
@@ -67,8 +74,30 @@ vk::DeviceAddress getBufferDeviceAddress(vk::Device device, vk::Buffer buffer) {
 
 void Graphics::LoadModel(const std::string& filename, glm::mat4 transform)
 {
+    // The model's buffers and textures are counted under its file
+    DeviceAllocator::OwnerScope owner(m_allocator, filename.c_str());
     ModelData meshdata;
-    meshdata.readAssimpFile(filename.c_str(), glm::mat4());
+    TimerWrap load_timer;
+    uint32_t import_options = (optimize_meshes ? 1u : 0u) | (keep_model_meshes ? 2u : 0u);
+    MeshCache mesh_cache(filename, glm::mat4(), import_options);
+    if (mesh_cache.Read(meshdata)) {
+        printf("Mesh cache hit: %s (%.1f ms)\n", mesh_cache.GetCachePath().c_str(),
+            load_timer.Mark() * 1000.0f);
+        printf("ACMR: %.3f\n", ComputeACMR(meshdata.indicies, meshdata.vertices.size()));
+    }
+    else {
+        meshdata.readAssimpFile(filename.c_str(), glm::mat4(), keep_model_meshes);
+        if (optimize_meshes) {
+            // Done before the emitter list is built below, so emitter triangle
+            // indices refer to the reordered triangles.
+            MeshOptimizeStats stats = OptimizeMesh(meshdata);
+            printf("Mesh optimize: vertices %zu -> %zu, ACMR %.3f -> %.3f\n",
+                stats.vertices_before, stats.vertices_after, stats.acmr_before, stats.acmr_after);
+        }
+        mesh_cache.Write(meshdata);
+        printf("Mesh cache miss: %s (%.1f ms)\n", mesh_cache.GetCachePath().c_str(),
+            load_timer.Mark() * 1000.0f);
+    }
 
     printf("vertices: %ld\n", meshdata.vertices.size());
     printf("indices: %ld (%ld)\n", meshdata.indicies.size(), meshdata.indicies.size() / 3);
@@ -76,7 +105,137 @@ void Graphics::LoadModel(const std::string& filename, glm::mat4 transform)
     printf("matIndx: %ld\n", meshdata.matIndx.size());
     printf("textures: %ld\n", meshdata.textures.size());
 
+    //Scale the emission by a factor of 5, once per material
+    for (auto& material : meshdata.materials)
+        material.emission *= 5;
+
+    // Creates the textures on the GPU. The registry hands out shared indices,
+    // so only images not seen before are loaded, and materials index m_objText directly.
+    std::vector<int32_t> textureRemap(meshdata.textures.size());
+    std::vector<std::string> newTextures;
+    std::vector<std::string> newContents;
+    std::vector<uint64_t> newHashes;
+    for (size_t t = 0; t < meshdata.textures.size(); ++t) {
+        bool is_new;
+        std::string contents;
+        textureRemap[t] = m_textureRegistry.Register(meshdata.textures[t], is_new, contents);
+        if (is_new) {
+            newTextures.push_back(meshdata.textures[t]);
+            newContents.push_back(std::move(contents));
+            newHashes.push_back(m_textureRegistry.GetEntries()[textureRemap[t]].content_hash);
+        }
+    }
+    std::vector<ImageWrap> textures = CreateTextureImages(newTextures, std::move(newContents),
+        std::move(newHashes));
+    m_objText.insert(m_objText.end(), std::make_move_iterator(textures.begin()),
+        std::make_move_iterator(textures.end()));
+    assert(m_objText.size() == m_textureRegistry.GetEntries().size());
+
+    for (auto& material : meshdata.materials)
+        if (material.textureId >= 0)
+            material.textureId = textureRemap[material.textureId];
+    const uint32_t txtOffset = 0;
+
+    // VRAM the duplicates would have taken, counting their full mip chains in
+    // the format each image was stored in
+    vk::DeviceSize savedBytes = 0;
+    const auto& entries = m_textureRegistry.GetEntries();
+    for (size_t t = 0; t < entries.size(); ++t) {
+        TextureFormat format = TextureFormat::RGBA8;
+        if (m_objText[t].GetFormat() == vk::Format::eBc1RgbUnormBlock)
+            format = TextureFormat::BC1;
+        else if (m_objText[t].GetFormat() == vk::Format::eBc7UnormBlock)
+            format = TextureFormat::BC7;
+        vk::Extent2D size = m_objText[t].GetImageSize();
+        vk::DeviceSize imageBytes = 0;
+        for (uint32_t level = 0; level < m_objText[t].GetMipLevels(); ++level)
+            imageBytes += TextureLevelSize(format, std::max(1u, size.width >> level),
+                std::max(1u, size.height >> level));
+        savedBytes += imageBytes * (entries[t].references - 1);
+    }
+    printf("texture registry: %u references -> %zu images, %.1f MB VRAM saved\n",
+        m_textureRegistry.GetReferenceCount(), entries.size(), savedBytes / (1024.0 * 1024.0));
+
+    // Every part indexes the model's whole material list, so one buffer of it
+    // serves them all
+    vk::CommandBuffer matCmdBuf = CreateInitCommandBuffer();
+    m_materialBWs.push_back(CreateStagedBufferWrap(matCmdBuf, meshdata.materials,
+        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddress));
+    SubmitInitCommandBuffer(matCmdBuf);
+    vk::DeviceAddress materialAddress = getBufferDeviceAddress(m_device, m_materialBWs.back().buffer);
+
+    // A flattened model is a single object with a single instance
+    std::vector<ModelData> parts;
+    std::vector<MeshInstance> instances = meshdata.instances;
+    if (meshdata.meshes.empty()) {
+        parts.push_back(std::move(meshdata));
+        instances = { MeshInstance{ glm::mat4(), 0 } };
+    }
+    else
+        parts = meshdata.splitMeshes();
+
+    // One ObjData/ObjDesc (and so one BLAS) per part, with its emitters in object space
+    auto objOffset = static_cast<uint32_t>(m_objData.size());
+    std::vector<std::vector<Emitter>> partEmitters(parts.size());
+    for (size_t p = 0; p < parts.size(); ++p)
+        CreateObject(parts[p], txtOffset, materialAddress, partEmitters[p]);
+
+    // Instances carry the node transforms; repeated meshes reuse the same object
     std::vector<Emitter> emitterList;
+    for (const auto& meshInstance : instances) {
+        ObjInst instance;
+        instance.transform = transform * meshInstance.transform;
+        instance.objIndex = objOffset + meshInstance.mesh; // Index of the instanced object
+        m_objInst.push_back(instance);
+
+        //Emitters are sampled in world space, so apply the instance transform
+        for (Emitter emitter : partEmitters[meshInstance.mesh]) {
+            emitter.v0 = vec3(instance.transform * vec4(emitter.v0, 1.0f));
+            emitter.v1 = vec3(instance.transform * vec4(emitter.v1, 1.0f));
+            emitter.v2 = vec3(instance.transform * vec4(emitter.v2, 1.0f));
+            vec3 tempCross = glm::cross((emitter.v1 - emitter.v0), (emitter.v2 - emitter.v0));
+            emitter.normal = glm::normalize(tempCross);
+            emitter.area = glm::length(tempCross) / 2;
+            emitterList.push_back(emitter);
+        }
+    }
+    uint32_t meshletCount = 0;
+    for (size_t p = 0; p < parts.size(); ++p)
+        meshletCount += m_objData[objOffset + p].nbMeshlets;
+    printf("objects: %zu, instances: %zu\n", parts.size(), instances.size());
+    printf("meshlets: %u\n", meshletCount);
+    printf("vertex layout %d: %zu bytes per vertex\n", VERTEX_LAYOUT, sizeof(GpuVertex));
+
+    //Alias table over the emitters, weighted by their power
+    std::vector<float> emitterWeights;
+    emitterWeights.reserve(emitterList.size());
+    for (const auto& emitter : emitterList)
+        emitterWeights.push_back(EmitterWeight(emitter));
+    std::vector<EmitterAlias> emitterAlias = BuildAliasTable(emitterWeights);
+    if (emitterAlias.empty())
+        emitterList.clear();
+    m_emitterCount = static_cast<uint32_t>(emitterList.size());
+    printf("emitters: %u\n", m_emitterCount);
+
+    //Descriptors need a non empty buffer, so a scene without lights gets one unused entry
+    if (emitterList.empty()) {
+        emitterList.push_back(Emitter{});
+        emitterAlias.push_back(EmitterAlias{});
+    }
+
+    //Create buffers for the emitter list and its alias table and send them
+    //A later model replaces the lights of the one before, which may still be in use
+    Retire(std::move(m_lightBW));
+    Retire(std::move(m_lightAliasBW));
+    vk::CommandBuffer cmdBuf = CreateInitCommandBuffer();
+    m_lightBW = CreateStagedBufferWrap(cmdBuf, emitterList, vk::BufferUsageFlagBits::eStorageBuffer);
+    m_lightAliasBW = CreateStagedBufferWrap(cmdBuf, emitterAlias, vk::BufferUsageFlagBits::eStorageBuffer);
+    SubmitInitCommandBuffer(cmdBuf);
+}
+
+void Graphics::CreateObject(const ModelData& meshdata, uint32_t txtOffset, vk::DeviceAddress materialAddress,
+    std::vector<Emitter>& emitterList)
+{
     Emitter tempEmitter;
     std::vector<uint32_t> lightTriangleIndeces;
     vec3 tempCross;
@@ -85,8 +244,6 @@ void Graphics::LoadModel(const std::string& filename, glm::mat4 transform)
             meshdata.materials[meshdata.matIndx[i]].emission.g > 0 ||
             meshdata.materials[meshdata.matIndx[i]].emission.b > 0) {
             //Found an emittor
-            //Scale the emission by a factor of 5
-            meshdata.materials[meshdata.matIndx[i]].emission *= 5;
 
             //Store the index of the emittor 
             lightTriangleIndeces.push_back(i);
@@ -103,65 +260,70 @@ void Graphics::LoadModel(const std::string& filename, glm::mat4 transform)
         }
     }
 
+    // Vulkan buffers can't be empty; the light index list is a placeholder for unlit objects
+    if (lightTriangleIndeces.empty())
+        lightTriangleIndeces.push_back(0);
+
+    MeshletData meshlets = BuildMeshlets(meshdata);
+
     ObjData object;
     object.nbIndices = static_cast<uint32_t>(meshdata.indicies.size());
     object.nbVertices = static_cast<uint32_t>(meshdata.vertices.size());
+    object.nbMeshlets = static_cast<uint32_t>(meshlets.meshlets.size());
 
-    // Create the buffers on Device and copy vertices, indices and materials
-    vk::CommandBuffer cmdBuf = CreateTempCommandBuffer();
+    // Create the buffers on Device and copy vertices, indices and material indices
+    vk::CommandBuffer cmdBuf = CreateInitCommandBuffer();
 
     vk::BufferUsageFlags flag = vk::BufferUsageFlagBits::eStorageBuffer |
         vk::BufferUsageFlagBits::eShaderDeviceAddress;
 
     vk::BufferUsageFlags rtFlags = flag | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR;
 
-    object.vertexBuffer = CreateStagedBufferWrap(cmdBuf, meshdata.vertices,
+    vec3 posOffset, posScale;
+    std::vector<GpuVertex> gpuVertices = PackVertices(meshdata.vertices, posOffset, posScale);
+
+    object.vertexBuffer = CreateStagedBufferWrap(cmdBuf, gpuVertices,
         vk::BufferUsageFlagBits::eVertexBuffer | rtFlags);
     object.indexBuffer = CreateStagedBufferWrap(cmdBuf, meshdata.indicies,
         vk::BufferUsageFlagBits::eIndexBuffer | rtFlags);
-    object.matColorBuffer = CreateStagedBufferWrap(cmdBuf, meshdata.materials, flag);
     object.matIndexBuffer = CreateStagedBufferWrap(cmdBuf, meshdata.matIndx, flag);
     object.lightBuffer = CreateStagedBufferWrap(cmdBuf, lightTriangleIndeces, flag);
-
-    SubmitTempCommandBuffer(cmdBuf);
-
-    //Create buffer for the emitter list and send it
-    cmdBuf = CreateTempCommandBuffer();
-    m_lightBW = CreateBufferWrap(sizeof(emitterList[0]) * emitterList.size(),
-        vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-    cmdBuf.updateBuffer(m_lightBW.buffer, 0,
-        sizeof(emitterList[0]) * emitterList.size(), emitterList.data());
-
-    SubmitTempCommandBuffer(cmdBuf);
-
-    // Creates all textures on the GPU
-    auto txtOffset = static_cast<uint32_t>(m_objText.size());  // Offset is current size
-    for (const auto& texName : meshdata.textures)
-        m_objText.push_back(CreateTextureImage(texName));
-
-    // Assuming one instance of an object with its supplied transform.
-    // Could provide multiple transform here to make a vector of instances of this object.
-    ObjInst instance;
-    instance.transform = transform;
-    instance.objIndex = static_cast<uint32_t>(m_objData.size()); // Index of current object
-    m_objInst.push_back(instance);
+    object.meshletBuffer = CreateStagedBufferWrap(cmdBuf, meshlets.meshlets, flag);
+    object.meshletVertexBuffer = CreateStagedBufferWrap(cmdBuf, meshlets.vertices, flag);
+    object.meshletTriangleBuffer = CreateStagedBufferWrap(cmdBuf, meshlets.triangles, flag);
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+    // The BLAS build expands the quantized positions with this transform
+    vk::TransformMatrixKHR dequantize(std::array<std::array<float, 4>, 3>{ {
+        { posScale.x, 0.0f, 0.0f, posOffset.x },
+        { 0.0f, posScale.y, 0.0f, posOffset.y },
+        { 0.0f, 0.0f, posScale.z, posOffset.z } } });
+    object.transformBuffer = CreateStagedBufferWrap(cmdBuf, sizeof(dequantize), &dequantize,
+        vk::BufferUsageFlagBits::eShaderDeviceAddress |
+        vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR);
+#endif
+
+    SubmitInitCommandBuffer(cmdBuf);
 
     // Creating information for device access
     ObjDesc desc;
     desc.txtOffset = txtOffset;
+    desc.meshletCount = object.nbMeshlets;
+    desc.posOffset = posOffset;
+    desc.posScale = posScale;
     desc.vertexAddress = getBufferDeviceAddress(m_device, object.vertexBuffer.buffer);
     desc.indexAddress = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
-    desc.materialAddress = getBufferDeviceAddress(m_device, object.matColorBuffer.buffer);
+    desc.materialAddress = materialAddress;
     desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
     desc.lightTriangleIndexAddress = getBufferDeviceAddress(m_device, object.lightBuffer.buffer);
+    desc.meshletAddress = getBufferDeviceAddress(m_device, object.meshletBuffer.buffer);
+    desc.meshletVertexAddress = getBufferDeviceAddress(m_device, object.meshletVertexBuffer.buffer);
+    desc.meshletTriangleAddress = getBufferDeviceAddress(m_device, object.meshletTriangleBuffer.buffer);
 
-    m_objData.emplace_back(object);
+    m_objData.emplace_back(std::move(object));
     m_objDesc.emplace_back(desc);
 }
 
-void ModelData::readAssimpFile(const std::string& path, const mat4& M)
+void ModelData::readAssimpFile(const std::string& path, const mat4& M, bool keep_meshes)
 {
     printf("ReadAssimpFile File:  %s \n", path.c_str());
 
@@ -244,10 +406,88 @@ void ModelData::readAssimpFile(const std::string& path, const mat4& M)
         materials.push_back(newmat);
     }
 
-    recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
+    if (keep_meshes) {
+        std::vector<int> meshIndex(aiscene->mNumMeshes, -1);
+        recurseModelInstances(this, aiscene, aiscene->mRootNode, modelTr, meshIndex);
+        deduplicateMeshes();
+        printf("Assimp meshes kept: %zu meshes, %zu instances\n", meshes.size(), instances.size());
+    }
+    else
+        recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
 
 }
 
+// Appends one Assimp mesh to meshdata in its own space, as a new MeshRange.
+void appendMesh(ModelData* meshdata, const aiMesh* aimesh,
+    const aiMatrix4x4& tr, const aiMatrix3x3& normalTr)
+{
+    uint faceOffset = meshdata->vertices.size();
+    for (unsigned int t = 0; t < aimesh->mNumVertices; ++t) {
+        aiVector3D aipnt = tr * aimesh->mVertices[t];
+        aiVector3D ainrm = aimesh->HasNormals() ? normalTr * aimesh->mNormals[t] : aiVector3D(0, 0, 1);
+        aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0, 0, 0);
+
+        meshdata->vertices.push_back({ {aipnt.x, aipnt.y, aipnt.z},
+                                      {ainrm.x, ainrm.y, ainrm.z},
+                                      {aitex.x, aitex.y} });
+    }
+
+    for (unsigned int t = 0; t < aimesh->mNumFaces; ++t) {
+        aiFace* aiface = &aimesh->mFaces[t];
+        for (int i = 2; i < aiface->mNumIndices; i++) {
+            meshdata->matIndx.push_back(aimesh->mMaterialIndex);
+            meshdata->indicies.push_back(aiface->mIndices[0] + faceOffset);
+            meshdata->indicies.push_back(aiface->mIndices[i - 1] + faceOffset);
+            meshdata->indicies.push_back(aiface->mIndices[i] + faceOffset);
+        }
+    }
+}
+
+// Like recurseModelNodes, but every Assimp mesh is stored once, untransformed,
+// and each node referencing it adds a MeshInstance with the accumulated transform.
+void recurseModelInstances(ModelData* meshdata,
+    const aiScene* aiscene,
+    const aiNode* node,
+    const aiMatrix4x4& parentTr,
+    std::vector<int>& meshIndex)
+{
+    const int skipped_mesh = -2;
+    aiMatrix4x4 childTr = parentTr * node->mTransformation;
+
+    for (unsigned int m = 0; m < node->mNumMeshes; ++m) {
+        unsigned int aimeshIndex = node->mMeshes[m];
+        if (meshIndex[aimeshIndex] < 0) {
+            MeshRange range;
+            range.firstVertex = static_cast<uint32_t>(meshdata->vertices.size());
+            range.firstIndex = static_cast<uint32_t>(meshdata->indicies.size());
+            appendMesh(meshdata, aiscene->mMeshes[aimeshIndex], aiMatrix4x4(), aiMatrix3x3());
+            range.vertexCount = static_cast<uint32_t>(meshdata->vertices.size()) - range.firstVertex;
+            range.indexCount = static_cast<uint32_t>(meshdata->indicies.size()) - range.firstIndex;
+            if (range.indexCount == 0) {
+                // Point and line meshes have no triangles to draw or trace
+                meshdata->vertices.resize(range.firstVertex);
+                meshIndex[aimeshIndex] = skipped_mesh;
+                continue;
+            }
+            meshIndex[aimeshIndex] = static_cast<int>(meshdata->meshes.size());
+            meshdata->meshes.push_back(range);
+        }
+        if (meshIndex[aimeshIndex] == skipped_mesh)
+            continue;
+
+        // aiMatrix4x4 is row major, glm is column major
+        MeshInstance instance;
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c)
+                instance.transform[c][r] = childTr[r][c];
+        instance.mesh = static_cast<uint32_t>(meshIndex[aimeshIndex]);
+        meshdata->instances.push_back(instance);
+    }
+
+    for (unsigned int i = 0; i < node->mNumChildren; ++i)
+        recurseModelInstances(meshdata, aiscene, node->mChildren[i], childTr, meshIndex);
+}
+
 // Recursively traverses the assimp node hierarchy, accumulating
 // modeling transformations, and creating and transforming any meshes
 // found.  Meshes comming from assimp can have associated surface
@@ -272,32 +512,9 @@ void recurseModelNodes(ModelData* meshdata,
         aiMesh* aimesh = aiscene->mMeshes[node->mMeshes[m]];
         //printf("  %d: %d:%d\n", m, aimesh->mNumVertices, aimesh->mNumFaces);
 
-        // Loop through all vertices and record the
-        // vertex/normal/texture/tangent data with the node's model
-        // transformation applied.
-        uint faceOffset = meshdata->vertices.size();
-        for (unsigned int t = 0; t < aimesh->mNumVertices; ++t) {
-            aiVector3D aipnt = childTr * aimesh->mVertices[t];
-            aiVector3D ainrm = aimesh->HasNormals() ? normalTr * aimesh->mNormals[t] : aiVector3D(0, 0, 1);
-            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0, 0, 0);
-            aiVector3D aitan = aimesh->HasTangentsAndBitangents() ? normalTr * aimesh->mTangents[t] : aiVector3D(1, 0, 0);
-
-
-            meshdata->vertices.push_back({ {aipnt.x, aipnt.y, aipnt.z},
-                                          {ainrm.x, ainrm.y, ainrm.z},
-                                          {aitex.x, aitex.y} });
-        }
-
-        // Loop through all faces, recording indices
-        for (unsigned int t = 0; t < aimesh->mNumFaces; ++t) {
-            aiFace* aiface = &aimesh->mFaces[t];
-            for (int i = 2; i < aiface->mNumIndices; i++) {
-                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
-                meshdata->indicies.push_back(aiface->mIndices[0] + faceOffset);
-                meshdata->indicies.push_back(aiface->mIndices[i - 1] + faceOffset);
-                meshdata->indicies.push_back(aiface->mIndices[i] + faceOffset);
-            }
-        };
+        // Record the vertex/normal/texture data with the node's model
+        // transformation applied, and the triangles' indices.
+        appendMesh(meshdata, aimesh, childTr, normalTr);
     }
 
 
@@ -307,45 +524,299 @@ void recurseModelNodes(ModelData* meshdata,
 }
 
 ImageWrap Graphics::CreateTextureImage(std::string fileName) {
-    int texWidth, texHeight, texChannels;
+    return std::move(CreateTextureImages({ fileName }).front());
+}
+
+namespace {
+    struct DecodedTexture
+    {
+        TextureLevels levels;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool cache_hit = false;
+        bool failed = false;
+        float decode_ms = 0.0f;
+        float mip_ms = 0.0f;
+        float encode_ms = 0.0f;
+        // Only with benchmark_mip_generation: level 0 for the blit, and the CPU
+        // mip time of textures that took the blit path
+        std::vector<uint8_t> benchmark_rgba;
+        float benchmark_cpu_mip_ms = 0.0f;
+    };
+
+    vk::Format ToVkFormat(TextureFormat format) {
+        switch (format) {
+        case TextureFormat::BC1: return vk::Format::eBc1RgbUnormBlock;
+        case TextureFormat::BC7: return vk::Format::eBc7UnormBlock;
+        default: return vk::Format::eR8G8B8A8Unorm;
+        }
+    }
 
+    const char* FormatName(TextureFormat format) {
+        switch (format) {
+        case TextureFormat::BC1: return "BC1";
+        case TextureFormat::BC7: return "BC7";
+        default: return "RGBA8";
+        }
+    }
+}
+
+std::vector<ImageWrap> Graphics::CreateTextureImages(const std::vector<std::string>& fileNames,
+    std::vector<std::string> fileContents, std::vector<uint64_t> contentHashes) {
+    std::vector<ImageWrap> images;
+    if (fileNames.empty())
+        return images;
+
+    TimerWrap total_timer;
+    fileContents.resize(fileNames.size());
+    bool hashed = contentHashes.size() == fileNames.size();
+    contentHashes.resize(fileNames.size());
+
+    // Block compression needs device support; otherwise fall back to RGBA8
+    TextureCompression compression = m_bc_supported ? texture_compression : TextureCompression::None;
+    // Block compressed levels can't be blitted, so they always come from the CPU
+    bool cpu_mips = compression != TextureCompression::None || mip_generation == MipGeneration::Cpu;
+    bool use_cache = cpu_mips && !benchmark_mip_generation;
+
+    // The flip flag is global state in stb_image, so set it before any worker starts
     stbi_set_flip_vertically_on_load(true);
-    stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
-        STBI_rgb_alpha);
-    vk::DeviceSize imageSize = texWidth * texHeight * 4;
 
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
+    // Read cached levels or decode every image concurrently
+    std::vector<DecodedTexture> decoded(fileNames.size());
+    std::vector<stbi_uc*> pixels(fileNames.size(), nullptr);
+    uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(thread_count);
+    {
+        std::vector<std::future<void>> jobs;
+        for (size_t i = 0; i < fileNames.size(); ++i) {
+            jobs.push_back(pool.Submit([&, i]() {
+                TimerWrap timer;
+                DecodedTexture& result = decoded[i];
+                // Files not handed in are read here, once, for both the cache key and the decode
+                std::string& contents = fileContents[i];
+                if (contents.empty())
+                    contents = LoadFileIntoString(fileNames[i]);
+                if (!hashed)
+                    contentHashes[i] = HashBytes(contents.data(), contents.size());
+                if (use_cache && TextureCache(fileNames[i], contentHashes[i], compression).Read(result.levels)) {
+                    result.cache_hit = true;
+                    result.width = result.levels.levels[0].width;
+                    result.height = result.levels.levels[0].height;
+                }
+                else {
+                    int width, height, texChannels;
+                    pixels[i] = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(contents.data()),
+                        static_cast<int>(contents.size()), &width, &height, &texChannels, STBI_rgb_alpha);
+                    result.failed = pixels[i] == nullptr;
+                    result.width = static_cast<uint32_t>(width);
+                    result.height = static_cast<uint32_t>(height);
+                }
+                // The encoded bytes aren't needed past the decode
+                std::string().swap(contents);
+                result.decode_ms = timer.Mark() * 1000.0f;
+                }));
+        }
+        for (auto& job : jobs)
+            job.get();
+    }
+    float decode_ms = total_timer.Mark() * 1000.0f;
+
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        if (decoded[i].failed) {
+            for (auto texture : pixels)
+                stbi_image_free(texture);
+            throw std::runtime_error("failed to load texture image: " + fileNames[i]);
+        }
+    }
+
+    // Build the mips of the misses one at a time, each spread over all the workers,
+    // encode them and cache them
+    float mip_ms = 0.0f;
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        if (!pixels[i])
+            continue;
+        DecodedTexture& texture = decoded[i];
+        TextureLevels level0;
+        level0.format = TextureFormat::RGBA8;
+        level0.levels = { { texture.width, texture.height, 0,
+            TextureLevelSize(TextureFormat::RGBA8, texture.width, texture.height) } };
+        level0.data.assign(pixels[i], pixels[i] + level0.levels[0].size);
+
+        if (cpu_mips) {
+            TimerWrap timer;
+            TextureLevels mips = BuildMipChain(pixels[i], texture.width, texture.height, pool);
+            texture.mip_ms = timer.Mark() * 1000.0f;
+            mip_ms += texture.mip_ms;
+
+            TextureFormat format = TextureFormat::RGBA8;
+            if (compression == TextureCompression::BC1 ||
+                (compression == TextureCompression::Auto && !HasAlpha(pixels[i], texture.width, texture.height)))
+                format = TextureFormat::BC1;
+            else if (compression != TextureCompression::None)
+                format = TextureFormat::BC7;
+            texture.levels = CompressTexture(mips, format, pool);
+            texture.encode_ms = timer.Mark() * 1000.0f;
+            if (use_cache)
+                TextureCache(fileNames[i], contentHashes[i], compression).Write(texture.levels);
+        }
+        else {
+            // Level 0 only; the mip chain is blitted on the GPU
+            if (benchmark_mip_generation) {
+                TimerWrap timer;
+                BuildMipChain(pixels[i], texture.width, texture.height, pool);
+                texture.benchmark_cpu_mip_ms = timer.Mark() * 1000.0f;
+            }
+            texture.levels = level0;
+        }
+        if (benchmark_mip_generation)
+            texture.benchmark_rgba = std::move(level0.data);
+        stbi_image_free(pixels[i]);
+        pixels[i] = nullptr;
+    }
+    float encode_ms = total_timer.Mark() * 1000.0f;
+
+    // Every texture is copied through the uploader (on the transfer queue when there
+    // is one). Only the blit chains are recorded here, on the graphics queue; per
+    // texture, timestamps bracket its blit chain and then the benchmark blit. Every
+    // query is written, back to back when there is nothing to time, so the eWait
+    // readback can't stall on an unwritten one.
+    vk::CommandBuffer cmdBuf = CreateInitCommandBuffer();
+
+    const uint32_t queriesPerTexture = 4;
+    uint32_t queryCount = static_cast<uint32_t>(queriesPerTexture * decoded.size());
+    vk::QueryPool queryPool;
+    if (m_physical_device.getQueueFamilyProperties()[m_graphics_queue_index].timestampValidBits > 0) {
+        queryPool = m_device.createQueryPool(
+            vk::QueryPoolCreateInfo(vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, queryCount));
+        cmdBuf.resetQueryPool(queryPool, 0, queryCount);
     }
+    auto timestamp = [&](size_t texture, uint32_t query) {
+        if (queryPool)
+            cmdBuf.writeTimestamp(vk::PipelineStageFlagBits::eTransfer, queryPool,
+                static_cast<uint32_t>(queriesPerTexture * texture + query));
+    };
+
+    vk::DeviceSize gpuBytes = 0, rgba8Bytes = 0;
+    std::vector<ImageWrap> benchmarkImages;
+    images.reserve(decoded.size());
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        const TextureLevels& levels = decoded[i].levels;
+        uint32_t texWidth = decoded[i].width;
+        uint32_t texHeight = decoded[i].height;
+        uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
+        bool gpuMips = levels.levels.size() < mipLevels;
+
+        vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+        if (gpuMips)
+            usage |= vk::ImageUsageFlagBits::eTransferSrc;
+        images.emplace_back(texWidth, texHeight, ToVkFormat(levels.format), usage,
+            vk::ImageAspectFlagBits::eColor,
+            vk::MemoryPropertyFlagBits::eDeviceLocal,
+            mipLevels, this);
+
+        // Every level the CPU made goes up in a single copy
+        ImageWrap& myImage = images.back();
+        std::vector<vk::BufferImageCopy> regions;
+        for (uint32_t l = 0; l < levels.levels.size(); ++l) {
+            vk::BufferImageCopy region{};
+            region.bufferOffset = levels.levels[l].offset;
+            region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, l, 0, 1);
+            region.imageExtent = vk::Extent3D(levels.levels[l].width, levels.levels[l].height, 1);
+            regions.push_back(region);
+        }
+        timestamp(i, 0);
+        if (gpuMips) {
+            m_uploader.UploadImage(myImage, levels.data.data(), levels.data.size(), regions,
+                vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer,
+                vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+            myImage.GenerateMipMaps(cmdBuf);
+        }
+        else {
+            m_uploader.UploadImage(myImage, levels.data.data(), levels.data.size(), regions,
+                vk::ImageLayout::eShaderReadOnlyOptimal);
+        }
+        timestamp(i, 1);
+
+        myImage.CreateTextureSampler();
+
+        for (uint32_t l = 0; l < mipLevels; ++l) {
+            uint32_t w = std::max(1u, texWidth >> l), h = std::max(1u, texHeight >> l);
+            gpuBytes += TextureLevelSize(levels.format, w, h);
+            rgba8Bytes += TextureLevelSize(TextureFormat::RGBA8, w, h);
+        }
 
-    BufferWrap staging = CreateBufferWrap(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible
-        | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-    void* data;
-    m_device.mapMemory(staging.memory, 0, imageSize, vk::MemoryMapFlags(), &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    m_device.unmapMemory(staging.memory);
-
-    stbi_image_free(pixels);
-
-    uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
-
-    ImageWrap myImage(texWidth, texHeight, vk::Format::eR8G8B8A8Unorm,
-        vk::ImageUsageFlagBits::eTransferDst |
-        vk::ImageUsageFlagBits::eTransferSrc |
-        vk::ImageUsageFlagBits::eSampled,
-        vk::ImageAspectFlagBits::eColor,
-        vk::MemoryPropertyFlagBits::eDeviceLocal,
-        mipLevels, this);
-
-    myImage.TransitionImageLayout(vk::ImageLayout::eTransferDstOptimal);
-    myImage.CopyFromBuffer(staging.buffer, static_cast<uint32_t>(texWidth),
-        static_cast<uint32_t>(texHeight));
-
-    staging.destroy(m_device);
-    myImage.GenerateMipMaps();
-    
-    myImage.CreateTextureSampler();
-    return myImage;
-}
\ No newline at end of file
+        // Blit the same texture's chain into a scratch image to time the GPU path
+        timestamp(i, 2);
+        if (benchmark_mip_generation && !decoded[i].benchmark_rgba.empty()) {
+            benchmarkImages.emplace_back(texWidth, texHeight, vk::Format::eR8G8B8A8Unorm,
+                vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc
+                | vk::ImageUsageFlagBits::eSampled,
+                vk::ImageAspectFlagBits::eColor,
+                vk::MemoryPropertyFlagBits::eDeviceLocal,
+                mipLevels, this);
+            ImageWrap& scratch = benchmarkImages.back();
+            m_uploader.UploadImage(scratch, decoded[i].benchmark_rgba.data(), decoded[i].benchmark_rgba.size(),
+                { regions.front() }, vk::ImageLayout::eTransferDstOptimal, vk::PipelineStageFlagBits::eTransfer,
+                vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite);
+            scratch.GenerateMipMaps(cmdBuf);
+        }
+        timestamp(i, 3);
+    }
+
+    SubmitInitCommandBuffer(cmdBuf);
+    float record_ms = total_timer.Mark() * 1000.0f;
+
+    // The blits only have to finish before the scratch images go
+    for (auto& scratch : benchmarkImages)
+        m_deletion_queue.Retire(std::move(scratch));
+
+    // The uploader has its own copy of the pixels; the rest is only needed for the
+    // report, which has to wait for the GPU work (the end of the init batch, if any)
+    for (auto& texture : decoded) {
+        texture.levels.data = {};
+        texture.benchmark_rgba = {};
+    }
+    RunAfterInit([this, decoded = std::move(decoded), fileNames, queryPool, queryCount,
+        queriesPerTexture, cpu_mips, thread_count, decode_ms, mip_ms, encode_ms, record_ms,
+        gpuBytes, rgba8Bytes]() mutable {
+        std::vector<uint64_t> timestamps(queryCount, 0);
+        if (queryPool) {
+            m_device.getQueryPoolResults(queryPool, 0, queryCount, timestamps.size() * sizeof(uint64_t),
+                timestamps.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+            m_device.destroyQueryPool(queryPool);
+        }
+        float timestampPeriod = m_physical_device.getProperties().limits.timestampPeriod;
+        auto gpuTime = [&](size_t texture, uint32_t from, uint32_t to) {
+            const uint64_t* t = timestamps.data() + queriesPerTexture * texture;
+            return (t[to] - t[from]) * timestampPeriod / 1000000.0f;
+        };
+
+        float blit_ms = 0.0f, benchmark_cpu_ms = 0.0f, benchmark_blit_ms = 0.0f;
+        for (size_t i = 0; i < decoded.size(); ++i) {
+            const DecodedTexture& texture = decoded[i];
+            float gpu_mip_ms = cpu_mips ? 0.0f : gpuTime(i, 0, 1);
+            blit_ms += gpu_mip_ms;
+            printf("Texture %s: %ux%u %s, %s %.1f ms, mips %.1f ms %s, encode %.1f ms\n",
+                fileNames[i].c_str(), texture.width, texture.height, FormatName(texture.levels.format),
+                texture.cache_hit ? "cache hit" : "decode", texture.decode_ms,
+                cpu_mips ? texture.mip_ms : gpu_mip_ms, cpu_mips ? "cpu" : "blit", texture.encode_ms);
+            if (benchmark_mip_generation) {
+                float cpu_ms = cpu_mips ? texture.mip_ms : texture.benchmark_cpu_mip_ms;
+                float gpu_ms = cpu_mips ? gpuTime(i, 2, 3) : gpu_mip_ms;
+                benchmark_cpu_ms += cpu_ms;
+                benchmark_blit_ms += gpu_ms;
+                printf("  mip benchmark: cpu %.2f ms on %u threads, gpu blit %.2f ms\n", cpu_ms, thread_count, gpu_ms);
+            }
+        }
+        printf("Textures: %zu decoded on %u threads in %.1f ms, mips (%s) %.1f ms, built and encoded in %.1f ms, recorded in %.1f ms\n",
+            decoded.size(), thread_count, decode_ms, cpu_mips ? "cpu" : "gpu blit", cpu_mips ? mip_ms : blit_ms,
+            encode_ms, record_ms);
+        if (benchmark_mip_generation)
+            printf("Mip benchmark: cpu %.1f ms vs gpu blit %.1f ms over %zu textures\n",
+                benchmark_cpu_ms, benchmark_blit_ms, decoded.size());
+        printf("Texture VRAM: %.1f MB (%.1f MB as RGBA8)\n",
+            gpuBytes / (1024.0 * 1024.0), rgba8Bytes / (1024.0 * 1024.0));
+    });
+
+    return images;
+}
@@ -2,11 +2,10 @@
 
 #include "MBlurPass.h"
 #include "TileMaxPass.h"
-#include "LightingPass.h"
 
 void MBlurPass::SetupBuffer() {
     m_buffer.CreateTextureSampler();
-    m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::SceneColor);
 }
 
 void MBlurPass::SetupDescriptor() {
@@ -18,20 +17,17 @@ void MBlurPass::SetupDescriptor() {
         {2, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {3, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {4, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {5, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute} });
 }
 
 void MBlurPass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantMBlur));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -53,10 +49,10 @@ void MBlurPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-MBlurPass::MBlurPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
-    RenderPass(_p_gfx, _p_prev_pass), m_push_consts(),
+MBlurPass::MBlurPass(Graphics* _p_gfx) :
+    RenderPass(_p_gfx), m_push_consts(),
     m_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::SceneColor),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -64,12 +60,13 @@ MBlurPass::MBlurPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx), enabled(true) {
+        1, p_gfx, false), enabled(true) {
     m_push_consts.velocity_scale = 20.0f;
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.max_samples = 20;
     m_push_consts.soft_z_extent = 0.01;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantMBlur));
 
     SetupBuffer();
     SetupDescriptor();
@@ -83,70 +80,59 @@ MBlurPass::~MBlurPass() {
     m_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void MBlurPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    const vk::PipelineStageFlags copy = vk::PipelineStageFlagBits::eTransfer;
+    builder.Output("mblur", m_buffer);
+    p_color_buffer = &builder.Read("color", stages);
+    p_velocity_buffer = &builder.Read("velocity", stages);
+    p_neighbour_max_buffer = &builder.Read("neighbour_max", stages);
+    p_depth_buffer = &builder.Read("depth", stages);
+    builder.Write("mblur", stages);
+    // The blurred image is copied back over the color buffer
+    builder.Read("mblur", copy, vk::AccessFlagBits::eTransferRead);
+    builder.Write("color", copy, vk::AccessFlagBits::eTransferWrite);
+    builder.AsyncCompute();
+}
+
+void MBlurPass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void MBlurPass::Setup() {
-    m_descriptor.write(p_gfx->GetDeviceRef(), 0,
-        m_buffer.Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 1,
-        static_cast<LightingPass*>(p_prev_pass)->GetBufferRef().Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 2,
-        static_cast<LightingPass*>(p_prev_pass)->GetVeloDepthBufferRef().Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 3,
-        neighbour_max_desc);
-    SetupPipeline();
+    m_descriptor.write(p_gfx->GetDeviceRef(), 0, m_buffer.Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 1, p_color_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 2, p_velocity_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 3, p_neighbour_max_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 4, p_depth_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 5, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantMBlur));
+    if (!m_pipeline)
+        SetupPipeline();
+}
+
+void MBlurPass::UpdateParams() {
+    p_gfx->WriteParams(m_params_region, m_push_consts);
 }
 
 void MBlurPass::Render() {
-    if (not enabled)
-        return;
-
-    LightingPass* p_prev_lighting_pass = static_cast<LightingPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_prev_lighting_pass->GetBufferRef().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    // Select the compute shader, and its descriptor set and push constant
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
+    // Select the compute shader and its descriptor set
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0,
-        sizeof(PushConstantMBlur),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     // This MUST match the shaders's line:
     //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
-    p_gfx->GetCommandBuffer().dispatch(p_gfx->GetWindowSize().x,
-        p_gfx->GetWindowSize().y, 1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+    p_gfx->GetCommandBuffer().dispatch(p_gfx->GetRenderSize().x,
+        p_gfx->GetRenderSize().y, 1);
 
-    p_gfx->CommandCopyImage(m_buffer, p_prev_lighting_pass->GetBufferRef());
+    p_gfx->CommandCopyImage(m_buffer, *p_color_buffer, vk::PipelineStageFlagBits::eComputeShader);
 }
 
 void MBlurPass::Teardown()
@@ -166,6 +152,6 @@ void MBlurPass::DrawGUI() {
     ImGui::Checkbox("Enable MBlur", &enabled);
 }
 
-void MBlurPass::SetNeighbourMaxDesc(const ImageWrap& _buffer) {
-    neighbour_max_desc = _buffer.Descriptor();
+const ImageWrap& MBlurPass::GetBuffer() const {
+    return m_buffer;
 }
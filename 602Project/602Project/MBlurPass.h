@@ -7,6 +7,7 @@ private:
 	void SetupBuffer();
 
 	PushConstantMBlur m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 
 	DescriptorWrap m_descriptor;
 	void SetupDescriptor();
@@ -17,16 +18,23 @@ private:
 
 	bool enabled;
 
-	vk::DescriptorImageInfo neighbour_max_desc;
+	const ImageWrap* p_color_buffer = nullptr;
+	const ImageWrap* p_velocity_buffer = nullptr;
+	const ImageWrap* p_neighbour_max_buffer = nullptr;
+	const ImageWrap* p_depth_buffer = nullptr;
 public:
-	MBlurPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	MBlurPass(Graphics* _p_gfx);
 	~MBlurPass();
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
 	void DrawGUI();
+	bool IsEnabled() const override { return enabled; }
 
-	void SetNeighbourMaxDesc(const ImageWrap& _buffer);
+	const ImageWrap& GetBuffer() const;
 };
 
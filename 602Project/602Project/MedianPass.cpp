@@ -3,17 +3,16 @@
 #include "Graphics.h"
 
 #include "MedianPass.h"
-#include "DOFPass.h"
 
 void MedianPass::SetupBuffer() {
     m_bg_buffer.CreateTextureSampler();
-    m_bg_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_bg_buffer, TargetKind::Color);
 
     m_fg_buffer.CreateTextureSampler();
-    m_fg_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_fg_buffer, TargetKind::Color);
 
     m_rt_buffer.CreateTextureSampler();
-    m_rt_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_rt_buffer, TargetKind::Color);
 }
 
 void MedianPass::SetupDescriptor() {
@@ -65,9 +64,9 @@ void MedianPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-MedianPass::MedianPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx, _p_prev_pass),
+MedianPass::MedianPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
     m_bg_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -75,9 +74,9 @@ MedianPass::MedianPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     m_fg_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -85,9 +84,9 @@ MedianPass::MedianPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     m_rt_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -95,7 +94,7 @@ MedianPass::MedianPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx) {
+        1, p_gfx, false) {
     SetupBuffer();
     SetupDescriptor();
 }
@@ -110,41 +109,39 @@ MedianPass::~MedianPass() {
     m_rt_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void MedianPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("median_bg", m_bg_buffer);
+    builder.Output("median_fg", m_fg_buffer);
+    builder.Output("median_rt", m_rt_buffer);
+    p_dof_bg_buffer = &builder.Read("dof_bg", stages);
+    p_dof_fg_buffer = &builder.Read("dof_fg", stages);
+    p_raycast_bg_buffer = &builder.Read("raycast_bg", stages);
+    builder.Write("median_bg", stages);
+    builder.Write("median_fg", stages);
+    builder.Write("median_rt", stages);
+    builder.AsyncCompute();
+}
+
+void MedianPass::Resize() {
+    m_bg_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_fg_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_rt_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void MedianPass::Setup() {
-    m_descriptor.write(p_gfx->GetDeviceRef(), 0,
-        static_cast<DOFPass*>(p_prev_pass)->GetBGBuffer().Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 1,
-        static_cast<DOFPass*>(p_prev_pass)->GetFGBuffer().Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 0, p_dof_bg_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 1, p_dof_fg_buffer->Descriptor());
     m_descriptor.write(p_gfx->GetDeviceRef(), 2, m_bg_buffer.Descriptor());
     m_descriptor.write(p_gfx->GetDeviceRef(), 3, m_fg_buffer.Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 4, rt_bg_desc);
+    m_descriptor.write(p_gfx->GetDeviceRef(), 4, p_raycast_bg_buffer->Descriptor());
     m_descriptor.write(p_gfx->GetDeviceRef(), 5, m_rt_buffer.Descriptor());
-    SetupPipeline();
+    if (!m_pipeline)
+        SetupPipeline();
 }
 
 void MedianPass::Render() {
-    DOFPass* p_dof_pass = static_cast<DOFPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_dof_pass->GetBuffer().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
@@ -154,29 +151,8 @@ void MedianPass::Render() {
         &m_descriptor.descSet, 0, nullptr);
 
     p_gfx->GetCommandBuffer().dispatch(
-        (p_gfx->GetWindowSize().x / 2),
-        (p_gfx->GetWindowSize().y / 2), 1);
-
-    img_mem_barrier.setImage(m_bg_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    img_mem_barrier.setImage(m_fg_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    img_mem_barrier.setImage(m_rt_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+        (p_gfx->GetRenderSize().x / 2),
+        (p_gfx->GetRenderSize().y / 2), 1);
 }
 
 void MedianPass::Teardown()
@@ -199,7 +175,3 @@ const ImageWrap& MedianPass::GetRTBuffer() const {
     return m_rt_buffer;
 }
 
-void MedianPass::SetRaycastBGDesc(const ImageWrap& _buffer) {
-    rt_bg_desc = _buffer.Descriptor();
-}
-
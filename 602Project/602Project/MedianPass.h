@@ -15,11 +15,15 @@ private:
 	vk::Pipeline m_pipeline;
 	void SetupPipeline();
 
-	vk::DescriptorImageInfo rt_bg_desc;
+	const ImageWrap* p_dof_bg_buffer = nullptr;
+	const ImageWrap* p_dof_fg_buffer = nullptr;
+	const ImageWrap* p_raycast_bg_buffer = nullptr;
 public:
-	MedianPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	MedianPass(Graphics* _p_gfx);
 	~MedianPass();
 
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
 	void Render() override;
 	void Teardown() override;
@@ -29,7 +33,5 @@ public:
 	const ImageWrap& GetBGBuffer() const;
 	const ImageWrap& GetFGBuffer() const;
 	const ImageWrap& GetRTBuffer() const;
-
-	void SetRaycastBGDesc(const ImageWrap& _buffer);
 };
 
@@ -0,0 +1,249 @@
+#include "MeshCache.h"
+
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "Util.h"
+
+namespace {
+    constexpr uint32_t mesh_cache_magic = 0x4853454d; // "MESH"
+    constexpr uint32_t mesh_cache_version = 2;
+    const char* mesh_cache_dir = "cache/meshes";
+
+    uint64_t Align16(uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    //Hashes a whole file into the running hash. Missing files leave the hash untouched.
+    bool HashFile(const fs::path& path, uint64_t& hash) {
+        std::string contents = LoadFileIntoString(path.string());
+        if (contents.empty())
+            return false;
+        hash = HashBytes(contents.data(), contents.size(), hash);
+        return true;
+    }
+
+    //The files an OBJ's mtllib lines name, relative to the OBJ. The rest of the
+    //line is one name, and a missing library falls back to <model>.mtl, as in
+    //Assimp's OBJ importer.
+    std::vector<fs::path> MaterialLibraries(const std::string& obj, const fs::path& source) {
+        std::vector<fs::path> libraries;
+        size_t line = 0;
+        while (line < obj.size()) {
+            size_t end = obj.find('\n', line);
+            if (end == std::string::npos)
+                end = obj.size();
+            size_t start = obj.find_first_not_of(" \t", line);
+            if (start < end && obj.compare(start, 6, "mtllib") == 0 && start + 6 < end &&
+                (obj[start + 6] == ' ' || obj[start + 6] == '\t')) {
+                size_t first = obj.find_first_not_of(" \t", start + 6);
+                size_t last = obj.find_last_not_of(" \t\r", end - 1);
+                if (first < end && last >= first) {
+                    fs::path library = source.parent_path() / obj.substr(first, last - first + 1);
+                    std::error_code ec;
+                    if (!fs::exists(library, ec))
+                        library = fs::path(source).replace_extension(".mtl");
+                    libraries.push_back(library);
+                }
+            }
+            line = end + 1;
+        }
+        return libraries;
+    }
+
+    template <typename T>
+    bool ReadSection(std::ifstream& stream, uint64_t file_size,
+        uint64_t offset, uint64_t count, std::vector<T>& out) {
+        if (offset > file_size || count > (file_size - offset) / sizeof(T))
+            return false;
+        out.resize(count);
+        stream.seekg(offset, std::ios::beg);
+        stream.read(reinterpret_cast<char*>(out.data()), count * sizeof(T));
+        return static_cast<bool>(stream);
+    }
+
+    template <typename T>
+    void WriteSection(std::ofstream& stream, uint64_t offset, const std::vector<T>& data) {
+        static const char zeros[16] = {};
+        uint64_t pos = stream.tellp();
+        stream.write(zeros, offset - pos);
+        stream.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+    }
+}
+
+MeshCache::MeshCache(const std::string& model_path, const mat4& transform, uint32_t import_options) :
+    m_model_path(model_path) {
+    std::error_code ec;
+    fs::path source = fs::absolute(model_path, ec);
+    if (ec)
+        source = model_path;
+
+    std::string key = source.generic_string();
+    char name[32];
+    snprintf(name, sizeof(name), "_%016llx.meshcache",
+        static_cast<unsigned long long>(HashBytes(key.data(), key.size())));
+    m_cache_path = (fs::path(mesh_cache_dir) / (source.stem().string() + name)).string();
+
+    m_source_size = fs::file_size(source, ec);
+    if (ec)
+        return;
+    m_source_mtime = static_cast<int64_t>(fs::last_write_time(source, ec).time_since_epoch().count());
+    if (ec)
+        return;
+
+    // The baked transform, import options and the material libraries are part of the result too
+    m_source_hash = HashBytes(&transform, sizeof(transform));
+    m_source_hash = HashBytes(&import_options, sizeof(import_options), m_source_hash);
+    std::string contents = LoadFileIntoString(source.string());
+    if (contents.empty())
+        return;
+    m_source_hash = HashBytes(contents.data(), contents.size(), m_source_hash);
+    for (const fs::path& library : MaterialLibraries(contents, source))
+        HashFile(library, m_source_hash);
+
+    m_valid_source = true;
+}
+
+bool MeshCache::Read(ModelData& meshdata) const {
+    if (!m_valid_source)
+        return false;
+
+    std::ifstream stream(m_cache_path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    uint64_t file_size = stream.tellg();
+    if (file_size < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    stream.seekg(0, std::ios::beg);
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!stream ||
+        header.magic != mesh_cache_magic ||
+        header.version != mesh_cache_version ||
+        header.vertexStride != sizeof(Vertex) ||
+        header.materialStride != sizeof(Material) ||
+        header.sourceSize != m_source_size ||
+        header.sourceMtime != m_source_mtime ||
+        header.sourceHash != m_source_hash) {
+        printf("Mesh cache stale: %s\n", m_cache_path.c_str());
+        return false;
+    }
+
+    ModelData result;
+    std::vector<char> texture_blob;
+    if (!ReadSection(stream, file_size, header.vertices.offset, header.vertices.count, result.vertices) ||
+        !ReadSection(stream, file_size, header.indices.offset, header.indices.count, result.indicies) ||
+        !ReadSection(stream, file_size, header.materials.offset, header.materials.count, result.materials) ||
+        !ReadSection(stream, file_size, header.matIndx.offset, header.matIndx.count, result.matIndx) ||
+        !ReadSection(stream, file_size, header.meshes.offset, header.meshes.count, result.meshes) ||
+        !ReadSection(stream, file_size, header.instances.offset, header.instances.count, result.instances) ||
+        !ReadSection(stream, file_size, header.textures.offset, file_size - header.textures.offset, texture_blob)) {
+        printf("Mesh cache truncated: %s\n", m_cache_path.c_str());
+        return false;
+    }
+
+    // Mesh ranges and instances must stay inside the arrays they index
+    for (const auto& range : result.meshes) {
+        if (uint64_t(range.firstVertex) + range.vertexCount > result.vertices.size() ||
+            uint64_t(range.firstIndex) + range.indexCount > result.indicies.size()) {
+            printf("Mesh cache corrupt: %s\n", m_cache_path.c_str());
+            return false;
+        }
+    }
+    for (const auto& instance : result.instances) {
+        if (instance.mesh >= result.meshes.size()) {
+            printf("Mesh cache corrupt: %s\n", m_cache_path.c_str());
+            return false;
+        }
+    }
+
+    // Texture paths are stored as length prefixed strings
+    size_t cursor = 0;
+    for (uint64_t i = 0; i < header.textures.count; ++i) {
+        uint32_t length;
+        if (cursor + sizeof(length) > texture_blob.size())
+            return false;
+        memcpy(&length, texture_blob.data() + cursor, sizeof(length));
+        cursor += sizeof(length);
+        if (cursor + length > texture_blob.size())
+            return false;
+        result.textures.emplace_back(texture_blob.data() + cursor, length);
+        cursor += length;
+    }
+
+    meshdata = std::move(result);
+    return true;
+}
+
+void MeshCache::Write(const ModelData& meshdata) const {
+    if (!m_valid_source)
+        return;
+
+    MeshCacheHeader header = {};
+    header.magic = mesh_cache_magic;
+    header.version = mesh_cache_version;
+    header.vertexStride = sizeof(Vertex);
+    header.materialStride = sizeof(Material);
+    header.sourceSize = m_source_size;
+    header.sourceMtime = m_source_mtime;
+    header.sourceHash = m_source_hash;
+
+    header.vertices = { Align16(sizeof(header)), meshdata.vertices.size() };
+    header.indices = { Align16(header.vertices.offset + meshdata.vertices.size() * sizeof(Vertex)),
+        meshdata.indicies.size() };
+    header.materials = { Align16(header.indices.offset + meshdata.indicies.size() * sizeof(uint32_t)),
+        meshdata.materials.size() };
+    header.matIndx = { Align16(header.materials.offset + meshdata.materials.size() * sizeof(Material)),
+        meshdata.matIndx.size() };
+    header.meshes = { Align16(header.matIndx.offset + meshdata.matIndx.size() * sizeof(int32_t)),
+        meshdata.meshes.size() };
+    header.instances = { Align16(header.meshes.offset + meshdata.meshes.size() * sizeof(MeshRange)),
+        meshdata.instances.size() };
+    header.textures = { Align16(header.instances.offset + meshdata.instances.size() * sizeof(MeshInstance)),
+        meshdata.textures.size() };
+
+    std::vector<char> texture_blob;
+    for (const auto& texture : meshdata.textures) {
+        uint32_t length = static_cast<uint32_t>(texture.size());
+        texture_blob.insert(texture_blob.end(), reinterpret_cast<const char*>(&length),
+            reinterpret_cast<const char*>(&length) + sizeof(length));
+        texture_blob.insert(texture_blob.end(), texture.begin(), texture.end());
+    }
+
+    std::error_code ec;
+    fs::create_directories(mesh_cache_dir, ec);
+
+    // Write to a temporary file first so an interrupted write never leaves a
+    // half written entry behind.
+    std::string temp_path = m_cache_path + ".tmp";
+    {
+        std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+        if (!stream.is_open()) {
+            printf("Failed to write mesh cache: %s\n", m_cache_path.c_str());
+            return;
+        }
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        WriteSection(stream, header.vertices.offset, meshdata.vertices);
+        WriteSection(stream, header.indices.offset, meshdata.indicies);
+        WriteSection(stream, header.materials.offset, meshdata.materials);
+        WriteSection(stream, header.matIndx.offset, meshdata.matIndx);
+        WriteSection(stream, header.meshes.offset, meshdata.meshes);
+        WriteSection(stream, header.instances.offset, meshdata.instances);
+        WriteSection(stream, header.textures.offset, texture_blob);
+        if (!stream) {
+            printf("Failed to write mesh cache: %s\n", m_cache_path.c_str());
+            return;
+        }
+    }
+
+    fs::rename(temp_path, m_cache_path, ec);
+    if (ec)
+        printf("Failed to write mesh cache: %s\n", m_cache_path.c_str());
+}
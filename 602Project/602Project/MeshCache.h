@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+#include "ModelData.h"
+
+// On disk cache of the arrays produced by ModelData::readAssimpFile.
+// Entries are keyed by the source path, its size, mtime and a hash of its
+// contents (plus the material libraries an OBJ's mtllib lines name), so Assimp only runs
+// when the model actually changed.
+//
+// File layout (all sections 16 byte aligned so the file can be mapped):
+//   MeshCacheHeader
+//   Vertex[vertexCount]
+//   uint32_t[indexCount]
+//   Material[materialCount]
+//   int32_t[matIndxCount]
+//   MeshRange[meshCount]
+//   MeshInstance[instanceCount]
+//   texture paths: textureCount x { uint32_t length; char path[length]; }
+class MeshCache
+{
+public:
+	//import_options distinguishes differently processed results of the same file
+	MeshCache(const std::string& model_path, const mat4& transform, uint32_t import_options = 0);
+
+	//Fills meshdata from the cache. Returns false on a miss or a stale entry.
+	bool Read(ModelData& meshdata) const;
+
+	//Writes meshdata to the cache, replacing any previous entry.
+	void Write(const ModelData& meshdata) const;
+
+	const std::string& GetCachePath() const { return m_cache_path; }
+private:
+	struct Section
+	{
+		uint64_t offset;
+		uint64_t count;
+	};
+
+	struct MeshCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vertexStride;   // sizeof(Vertex) at write time
+		uint32_t materialStride; // sizeof(Material) at write time
+		uint64_t sourceSize;
+		int64_t  sourceMtime;
+		uint64_t sourceHash;
+		Section vertices;
+		Section indices;
+		Section materials;
+		Section matIndx;
+		Section meshes;
+		Section instances;
+		Section textures;
+	};
+
+	std::string m_model_path;
+	std::string m_cache_path;
+	uint64_t m_source_size = 0;
+	int64_t  m_source_mtime = 0;
+	uint64_t m_source_hash = 0;
+	bool m_valid_source = false;
+};
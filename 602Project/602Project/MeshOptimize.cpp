@@ -0,0 +1,291 @@
+#include "MeshOptimize.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace {
+    // Forsyth's scoring constants
+    constexpr int vertex_cache_size = 32;
+    constexpr float cache_decay_power = 1.5f;
+    constexpr float last_tri_score = 0.75f;
+    constexpr float valence_boost_scale = 2.0f;
+    constexpr float valence_boost_power = 0.5f;
+
+    float VertexScore(int cache_position, uint32_t remaining_tris) {
+        if (remaining_tris == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cache_position >= 0) {
+            if (cache_position < 3) {
+                // The last triangle's vertices get a fixed score so the next
+                // triangle doesn't simply reuse the same edge every time.
+                score = last_tri_score;
+            }
+            else {
+                const float scaler = 1.0f / (vertex_cache_size - 3);
+                score = std::pow(1.0f - (cache_position - 3) * scaler, cache_decay_power);
+            }
+        }
+
+        // Favour vertices with few triangles left so they get finished off
+        score += valence_boost_scale * std::pow(static_cast<float>(remaining_tris), -valence_boost_power);
+        return score;
+    }
+
+    struct WeldKey
+    {
+        int64_t values[8];
+
+        bool operator==(const WeldKey& other) const {
+            return memcmp(values, other.values, sizeof(values)) == 0;
+        }
+    };
+
+    struct WeldKeyHash
+    {
+        size_t operator()(const WeldKey& key) const {
+            uint64_t hash = 14695981039346656037ull;
+            for (int64_t value : key.values) {
+                hash ^= static_cast<uint64_t>(value);
+                hash *= 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    int64_t QuantizeComponent(float value, float epsilon) {
+        if (epsilon > 0.0f)
+            return static_cast<int64_t>(std::llround(value / epsilon));
+
+        // Exact compare on the bit pattern, with -0 folded into +0
+        if (value == 0.0f)
+            value = 0.0f;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+}
+
+float ComputeACMR(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size) {
+    if (indices.size() < 3)
+        return 0.0f;
+
+    // Each vertex remembers the miss counter value at which it entered the cache
+    std::vector<uint32_t> timestamps(vertex_count, 0);
+    uint32_t misses = 0;
+    for (uint32_t index : indices) {
+        if (timestamps[index] == 0 || misses - timestamps[index] >= cache_size) {
+            ++misses;
+            timestamps[index] = misses;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+void WeldVertices(ModelData& meshdata, float epsilon) {
+    std::unordered_map<WeldKey, uint32_t, WeldKeyHash> unique;
+    unique.reserve(meshdata.vertices.size());
+
+    std::vector<Vertex> welded;
+    welded.reserve(meshdata.vertices.size());
+    std::vector<uint32_t> remap(meshdata.vertices.size());
+
+    for (size_t i = 0; i < meshdata.vertices.size(); ++i) {
+        const Vertex& v = meshdata.vertices[i];
+        WeldKey key = { {
+            QuantizeComponent(v.pos.x, epsilon), QuantizeComponent(v.pos.y, epsilon),
+            QuantizeComponent(v.pos.z, epsilon),
+            QuantizeComponent(v.nrm.x, epsilon), QuantizeComponent(v.nrm.y, epsilon),
+            QuantizeComponent(v.nrm.z, epsilon),
+            QuantizeComponent(v.texCoord.x, epsilon), QuantizeComponent(v.texCoord.y, epsilon) } };
+
+        auto found = unique.emplace(key, static_cast<uint32_t>(welded.size()));
+        if (found.second)
+            welded.push_back(v);
+        remap[i] = found.first->second;
+    }
+
+    for (auto& index : meshdata.indicies)
+        index = remap[index];
+    meshdata.vertices = std::move(welded);
+}
+
+void OptimizeVertexCache(ModelData& meshdata) {
+    const std::vector<uint32_t>& indices = meshdata.indicies;
+    const size_t vertex_count = meshdata.vertices.size();
+    const size_t tri_count = indices.size() / 3;
+    if (tri_count == 0)
+        return;
+
+    // Triangle adjacency per vertex, stored as one flat array with offsets
+    std::vector<uint32_t> valence(vertex_count, 0);
+    for (uint32_t index : indices)
+        ++valence[index];
+
+    std::vector<uint32_t> adjacency_offset(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; ++v)
+        adjacency_offset[v + 1] = adjacency_offset[v] + valence[v];
+
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+        for (size_t t = 0; t < tri_count; ++t)
+            for (int k = 0; k < 3; ++k)
+                adjacency[fill[indices[3 * t + k]]++] = static_cast<uint32_t>(t);
+    }
+
+    // Triangles still to be emitted live at the front of each vertex's list
+    std::vector<uint32_t> remaining = valence;
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vertex_score(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+        vertex_score[v] = VertexScore(-1, remaining[v]);
+
+    std::vector<float> tri_score(tri_count);
+    for (size_t t = 0; t < tri_count; ++t)
+        tri_score[t] = vertex_score[indices[3 * t]] + vertex_score[indices[3 * t + 1]] +
+        vertex_score[indices[3 * t + 2]];
+
+    std::vector<bool> emitted(tri_count, false);
+    std::vector<uint32_t> order;
+    order.reserve(tri_count);
+
+    std::vector<uint32_t> cache;
+    std::vector<uint32_t> next_cache;
+    cache.reserve(vertex_cache_size + 3);
+    next_cache.reserve(vertex_cache_size + 3);
+
+    int64_t best_tri = -1;
+    size_t scan_cursor = 0;
+    while (order.size() < tri_count) {
+        if (best_tri < 0) {
+            // Nothing useful in the cache; continue from the next unused triangle
+            while (emitted[scan_cursor])
+                ++scan_cursor;
+            best_tri = static_cast<int64_t>(scan_cursor);
+        }
+
+        const uint32_t tri = static_cast<uint32_t>(best_tri);
+        emitted[tri] = true;
+        order.push_back(tri);
+
+        // Remove the triangle from its vertices' remaining lists
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[3 * tri + k];
+            uint32_t* list = &adjacency[adjacency_offset[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j) {
+                if (list[j] == tri) {
+                    std::swap(list[j], list[remaining[v] - 1]);
+                    break;
+                }
+            }
+            --remaining[v];
+        }
+
+        // New cache: the triangle's vertices first, then the old contents
+        next_cache.clear();
+        for (int k = 0; k < 3; ++k)
+            next_cache.push_back(indices[3 * tri + k]);
+        for (uint32_t v : cache)
+            if (v != next_cache[0] && v != next_cache[1] && v != next_cache[2])
+                next_cache.push_back(v);
+
+        // Vertices that fell out of the cache lose their position score
+        for (size_t i = vertex_cache_size; i < next_cache.size(); ++i)
+            cache_position[next_cache[i]] = -1;
+        if (next_cache.size() > vertex_cache_size)
+            next_cache.resize(vertex_cache_size);
+
+        for (size_t i = 0; i < next_cache.size(); ++i)
+            cache_position[next_cache[i]] = static_cast<int>(i);
+
+        // Push score changes to the triangles that are still waiting
+        auto rescore = [&](uint32_t v) {
+            float score = VertexScore(cache_position[v], remaining[v]);
+            float delta = score - vertex_score[v];
+            vertex_score[v] = score;
+            const uint32_t* list = &adjacency[adjacency_offset[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j)
+                tri_score[list[j]] += delta;
+        };
+        for (uint32_t v : cache)
+            if (cache_position[v] < 0)
+                rescore(v);
+        for (uint32_t v : next_cache)
+            rescore(v);
+
+        std::swap(cache, next_cache);
+
+        // Best candidate among the triangles touching the cache
+        best_tri = -1;
+        float best_score = -1.0f;
+        for (uint32_t v : cache) {
+            const uint32_t* list = &adjacency[adjacency_offset[v]];
+            for (uint32_t j = 0; j < remaining[v]; ++j) {
+                if (tri_score[list[j]] > best_score) {
+                    best_score = tri_score[list[j]];
+                    best_tri = list[j];
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> newIndices(indices.size());
+    std::vector<int32_t> newMatIndx(meshdata.matIndx.size());
+    for (size_t t = 0; t < tri_count; ++t) {
+        const uint32_t src = order[t];
+        for (int k = 0; k < 3; ++k)
+            newIndices[3 * t + k] = indices[3 * src + k];
+        if (src < meshdata.matIndx.size())
+            newMatIndx[t] = meshdata.matIndx[src];
+    }
+
+    meshdata.indicies = std::move(newIndices);
+    meshdata.matIndx = std::move(newMatIndx);
+}
+
+void OptimizeVertexFetch(ModelData& meshdata) {
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> remap(meshdata.vertices.size(), unused);
+    std::vector<Vertex> reordered;
+    reordered.reserve(meshdata.vertices.size());
+
+    for (auto& index : meshdata.indicies) {
+        if (remap[index] == unused) {
+            remap[index] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(meshdata.vertices[index]);
+        }
+        index = remap[index];
+    }
+
+    meshdata.vertices = std::move(reordered);
+}
+
+MeshOptimizeStats OptimizeMesh(ModelData& meshdata, float weld_epsilon) {
+    MeshOptimizeStats stats;
+    stats.vertices_before = meshdata.vertices.size();
+    stats.acmr_before = ComputeACMR(meshdata.indicies, meshdata.vertices.size());
+
+    if (meshdata.meshes.empty()) {
+        WeldVertices(meshdata, weld_epsilon);
+        OptimizeVertexCache(meshdata);
+        OptimizeVertexFetch(meshdata);
+    }
+    else {
+        // Kept meshes are optimized one by one so no vertex is shared across ranges
+        std::vector<ModelData> parts = meshdata.splitMeshes();
+        for (auto& part : parts) {
+            WeldVertices(part, weld_epsilon);
+            OptimizeVertexCache(part);
+            OptimizeVertexFetch(part);
+        }
+        meshdata.mergeMeshes(parts);
+    }
+
+    stats.vertices_after = meshdata.vertices.size();
+    stats.acmr_after = ComputeACMR(meshdata.indicies, meshdata.vertices.size());
+    return stats;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "ModelData.h"
+
+// Optional post import optimization of a ModelData.
+// Every step keeps matIndx in step with the triangles it moves, so the
+// emitter list built from the result in LoadModel stays consistent.
+
+struct MeshOptimizeStats
+{
+    size_t vertices_before = 0;
+    size_t vertices_after = 0;
+    float acmr_before = 0.0f;
+    float acmr_after = 0.0f;
+};
+
+//Average cache miss ratio (transformed vertices per triangle) for a FIFO post-transform cache
+float ComputeACMR(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = 16);
+
+//Merges vertices whose attributes are equal (epsilon == 0) or within epsilon of each other
+void WeldVertices(ModelData& meshdata, float epsilon = 0.0f);
+
+//Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+void OptimizeVertexCache(ModelData& meshdata);
+
+//Reorders vertices by first use in the index buffer; unreferenced vertices are dropped
+void OptimizeVertexFetch(ModelData& meshdata);
+
+//Runs all three steps above (per MeshRange when meshes are kept) and returns before/after numbers
+MeshOptimizeStats OptimizeMesh(ModelData& meshdata, float weld_epsilon = 0.0f);
@@ -0,0 +1,108 @@
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // Bounding sphere and normal cone of a finished meshlet
+    void ComputeMeshletBounds(const ModelData& meshdata, const MeshletData& result, Meshlet& meshlet) {
+        vec3 lo = meshdata.vertices[result.vertices[meshlet.vertexOffset]].pos;
+        vec3 hi = lo;
+        for (uint32_t i = 1; i < meshlet.vertexCount; ++i) {
+            const vec3& p = meshdata.vertices[result.vertices[meshlet.vertexOffset + i]].pos;
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+
+        meshlet.center = (lo + hi) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (uint32_t i = 0; i < meshlet.vertexCount; ++i) {
+            const vec3& p = meshdata.vertices[result.vertices[meshlet.vertexOffset + i]].pos;
+            meshlet.radius = std::max(meshlet.radius, glm::distance(meshlet.center, p));
+        }
+
+        // Cone axis is the average of the (unit) face normals
+        std::vector<vec3> normals;
+        normals.reserve(meshlet.triangleCount);
+        vec3 axis(0.0f);
+        for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+            const uint32_t tri = meshlet.triangleOffset + t;
+            const vec3& p0 = meshdata.vertices[meshdata.indicies[3 * tri + 0]].pos;
+            const vec3& p1 = meshdata.vertices[meshdata.indicies[3 * tri + 1]].pos;
+            const vec3& p2 = meshdata.vertices[meshdata.indicies[3 * tri + 2]].pos;
+            vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float len = glm::length(n);
+            if (len > 0.0f) {
+                normals.push_back(n / len);
+                axis += normals.back();
+            }
+        }
+
+        meshlet.coneAxis = vec3(0.0f, 0.0f, 1.0f);
+        meshlet.coneCutoff = 1.0f;
+        float axis_len = glm::length(axis);
+        if (normals.empty() || axis_len <= 0.0f)
+            return;
+        axis = axis / axis_len;
+
+        float min_dot = 1.0f;
+        for (const vec3& n : normals)
+            min_dot = std::min(min_dot, glm::dot(axis, n));
+
+        // A spread near 90 degrees can never be culled
+        meshlet.coneAxis = axis;
+        if (min_dot > 0.1f)
+            meshlet.coneCutoff = std::sqrt(1.0f - min_dot * min_dot);
+    }
+}
+
+MeshletData BuildMeshlets(const ModelData& meshdata, uint32_t max_vertices, uint32_t max_triangles) {
+    MeshletData result;
+    const size_t tri_count = meshdata.indicies.size() / 3;
+    result.triangles.resize(tri_count);
+
+    // Local index of each model vertex in the meshlet being built
+    const uint32_t unused = ~0u;
+    std::vector<uint32_t> local_index(meshdata.vertices.size(), unused);
+
+    Meshlet current = {};
+    auto finish = [&]() {
+        if (current.triangleCount == 0)
+            return;
+        ComputeMeshletBounds(meshdata, result, current);
+        for (uint32_t i = 0; i < current.vertexCount; ++i)
+            local_index[result.vertices[current.vertexOffset + i]] = unused;
+        result.meshlets.push_back(current);
+
+        current = {};
+        current.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+    };
+
+    for (size_t t = 0; t < tri_count; ++t) {
+        const uint32_t* tri = &meshdata.indicies[3 * t];
+
+        uint32_t new_vertices = 0;
+        for (int k = 0; k < 3; ++k)
+            if (local_index[tri[k]] == unused && (k < 1 || tri[k] != tri[0]) && (k < 2 || tri[k] != tri[1]))
+                ++new_vertices;
+
+        if (current.vertexCount + new_vertices > max_vertices || current.triangleCount + 1 > max_triangles)
+            finish();
+        if (current.triangleCount == 0)
+            current.triangleOffset = static_cast<uint32_t>(t);
+
+        uint32_t packed = 0;
+        for (int k = 0; k < 3; ++k) {
+            if (local_index[tri[k]] == unused) {
+                local_index[tri[k]] = current.vertexCount++;
+                result.vertices.push_back(tri[k]);
+            }
+            packed |= local_index[tri[k]] << (8 * k);
+        }
+        result.triangles[t] = packed;
+        ++current.triangleCount;
+    }
+    finish();
+
+    return result;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "ModelData.h"
+
+// Meshlets of a model for the mesh shader path of LightingPass.
+// Meshlets cover consecutive runs of triangles, so a meshlet's local
+// primitive i is triangle (triangleOffset + i) of the original index
+// buffer and matIndx stays valid without remapping.
+struct MeshletData
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> vertices;   // Model vertex index of every meshlet local vertex
+    std::vector<uint32_t> triangles;  // Per triangle local indices packed as i0 | i1 << 8 | i2 << 16
+};
+
+MeshletData BuildMeshlets(const ModelData& meshdata,
+    uint32_t max_vertices = MESHLET_MAX_VERTICES,
+    uint32_t max_triangles = MESHLET_MAX_TRIANGLES);
@@ -0,0 +1,162 @@
+#include "MipBuilder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_BUILDER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "ThreadPool.h"
+
+namespace {
+    constexpr int linear_to_srgb_steps = 4096;
+
+    struct SrgbTables
+    {
+        float to_linear[256];
+        uint8_t to_srgb[linear_to_srgb_steps + 1];
+
+        SrgbTables() {
+            for (int i = 0; i < 256; ++i) {
+                float c = i / 255.0f;
+                to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            for (int i = 0; i <= linear_to_srgb_steps; ++i) {
+                float l = static_cast<float>(i) / linear_to_srgb_steps;
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                to_srgb[i] = static_cast<uint8_t>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+            }
+        }
+    };
+
+    const SrgbTables& Tables() {
+        static const SrgbTables tables;
+        return tables;
+    }
+
+    // Both filters give the same texels, bit for bit: the levels are cached, and the
+    // cache doesn't know which build wrote them. Colour sums pair up the same way and
+    // round half up (add 0.5, truncate); alpha is averaged in integers.
+
+    // Averages the four source pixels of one destination pixel
+    inline void FilterPixelScalar(const SrgbTables& t, const uint8_t* p0, const uint8_t* p1,
+        const uint8_t* p2, const uint8_t* p3, uint8_t* out) {
+        for (int c = 0; c < 3; ++c) {
+            float sum = (t.to_linear[p0[c]] + t.to_linear[p1[c]]) + (t.to_linear[p2[c]] + t.to_linear[p3[c]]);
+            out[c] = t.to_srgb[static_cast<int>(sum * (0.25f * linear_to_srgb_steps) + 0.5f)];
+        }
+        out[3] = static_cast<uint8_t>((p0[3] + p1[3] + p2[3] + p3[3] + 2) >> 2);
+    }
+
+#ifdef MIP_BUILDER_SSE2
+    inline void FilterPixelSse2(const SrgbTables& t, const uint8_t* p0, const uint8_t* p1,
+        const uint8_t* p2, const uint8_t* p3, uint8_t* out) {
+        // Lanes are r, g, b and an unused one; the table lookups stay scalar
+        auto load = [&](const uint8_t* p) {
+            return _mm_set_ps(0.0f, t.to_linear[p[2]], t.to_linear[p[1]], t.to_linear[p[0]]);
+        };
+        __m128 sum = _mm_add_ps(_mm_add_ps(load(p0), load(p1)), _mm_add_ps(load(p2), load(p3)));
+        __m128 scaled = _mm_mul_ps(sum, _mm_set1_ps(0.25f * linear_to_srgb_steps));
+        __m128i index = _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(0.5f)));
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), index);
+        out[0] = t.to_srgb[lanes[0]];
+        out[1] = t.to_srgb[lanes[1]];
+        out[2] = t.to_srgb[lanes[2]];
+        out[3] = static_cast<uint8_t>((p0[3] + p1[3] + p2[3] + p3[3] + 2) >> 2);
+    }
+#endif
+
+    inline void FilterPixel(const SrgbTables& t, const uint8_t* p0, const uint8_t* p1,
+        const uint8_t* p2, const uint8_t* p3, uint8_t* out) {
+#ifdef MIP_BUILDER_SSE2
+        FilterPixelSse2(t, p0, p1, p2, p3, out);
+#else
+        FilterPixelScalar(t, p0, p1, p2, p3, out);
+#endif
+    }
+
+#if defined(MIP_BUILDER_SSE2) && !defined(NDEBUG)
+    // Debug builds check once that the two filters agree on every 2x2 block of
+    // a ramp image; every channel steps through all 256 values
+    bool FiltersAgree(const SrgbTables& t) {
+        const uint32_t width = 64, height = 64;
+        std::vector<uint8_t> ramp(width * height * 4);
+        for (uint32_t y = 0; y < height; ++y) {
+            for (uint32_t x = 0; x < width; ++x) {
+                uint8_t* p = &ramp[(y * width + x) * 4];
+                p[0] = static_cast<uint8_t>(x * 4 + y);
+                p[1] = static_cast<uint8_t>(y * 4 + x);
+                p[2] = static_cast<uint8_t>(x + y * width);
+                p[3] = static_cast<uint8_t>(255 - (x * 3 + y * 5));
+            }
+        }
+        for (uint32_t y = 0; y + 1 < height; ++y) {
+            for (uint32_t x = 0; x + 1 < width; ++x) {
+                const uint8_t* p0 = &ramp[(y * width + x) * 4];
+                const uint8_t* p2 = p0 + width * 4;
+                uint8_t scalar[4], sse2[4];
+                FilterPixelScalar(t, p0, p0 + 4, p2, p2 + 4, scalar);
+                FilterPixelSse2(t, p0, p0 + 4, p2, p2 + 4, sse2);
+                if (memcmp(scalar, sse2, sizeof(scalar)) != 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+#endif
+}
+
+TextureLevels BuildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, ThreadPool& pool) {
+    const SrgbTables& tables = Tables();
+#if defined(MIP_BUILDER_SSE2) && !defined(NDEBUG)
+    static const bool filters_agree = FiltersAgree(tables);
+    assert(filters_agree && "SSE2 and scalar mip filters differ");
+#endif
+
+    TextureLevels result;
+    result.format = TextureFormat::RGBA8;
+    uint32_t levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    uint64_t size = 0;
+    for (uint32_t l = 0; l < levelCount; ++l) {
+        uint32_t w = std::max(1u, width >> l), h = std::max(1u, height >> l);
+        uint64_t levelSize = TextureLevelSize(TextureFormat::RGBA8, w, h);
+        result.levels.push_back({ w, h, size, levelSize });
+        size = (size + levelSize + 15) & ~uint64_t(15);
+    }
+    result.data.resize(size);
+    memcpy(result.data.data(), rgba, result.levels[0].size);
+
+    for (uint32_t l = 1; l < levelCount; ++l) {
+        const TextureLevels::Level& src = result.levels[l - 1];
+        const TextureLevels::Level& dst = result.levels[l];
+        const uint8_t* source = result.data.data() + src.offset;
+        uint8_t* dest = result.data.data() + dst.offset;
+
+        const uint32_t rowsPerJob = std::max(1u, 65536u / dst.width);
+        std::vector<std::future<void>> jobs;
+        for (uint32_t firstRow = 0; firstRow < dst.height; firstRow += rowsPerJob) {
+            uint32_t lastRow = std::min(dst.height, firstRow + rowsPerJob);
+            jobs.push_back(pool.Submit([=, &tables]() {
+                for (uint32_t y = firstRow; y < lastRow; ++y) {
+                    const uint8_t* row0 = source + size_t(std::min(2 * y, src.height - 1)) * src.width * 4;
+                    const uint8_t* row1 = source + size_t(std::min(2 * y + 1, src.height - 1)) * src.width * 4;
+                    uint8_t* out = dest + size_t(y) * dst.width * 4;
+                    for (uint32_t x = 0; x < dst.width; ++x) {
+                        uint32_t x0 = std::min(2 * x, src.width - 1) * 4;
+                        uint32_t x1 = std::min(2 * x + 1, src.width - 1) * 4;
+                        FilterPixel(tables, row0 + x0, row0 + x1, row1 + x0, row1 + x1, out + 4 * x);
+                    }
+                }
+                }));
+        }
+        for (auto& job : jobs)
+            job.get();
+    }
+    return result;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "TextureCompress.h"
+
+class ThreadPool;
+
+// How mip chains of RGBA8 textures are made
+enum class MipGeneration : uint32_t
+{
+    GpuBlit = 0,  // vkCmdBlitImage chain at every start (ImageWrap::GenerateMipMaps)
+    Cpu = 1       // BuildMipChain at import, cached with the texture
+};
+
+//Builds the full mip chain of an sRGB encoded RGBA8 image with a gamma correct
+//2x2 box filter: colour is averaged in linear space, alpha as is. Odd edges are
+//clamped. Rows of each level are spread over the pool's workers, and each pixel
+//is filtered with SSE2 where available, to the same texels as without it.
+TextureLevels BuildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, ThreadPool& pool);
@@ -0,0 +1,84 @@
+#include "ModelData.h"
+
+#include <unordered_map>
+#include <cstring>
+
+#include "Util.h"
+
+std::vector<ModelData> ModelData::splitMeshes() const {
+    std::vector<ModelData> parts(meshes.size());
+    for (size_t m = 0; m < meshes.size(); ++m) {
+        const MeshRange& range = meshes[m];
+        ModelData& part = parts[m];
+        part.vertices.assign(vertices.begin() + range.firstVertex,
+            vertices.begin() + range.firstVertex + range.vertexCount);
+        part.indicies.reserve(range.indexCount);
+        for (uint32_t i = 0; i < range.indexCount; ++i)
+            part.indicies.push_back(indicies[range.firstIndex + i] - range.firstVertex);
+        part.matIndx.assign(matIndx.begin() + range.firstIndex / 3,
+            matIndx.begin() + (range.firstIndex + range.indexCount) / 3);
+        part.materials = materials;
+    }
+    return parts;
+}
+
+void ModelData::mergeMeshes(const std::vector<ModelData>& parts) {
+    vertices.clear();
+    indicies.clear();
+    matIndx.clear();
+    meshes.clear();
+    for (const auto& part : parts) {
+        MeshRange range;
+        range.firstVertex = static_cast<uint32_t>(vertices.size());
+        range.vertexCount = static_cast<uint32_t>(part.vertices.size());
+        range.firstIndex = static_cast<uint32_t>(indicies.size());
+        range.indexCount = static_cast<uint32_t>(part.indicies.size());
+        meshes.push_back(range);
+
+        vertices.insert(vertices.end(), part.vertices.begin(), part.vertices.end());
+        for (uint32_t index : part.indicies)
+            indicies.push_back(index + range.firstVertex);
+        matIndx.insert(matIndx.end(), part.matIndx.begin(), part.matIndx.end());
+    }
+}
+
+namespace {
+    bool SameMesh(const ModelData& a, const ModelData& b) {
+        return a.vertices.size() == b.vertices.size() &&
+            a.indicies == b.indicies &&
+            a.matIndx == b.matIndx &&
+            memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0;
+    }
+}
+
+void ModelData::deduplicateMeshes() {
+    std::vector<ModelData> parts = splitMeshes();
+    std::vector<ModelData> unique;
+    std::vector<uint32_t> remap(parts.size());
+    std::unordered_multimap<uint64_t, uint32_t> seen;
+
+    for (size_t m = 0; m < parts.size(); ++m) {
+        const ModelData& part = parts[m];
+        uint64_t hash = HashBytes(part.vertices.data(), part.vertices.size() * sizeof(Vertex));
+        hash = HashBytes(part.indicies.data(), part.indicies.size() * sizeof(uint32_t), hash);
+        hash = HashBytes(part.matIndx.data(), part.matIndx.size() * sizeof(int32_t), hash);
+
+        remap[m] = static_cast<uint32_t>(unique.size());
+        bool found = false;
+        auto candidates = seen.equal_range(hash);
+        for (auto it = candidates.first; it != candidates.second && !found; ++it) {
+            if (SameMesh(unique[it->second], part)) {
+                remap[m] = it->second;
+                found = true;
+            }
+        }
+        if (!found) {
+            seen.emplace(hash, remap[m]);
+            unique.push_back(std::move(parts[m]));
+        }
+    }
+
+    for (auto& instance : instances)
+        instance.mesh = remap[instance.mesh];
+    mergeMeshes(unique);
+}
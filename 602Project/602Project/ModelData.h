@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+// A run of a ModelData's arrays holding one Assimp mesh.
+// Indices stay relative to the whole vertex array.
+struct MeshRange
+{
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;  // Also 3 * first entry of matIndx
+    uint32_t indexCount;
+};
+
+// A placement of one MeshRange by its node transform
+struct MeshInstance
+{
+    mat4 transform;
+    uint32_t mesh;  // Index into ModelData::meshes
+};
+
+// CPU side copy of a model, as produced by Assimp (or the mesh cache)
+// and consumed by Graphics::LoadModel.
+// Normally every mesh is flattened into the arrays with its node transform
+// baked in. With keep_meshes, the arrays instead hold each distinct mesh
+// once in its own space, listed in meshes and placed by instances.
+struct ModelData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indicies;
+    std::vector<Material> materials;
+    std::vector<int32_t>     matIndx;
+    std::vector<std::string> textures;
+
+    std::vector<MeshRange> meshes;
+    std::vector<MeshInstance> instances;
+
+    void readAssimpFile(const std::string& path, const mat4& M, bool keep_meshes = false);
+
+    //One ModelData per entry of meshes, with local indices and a copy of the materials
+    std::vector<ModelData> splitMeshes() const;
+
+    //Replaces the arrays and meshes with the concatenation of parts; instances are kept
+    void mergeMeshes(const std::vector<ModelData>& parts);
+
+    //Folds meshes with identical contents into one, so their instances share it
+    void deduplicateMeshes();
+};
@@ -5,7 +5,7 @@
 
 void NeighbourMax::SetupBuffer() {
     m_buffer.CreateTextureSampler();
-	m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+	p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::Tiles);
 }
 
 void NeighbourMax::SetupDescriptor() {
@@ -13,20 +13,15 @@ void NeighbourMax::SetupDescriptor() {
         {0, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {1, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute} });
 }
 
 void NeighbourMax::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantNeighbourMax));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -48,11 +43,11 @@ void NeighbourMax::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-NeighbourMax::NeighbourMax(Graphics* _p_gfx, RenderPass* _p_prev_pass) : 
-    RenderPass(_p_gfx, _p_prev_pass),
+NeighbourMax::NeighbourMax(Graphics* _p_gfx) : 
+    RenderPass(_p_gfx),
     m_buffer(p_gfx->GetWindowSize().x / TileMaxPass::tile_size, 
              p_gfx->GetWindowSize().y / TileMaxPass::tile_size,
-    vk::Format::eR32G32B32A32Sfloat,
+    TargetFormat(TargetKind::Tiles),
     vk::ImageUsageFlagBits::eTransferDst |
     vk::ImageUsageFlagBits::eSampled |
     vk::ImageUsageFlagBits::eStorage |
@@ -60,12 +55,13 @@ NeighbourMax::NeighbourMax(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
     vk::ImageUsageFlagBits::eColorAttachment,
     vk::ImageAspectFlagBits::eColor,
     vk::MemoryPropertyFlagBits::eDeviceLocal,
-    1, p_gfx), m_push_consts() {
+    1, p_gfx, false), m_push_consts() {
     SetupBuffer();
     SetupDescriptor();
 
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantNeighbourMax));
 }
 
 NeighbourMax::~NeighbourMax() {
@@ -76,57 +72,44 @@ NeighbourMax::~NeighbourMax() {
     m_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void NeighbourMax::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("neighbour_max", m_buffer);
+    p_tile_max_buffer = &builder.Read("tile_max", stages);
+    builder.Write("neighbour_max", stages);
+    builder.AsyncCompute();
+}
+
+void NeighbourMax::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x / TileMaxPass::tile_size, p_gfx->GetWindowSize().y / TileMaxPass::tile_size);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void NeighbourMax::Setup() {
-    m_descriptor.write(p_gfx->GetDeviceRef(), 0,
-        static_cast<TileMaxPass*>(p_prev_pass)->GetBuffer().Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 0, p_tile_max_buffer->Descriptor());
     m_descriptor.write(p_gfx->GetDeviceRef(), 1, m_buffer.Descriptor());
-    SetupPipeline();
+    m_descriptor.write(p_gfx->GetDeviceRef(), 2, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantNeighbourMax));
+    if (!m_pipeline)
+        SetupPipeline();
+}
+void NeighbourMax::UpdateParams() {
+    p_gfx->WriteParams(m_params_region, m_push_consts);
 }
-void NeighbourMax::Render() {
-    TileMaxPass* p_prev_tilemax_pass = static_cast<TileMaxPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_prev_tilemax_pass->GetBuffer().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
 
+void NeighbourMax::Render() {
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0,
-        sizeof(PushConstantNeighbourMax),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     p_gfx->GetCommandBuffer().dispatch(
-        (p_gfx->GetWindowSize().x / TileMaxPass::tile_size),
-        (p_gfx->GetWindowSize().y / TileMaxPass::tile_size), 1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+        (p_gfx->GetRenderSize().x / TileMaxPass::tile_size),
+        (p_gfx->GetRenderSize().y / TileMaxPass::tile_size), 1);
 }
 
 void NeighbourMax::Teardown()
@@ -14,11 +14,18 @@ private:
 	void SetupPipeline();
 
 	PushConstantNeighbourMax m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
+
+	const ImageWrap* p_tile_max_buffer = nullptr;
 public:
-	NeighbourMax(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	NeighbourMax(Graphics* _p_gfx);
 	~NeighbourMax();
 
+	void Declare(RenderGraph::Builder& builder) override;
+
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
@@ -0,0 +1,101 @@
+#include "ParallelRecorder.h"
+
+#include <stdexcept>
+
+// The secondary a job is recording on this thread
+static thread_local vk::CommandBuffer t_cmd_buffer;
+
+void ParallelRecorder::Init(vk::Device device, uint32_t graphics_family, uint32_t compute_family,
+    uint32_t frame_count, uint32_t thread_count) {
+    m_device = device;
+    m_threads.resize(thread_count);
+    for (auto& thread : m_threads) {
+        thread.pools.resize(frame_count * 2);
+        for (size_t i = 0; i < thread.pools.size(); ++i) {
+            thread.pools[i].pool = m_device.createCommandPool(vk::CommandPoolCreateInfo(
+                vk::CommandPoolCreateFlagBits::eTransient, i % 2 ? compute_family : graphics_family));
+        }
+    }
+    m_workers = std::make_unique<ThreadPool>(thread_count);
+}
+
+void ParallelRecorder::Destroy() {
+    // Joins the workers first
+    m_workers.reset();
+    for (auto& thread : m_threads) {
+        for (auto& pool : thread.pools)
+            m_device.destroyCommandPool(pool.pool);
+    }
+    m_threads.clear();
+    m_slots.clear();
+}
+
+void ParallelRecorder::BeginFrame(uint32_t frame) {
+    m_frame = frame;
+    for (auto& thread : m_threads) {
+        for (uint32_t i = 0; i < 2; ++i) {
+            Pool& pool = thread.pools[frame * 2 + i];
+            if (pool.used)
+                m_device.resetCommandPool(pool.pool);
+            pool.used = 0;
+        }
+    }
+}
+
+std::future<vk::CommandBuffer> ParallelRecorder::Record(bool compute,
+    const vk::CommandBufferInheritanceInfo& inheritance, std::function<void()> record) {
+    uint32_t frame = m_frame;
+    return m_workers->Submit([this, frame, compute, inheritance, record]() {
+        Pool& pool = ThisThread().pools[frame * 2 + (compute ? 1 : 0)];
+        if (pool.used == pool.cmds.size()) {
+            pool.cmds.push_back(m_device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(
+                pool.pool, vk::CommandBufferLevel::eSecondary, 1)).front());
+        }
+        vk::CommandBuffer cmd = pool.cmds[pool.used++];
+        RecordOn(cmd, true, inheritance, record);
+        return cmd;
+        });
+}
+
+std::future<vk::CommandBuffer> ParallelRecorder::Record(vk::CommandBuffer cmd,
+    const vk::CommandBufferInheritanceInfo& inheritance, std::function<void()> record) {
+    return m_workers->Submit([cmd, inheritance, record]() {
+        RecordOn(cmd, false, inheritance, record);
+        return cmd;
+        });
+}
+
+void ParallelRecorder::RecordOn(vk::CommandBuffer cmd, bool one_time,
+    const vk::CommandBufferInheritanceInfo& inheritance, const std::function<void()>& record) {
+    vk::CommandBufferUsageFlags usage;
+    if (one_time)
+        usage |= vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+    if (inheritance.renderPass)
+        usage |= vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    cmd.begin(vk::CommandBufferBeginInfo(usage, &inheritance));
+    t_cmd_buffer = cmd;
+    try {
+        record();
+    }
+    catch (...) {
+        t_cmd_buffer = nullptr;
+        throw;
+    }
+    t_cmd_buffer = nullptr;
+    cmd.end();
+}
+
+const vk::CommandBuffer& ParallelRecorder::GetCommandBuffer() {
+    return t_cmd_buffer;
+}
+
+ParallelRecorder::Thread& ParallelRecorder::ThisThread() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto slot = m_slots.find(std::this_thread::get_id());
+    if (slot == m_slots.end()) {
+        if (m_slots.size() == m_threads.size())
+            throw std::runtime_error("parallel recorder: more threads than pools!");
+        slot = m_slots.emplace(std::this_thread::get_id(), static_cast<uint32_t>(m_slots.size())).first;
+    }
+    return m_threads[slot->second];
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "ThreadPool.h"
+
+/*
+* Records work into secondary command buffers on a pool of worker threads.
+* Every worker has its own command pool per frame in flight and queue family
+* (graphics and async compute), so recording takes no locks; BeginFrame resets
+* a frame's pools together once the GPU is done with that frame, and their
+* command buffers are reused from then on.
+*
+* While a job runs, GetCommandBuffer() on its thread returns the secondary
+* it records into, which is how Graphics::GetCommandBuffer hands it to the
+* passes. The caller stitches the results into the primary in order with
+* executeCommands.
+*/
+class ParallelRecorder
+{
+public:
+	void Init(vk::Device device, uint32_t graphics_family, uint32_t compute_family,
+		uint32_t frame_count, uint32_t thread_count);
+	void Destroy();
+
+	//Resets the frame's pools; no job may be running and the GPU must be done
+	//with the frame's previous submission
+	void BeginFrame(uint32_t frame);
+
+	//Queues record on a worker. inheritance.renderPass is set for work that goes
+	//inside a render pass the primary begins. The secondary is ended when the
+	//future is ready.
+	std::future<vk::CommandBuffer> Record(bool compute, const vk::CommandBufferInheritanceInfo& inheritance,
+		std::function<void()> record);
+	//Queues record into cmd, a secondary the caller owns and keeps between
+	//frames, so it isn't begun as one time submit
+	std::future<vk::CommandBuffer> Record(vk::CommandBuffer cmd, const vk::CommandBufferInheritanceInfo& inheritance,
+		std::function<void()> record);
+
+	//Begins cmd, runs record with cmd as this thread's GetCommandBuffer() and
+	//ends it. What the workers run, and how the main thread records a kept
+	//secondary without them.
+	static void RecordOn(vk::CommandBuffer cmd, bool one_time, const vk::CommandBufferInheritanceInfo& inheritance,
+		const std::function<void()>& record);
+
+	//The secondary being recorded on this thread, or null
+	static const vk::CommandBuffer& GetCommandBuffer();
+
+	uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+private:
+	struct Pool
+	{
+		vk::CommandPool pool;
+		std::vector<vk::CommandBuffer> cmds;
+		uint32_t used = 0;  // Since the last reset
+	};
+
+	//A worker's pools, indexed by frame * 2 + (compute ? 1 : 0)
+	struct Thread
+	{
+		std::vector<Pool> pools;
+	};
+
+	//The calling worker's pools; each worker gets a slot the first time it records
+	Thread& ThisThread();
+
+	vk::Device m_device;
+	uint32_t m_frame = 0;
+	std::vector<Thread> m_threads;
+	std::unique_ptr<ThreadPool> m_workers;
+
+	std::mutex m_mutex;  // Guards the slot lookup
+	std::unordered_map<std::thread::id, uint32_t> m_slots;
+};
@@ -4,16 +4,15 @@
 
 #include "PreDOFPass.h"
 #include "TileMaxPass.h"
-#include "LightingPass.h"
 #include "DOFPass.h"
 
 
 void PreDOFPass::SetupBuffer() {
     m_buffer.CreateTextureSampler();
-    m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::ColorDepth);
 
     m_params_buffer.CreateTextureSampler();
-    m_params_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+    p_gfx->GetRenderTargets().AddTransient(m_params_buffer, TargetKind::CocParams);
 }
 
 void PreDOFPass::SetupDescriptor() {
@@ -27,20 +26,15 @@ void PreDOFPass::SetupDescriptor() {
         {3, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {4, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {5, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute} });
 }
 
 void PreDOFPass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantPreDoF));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -62,10 +56,10 @@ void PreDOFPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-PreDOFPass::PreDOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : 
-    RenderPass(_p_gfx, _p_prev_pass),
+PreDOFPass::PreDOFPass(Graphics* _p_gfx) : 
+    RenderPass(_p_gfx),
     m_buffer(p_gfx->GetWindowSize().x/2, p_gfx->GetWindowSize().y/2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::ColorDepth),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -73,9 +67,9 @@ PreDOFPass::PreDOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     m_params_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::CocParams),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -83,7 +77,7 @@ PreDOFPass::PreDOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     m_push_consts(), enabled(true) {
     m_push_consts.lens_diameter = 0.035f;
     m_push_consts.focal_length = 0.05f;
@@ -92,6 +86,7 @@ PreDOFPass::PreDOFPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
     m_push_consts.soft_z_extent = 0.35f;
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantPreDoF));
     SetupBuffer();
     SetupDescriptor();
 }
@@ -105,85 +100,65 @@ PreDOFPass::~PreDOFPass() {
     m_params_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void PreDOFPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("pre_dof", m_buffer);
+    builder.Output("pre_dof_params", m_params_buffer);
+    p_color_buffer = &builder.Read("color", stages);
+    p_depth_buffer = &builder.Read("depth", stages);
+    p_neighbour_max_buffer = &builder.Read("neighbour_max", stages);
+    builder.Write("pre_dof", stages);
+    builder.Write("pre_dof_params", stages);
+    builder.AsyncCompute();
+}
+
+void PreDOFPass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_params_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void PreDOFPass::Setup() {
     WriteToDescriptor(0, m_buffer.Descriptor());
     WriteToDescriptor(1, m_params_buffer.Descriptor());
-    WriteToDescriptor(2,
-        static_cast<LightingPass*>(p_prev_pass)->GetBufferRef().Descriptor());
-    WriteToDescriptor(3,
-        static_cast<LightingPass*>(p_prev_pass)->GetVeloDepthBufferRef().Descriptor());
-    WriteToDescriptor(4, neighbour_max_buffer_desc);
-    SetupPipeline();
+    WriteToDescriptor(2, p_color_buffer->Descriptor());
+    WriteToDescriptor(3, p_depth_buffer->Descriptor());
+    WriteToDescriptor(4, p_neighbour_max_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 5, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantPreDoF));
+    if (!m_pipeline)
+        SetupPipeline();
 }
 
-void PreDOFPass::Render() {
-    if (not enabled)
-        return;
-    
-    //Set the push consts based on DOF params
+void PreDOFPass::UpdateParams() {
+    //Set the params based on DOF params
     m_push_consts.coc_sample_scale = p_dof_pass->GetDOFParams().coc_sample_scale;
     m_push_consts.focal_length = p_dof_pass->GetDOFParams().focal_length;
     m_push_consts.focal_distance = p_dof_pass->GetDOFParams().focal_distance;
     m_push_consts.lens_diameter = p_dof_pass->GetDOFParams().lens_diameter;
     m_push_consts.soft_z_extent = p_dof_pass->GetDOFParams().soft_z_extent;
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+}
 
-
-    LightingPass* p_prev_lighting_pass = static_cast<LightingPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_prev_lighting_pass->GetBufferRef().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    // Select the compute shader, and its descriptor set and push constant
+void PreDOFPass::Render() {
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
+    // Select the compute shader and its descriptor set
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0,
-        sizeof(PushConstantPreDoF),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     // This MUST match the shaders's line:
     //    layout(local_size_x=GROUP_SIZE, local_size_y=1, local_size_z=1) in;
     int GROUP_SIZE = 32;
     p_gfx->GetCommandBuffer().dispatch(
-        (p_gfx->GetWindowSize().x / 2)/GROUP_SIZE,
-        (p_gfx->GetWindowSize().y / 2)/GROUP_SIZE, 
+        (p_gfx->GetRenderSize().x / 2)/GROUP_SIZE,
+        (p_gfx->GetRenderSize().y / 2)/GROUP_SIZE, 
         1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
     
-    img_mem_barrier.setImage(m_params_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
 }
 
 void PreDOFPass::Teardown() {
@@ -193,10 +168,6 @@ void PreDOFPass::WriteToDescriptor(glm::uint index, const vk::DescriptorImageInf
     m_descriptor.write(p_gfx->GetDeviceRef(), index, img_desc_info);
 }
 
-void PreDOFPass::SetNeighbourMaxBufferDesc(const ImageWrap& buffer) {
-    neighbour_max_buffer_desc = buffer.Descriptor();
-}
-
 void PreDOFPass::SetDOFPass(DOFPass* _p_dof_pass) {
     p_dof_pass = _p_dof_pass;
 }
@@ -9,6 +9,7 @@ private:
 	void SetupBuffer();
 
 	PushConstantPreDoF m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 
 	DescriptorWrap m_descriptor;
 	void SetupDescriptor();
@@ -17,26 +18,30 @@ private:
 	vk::Pipeline m_pipeline;
 	void SetupPipeline();
 
-	vk::DescriptorImageInfo neighbour_max_buffer_desc;
+	const ImageWrap* p_color_buffer = nullptr;
+	const ImageWrap* p_depth_buffer = nullptr;
+	const ImageWrap* p_neighbour_max_buffer = nullptr;
 
 	bool enabled;
 
 	class DOFPass* p_dof_pass;
 public:
-	PreDOFPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	PreDOFPass(Graphics* _p_gfx);
 	~PreDOFPass();
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
 	void WriteToDescriptor(glm::uint index, const vk::DescriptorImageInfo img_desc_info);
-	void SetNeighbourMaxBufferDesc(const ImageWrap& buffer);
-
 	void SetDOFPass(DOFPass* _p_dof_pass);
 
 	const ImageWrap& GetBuffer() const;
 	const ImageWrap& GetParamsBuffer() const;
 
 	void DrawGUI();
+	bool IsEnabled() const override { return enabled; }
 };
 
@@ -3,7 +3,6 @@
 #include "Graphics.h"
 
 #include "RayCastPass.h"
-#include "RayMaskPass.h"
 #include "LightingPass.h"
 #include "DOFPass.h"
 #include "Camera.h"
@@ -29,14 +28,23 @@ BlasInput ObjectToVkGeometryKHR(const ObjData& model, const vk::Device& device)
 
     // Describe buffer as array of Vertex.
     vk::AccelerationStructureGeometryTrianglesDataKHR triangles;
-    triangles.setVertexFormat(vk::Format::eR32G32B32A32Sfloat);  // vec3 vertex position data.
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+    triangles.setVertexFormat(vk::Format::eR16G16B16A16Snorm);  // Bounds relative position.
+#else
+    triangles.setVertexFormat(vk::Format::eR32G32B32Sfloat);  // vec3 vertex position data.
+#endif
     triangles.vertexData.deviceAddress = vertexAddress;
-    triangles.setVertexStride(sizeof(Vertex));
+    triangles.setVertexStride(sizeof(GpuVertex));
     // Describe index data (32-bit unsigned int)
     triangles.setIndexType(vk::IndexType::eUint32);
     triangles.indexData.deviceAddress = indexAddress;
-    // Indicate identity transform by setting transformData to null device pointer.
-    //triangles.transformData = {};
+    // Identity transform (null device pointer) unless positions are quantized,
+    // then the object's transform buffer expands them back to object space.
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+    vk::BufferDeviceAddressInfo _b3;
+    _b3.setBuffer(model.transformBuffer.buffer);
+    triangles.transformData.deviceAddress = device.getBufferAddress(&_b3);
+#endif
     triangles.setMaxVertex(model.nbVertices);
 
     // Identify the above data as containing opaque triangles.
@@ -69,6 +77,11 @@ void RayCastPass::SetupBuffer() {
     m_buffer_nd.TransitionImageLayout(vk::ImageLayout::eGeneral);
     m_buffer_nd_prev.CreateTextureSampler();
     m_buffer_nd_prev.TransitionImageLayout(vk::ImageLayout::eGeneral);
+
+    p_gfx->GetRenderTargets().AddPersistent(m_buffer_bg, TargetKind::Color);
+    p_gfx->GetRenderTargets().AddPersistent(m_buffer_bg_prev, TargetKind::Color);
+    p_gfx->GetRenderTargets().AddPersistent(m_buffer_nd, TargetKind::NormalDepth);
+    p_gfx->GetRenderTargets().AddPersistent(m_buffer_nd_prev, TargetKind::NormalDepth);
 }
 
 void RayCastPass::CreateRaytraceAS() {
@@ -116,6 +129,12 @@ void RayCastPass::SetupDescriptor() {
         {4, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eRaygenKHR},
         {5, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eRaygenKHR},
+        {6, vk::DescriptorType::eStorageBuffer, 1,
+         vk::ShaderStageFlagBits::eRaygenKHR},
+        {7, vk::DescriptorType::eStorageBuffer, 1,
+         vk::ShaderStageFlagBits::eRaygenKHR},
+        {8, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eRaygenKHR}
         });
 }
@@ -172,17 +191,8 @@ void RayCastPass::SetupPipeline() {
 
     ////////////////////////////////////////////////////////////////////////////////////////////
     // Create the ray tracing pipeline layout.
-    // Push constant: we want to be able to update constants used by the shaders
-    vk::PushConstantRange pushConstant;
-    pushConstant.setStageFlags(vk::ShaderStageFlagBits::eRaygenKHR | 
-                               vk::ShaderStageFlagBits::eClosestHitKHR | 
-                               vk::ShaderStageFlagBits::eMissKHR);
-    pushConstant.setOffset(0);
-    pushConstant.setSize(sizeof(PushConstantRay));
-
+    // The constants used by the shaders are in the parameter buffer (binding 8)
     vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstant;
 
     // Descriptor sets: one specific to ray tracing, and one shared with the rasterization pipeline
     std::vector<vk::DescriptorSetLayout> rtDescSetLayouts =
@@ -269,14 +279,11 @@ void RayCastPass::CreateRtShaderBindingTable() {
         0, handleCount, dataSize, handles.data());
     assert(result == vk::Result::eSuccess);
 
-    // Allocate a buffer for storing the SBT, and a staging buffer for transferring data to it.
+    // Allocate a buffer for storing the SBT; the uploader stages the handles into it
     vk::DeviceSize sbtSize = m_rgen_region.size + m_miss_region.size
         + m_hit_region.size + m_call_region.size;
 
-    BufferWrap staging = p_gfx->CreateBufferWrap(sbtSize, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible
-        | vk::MemoryPropertyFlagBits::eHostCoherent);
-
+    DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), "RayCastPass");
     m_shaderBindingTableBW = p_gfx->CreateBufferWrap(sbtSize,
         vk::BufferUsageFlagBits::eTransferDst
         | vk::BufferUsageFlagBits::eShaderDeviceAddress
@@ -295,40 +302,38 @@ void RayCastPass::CreateRtShaderBindingTable() {
     // Helper to retrieve the handle data
     auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
 
-    // Map the SBT buffer and write in the handles.
-    uint8_t* mappedMemAddress;
-    p_gfx->GetDeviceRef().mapMemory(staging.memory, 0, sbtSize, vk::MemoryMapFlags(), (void**)&mappedMemAddress);
-    uint8_t offset = 0;
+    // Lay the handles out in the SBT's regions
+    std::vector<uint8_t> sbt(sbtSize, 0);
+    uint8_t* sbtData = sbt.data();
+    vk::DeviceSize offset = 0;
 
     // Raygen
     uint32_t handleIdx{ 0 };
-    memcpy(mappedMemAddress + offset, getHandle(handleIdx++), handleSize);
+    memcpy(sbtData + offset, getHandle(handleIdx++), handleSize);
 
     // Miss
     offset = m_rgen_region.size;
     for (uint32_t c = 0; c < missCount; c++) {
-        memcpy(mappedMemAddress + offset, getHandle(handleIdx++), handleSize);
+        memcpy(sbtData + offset, getHandle(handleIdx++), handleSize);
         offset += m_miss_region.stride;
     }
 
     // Hit
     offset = m_rgen_region.size + m_miss_region.size;
     for (uint32_t c = 0; c < hitCount; c++) {
-        memcpy(mappedMemAddress + offset, getHandle(handleIdx++), handleSize);
+        memcpy(sbtData + offset, getHandle(handleIdx++), handleSize);
         offset += m_hit_region.stride;
     }
 
-    p_gfx->GetDeviceRef().unmapMemory(staging.memory);
-
-    p_gfx->CopyBuffer(staging.buffer, m_shaderBindingTableBW.buffer, sbtSize);
-
-    staging.destroy(p_gfx->GetDeviceRef());
+    // The trace reads it; the frame acquires the upload before recording any
+    p_gfx->GetUploader().UploadBuffer(m_shaderBindingTableBW.buffer, 0, sbt.data(), sbtSize,
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR, vk::AccessFlagBits::eShaderRead);
 }
 
-RayCastPass::RayCastPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : 
-    RenderPass(_p_gfx, _p_prev_pass), 
+RayCastPass::RayCastPass(Graphics* _p_gfx) : 
+    RenderPass(_p_gfx), 
     m_buffer_bg(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -338,7 +343,7 @@ RayCastPass::RayCastPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::MemoryPropertyFlagBits::eDeviceLocal,
         1, p_gfx),
     m_buffer_bg_prev(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Color),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -348,7 +353,7 @@ RayCastPass::RayCastPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::MemoryPropertyFlagBits::eDeviceLocal,
         1, p_gfx),
     m_buffer_nd(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::NormalDepth),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -358,7 +363,7 @@ RayCastPass::RayCastPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
         vk::MemoryPropertyFlagBits::eDeviceLocal,
         1, p_gfx),
     m_buffer_nd_prev(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::NormalDepth),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -371,6 +376,8 @@ RayCastPass::RayCastPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) :
 
     m_push_consts.ray_count_factor = 10;
     m_push_consts.clear = 0;
+    m_push_consts.emitter_sampling = true;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantRay));
 
     CreateRaytraceAS();
     SetupBuffer();
@@ -389,37 +396,71 @@ RayCastPass::~RayCastPass() {
     m_shaderBindingTableBW.destroy(p_gfx->GetDeviceRef());
 }
  
-void RayCastPass::Setup(){
-    raymask_buffer_desc = static_cast<DOFPass*>(p_dof_pass)->GetRaymaskBuffer().Descriptor();
+void RayCastPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eRayTracingShaderKHR;
+    const vk::PipelineStageFlags copy = vk::PipelineStageFlagBits::eTransfer;
+    builder.Output("raycast_bg", m_buffer_bg);
+    builder.Output("raycast_bg_prev", m_buffer_bg_prev);
+    builder.Output("raycast_nd", m_buffer_nd);
+    builder.Output("raycast_nd_prev", m_buffer_nd_prev);
+    p_raymask_buffer = &builder.ReadWrite("dof_raymask", stages);
+    // Accumulates into bg and nd, then copies them over the previous frame's
+    builder.ReadWrite("raycast_bg", stages);
+    builder.ReadWrite("raycast_nd", stages);
+    builder.Read("raycast_bg", copy, vk::AccessFlagBits::eTransferRead);
+    builder.Read("raycast_nd", copy, vk::AccessFlagBits::eTransferRead);
+    builder.Read("raycast_bg_prev", stages);
+    builder.Read("raycast_nd_prev", stages);
+    builder.Write("raycast_bg_prev", copy, vk::AccessFlagBits::eTransferWrite);
+    builder.Write("raycast_nd_prev", copy, vk::AccessFlagBits::eTransferWrite);
+}
+
+void RayCastPass::Resize() {
+    m_buffer_bg.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_buffer_bg_prev.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_buffer_nd.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    m_buffer_nd_prev.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    p_gfx->RenewDescriptor(m_descriptor);
+    // The accumulated history is at the old size
+    m_push_consts.clear = true;
+}
 
+void RayCastPass::Setup(){
     auto device = p_gfx->GetDeviceRef();
     m_descriptor.write(device, 0, m_rt_builder.GetAccelerationStructure());
     m_descriptor.write(device, 1, m_buffer_bg.Descriptor());
     m_descriptor.write(device, 2, m_buffer_bg_prev.Descriptor());
-    m_descriptor.write(device, 3, raymask_buffer_desc);
+    m_descriptor.write(device, 3, p_raymask_buffer->Descriptor());
     m_descriptor.write(device, 4, m_buffer_nd.Descriptor());
     m_descriptor.write(device, 5, m_buffer_nd_prev.Descriptor());
+    m_descriptor.write(device, 6, p_gfx->m_lightBW.buffer);
+    m_descriptor.write(device, 7, p_gfx->m_lightAliasBW.buffer);
+    m_descriptor.write(device, 8, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantRay));
 
     lighting_pass_desc_layout = p_lighting_pass->GetDescriptor().descSetLayout;
     lighting_pass_desc_set = p_lighting_pass->GetDescriptor().descSet;
 
-    SetupPipeline();
-    CreateRtShaderBindingTable();
+    if (!m_pipeline) {
+        SetupPipeline();
+        CreateRtShaderBindingTable();
+    }
 }
 
-void RayCastPass::Render() {
-    if (not enabled)
-        return;
-
+void RayCastPass::UpdateParams() {
     if (p_gfx->GetCamera()->WasUpdated())
         m_push_consts.clear = true;
+    if (m_history_extent != p_gfx->GetRenderExtent()) {
+        m_history_extent = p_gfx->GetRenderExtent();
+        m_push_consts.clear = true;
+    }
 
-    // The push constants for the ray tracing pipeline.
+    // The parameters of the ray tracing pipeline.
     m_push_consts.alignmentTest = 1234;
 
     m_push_consts.lightPosition = p_lighting_pass->GetPCParams().lightPosition;
     m_push_consts.lightIntensity = p_lighting_pass->GetPCParams().lightIntensity;
     m_push_consts.ambientIntensity = p_lighting_pass->GetPCParams().ambientIntensity;
+    m_push_consts.emitterCount = p_gfx->m_emitterCount;
 
     m_push_consts.focal_distance = p_dof_pass->GetDOFParams().focal_distance;
     m_push_consts.focal_length = p_dof_pass->GetDOFParams().focal_length;
@@ -429,30 +470,33 @@ void RayCastPass::Render() {
 
     m_push_consts.frameSeed = rand() % 32768;
 
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+    m_push_consts.clear = 0;
+}
+
+void RayCastPass::Render() {
     // Bind the ray tracing pipeline
     auto cmd_buff = p_gfx->GetCommandBuffer();
     cmd_buff.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, m_pipeline);
 
     // Bind the descriptor sets (the ray tracing specific one, and the
     // full model descriptor)
+    // The parameters and the lighting set's matrices and raster parameters are
+    // dynamic buffers with a slice per frame in flight; the offsets go in set,
+    // then binding order
     std::vector<vk::DescriptorSet> descSets{ m_descriptor.descSet , lighting_pass_desc_set };
+    uint32_t offsets[] = { p_gfx->GetParamsOffset(m_params_region),
+        p_gfx->GetMatrixOffset(), p_lighting_pass->GetParamsOffset() };
     cmd_buff.bindDescriptorSets(vk::PipelineBindPoint::eRayTracingKHR,
         m_pipeline_layout, 0, (uint32_t)descSets.size(),
-        descSets.data(), 0, nullptr);
-
-    // Push the push constants
-    cmd_buff.pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR | vk::ShaderStageFlagBits::eMissKHR,
-        0, sizeof(PushConstantRay), &m_push_consts);
+        descSets.data(), 3, offsets);
 
     cmd_buff.traceRaysKHR(
         &m_rgen_region, &m_miss_region, &m_hit_region, &m_call_region, 
-        p_gfx->GetWindowExtent().width/2, p_gfx->GetWindowExtent().height/2, 1);
-
-    p_gfx->CommandCopyImage(m_buffer_bg, m_buffer_bg_prev);
-    p_gfx->CommandCopyImage(m_buffer_nd, m_buffer_nd_prev);
+        p_gfx->GetRenderExtent().width/2, p_gfx->GetRenderExtent().height/2, 1);
 
-    m_push_consts.clear = 0;
+    p_gfx->CommandCopyImage(m_buffer_bg, m_buffer_bg_prev, vk::PipelineStageFlagBits::eRayTracingShaderKHR);
+    p_gfx->CommandCopyImage(m_buffer_nd, m_buffer_nd_prev, vk::PipelineStageFlagBits::eRayTracingShaderKHR);
 }
 
 void RayCastPass::Teardown() {
@@ -462,6 +506,8 @@ void RayCastPass::Teardown() {
 void RayCastPass::DrawGUI() {
     ImGui::Checkbox("Raycast enabled", &enabled);
     ImGui::SliderInt("Raycast count factor", &m_push_consts.ray_count_factor, 1, 50);
+    if (ImGui::Checkbox("Sample emitters", &m_push_consts.emitter_sampling))
+        m_push_consts.clear = 1;
 
     if (ImGui::Button("Reset accumulation"))
         m_push_consts.clear = 1;
@@ -477,4 +523,16 @@ void RayCastPass::SetDOFPass(DOFPass* _p_dof_pass) {
 
 const ImageWrap& RayCastPass::GetBGBuffer() const {
     return m_buffer_bg;
+}
+
+const ImageWrap& RayCastPass::GetBGPrevBuffer() const {
+    return m_buffer_bg_prev;
+}
+
+const ImageWrap& RayCastPass::GetNDBuffer() const {
+    return m_buffer_nd;
+}
+
+const ImageWrap& RayCastPass::GetNDPrevBuffer() const {
+    return m_buffer_nd_prev;
 }
\ No newline at end of file
@@ -12,10 +12,11 @@ private:
     ImageWrap m_buffer_bg_prev;
     ImageWrap m_buffer_nd;
     ImageWrap m_buffer_nd_prev;
-    vk::DescriptorImageInfo raymask_buffer_desc;
+    const ImageWrap* p_raymask_buffer = nullptr;
     void SetupBuffer();
 
-    PushConstantRay m_push_consts;  // Push constant for ray tracer
+    PushConstantRay m_push_consts;  // Parameters of the ray tracer
+    uint32_t m_params_region;  // Of the parameter buffer
     RaytracingBuilderKHR m_rt_builder;
 
     // Accelleration structure objects and functions
@@ -41,19 +42,28 @@ private:
     DOFPass* p_dof_pass;
 
     bool enabled;
+    // The history was accumulated at this size; reprojecting it to another is wrong
+    vk::Extent2D m_history_extent;
 public:
-    RayCastPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+    RayCastPass(Graphics* _p_gfx);
     ~RayCastPass();
 
+    void Declare(RenderGraph::Builder& builder) override;
+    void Resize() override;
     void Setup() override;
+    void UpdateParams() override;
     void Render() override;
     void Teardown() override;
 
     void DrawGUI() override;
+    bool IsEnabled() const override { return enabled; }
 
     void SetLightingPass(LightingPass* _p_lighting_pass);
     void SetDOFPass(DOFPass* _p_lighting_pass);
 
     const ImageWrap& GetBGBuffer() const;
+    const ImageWrap& GetBGPrevBuffer() const;
+    const ImageWrap& GetNDBuffer() const;
+    const ImageWrap& GetNDPrevBuffer() const;
 };
 
@@ -4,11 +4,10 @@
 #include "Camera.h"
 
 #include "RayMaskPass.h"
-#include "PreDOFPass.h"
 
 void RayMaskPass::SetupBuffer() {
 	m_buffer.CreateTextureSampler();
-	m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+	p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::Edge);
 }
 
 void RayMaskPass::SetupDescriptor() {
@@ -16,20 +15,15 @@ void RayMaskPass::SetupDescriptor() {
         {0, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {1, vk::DescriptorType::eCombinedImageSampler, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute} });
 }
 
 void RayMaskPass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantRaymask));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -50,9 +44,9 @@ void RayMaskPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-RayMaskPass::RayMaskPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx, _p_prev_pass),
+RayMaskPass::RayMaskPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
     m_buffer(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2,
-        vk::Format::eR32G32B32A32Sfloat,
+        TargetFormat(TargetKind::Edge),
         vk::ImageUsageFlagBits::eTransferDst |
         vk::ImageUsageFlagBits::eSampled |
         vk::ImageUsageFlagBits::eStorage |
@@ -60,10 +54,11 @@ RayMaskPass::RayMaskPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPas
         vk::ImageUsageFlagBits::eColorAttachment,
         vk::ImageAspectFlagBits::eColor,
         vk::MemoryPropertyFlagBits::eDeviceLocal,
-        1, p_gfx),
+        1, p_gfx, false),
     enabled(true) {
     m_push_consts.weak_threshold = 0.3;
     m_push_consts.strong_threshold = 0.7;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantRaymask));
 
     SetupBuffer();
     SetupDescriptor();
@@ -77,66 +72,50 @@ RayMaskPass::~RayMaskPass() {
     m_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void RayMaskPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("edge", m_buffer);
+    p_pre_dof_buffer = &builder.Read("pre_dof", stages);
+    builder.Write("edge", stages);
+    builder.AsyncCompute();
+}
+
+void RayMaskPass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x / 2, p_gfx->GetWindowSize().y / 2);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void RayMaskPass::Setup() {
     WriteToDescriptor(0, m_buffer.Descriptor());
-    WriteToDescriptor(1,
-        static_cast<PreDOFPass*>(p_prev_pass)->GetBuffer().Descriptor());
-    SetupPipeline();
+    WriteToDescriptor(1, p_pre_dof_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 2, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantRaymask));
+    if (!m_pipeline)
+        SetupPipeline();
+}
+
+void RayMaskPass::UpdateParams() {
+    p_gfx->WriteParams(m_params_region, m_push_consts);
 }
 
 void RayMaskPass::Render() {
-    if (not enabled)
-        return;
-
-    PreDOFPass* p_pre_dof_pass = static_cast<PreDOFPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_pre_dof_pass->GetBuffer().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
-    // Select the compute shader, and its descriptor set and push constant
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
+    // Select the compute shader and its descriptor set
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(
-        m_pipeline_layout, 
-        vk::ShaderStageFlagBits::eCompute, 0, 
-        sizeof(PushConstantRaymask), & m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     // This MUST match the shaders's line:
     //    layout(local_size_x=32, local_size_y=32, local_size_z=1) in;
     int group_size = 32;
     p_gfx->GetCommandBuffer().dispatch(
-        (p_gfx->GetWindowSize().x / 2) / 32,
-        (p_gfx->GetWindowSize().y / 2) / 32,
+        (p_gfx->GetRenderSize().x / 2) / 32,
+        (p_gfx->GetRenderSize().y / 2) / 32,
         1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
 }
 
 void RayMaskPass::Teardown()
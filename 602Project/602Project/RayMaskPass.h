@@ -14,12 +14,18 @@ private:
 	void SetupPipeline();
 
 	PushConstantRaymask m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
+
+	const ImageWrap* p_pre_dof_buffer = nullptr;
 
 	bool enabled;
 public:
-	RayMaskPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	RayMaskPass(Graphics* _p_gfx);
 	~RayMaskPass();
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
@@ -28,5 +34,6 @@ public:
 	const ImageWrap& GetBuffer() const;
 
 	void DrawGUI();
+	bool IsEnabled() const override { return enabled; }
 };
 
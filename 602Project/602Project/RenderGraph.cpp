@@ -0,0 +1,524 @@
+#include "RenderGraph.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "Graphics.h"
+#include "ParallelRecorder.h"
+#include "TimerWrap.h"
+
+namespace {
+    const vk::AccessFlags READ_ACCESS = vk::AccessFlagBits::eShaderRead
+        | vk::AccessFlagBits::eTransferRead
+        | vk::AccessFlagBits::eColorAttachmentRead
+        | vk::AccessFlagBits::eDepthStencilAttachmentRead
+        | vk::AccessFlagBits::eInputAttachmentRead;
+    const vk::AccessFlags WRITE_ACCESS = vk::AccessFlagBits::eShaderWrite
+        | vk::AccessFlagBits::eTransferWrite
+        | vk::AccessFlagBits::eColorAttachmentWrite
+        | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+}
+
+void RenderGraph::Builder::Output(const char* name, const ImageWrap& image) {
+    for (const auto& resource : p_graph->m_resources) {
+        if (resource.name == name)
+            throw std::runtime_error(std::string("render graph: two passes make ") + name + "!");
+    }
+    Resource resource;
+    resource.name = name;
+    resource.image = &image;
+    p_graph->m_resources.push_back(resource);
+}
+
+const ImageWrap& RenderGraph::Builder::Read(const char* name, vk::PipelineStageFlags stages,
+    vk::AccessFlags access) {
+    return Add(name, stages, access, false);
+}
+
+const ImageWrap& RenderGraph::Builder::Write(const char* name, vk::PipelineStageFlags stages,
+    vk::AccessFlags access) {
+    return Add(name, stages, access, false);
+}
+
+const ImageWrap& RenderGraph::Builder::ReadWrite(const char* name, vk::PipelineStageFlags stages) {
+    return Add(name, stages, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite, false);
+}
+
+const ImageWrap& RenderGraph::Builder::Peek(const char* name, vk::PipelineStageFlags stages) {
+    return Add(name, stages, vk::AccessFlagBits::eShaderRead, true);
+}
+
+void RenderGraph::Builder::DrawsOutside() {
+    p_graph->m_passes[m_pass].draws_outside = true;
+}
+
+void RenderGraph::Builder::AsyncCompute() {
+    p_graph->m_passes[m_pass].async_compute = true;
+}
+
+const ImageWrap& RenderGraph::Builder::Add(const char* name, vk::PipelineStageFlags stages,
+    vk::AccessFlags access, bool peek) {
+    uint32_t resource = p_graph->Find(name);
+    std::vector<RenderGraph::Use>& uses = p_graph->m_passes[m_pass].uses;
+    RenderGraph::Use* use = nullptr;
+    for (auto& other : uses) {
+        if (other.resource == resource)
+            use = &other;
+    }
+    if (!use) {
+        uses.push_back(RenderGraph::Use());
+        use = &uses.back();
+        use->resource = resource;
+    }
+
+    if (access & READ_ACCESS) {
+        use->read_stages |= stages;
+        use->read_access |= access & READ_ACCESS;
+    }
+    if (access & WRITE_ACCESS) {
+        use->write_stages |= stages;
+        use->write_access |= access & WRITE_ACCESS;
+    }
+    if (!peek)
+        use->peek = false;
+    return *p_graph->m_resources[resource].image;
+}
+
+void RenderGraph::Init(Graphics* gfx, RenderTargetAliaser* targets) {
+    p_gfx = gfx;
+    p_targets = targets;
+}
+
+void RenderGraph::Destroy() {
+    // Frees the kept command buffers with their pools
+    for (auto& pass : m_passes) {
+        if (pass.pool)
+            p_gfx->GetDeviceRef().destroyCommandPool(pass.pool);
+        pass.pass.reset();
+    }
+    m_passes.clear();
+    m_resources.clear();
+    m_outputs.clear();
+}
+
+void RenderGraph::AddPass(const char* name, std::unique_ptr<RenderPass> pass) {
+    m_passes.push_back(Pass());
+    m_passes.back().name = name;
+    m_passes.back().pass = std::move(pass);
+
+    Builder builder(this, static_cast<uint32_t>(m_passes.size() - 1));
+    m_passes.back().pass->Declare(builder);
+}
+
+void RenderGraph::AddOutput(const char* name, vk::PipelineStageFlags stages, vk::AccessFlags access) {
+    Use use;
+    use.resource = Find(name);
+    use.read_stages = stages;
+    use.read_access = access;
+    use.peek = false;
+    m_outputs.push_back(use);
+}
+
+uint32_t RenderGraph::Find(const char* name) const {
+    for (uint32_t i = 0; i < m_resources.size(); ++i) {
+        if (m_resources[i].name == name)
+            return i;
+    }
+    throw std::runtime_error(std::string("render graph: no earlier pass makes ") + name + "!");
+}
+
+void RenderGraph::Compile(bool alias) {
+    // Peeks stay out of the lifetimes, or the debug draw would keep every target alive
+    for (uint32_t i = 0; i < m_passes.size(); ++i) {
+        for (const Use& use : m_passes[i].uses) {
+            if (!use.peek)
+                p_targets->Use(i, *m_resources[use.resource].image);
+        }
+    }
+    p_targets->Build(static_cast<uint32_t>(m_passes.size()), alias);
+
+    for (auto& resource : m_resources) {
+        resource.transient = p_targets->IsTransient(*resource.image);
+        resource.last = p_targets->LastUse(*resource.image);
+    }
+}
+
+void RenderGraph::Setup() {
+    for (auto& pass : m_passes)
+        pass.pass->Setup();
+    // The passes rewrote their descriptors and made new pipelines
+    ++m_generation;
+}
+
+void RenderGraph::Resize() {
+    for (auto& pass : m_passes) {
+        DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), pass.name.c_str());
+        pass.pass->Resize();
+    }
+    {
+        DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), "render targets (aliased)");
+        p_targets->Rebuild();
+    }
+    // Also stales every kept secondary, which bound the old images
+    Setup();
+}
+
+void RenderGraph::FindLivePasses(bool outputs_read) {
+    // Walking back from the outputs: a pass is live when a live pass after it
+    // reads what it writes
+    m_needed.assign(m_resources.size(), false);
+    if (outputs_read) {
+        for (const Use& use : m_outputs)
+            m_needed[use.resource] = true;
+    }
+    m_live.assign(m_passes.size(), false);
+    for (size_t i = m_passes.size(); i-- > 0;) {
+        const Pass& pass = m_passes[i];
+        if (!pass.pass->IsEnabled())
+            continue;
+        bool live = pass.draws_outside;
+        for (const Use& use : pass.uses) {
+            if (use.write_stages && m_needed[use.resource] && pass.pass->Uses(*m_resources[use.resource].image))
+                live = true;
+        }
+        if (!live)
+            continue;
+        m_live[i] = true;
+        for (const Use& use : pass.uses) {
+            if (use.read_stages && pass.pass->Uses(*m_resources[use.resource].image))
+                m_needed[use.resource] = true;
+        }
+    }
+
+    // A peeked transient's memory goes to other targets after its last declared use
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (!m_live[i])
+            continue;
+        for (const Use& use : m_passes[i].uses) {
+            const Resource& resource = m_resources[use.resource];
+            if (!use.peek || !resource.transient || resource.last >= i
+                || !m_passes[i].pass->Uses(*resource.image))
+                continue;
+            for (size_t j = resource.last + 1; j < i; ++j)
+                m_live[j] = false;
+        }
+    }
+}
+
+void RenderGraph::Execute(bool outputs_read) {
+    TimerWrap timer;
+    FindLivePasses(outputs_read);
+
+    m_states.assign(m_resources.size(), State());
+    m_queue = GRAPHICS;
+    for (uint32_t queue = 0; queue < QUEUE_COUNT; ++queue) {
+        m_batch[queue] = NO_BATCH;
+        m_transient_batch[queue] = NO_BATCH;
+        m_frame_stages[queue] = vk::PipelineStageFlags();
+        m_frame_writes[queue] = vk::AccessFlags();
+    }
+    m_batch[GRAPHICS] = p_gfx->GetBatch();
+    m_live_count = 0;
+    m_barrier_count = 0;
+    m_image_barrier_count = 0;
+    m_compute_batch_count = 0;
+    m_reused_count = 0;
+
+    // Before anything records, so Render only reads what the passes wrote here
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (m_live[i])
+            m_passes[i].pass->UpdateParams();
+    }
+
+    // The workers record the passes while the loop below records the barriers
+    m_recordings.resize(m_passes.size());
+    m_frame = p_gfx->GetFrameIndex();
+    m_cache = p_gfx->CachesPassCommands();
+    p_recorder = p_gfx->GetRecorder();
+    if (p_recorder)
+        p_recorder->BeginFrame(m_frame);
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (m_live[i])
+            StartRecording(i);
+    }
+
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (!m_live[i])
+            continue;
+        Pass& pass = m_passes[i];
+        uint32_t queue = QueueOf(pass);
+        if (queue != m_queue)
+            SwitchQueue(queue);
+        m_frame_uses.clear();
+        for (const Use& use : pass.uses) {
+            if (pass.pass->Uses(*m_resources[use.resource].image))
+                m_frame_uses.push_back(use);
+        }
+        RecordBarriers(m_frame_uses, pass.name.c_str());
+        RecordPass(i);
+        ++m_live_count;
+    }
+
+    // The post process and the GUI draw on the graphics queue
+    if (m_queue != GRAPHICS)
+        SwitchQueue(GRAPHICS);
+    if (outputs_read)
+        RecordBarriers(m_outputs, "the code after the graph");
+    m_execute_ms = timer.Mark() * 1000.0f;
+}
+
+uint32_t RenderGraph::QueueOf(const Pass& pass) const {
+    return pass.async_compute && p_gfx->HasAsyncCompute() ? COMPUTE : GRAPHICS;
+}
+
+void RenderGraph::StartRecording(size_t pass) {
+    Pass& p = m_passes[pass];
+    Recording& recording = m_recordings[pass];
+    recording.render_pass = p.pass->GetRenderPassBegin(recording.begin);
+    recording.inheritance = vk::CommandBufferInheritanceInfo();
+    if (recording.render_pass) {
+        recording.inheritance.setRenderPass(recording.begin.renderPass);
+        recording.inheritance.setSubpass(0);
+        recording.inheritance.setFramebuffer(recording.begin.framebuffer);
+    }
+
+    recording.cached = m_cache && p.pass->IsStatic();
+    recording.reused = false;
+    if (recording.cached) {
+        Cache& cache = CacheOf(pass);
+        uint64_t key = p.pass->GetRecordKey();
+        if (cache.valid && cache.key == key && cache.framebuffer == recording.inheritance.framebuffer
+            && cache.generation == m_generation && cache.render_extent == p_gfx->GetRenderExtent()) {
+            recording.reused = true;
+            ++m_reused_count;
+            return;
+        }
+        cache.valid = true;
+        cache.key = key;
+        cache.framebuffer = recording.inheritance.framebuffer;
+        cache.generation = m_generation;
+        cache.render_extent = p_gfx->GetRenderExtent();
+        // Without a recorder RecordPass records it in order
+        if (p_recorder)
+            recording.cmd = p_recorder->Record(cache.cmd, recording.inheritance, [this, pass]() { Render(pass); });
+        return;
+    }
+    if (p_recorder) {
+        recording.cmd = p_recorder->Record(QueueOf(p) == COMPUTE, recording.inheritance,
+            [this, pass]() { Render(pass); });
+    }
+}
+
+RenderGraph::Cache& RenderGraph::CacheOf(size_t pass) {
+    Pass& p = m_passes[pass];
+    if (!p.pool) {
+        // Each buffer is recorded again on its own once it's stale
+        p.pool = p_gfx->GetDeviceRef().createCommandPool(vk::CommandPoolCreateInfo(
+            vk::CommandPoolCreateFlagBits::eResetCommandBuffer, p_gfx->GetQueueFamily(QueueOf(p) == COMPUTE)));
+        std::vector<vk::CommandBuffer> cmds = p_gfx->GetDeviceRef().allocateCommandBuffers(
+            vk::CommandBufferAllocateInfo(p.pool, vk::CommandBufferLevel::eSecondary, p_gfx->GetFrameCount()));
+        p.caches.resize(cmds.size());
+        for (size_t i = 0; i < cmds.size(); ++i)
+            p.caches[i].cmd = cmds[i];
+    }
+    return p.caches[m_frame];
+}
+
+void RenderGraph::RecordPass(size_t pass) {
+    vk::CommandBuffer cmd = p_gfx->GetCommandBuffer();
+    Recording& recording = m_recordings[pass];
+    vk::CommandBuffer secondary;
+    if (recording.reused) {
+        secondary = CacheOf(pass).cmd;
+    }
+    else if (recording.cmd.valid()) {
+        // Waits for the worker if it isn't done yet
+        secondary = recording.cmd.get();
+    }
+    else if (recording.cached) {
+        secondary = CacheOf(pass).cmd;
+        ParallelRecorder::RecordOn(secondary, false, recording.inheritance, [this, pass]() { Render(pass); });
+    }
+    else {
+        if (recording.render_pass)
+            cmd.beginRenderPass(recording.begin, vk::SubpassContents::eInline);
+        Render(pass);
+        if (recording.render_pass)
+            cmd.endRenderPass();
+        return;
+    }
+
+    if (recording.render_pass)
+        cmd.beginRenderPass(recording.begin, vk::SubpassContents::eSecondaryCommandBuffers);
+    cmd.executeCommands(secondary);
+    if (recording.render_pass)
+        cmd.endRenderPass();
+}
+
+void RenderGraph::Render(size_t pass) {
+    TimerWrap timer;
+    m_passes[pass].pass->Render();
+    m_passes[pass].record_ms = timer.Mark() * 1000.0f;
+}
+
+void RenderGraph::SwitchQueue(uint32_t queue) {
+    bool first = m_batch[queue] == NO_BATCH;
+    m_queue = queue;
+    m_batch[queue] = p_gfx->BeginBatch(queue == COMPUTE);
+    if (queue == COMPUTE)
+        ++m_compute_batch_count;
+    // The frame's first graphics batch starts after the previous frame, so the
+    // first compute batch goes after the graphics work before it
+    if (first)
+        p_gfx->WaitForBatch(m_batch[GRAPHICS], vk::PipelineStageFlagBits::eAllCommands);
+}
+
+void RenderGraph::RecordBarriers(const std::vector<Use>& uses, const char* pass) {
+    const uint32_t queue = m_queue;
+    const uint32_t other = queue == GRAPHICS ? COMPUTE : GRAPHICS;
+    m_barriers.clear();
+    vk::PipelineStageFlags src_stages;
+    vk::PipelineStageFlags dst_stages;
+    for (const Use& use : uses) {
+        const Resource& resource = m_resources[use.resource];
+        const State& state = m_states[use.resource];
+        const vk::PipelineStageFlags stages = use.read_stages | use.write_stages;
+
+        vk::PipelineStageFlags src;
+        vk::AccessFlags src_access;
+        bool discard = resource.transient && !state.touched;
+        if (discard) {
+            // The memory may have held any target recorded so far
+            src = m_frame_stages[queue] ? m_frame_stages[queue]
+                : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+            src_access = m_frame_writes[queue];
+            if (m_transient_batch[other] != NO_BATCH)
+                p_gfx->WaitForBatch(m_transient_batch[other], stages);
+#ifndef NDEBUG
+            if (use.read_stages)
+                Report(pass, use.resource, "reads", "before anything wrote it this frame");
+#endif
+        }
+        else {
+            // Read after write, unless an earlier barrier already covered these
+            // stages. A semaphore wait only covers the batch that waits.
+            if (use.read_stages && state.write_stages) {
+                if (state.write_queue != queue)
+                    p_gfx->WaitForBatch(state.write_batch, use.read_stages);
+                else if (use.read_stages & ~state.visible_stages[queue]) {
+                    src |= state.write_stages;
+                    src_access |= state.write_access;
+                }
+            }
+            // Write after read or write
+            if (use.write_stages) {
+                src |= state.read_stages[queue];
+                if (state.read_stages[other])
+                    p_gfx->WaitForBatch(state.read_batch[other], use.write_stages);
+                if (state.write_stages && state.write_queue == queue) {
+                    src |= state.write_stages;
+                    src_access |= state.write_access;
+                }
+                else if (state.write_stages)
+                    p_gfx->WaitForBatch(state.write_batch, use.write_stages);
+#ifndef NDEBUG
+                if (resource.transient && state.write_stages
+                    && !state.read_stages[GRAPHICS] && !state.read_stages[COMPUTE])
+                    Report(pass, use.resource, "overwrites", "before anything read it");
+#endif
+            }
+        }
+        if (!discard && !src)
+            continue;
+
+        const ImageWrap& image = *resource.image;
+        vk::ImageMemoryBarrier barrier;
+        barrier.setSrcAccessMask(src_access);
+        barrier.setDstAccessMask(use.read_access | use.write_access);
+        barrier.setOldLayout(discard ? vk::ImageLayout::eUndefined : vk::ImageLayout::eGeneral);
+        barrier.setNewLayout(vk::ImageLayout::eGeneral);
+        barrier.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED);
+        barrier.setImage(image.GetImage());
+        barrier.setSubresourceRange({ image.GetAspect(), 0, image.GetMipLevels(), 0, 1 });
+        m_barriers.push_back(barrier);
+        src_stages |= src;
+        dst_stages |= stages;
+    }
+
+    if (!m_barriers.empty()) {
+        p_gfx->GetCommandBuffer().pipelineBarrier(src_stages, dst_stages, vk::DependencyFlags(), 0, nullptr, 0, nullptr,
+            static_cast<uint32_t>(m_barriers.size()), m_barriers.data());
+        ++m_barrier_count;
+        m_image_barrier_count += static_cast<uint32_t>(m_barriers.size());
+    }
+
+    for (const Use& use : uses) {
+        State& state = m_states[use.resource];
+        state.touched = true;
+        if (use.write_stages) {
+            // The pass's own reads count against the next write
+            state.write_queue = queue;
+            state.write_batch = m_batch[queue];
+            state.write_stages = use.write_stages;
+            state.write_access = use.write_access;
+            state.read_stages[other] = vk::PipelineStageFlags();
+            state.visible_stages[other] = vk::PipelineStageFlags();
+            state.read_stages[queue] = use.read_stages;
+            state.visible_stages[queue] = vk::PipelineStageFlags();
+        }
+        else {
+            state.read_stages[queue] |= use.read_stages;
+            if (state.write_stages && state.write_queue == queue)
+                state.visible_stages[queue] |= use.read_stages;
+        }
+        state.read_batch[queue] = m_batch[queue];
+        m_frame_stages[queue] |= use.read_stages | use.write_stages;
+        m_frame_writes[queue] |= use.write_access;
+        if (m_resources[use.resource].transient)
+            m_transient_batch[queue] = m_batch[queue];
+    }
+}
+
+void RenderGraph::Report(const char* pass, uint32_t resource, const char* verb, const char* problem) {
+    if (!m_reported.insert({ pass, resource }).second)
+        return;
+    printf("Render graph: %s %s %s %s\n", pass, verb, m_resources[resource].name.c_str(), problem);
+}
+
+void RenderGraph::DrawGUI() {
+    for (auto& pass : m_passes)
+        pass.pass->DrawGUI();
+
+    if (!ImGui::BeginMenu("Render graph"))
+        return;
+    ImGui::Text("%u of %u passes, %u barriers over %u images", m_live_count,
+        static_cast<uint32_t>(m_passes.size()), m_barrier_count, m_image_barrier_count);
+    if (p_gfx->HasAsyncCompute())
+        ImGui::Text("%u async compute batches", m_compute_batch_count);
+    float record_ms = 0.0f;
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (m_live.size() > i && m_live[i] && !m_recordings[i].reused)
+            record_ms += m_passes[i].record_ms;
+    }
+    if (p_recorder)
+        ImGui::Text("Recorded in %.3f ms, passes %.3f ms on %u threads", m_execute_ms, record_ms,
+            p_recorder->GetThreadCount());
+    else
+        ImGui::Text("Recorded in %.3f ms, passes %.3f ms on the main thread", m_execute_ms, record_ms);
+    if (m_cache)
+        ImGui::Text("%u passes replayed kept commands", m_reused_count);
+    ImGui::Separator();
+    for (size_t i = 0; i < m_passes.size(); ++i) {
+        if (m_live.size() > i && m_live[i]) {
+            if (m_recordings[i].reused)
+                ImGui::Text("%s  (kept)", m_passes[i].name.c_str());
+            else
+                ImGui::Text("%s  %.3f ms", m_passes[i].name.c_str(), m_passes[i].record_ms);
+            continue;
+        }
+        ImGui::Text("%s%s", m_passes[i].name.c_str(),
+            m_passes[i].pass->IsEnabled() ? " (culled)" : " (disabled)");
+    }
+    ImGui::EndMenu();
+}
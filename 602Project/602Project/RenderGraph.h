@@ -0,0 +1,255 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <future>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+class Graphics;
+class ImageWrap;
+class ParallelRecorder;
+class RenderPass;
+class RenderTargetAliaser;
+
+/*
+* Owns the render passes and records the barriers between them.
+* Each pass, as it's added, names the images it makes and declares which
+* images it reads and writes and at which stages (RenderPass::Declare). The
+* graph hands the images back by name, so passes don't reach into each other.
+*
+* Every frame Execute:
+* - culls the passes nothing needs. A pass runs when it's enabled and either
+*   draws outside the graph or writes an image that a later live pass, or the
+*   code after the graph, reads.
+* - records one pipelineBarrier before each live pass, with one image barrier
+*   per image that depends on an earlier live pass (read after write, write
+*   after read or write), using only the stages and accesses declared for them.
+* - discards each aliased transient before its first live use, ordered after
+*   everything recorded so far since the memory may have held another target.
+*
+* With an async compute queue (Graphics::HasAsyncCompute) the passes that
+* declared AsyncCompute run there, and the graph starts a new batch whenever
+* the queue changes. Dependencies between the queues become semaphore waits on
+* the batch that wrote or read the image instead of barriers; storage images
+* are shared concurrently, so nothing changes owner. The first compute batch
+* waits for the graphics work before it, which orders it after the previous
+* frame, and the graph always ends on the graphics queue.
+*
+* With a ParallelRecorder (Graphics::GetRecorder) every live pass is recorded
+* into a secondary command buffer on a worker thread as soon as Execute knows
+* which passes run. Meanwhile the main thread records the barriers in order
+* and stitches each pass in after them with executeCommands. A pass that
+* draws inside a vk::RenderPass has it begun by the graph (see
+* RenderPass::GetRenderPassBegin).
+*
+* With Graphics::cache_pass_commands the graph keeps a static pass's secondary
+* (RenderPass::IsStatic), one per frame in flight since the passes bind that
+* frame's slice of the parameter buffer, and replays it while the pass's
+* GetRecordKey, framebuffer, setup and render size (Graphics::GetRenderExtent)
+* stay the same. Each frame then only writes the parameters
+* (RenderPass::UpdateParams), records the barriers and executes the kept
+* secondaries.
+*
+* Images stay in eGeneral between passes (descriptors are written with it), so
+* apart from the discards the barriers only order memory. A pass that touches
+* an image in several steps inside Render (a dispatch, then a copy of its
+* result) orders those steps itself.
+*
+* Debug builds also report, once each, a live pass reading a transient nothing
+* has written this frame and a transient overwritten before anything read it.
+*/
+class RenderGraph
+{
+public:
+	//Handed to RenderPass::Declare. Reads and writes look images up by name and
+	//return them; a pass may declare several uses of one image.
+	class Builder
+	{
+	public:
+		//Names an image the pass makes so later passes can find it
+		void Output(const char* name, const ImageWrap& image);
+
+		const ImageWrap& Read(const char* name, vk::PipelineStageFlags stages,
+			vk::AccessFlags access = vk::AccessFlagBits::eShaderRead);
+		//A write replaces the whole image
+		const ImageWrap& Write(const char* name, vk::PipelineStageFlags stages,
+			vk::AccessFlags access = vk::AccessFlagBits::eShaderWrite);
+		const ImageWrap& ReadWrite(const char* name, vk::PipelineStageFlags stages);
+		//A read that doesn't extend a transient's aliased lifetime. While a live
+		//pass peeks a transient, the passes after the transient's last declared
+		//use are culled so nothing reuses its memory first.
+		const ImageWrap& Peek(const char* name, vk::PipelineStageFlags stages);
+
+		//The pass draws to something outside the graph (the swapchain), so it
+		//runs whenever it's enabled
+		void DrawsOutside();
+		//The pass only dispatches compute work, so it may run on the async
+		//compute queue
+		void AsyncCompute();
+	private:
+		friend class RenderGraph;
+		Builder(RenderGraph* graph, uint32_t pass) : p_graph(graph), m_pass(pass) {}
+		const ImageWrap& Add(const char* name, vk::PipelineStageFlags stages,
+			vk::AccessFlags access, bool peek);
+
+		RenderGraph* p_graph;
+		uint32_t m_pass;
+	};
+
+	void Init(Graphics* gfx, RenderTargetAliaser* targets);
+	//Destroys the passes
+	void Destroy();
+
+	//Passes run in the order they're added; Declare runs right away
+	void AddPass(const char* name, std::unique_ptr<RenderPass> pass);
+	//An image read after the graph has run, e.g. by the post process
+	void AddOutput(const char* name, vk::PipelineStageFlags stages,
+		vk::AccessFlags access = vk::AccessFlagBits::eShaderRead);
+
+	//Gives the aliaser every declared use and builds it. The transients have
+	//memory afterwards, so the passes can be set up.
+	void Compile(bool alias);
+	void Setup();
+	//After the window size changed: resizes the passes' targets
+	//(RenderPass::Resize), places the transients again and sets the passes up
+	//once more
+	void Resize();
+
+	//Records the live passes and their barriers into the graphics object's
+	//batches. outputs_read says whether the AddOutput images are read after the
+	//graph this frame.
+	void Execute(bool outputs_read);
+
+	//The passes' own GUIs and what the last frame ran
+	void DrawGUI();
+private:
+	//Everything one pass declared for one image
+	struct Use
+	{
+		uint32_t resource = 0;
+		vk::PipelineStageFlags read_stages, write_stages;
+		vk::AccessFlags read_access, write_access;
+		bool peek = true;  // Only while every read is a peek
+	};
+
+	//A static pass's commands kept for one frame in flight, and what they were recorded with
+	struct Cache
+	{
+		vk::CommandBuffer cmd;
+		bool valid = false;
+		uint64_t key = 0;
+		vk::Framebuffer framebuffer;
+		uint32_t generation = 0;
+		vk::Extent2D render_extent;  // Sizes the dispatches and the viewport
+	};
+
+	struct Pass
+	{
+		std::string name;
+		std::unique_ptr<RenderPass> pass;
+		std::vector<Use> uses;
+		bool draws_outside = false;
+		bool async_compute = false;
+		float record_ms = 0.0f;  // CPU time its Render took last frame
+		vk::CommandPool pool;    // Of the kept commands, made when first needed
+		std::vector<Cache> caches;  // Per frame in flight
+	};
+
+	//A live pass's recording this frame
+	struct Recording
+	{
+		bool render_pass = false;  // begin is valid
+		vk::RenderPassBeginInfo begin;
+		vk::CommandBufferInheritanceInfo inheritance;
+		bool cached = false;  // Into the frame's Cache
+		bool reused = false;  // The Cache was still valid, nothing to record
+		std::future<vk::CommandBuffer> cmd;  // With parallel recording
+	};
+
+	struct Resource
+	{
+		std::string name;
+		const ImageWrap* image = nullptr;
+		bool transient = false;  // Set by Compile
+		uint32_t last = 0;       // Last pass of a transient's aliased lifetime
+	};
+
+	//Indexes the per-queue arrays
+	enum Queue { GRAPHICS, COMPUTE, QUEUE_COUNT };
+	static const uint32_t NO_BATCH = UINT32_MAX;
+
+	//What the frame recorded so far did to a resource
+	struct State
+	{
+		bool touched = false;  // Used by a live pass this frame
+		uint32_t write_queue = GRAPHICS;
+		uint32_t write_batch = 0;
+		vk::PipelineStageFlags write_stages;
+		vk::AccessFlags write_access;
+		// Per queue
+		vk::PipelineStageFlags read_stages[QUEUE_COUNT];     // Since the last write
+		uint32_t read_batch[QUEUE_COUNT] = { 0, 0 };         // Latest of those reads
+		vk::PipelineStageFlags visible_stages[QUEUE_COUNT];  // Readers a barrier made the last write visible to
+	};
+
+	uint32_t Find(const char* name) const;
+	//Culls into m_live
+	void FindLivePasses(bool outputs_read);
+	uint32_t QueueOf(const Pass& pass) const;
+	//Begins a batch on queue
+	void SwitchQueue(uint32_t queue);
+	//Checks the pass's kept commands and queues what needs recording on the
+	//recorder's workers, if there is one
+	void StartRecording(size_t pass);
+	//This frame's Cache of the pass
+	Cache& CacheOf(size_t pass);
+	//Records the pass into the current command buffer, or executes its
+	//secondary there, inside its render pass if it has one
+	void RecordPass(size_t pass);
+	//Runs the pass's Render on this thread and times it
+	void Render(size_t pass);
+	//Semaphore waits for what uses depends on from the other queue and one
+	//pipelineBarrier for the rest, then updates the states. pass is only for
+	//the debug reports.
+	void RecordBarriers(const std::vector<Use>& uses, const char* pass);
+	//Warns once per pass and resource
+	void Report(const char* pass, uint32_t resource, const char* verb, const char* problem);
+
+	Graphics* p_gfx = nullptr;
+	RenderTargetAliaser* p_targets = nullptr;
+	ParallelRecorder* p_recorder = nullptr;  // This frame's, null on the main thread
+	std::vector<Pass> m_passes;
+	std::vector<Resource> m_resources;
+	std::vector<Use> m_outputs;
+
+	// Per frame
+	std::vector<bool> m_live;
+	std::vector<bool> m_needed;
+	std::vector<State> m_states;
+	std::vector<Use> m_frame_uses;
+	std::vector<vk::ImageMemoryBarrier> m_barriers;
+	std::vector<Recording> m_recordings;
+	uint32_t m_frame = 0;        // In flight
+	bool m_cache = false;        // Graphics::CachesPassCommands this frame
+	uint32_t m_generation = 0;   // Bumped by Setup; older kept commands are stale
+	uint32_t m_queue = GRAPHICS;
+	// Per queue
+	uint32_t m_batch[QUEUE_COUNT];                      // Latest batch, or NO_BATCH
+	uint32_t m_transient_batch[QUEUE_COUNT];            // Latest batch that used a transient
+	vk::PipelineStageFlags m_frame_stages[QUEUE_COUNT];  // Every stage recorded so far
+	vk::AccessFlags m_frame_writes[QUEUE_COUNT];
+	std::set<std::pair<std::string, uint32_t>> m_reported;
+
+	// Last frame, for the GUI
+	uint32_t m_live_count = 0;
+	uint32_t m_barrier_count = 0;        // pipelineBarrier calls
+	uint32_t m_image_barrier_count = 0;
+	uint32_t m_compute_batch_count = 0;
+	uint32_t m_reused_count = 0;  // Passes that replayed kept commands
+	float m_execute_ms = 0.0f;  // CPU time of the whole Execute
+};
@@ -1,7 +1,7 @@
 #include "RenderPass.h"
 
-RenderPass::RenderPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : 
-	p_gfx(_p_gfx), p_prev_pass(_p_prev_pass) {
+RenderPass::RenderPass(Graphics* _p_gfx) : 
+	p_gfx(_p_gfx) {
 
 }
 
@@ -1,19 +1,49 @@
 #pragma once
 
+#include "RenderGraph.h"
+
 class Graphics;
+class ImageWrap;
 
 class RenderPass
 {
 public:
 	Graphics* p_gfx;
 
-	RenderPass(Graphics* _p_gfx, RenderPass* _p_prev_pass = nullptr);
+	RenderPass(Graphics* _p_gfx);
 	virtual ~RenderPass() = default;
+	//Names the images the pass makes and declares the ones it reads and writes.
+	//Runs when the pass is added to the render graph, before the transients have
+	//memory, so keep the images and leave their descriptors for Setup.
+	virtual void Declare(RenderGraph::Builder& builder) = 0;
 	virtual void Setup() = 0;
+	//Remakes what depends on the window size once the swapchain was recreated:
+	//resizes the pass's images (ImageWrap::Resize), renews its descriptor set
+	//(Graphics::RenewDescriptor) and remakes framebuffers, retiring the old
+	//ones. The transients get memory afterwards, then Setup runs again, so
+	//descriptor writes stay in Setup and pipelines must not be remade there.
+	virtual void Resize() {}
+	//Writes the frame's parameters (Graphics::WriteParams). The render graph
+	//calls it on the main thread every frame the pass runs, before Render.
+	virtual void UpdateParams() {}
 	virtual void Render() = 0;
+	//Whether what Render records only changes with Setup and GetRecordKey, so
+	//the render graph may keep the commands and replay them in later frames.
+	//Anything else that changes per frame belongs in UpdateParams.
+	virtual bool IsStatic() const { return true; }
+	//Changes whenever Render would record something different, e.g. another
+	//pipeline picked in the GUI
+	virtual uint64_t GetRecordKey() const { return 0; }
+	//A pass that draws inside a vk::RenderPass fills in how to begin it and
+	//returns true. The render graph begins and ends it around Render, so Render
+	//only records what goes inside; parallel recording puts that in a secondary
+	//command buffer, which can't begin a render pass itself.
+	virtual bool GetRenderPassBegin(vk::RenderPassBeginInfo& info) const { return false; }
 	virtual void Teardown() = 0;
 	virtual void DrawGUI();
-protected:
-	RenderPass* p_prev_pass;
+	//The render graph skips disabled passes
+	virtual bool IsEnabled() const { return true; }
+	//Whether this frame uses a declared image; lets a pass that picks one of
+	//its inputs at run time keep only that one alive
+	virtual bool Uses(const ImageWrap& image) const { return true; }
 };
-
@@ -0,0 +1,222 @@
+#include "RenderTargetAliaser.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+#include "Graphics.h"
+#include "ImageWrap.h"
+
+void RenderTargetAliaser::Init(Graphics* gfx) {
+    p_gfx = gfx;
+}
+
+void RenderTargetAliaser::Destroy() {
+    // The passes destroy the images; only the memory under them is ours
+    m_memory.Free();
+    m_targets.clear();
+}
+
+void RenderTargetAliaser::AddTransient(ImageWrap& image, TargetKind kind) {
+    Target& target = Find(image);
+    target.transient = &image;
+    target.has_kind = true;
+    target.kind = kind;
+}
+
+void RenderTargetAliaser::AddPersistent(const ImageWrap& image, TargetKind kind) {
+    Target& target = Find(image);
+    target.has_kind = true;
+    target.kind = kind;
+}
+
+void RenderTargetAliaser::Use(uint32_t pass, const ImageWrap& image) {
+    Target& target = Find(image);
+    target.first = std::min(target.first, pass);
+    target.last = std::max(target.last, pass);
+    ++target.uses;
+}
+
+RenderTargetAliaser::Target& RenderTargetAliaser::Find(const ImageWrap& image) {
+    for (auto& target : m_targets) {
+        if (target.image == &image)
+            return target;
+    }
+    m_targets.push_back(Target());
+    m_targets.back().image = &image;
+    return m_targets.back();
+}
+
+vk::DeviceSize RenderTargetAliaser::Place(std::vector<Range>& ranges, bool alias) {
+    // Largest first, each at the lowest offset clear of the ranges already
+    // placed that are alive at the same time
+    std::vector<uint32_t> order(ranges.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+        [&](uint32_t a, uint32_t b) { return ranges[a].size > ranges[b].size; });
+
+    vk::DeviceSize total = 0;
+    std::vector<const Range*> placed;
+    std::vector<const Range*> live;
+    for (uint32_t i : order) {
+        Range& range = ranges[i];
+        live.clear();
+        for (const Range* other : placed) {
+            if (!alias || (other->first <= range.last && range.first <= other->last))
+                live.push_back(other);
+        }
+        std::sort(live.begin(), live.end(),
+            [](const Range* a, const Range* b) { return a->offset < b->offset; });
+
+        vk::DeviceSize offset = 0;
+        for (const Range* other : live) {
+            if (other->offset >= offset + range.size)
+                break;
+            vk::DeviceSize end = other->offset + other->size;
+            end = (end + range.alignment - 1) / range.alignment * range.alignment;
+            offset = std::max(offset, end);
+        }
+        range.offset = offset;
+        total = std::max(total, offset + range.size);
+        placed.push_back(&range);
+    }
+    return total;
+}
+
+void RenderTargetAliaser::Build(uint32_t pass_count, bool alias) {
+    const vk::Device& device = p_gfx->GetDeviceRef();
+    m_pass_count = pass_count;
+    m_alias = alias;
+
+    std::vector<Target*> transients;
+    std::vector<Range> ranges;
+    uint32_t typeBits = ~0u;
+    for (auto& target : m_targets) {
+        if (!target.transient)
+            continue;
+        if (target.first == UINT32_MAX) {
+            // Nothing said who uses it, so it can't share memory with anything
+            printf("Render targets: a transient has no declared uses\n");
+            target.first = 0;
+            target.last = pass_count - 1;
+        }
+        vk::MemoryRequirements requirements = device.getImageMemoryRequirements(target.transient->GetImage());
+        typeBits &= requirements.memoryTypeBits;
+
+        Range range;
+        range.size = requirements.size;
+        range.alignment = requirements.alignment;
+        range.first = target.first;
+        range.last = target.last;
+        ranges.push_back(range);
+        transients.push_back(&target);
+    }
+    if (transients.empty())
+        return;
+    if (!typeBits)
+        throw std::runtime_error("render targets have no memory type in common!");
+
+    vk::MemoryRequirements requirements;
+    requirements.size = Place(ranges, alias);
+    requirements.alignment = 1;
+    for (const auto& range : ranges)
+        requirements.alignment = std::max(requirements.alignment, range.alignment);
+    requirements.memoryTypeBits = typeBits;
+    m_memory = p_gfx->GetAllocator().AllocateUnbound(requirements, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    for (size_t i = 0; i < transients.size(); ++i) {
+        ImageWrap& image = *transients[i]->transient;
+        image.BindMemory(m_memory.memory, m_memory.offset + ranges[i].offset);
+        // Descriptors are written with eGeneral; the render graph's discard gets it there
+        image.SetLayout(vk::ImageLayout::eGeneral);
+    }
+}
+
+void RenderTargetAliaser::Rebuild() {
+    DeviceAllocation memory = m_memory;
+    m_memory = DeviceAllocation();
+    p_gfx->Retire([memory]() mutable { memory.Free(); });
+    Build(m_pass_count, m_alias);
+}
+
+bool RenderTargetAliaser::IsTransient(const ImageWrap& image) const {
+    for (const auto& target : m_targets) {
+        if (target.image == &image)
+            return target.transient != nullptr;
+    }
+    return false;
+}
+
+uint32_t RenderTargetAliaser::LastUse(const ImageWrap& image) const {
+    for (const auto& target : m_targets) {
+        if (target.transient && target.image == &image)
+            return target.last;
+    }
+    return UINT32_MAX;
+}
+
+std::vector<RenderTargetAliaser::Range> RenderTargetAliaser::Ranges(vk::Extent2D window, int precision) const {
+    const vk::Device& device = p_gfx->GetDeviceRef();
+    const vk::Extent2D current = p_gfx->GetWindowExtent();
+
+    std::vector<Range> ranges;
+    for (const auto& target : m_targets) {
+        const ImageWrap& image = *target.image;
+        vk::MemoryRequirements requirements;
+        if (window == current && precision == TARGET_PRECISION) {
+            requirements = device.getImageMemoryRequirements(image.GetImage());
+        }
+        else {
+            // Targets are the window size over a whole divisor (1, 2 or the tile size)
+            vk::Extent2D size = image.GetImageSize();
+            uint32_t divX = std::max(1u, current.width / std::max(1u, size.width));
+            uint32_t divY = std::max(1u, current.height / std::max(1u, size.height));
+            vk::Format format = target.has_kind ? TargetFormat(target.kind, precision) : image.GetFormat();
+            vk::ImageCreateInfo info(vk::ImageCreateFlags(), vk::ImageType::e2D, format,
+                vk::Extent3D(std::max(1u, window.width / divX), std::max(1u, window.height / divY), 1),
+                image.GetMipLevels(), 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+                image.GetUsage());
+            requirements = device.getImageMemoryRequirements(vk::DeviceImageMemoryRequirements(&info))
+                .memoryRequirements;
+        }
+
+        Range range;
+        range.size = requirements.size;
+        range.alignment = requirements.alignment;
+        // Persistent images live across frames
+        range.first = target.transient ? target.first : 0;
+        range.last = target.transient ? target.last : m_pass_count - 1;
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+void RenderTargetAliaser::PrintReport() const {
+    uint32_t transients = static_cast<uint32_t>(std::count_if(m_targets.begin(), m_targets.end(),
+        [](const Target& t) { return t.transient != nullptr; }));
+    printf("Render targets: %u declared, %u transient\n", static_cast<uint32_t>(m_targets.size()), transients);
+
+    const vk::Extent2D sizes[] = { p_gfx->GetWindowExtent(), { 1280, 768 }, { 3840, 2160 } };
+    for (const auto& size : sizes) {
+        std::vector<Range> ranges = Ranges(size, TARGET_PRECISION);
+        vk::DeviceSize separate = Place(ranges, false);
+        vk::DeviceSize aliased = Place(ranges, true);
+        printf("  %ux%u: peak %.1f MB separate, %.1f MB aliased (%.0f%% saved)\n",
+            size.width, size.height, separate / (1024.0 * 1024.0), aliased / (1024.0 * 1024.0),
+            separate ? 100.0 * (1.0 - double(aliased) / double(separate)) : 0.0);
+    }
+
+    // Every use reads or writes about the whole image once
+    const vk::Extent2D window = p_gfx->GetWindowExtent();
+    for (int precision = TARGET_PRECISION_FULL; precision <= TARGET_PRECISION_PACKED; ++precision) {
+        std::vector<Range> ranges = Ranges(window, precision);
+        double touched = 0.0;
+        for (size_t i = 0; i < ranges.size(); ++i)
+            touched += double(ranges[i].size) * m_targets[i].uses;
+        vk::DeviceSize separate = Place(ranges, false);
+        vk::DeviceSize aliased = Place(ranges, true);
+        printf("  %s precision%s: %.1f MB separate, %.1f MB aliased, ~%.1f MB touched per frame\n",
+            TargetPrecisionName(precision), precision == TARGET_PRECISION ? " (built)" : "",
+            separate / (1024.0 * 1024.0), aliased / (1024.0 * 1024.0), touched / (1024.0 * 1024.0));
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+#include <stdint.h>
+
+#include "DeviceAllocator.h"
+#include "TargetFormats.h"
+
+class Graphics;
+class ImageWrap;
+
+/*
+* Lets the pass chain's scratch render targets share memory.
+* Passes create their transient images without memory (bind_memory = false)
+* and hand them to AddTransient. The render graph then passes on which pass,
+* by index into the render order, touches which image. Build turns those uses
+* into a [first, last] pass interval per image and packs images whose
+* intervals don't overlap onto the same bytes of one allocation.
+*
+* A transient's contents are gone once its last pass has run. Every frame the
+* render graph moves it from eUndefined to eGeneral before its first live
+* pass, which has to write it, ordered after the previous occupant's uses.
+*/
+class RenderTargetAliaser
+{
+public:
+	void Init(Graphics* gfx);
+	void Destroy();
+
+	//The image must have been made with bind_memory = false and the format
+	//TargetFormat(kind)
+	void AddTransient(ImageWrap& image, TargetKind kind);
+	//A bound image that lives across frames; the kind is only for the report
+	void AddPersistent(const ImageWrap& image, TargetKind kind);
+	//Pass number pass reads or writes the image. Images that weren't added as
+	//transients are persistent; they only count towards the memory report
+	void Use(uint32_t pass, const ImageWrap& image);
+
+	//Places and binds every transient, leaving them in eGeneral for descriptors.
+	//alias = false gives each transient its own memory.
+	void Build(uint32_t pass_count, bool alias);
+	//Builds again with the same uses once the transients have been resized
+	//(ImageWrap::Resize). The old memory is retired, since frames in flight
+	//still use it.
+	void Rebuild();
+
+	bool IsTransient(const ImageWrap& image) const;
+	//Last pass whose output the transient still holds; UINT32_MAX for any
+	//other image
+	uint32_t LastUse(const ImageWrap& image) const;
+
+	//Peak render target memory with and without aliasing at the window size,
+	//1280x768 and 3840x2160, then memory and bytes touched per frame at the
+	//window size under each TARGET_PRECISION setting
+	void PrintReport() const;
+
+	struct Range
+	{
+		vk::DeviceSize size = 0;
+		vk::DeviceSize alignment = 1;
+		uint32_t first = 0, last = 0;  // Passes, inclusive
+		vk::DeviceSize offset = 0;     // Set by Place
+	};
+	//Sets every offset so that ranges with overlapping passes never share bytes
+	//(no range shares bytes when alias is false). Returns the total size.
+	static vk::DeviceSize Place(std::vector<Range>& ranges, bool alias);
+private:
+	struct Target
+	{
+		const ImageWrap* image = nullptr;
+		ImageWrap* transient = nullptr;  // Null for persistent images
+		bool has_kind = false;
+		TargetKind kind = TargetKind::Color;
+		uint32_t first = UINT32_MAX, last = 0;
+		uint32_t uses = 0;
+	};
+
+	Target& Find(const ImageWrap& image);
+	//Ranges for every target at the given window size and precision setting;
+	//the current size and setting use the real images
+	std::vector<Range> Ranges(vk::Extent2D window, int precision) const;
+
+	Graphics* p_gfx = nullptr;
+	std::vector<Target> m_targets;
+	uint32_t m_pass_count = 0;
+	bool m_alias = false;
+	DeviceAllocation m_memory;
+};
@@ -1,15 +1,39 @@
 #include "Graphics.h"
 
 void Graphics::CreateObjDescriptionBuffer() {
-    vk::CommandBuffer cmdBuf = CreateTempCommandBuffer();
+    vk::CommandBuffer cmdBuf = CreateInitCommandBuffer();
 
     m_objDescriptionBW = CreateStagedBufferWrap(cmdBuf, m_objDesc, vk::BufferUsageFlagBits::eStorageBuffer);
 
-    SubmitTempCommandBuffer(cmdBuf);
+    SubmitInitCommandBuffer(cmdBuf);
 }
 
 void Graphics::CreateMatrixBuffer() {
-    m_matrixBW = CreateBufferWrap(sizeof(MatrixUniforms),
-        vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferDst,
-        vk::MemoryPropertyFlagBits::eDeviceLocal);
+    // A slice per frame in flight, bound with a dynamic offset, so the CPU can
+    // write the next frame's matrices while the GPU reads the previous ones
+    vk::DeviceSize alignment = m_physical_device.getProperties().limits.minUniformBufferOffsetAlignment;
+    m_matrix_stride = (sizeof(MatrixUniforms) + alignment - 1) / alignment * alignment;
+    m_matrixBW = CreateBufferWrap(m_matrix_stride * m_frames.size(),
+        vk::BufferUsageFlagBits::eUniformBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible
+        | vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void Graphics::CreateParamsBuffer() {
+    // Like the matrices: the CPU writes the next frame's parameters while the
+    // GPU reads the previous ones. The async compute passes read it too, so
+    // it's shared between the queues rather than changing owner every frame.
+    m_paramsBW = CreateBufferWrap(m_params_stride * m_frames.size(),
+        vk::BufferUsageFlagBits::eStorageBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible
+        | vk::MemoryPropertyFlagBits::eHostCoherent, true);
+}
+
+uint32_t Graphics::AddPassParams(vk::DeviceSize size) {
+    vk::DeviceSize alignment = m_physical_device.getProperties().limits.minStorageBufferOffsetAlignment;
+    vk::DeviceSize offset = (m_params_size + alignment - 1) / alignment * alignment;
+    if (offset + size > m_params_stride)
+        throw std::runtime_error("parameter buffer is full!");
+    m_params_size = offset + size;
+    return static_cast<uint32_t>(offset);
 }
@@ -0,0 +1,22 @@
+#include "StagingRing.h"
+
+bool StagingRing::Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+    if (size > m_capacity)
+        return false;
+
+    uint64_t start = (m_head + alignment - 1) & ~(alignment - 1);
+    // Skip the tail end of the buffer rather than splitting the region
+    if (start % m_capacity + size > m_capacity)
+        start = (start / m_capacity + 1) * m_capacity;
+    if (start + size - m_tail > m_capacity)
+        return false;
+
+    m_head = start + size;
+    offset = start % m_capacity;
+    return true;
+}
+
+void StagingRing::Release(uint64_t head) {
+    if (head > m_tail)
+        m_tail = head;
+}
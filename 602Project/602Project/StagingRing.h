@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Offset bookkeeping for a ring buffer of staging memory.
+* Positions only ever grow; a position modulo the capacity is the offset into
+* the buffer. The owner remembers GetHead() when it submits work that reads
+* the ring and calls Release() with it once that work's fence has signaled,
+* so regions are freed in submission order.
+*/
+class StagingRing
+{
+public:
+	explicit StagingRing(uint64_t capacity = 0) : m_capacity(capacity) {}
+
+	//Reserves size bytes at the given (power of two) alignment. A region never
+	//wraps around the end of the buffer. Returns false if the ring is too full.
+	bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+
+	//Position just past the last allocation
+	uint64_t GetHead() const { return m_head; }
+
+	//Frees every region allocated before head
+	void Release(uint64_t head);
+
+	uint64_t GetCapacity() const { return m_capacity; }
+	uint64_t GetUsed() const { return m_head - m_tail; }
+private:
+	uint64_t m_capacity;
+	uint64_t m_head = 0;
+	uint64_t m_tail = 0;
+};
@@ -0,0 +1,59 @@
+#include "TargetFormats.h"
+
+#include <stdexcept>
+#include <string>
+
+vk::Format TargetFormat(TargetKind kind, int precision) {
+    bool full = precision == TARGET_PRECISION_FULL;
+    switch (kind) {
+    case TargetKind::SceneColor:
+        if (full)
+            return vk::Format::eR32G32B32A32Sfloat;
+        return precision == TARGET_PRECISION_PACKED ?
+            vk::Format::eB10G11R11UfloatPack32 : vk::Format::eR16G16B16A16Sfloat;
+    case TargetKind::Velocity:
+        return full ? vk::Format::eR32G32Sfloat : vk::Format::eR16G16Sfloat;
+    case TargetKind::Color:
+    case TargetKind::CocParams:
+    case TargetKind::NormalDepth:
+        return full ? vk::Format::eR32G32B32A32Sfloat : vk::Format::eR16G16B16A16Sfloat;
+    // Everything holding a depth that gets soft compared stays 32 bit
+    case TargetKind::Depth:
+        return vk::Format::eR32Sfloat;
+    case TargetKind::Edge:
+        return vk::Format::eR32G32Sfloat;
+    case TargetKind::Tiles:
+    case TargetKind::ColorDepth:
+    case TargetKind::RayMask:
+    default:
+        return vk::Format::eR32G32B32A32Sfloat;
+    }
+}
+
+const char* TargetKindName(TargetKind kind) {
+    static const char* names[] = { "scene color", "velocity", "depth", "tiles", "color+depth",
+        "coc params", "edge", "color", "raymask", "normal+depth" };
+    uint32_t i = static_cast<uint32_t>(kind);
+    return i < static_cast<uint32_t>(TargetKind::Count) ? names[i] : "?";
+}
+
+const char* TargetPrecisionName(int precision) {
+    switch (precision) {
+    case TARGET_PRECISION_FULL: return "full";
+    case TARGET_PRECISION_REDUCED: return "reduced";
+    case TARGET_PRECISION_PACKED: return "packed";
+    default: return "?";
+    }
+}
+
+void ValidateTargetFormats(const vk::PhysicalDevice& physical_device) {
+    vk::FormatFeatureFlags needed = vk::FormatFeatureFlagBits::eStorageImage |
+        vk::FormatFeatureFlagBits::eColorAttachment | vk::FormatFeatureFlagBits::eSampledImage;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(TargetKind::Count); ++i) {
+        TargetKind kind = static_cast<TargetKind>(i);
+        vk::Format format = TargetFormat(kind);
+        if ((physical_device.getFormatProperties(format).optimalTilingFeatures & needed) != needed)
+            throw std::runtime_error(std::string("render target format ") + vk::to_string(format) +
+                " (" + TargetKindName(kind) + ") is not supported, build with TARGET_PRECISION_FULL!");
+    }
+}
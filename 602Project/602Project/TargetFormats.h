@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <stdint.h>
+
+#include "shaders/shared_structs.h"
+
+// What an intermediate render target holds; decides its format under each
+// TARGET_PRECISION. The shaders name the same kinds with the FMT_* qualifiers
+// in shared_structs.h.
+enum class TargetKind : uint32_t
+{
+    SceneColor = 0,   // Lit scene, motion blur and upscale output
+    Velocity = 1,     // Screen space velocity
+    Depth = 2,        // Linear depth
+    Tiles = 3,        // TileMax/NeighbourMax: velocity, min depth, max CoC
+    ColorDepth = 4,   // Downscaled color with max depth
+    CocParams = 5,    // CoC radius with bg/fg weights
+    Edge = 6,         // Ray mask with depth
+    Color = 7,        // DOF layers, median and raycast colors
+    RayMask = 8,      // Ray mask, depth and raycast history count
+    NormalDepth = 9,  // Raycast first hit normal and distance
+    Count = 10
+};
+
+//Format of kind under the given precision setting
+vk::Format TargetFormat(TargetKind kind, int precision = TARGET_PRECISION);
+const char* TargetKindName(TargetKind kind);
+const char* TargetPrecisionName(int precision);
+
+//Throws when the device can't use a format of the compiled precision setting
+//as a storage image, color attachment and sampled image
+void ValidateTargetFormats(const vk::PhysicalDevice& physical_device);
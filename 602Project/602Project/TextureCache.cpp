@@ -0,0 +1,124 @@
+#include "TextureCache.h"
+
+#include <fstream>
+#include <cstdio>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr uint32_t texture_cache_magic = 0x43584554; // "TEXC"
+    // Bump when the encoders or the CPU mip filter change their output
+    constexpr uint32_t texture_cache_version = 3;
+}
+
+TextureCache::TextureCache(const std::string& image_path, uint64_t source_hash, TextureCompression compression) :
+    m_cache_path(image_path + ".texcache"), m_compression(compression), m_source_hash(source_hash) {
+    std::error_code ec;
+    m_source_size = fs::file_size(image_path, ec);
+    if (ec)
+        return;
+    m_source_mtime = static_cast<int64_t>(fs::last_write_time(image_path, ec).time_since_epoch().count());
+    if (ec || !m_source_size)
+        return;
+    m_valid_source = true;
+}
+
+bool TextureCache::Read(TextureLevels& levels) const {
+    if (!m_valid_source)
+        return false;
+
+    std::ifstream stream(m_cache_path, std::ios::ate | std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    uint64_t file_size = stream.tellg();
+    if (file_size < sizeof(TextureCacheHeader))
+        return false;
+
+    TextureCacheHeader header;
+    stream.seekg(0, std::ios::beg);
+    stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!stream ||
+        header.magic != texture_cache_magic ||
+        header.version != texture_cache_version ||
+        header.compression != static_cast<uint32_t>(m_compression) ||
+        header.sourceSize != m_source_size ||
+        header.sourceMtime != m_source_mtime ||
+        header.sourceHash != m_source_hash) {
+        printf("Texture cache stale: %s\n", m_cache_path.c_str());
+        return false;
+    }
+
+    TextureLevels result;
+    result.format = static_cast<TextureFormat>(header.format);
+    result.levels.resize(header.levelCount);
+    uint64_t table_size = uint64_t(header.levelCount) * sizeof(TextureLevels::Level);
+    if (header.dataOffset < sizeof(header) + table_size ||
+        header.dataOffset > file_size || header.dataSize > file_size - header.dataOffset) {
+        printf("Texture cache truncated: %s\n", m_cache_path.c_str());
+        return false;
+    }
+    stream.read(reinterpret_cast<char*>(result.levels.data()), table_size);
+    for (const auto& level : result.levels) {
+        if (level.offset + level.size > header.dataSize) {
+            printf("Texture cache truncated: %s\n", m_cache_path.c_str());
+            return false;
+        }
+    }
+
+    result.data.resize(header.dataSize);
+    stream.seekg(header.dataOffset, std::ios::beg);
+    stream.read(reinterpret_cast<char*>(result.data.data()), header.dataSize);
+    if (!stream) {
+        printf("Texture cache truncated: %s\n", m_cache_path.c_str());
+        return false;
+    }
+
+    levels = std::move(result);
+    return true;
+}
+
+void TextureCache::Write(const TextureLevels& levels) const {
+    if (!m_valid_source)
+        return;
+
+    TextureCacheHeader header = {};
+    header.magic = texture_cache_magic;
+    header.version = texture_cache_version;
+    header.compression = static_cast<uint32_t>(m_compression);
+    header.format = static_cast<uint32_t>(levels.format);
+    header.levelCount = static_cast<uint32_t>(levels.levels.size());
+    uint64_t table_end = sizeof(header) + levels.levels.size() * sizeof(TextureLevels::Level);
+    header.dataOffset = static_cast<uint32_t>((table_end + 15) & ~uint64_t(15));
+    header.dataSize = levels.data.size();
+    header.sourceSize = m_source_size;
+    header.sourceMtime = m_source_mtime;
+    header.sourceHash = m_source_hash;
+
+    // Write to a temporary file first so an interrupted write never leaves a
+    // half written entry behind.
+    std::string temp_path = m_cache_path + ".tmp";
+    {
+        static const char zeros[16] = {};
+        std::ofstream stream(temp_path, std::ios::binary | std::ios::trunc);
+        if (!stream.is_open()) {
+            printf("Failed to write texture cache: %s\n", m_cache_path.c_str());
+            return;
+        }
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(levels.levels.data()),
+            levels.levels.size() * sizeof(TextureLevels::Level));
+        stream.write(zeros, header.dataOffset - table_end);
+        stream.write(reinterpret_cast<const char*>(levels.data.data()), levels.data.size());
+        if (!stream) {
+            printf("Failed to write texture cache: %s\n", m_cache_path.c_str());
+            return;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_path, m_cache_path, ec);
+    if (ec)
+        printf("Failed to write texture cache: %s\n", m_cache_path.c_str());
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+
+#include "TextureCompress.h"
+
+// On disk cache of the CPU built (and encoded) mip chain of one texture, stored next to
+// the source image as <image>.texcache. Entries are keyed by the source
+// file's size, mtime and content hash plus the compression policy, so
+// encoding only runs when the image or the policy changed. The caller hashes the
+// contents (HashBytes) from the bytes it read anyway, so the image isn't read again.
+//
+// File layout:
+//   TextureCacheHeader
+//   Level[levelCount]
+//   level data, 16 byte aligned
+class TextureCache
+{
+public:
+	TextureCache(const std::string& image_path, uint64_t source_hash, TextureCompression compression);
+
+	//Fills levels from the cache. Returns false on a miss or a stale entry.
+	bool Read(TextureLevels& levels) const;
+
+	//Writes levels to the cache, replacing any previous entry.
+	void Write(const TextureLevels& levels) const;
+
+	const std::string& GetCachePath() const { return m_cache_path; }
+private:
+	struct TextureCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t compression;  // TextureCompression the entry was made with
+		uint32_t format;       // TextureFormat of the levels
+		uint32_t levelCount;
+		uint32_t dataOffset;
+		uint64_t dataSize;
+		uint64_t sourceSize;
+		int64_t  sourceMtime;
+		uint64_t sourceHash;
+	};
+
+	std::string m_cache_path;
+	TextureCompression m_compression;
+	uint64_t m_source_size = 0;
+	int64_t  m_source_mtime = 0;
+	uint64_t m_source_hash = 0;
+	bool m_valid_source = false;
+};
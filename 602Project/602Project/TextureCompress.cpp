@@ -0,0 +1,393 @@
+#include "TextureCompress.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "ThreadPool.h"
+
+namespace {
+    // Principal axis of a set of points by power iteration on their covariance
+    template <int N>
+    void PrincipalAxis(const float (*points)[4], int count, float mean[N], float axis[N]) {
+        for (int c = 0; c < N; ++c) {
+            mean[c] = 0.0f;
+            for (int i = 0; i < count; ++i)
+                mean[c] += points[i][c];
+            mean[c] /= count;
+        }
+
+        float cov[N][N] = {};
+        for (int i = 0; i < count; ++i)
+            for (int a = 0; a < N; ++a)
+                for (int b = 0; b < N; ++b)
+                    cov[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+
+        // Start from the longest diagonal so grey ramps converge immediately
+        for (int c = 0; c < N; ++c)
+            axis[c] = 1.0f;
+        for (int iter = 0; iter < 8; ++iter) {
+            float next[N] = {};
+            for (int a = 0; a < N; ++a)
+                for (int b = 0; b < N; ++b)
+                    next[a] += cov[a][b] * axis[b];
+            float len = 0.0f;
+            for (int c = 0; c < N; ++c)
+                len += next[c] * next[c];
+            if (len < 1e-12f)
+                break;
+            len = 1.0f / std::sqrt(len);
+            for (int c = 0; c < N; ++c)
+                axis[c] = next[c] * len;
+        }
+    }
+
+    template <int N>
+    void EndpointsAlongAxis(const float (*points)[4], int count, const float mean[N], const float axis[N],
+        float lo[N], float hi[N]) {
+        float minp = 0.0f, maxp = 0.0f;
+        for (int i = 0; i < count; ++i) {
+            float p = 0.0f;
+            for (int c = 0; c < N; ++c)
+                p += (points[i][c] - mean[c]) * axis[c];
+            minp = std::min(minp, p);
+            maxp = std::max(maxp, p);
+        }
+        for (int c = 0; c < N; ++c) {
+            lo[c] = std::clamp(mean[c] + axis[c] * minp, 0.0f, 255.0f);
+            hi[c] = std::clamp(mean[c] + axis[c] * maxp, 0.0f, 255.0f);
+        }
+    }
+
+    // Least squares endpoints for fixed palette weights: p_i ~ (1-w_i) lo + w_i hi
+    template <int N>
+    bool SolveEndpoints(const float (*points)[4], const float* weights, int count, float lo[N], float hi[N]) {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[N] = {}, bx[N] = {};
+        for (int i = 0; i < count; ++i) {
+            float b = weights[i];
+            float a = 1.0f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < N; ++c) {
+                ax[c] += a * points[i][c];
+                bx[c] += b * points[i][c];
+            }
+        }
+        float det = aa * bb - ab * ab;
+        if (std::fabs(det) < 1e-6f)
+            return false;
+        det = 1.0f / det;
+        for (int c = 0; c < N; ++c) {
+            lo[c] = std::clamp((ax[c] * bb - bx[c] * ab) * det, 0.0f, 255.0f);
+            hi[c] = std::clamp((bx[c] * aa - ax[c] * ab) * det, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // BC1
+
+    uint16_t Pack565(const float color[3]) {
+        int r = std::clamp(static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+        int g = std::clamp(static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+        int b = std::clamp(static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void Unpack565(uint16_t packed, int color[3]) {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // Picks the nearest of the 4 colour palette entries; returns the total squared error
+    int AssignBC1(const float (*points)[4], uint16_t c0, uint16_t c1, uint8_t indices[16]) {
+        int e0[3], e1[3], palette[4][3];
+        Unpack565(c0, e0);
+        Unpack565(c1, e1);
+        for (int c = 0; c < 3; ++c) {
+            palette[0][c] = e0[c];
+            palette[1][c] = e1[c];
+            palette[2][c] = (2 * e0[c] + e1[c]) / 3;
+            palette[3][c] = (e0[c] + 2 * e1[c]) / 3;
+        }
+        int total = 0;
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, best_error = INT32_MAX;
+            for (int p = 0; p < 4; ++p) {
+                int error = 0;
+                for (int c = 0; c < 3; ++c) {
+                    int d = static_cast<int>(points[i][c]) - palette[p][c];
+                    error += d * d;
+                }
+                if (error < best_error) {
+                    best_error = error;
+                    best = p;
+                }
+            }
+            indices[i] = static_cast<uint8_t>(best);
+            total += best_error;
+        }
+        return total;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    // BC7 mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4 bit indices
+
+    const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    struct BC7Endpoints
+    {
+        int q[2][4];  // 7 bit endpoint values
+        int p[2];     // p-bits
+    };
+
+    int Quantize7(float value, int pbit) {
+        return std::clamp(static_cast<int>((value - pbit) * 0.5f + 0.5f), 0, 127);
+    }
+
+    int AssignBC7(const float (*points)[4], const BC7Endpoints& ends, uint8_t indices[16]) {
+        int e[2][4], palette[16][4];
+        for (int s = 0; s < 2; ++s)
+            for (int c = 0; c < 4; ++c)
+                e[s][c] = (ends.q[s][c] << 1) | ends.p[s];
+        for (int p = 0; p < 16; ++p)
+            for (int c = 0; c < 4; ++c)
+                palette[p][c] = ((64 - bc7_weights4[p]) * e[0][c] + bc7_weights4[p] * e[1][c] + 32) >> 6;
+
+        int total = 0;
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, best_error = INT32_MAX;
+            for (int p = 0; p < 16; ++p) {
+                int error = 0;
+                for (int c = 0; c < 4; ++c) {
+                    int d = static_cast<int>(points[i][c]) - palette[p][c];
+                    error += d * d;
+                }
+                if (error < best_error) {
+                    best_error = error;
+                    best = p;
+                }
+            }
+            indices[i] = static_cast<uint8_t>(best);
+            total += best_error;
+        }
+        return total;
+    }
+
+    // Tries the four p-bit combinations for a pair of float endpoints and keeps the best
+    int FitBC7(const float (*points)[4], const float lo[4], const float hi[4],
+        BC7Endpoints& best, uint8_t indices[16]) {
+        int best_error = INT32_MAX;
+        for (int pbits = 0; pbits < 4; ++pbits) {
+            BC7Endpoints ends;
+            ends.p[0] = pbits & 1;
+            ends.p[1] = pbits >> 1;
+            for (int c = 0; c < 4; ++c) {
+                ends.q[0][c] = Quantize7(lo[c], ends.p[0]);
+                ends.q[1][c] = Quantize7(hi[c], ends.p[1]);
+            }
+            uint8_t candidate[16];
+            int error = AssignBC7(points, ends, candidate);
+            if (error < best_error) {
+                best_error = error;
+                best = ends;
+                memcpy(indices, candidate, 16);
+            }
+        }
+        return best_error;
+    }
+
+    struct BitWriter
+    {
+        uint8_t* out;
+        uint32_t position = 0;
+
+        void Write(uint32_t value, uint32_t bits) {
+            for (uint32_t b = 0; b < bits; ++b, ++position)
+                if (value & (1u << b))
+                    out[position >> 3] |= static_cast<uint8_t>(1u << (position & 7));
+        }
+    };
+
+    void LoadBlockPoints(const uint8_t* block, float points[16][4]) {
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+                points[i][c] = block[4 * i + c];
+    }
+}
+
+uint32_t TextureBlockBytes(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::BC1: return 8;
+    case TextureFormat::BC7: return 16;
+    default: return 4;
+    }
+}
+
+uint64_t TextureLevelSize(TextureFormat format, uint32_t width, uint32_t height) {
+    if (format == TextureFormat::RGBA8)
+        return uint64_t(width) * height * 4;
+    return uint64_t((width + 3) / 4) * ((height + 3) / 4) * TextureBlockBytes(format);
+}
+
+bool HasAlpha(const uint8_t* rgba, uint32_t width, uint32_t height) {
+    const size_t count = size_t(width) * height;
+    for (size_t i = 0; i < count; ++i)
+        if (rgba[4 * i + 3] != 255)
+            return true;
+    return false;
+}
+
+void EncodeBC1Block(const uint8_t* block, uint8_t* out) {
+    float points[16][4];
+    LoadBlockPoints(block, points);
+
+    float mean[3], axis[3], lo[3], hi[3];
+    PrincipalAxis<3>(points, 16, mean, axis);
+    EndpointsAlongAxis<3>(points, 16, mean, axis, lo, hi);
+
+    uint16_t c0 = Pack565(hi), c1 = Pack565(lo);
+    uint8_t indices[16];
+    int error = AssignBC1(points, c0, c1, indices);
+
+    // One least squares pass on the chosen indices usually recovers a little error
+    static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    float w[16];
+    for (int i = 0; i < 16; ++i)
+        w[i] = weights[indices[i]];
+    float lo2[3], hi2[3];
+    if (SolveEndpoints<3>(points, w, 16, hi2, lo2)) {
+        uint16_t r0 = Pack565(hi2), r1 = Pack565(lo2);
+        uint8_t refined[16];
+        int refined_error = AssignBC1(points, r0, r1, refined);
+        if (refined_error < error) {
+            c0 = r0;
+            c1 = r1;
+            memcpy(indices, refined, 16);
+        }
+    }
+
+    // c0 > c1 selects the 4 colour mode; swapping the endpoints swaps index 0<->1 and 2<->3
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        for (auto& index : indices)
+            index ^= 1;
+    }
+    else if (c0 == c1) {
+        for (auto& index : indices)
+            index = 0;
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; ++i)
+        bits |= uint32_t(indices[i]) << (2 * i);
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    memcpy(out + 4, &bits, 4);
+}
+
+void EncodeBC7Block(const uint8_t* block, uint8_t* out) {
+    float points[16][4];
+    LoadBlockPoints(block, points);
+
+    float mean[4], axis[4], lo[4], hi[4];
+    PrincipalAxis<4>(points, 16, mean, axis);
+    EndpointsAlongAxis<4>(points, 16, mean, axis, lo, hi);
+
+    BC7Endpoints ends;
+    uint8_t indices[16];
+    int error = FitBC7(points, lo, hi, ends, indices);
+
+    float w[16];
+    for (int i = 0; i < 16; ++i)
+        w[i] = bc7_weights4[indices[i]] / 64.0f;
+    float lo2[4], hi2[4];
+    if (error > 0 && SolveEndpoints<4>(points, w, 16, lo2, hi2)) {
+        BC7Endpoints refined;
+        uint8_t refined_indices[16];
+        if (FitBC7(points, lo2, hi2, refined, refined_indices) < error) {
+            ends = refined;
+            memcpy(indices, refined_indices, 16);
+        }
+    }
+
+    // The anchor (first) index is stored with its top bit implied zero
+    if (indices[0] & 8) {
+        std::swap(ends.q[0], ends.q[1]);
+        std::swap(ends.p[0], ends.p[1]);
+        for (auto& index : indices)
+            index = 15 - index;
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer{ out };
+    writer.Write(1u << 6, 7);  // Mode 6
+    for (int c = 0; c < 4; ++c) {
+        writer.Write(ends.q[0][c], 7);
+        writer.Write(ends.q[1][c], 7);
+    }
+    writer.Write(ends.p[0], 1);
+    writer.Write(ends.p[1], 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.Write(indices[i], 4);
+}
+
+TextureLevels CompressTexture(const TextureLevels& mips, TextureFormat format, ThreadPool& pool) {
+    if (format == TextureFormat::RGBA8)
+        return mips;
+
+    TextureLevels result;
+    result.format = format;
+
+    uint64_t size = 0;
+    for (const TextureLevels::Level& mip : mips.levels) {
+        uint64_t levelSize = TextureLevelSize(format, mip.width, mip.height);
+        result.levels.push_back({ mip.width, mip.height, size, levelSize });
+        size = (size + levelSize + 15) & ~uint64_t(15);
+    }
+    result.data.resize(size);
+
+    for (size_t l = 0; l < result.levels.size(); ++l) {
+        const TextureLevels::Level& level = result.levels[l];
+        const uint8_t* source = mips.data.data() + mips.levels[l].offset;
+
+        // One job per group of block rows; edge blocks repeat the last row/column
+        const uint32_t blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+        const uint32_t blockBytes = TextureBlockBytes(format);
+        const uint32_t rowsPerJob = std::max(1u, 4096u / blocksX);
+        uint8_t* dest = result.data.data() + level.offset;
+        std::vector<std::future<void>> jobs;
+        for (uint32_t firstRow = 0; firstRow < blocksY; firstRow += rowsPerJob) {
+            uint32_t lastRow = std::min(blocksY, firstRow + rowsPerJob);
+            jobs.push_back(pool.Submit([=]() {
+                uint8_t block[64];
+                for (uint32_t by = firstRow; by < lastRow; ++by) {
+                    for (uint32_t bx = 0; bx < blocksX; ++bx) {
+                        for (uint32_t y = 0; y < 4; ++y) {
+                            uint32_t sy = std::min(4 * by + y, level.height - 1);
+                            for (uint32_t x = 0; x < 4; ++x) {
+                                uint32_t sx = std::min(4 * bx + x, level.width - 1);
+                                memcpy(block + 4 * (4 * y + x), source + (size_t(sy) * level.width + sx) * 4, 4);
+                            }
+                        }
+                        uint8_t* out = dest + (size_t(by) * blocksX + bx) * blockBytes;
+                        if (format == TextureFormat::BC1)
+                            EncodeBC1Block(block, out);
+                        else
+                            EncodeBC7Block(block, out);
+                    }
+                }
+                }));
+        }
+        for (auto& job : jobs)
+            job.get();
+    }
+    return result;
+}
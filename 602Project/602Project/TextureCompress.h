@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+class ThreadPool;
+
+// How scene textures are stored on the GPU
+enum class TextureCompression : uint32_t
+{
+    None = 0,  // RGBA8, mips made as Graphics::mip_generation says
+    BC1 = 1,   // 4 bpp, opaque RGB
+    BC7 = 2,   // 8 bpp, RGBA
+    Auto = 3   // BC1 for opaque images, BC7 for images with alpha
+};
+
+// Pixel format of a TextureLevels
+enum class TextureFormat : uint32_t
+{
+    RGBA8 = 0,
+    BC1 = 1,
+    BC7 = 2
+};
+
+// A texture with its mip levels packed the way copyBufferToImage wants them
+struct TextureLevels
+{
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;  // Into data, 16 byte aligned
+        uint64_t size;
+    };
+
+    TextureFormat format = TextureFormat::RGBA8;
+    std::vector<Level> levels;
+    std::vector<uint8_t> data;
+};
+
+//Bytes per 4x4 block, or per pixel for RGBA8
+uint32_t TextureBlockBytes(TextureFormat format);
+
+//Size of one level of the given format, in bytes
+uint64_t TextureLevelSize(TextureFormat format, uint32_t width, uint32_t height);
+
+//True if any pixel of an RGBA8 image is not fully opaque
+bool HasAlpha(const uint8_t* rgba, uint32_t width, uint32_t height);
+
+//Encodes one 4x4 RGBA8 block (64 bytes, row major) as BC1 (8 bytes, alpha ignored)
+void EncodeBC1Block(const uint8_t* block, uint8_t* out);
+
+//Encodes one 4x4 RGBA8 block as BC7 mode 6 (16 bytes)
+void EncodeBC7Block(const uint8_t* block, uint8_t* out);
+
+//Encodes every level of an RGBA8 mip chain (see BuildMipChain in MipBuilder.h);
+//RGBA8 chains are returned as is.
+//Rows of blocks are spread over the pool's workers.
+TextureLevels CompressTexture(const TextureLevels& mips, TextureFormat format, ThreadPool& pool);
@@ -0,0 +1,53 @@
+#include "TextureRegistry.h"
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "Util.h"
+
+uint32_t TextureRegistry::Register(const std::string& path, bool& is_new, std::string& contents) {
+    ++m_references;
+    is_new = false;
+    contents.clear();
+
+    std::error_code ec;
+    fs::path canonical = fs::weakly_canonical(path, ec);
+    std::string key = ec ? fs::path(path).lexically_normal().generic_string() : canonical.generic_string();
+
+    auto by_path = m_by_path.find(key);
+    if (by_path != m_by_path.end()) {
+        ++m_entries[by_path->second].references;
+        return by_path->second;
+    }
+
+    // Same bytes under a different name (copied or renamed files)
+    contents = LoadFileIntoString(key);
+    uint64_t hash = HashBytes(contents.data(), contents.size());
+    if (!contents.empty()) {
+        auto candidates = m_by_content.equal_range(hash);
+        for (auto it = candidates.first; it != candidates.second; ++it) {
+            const Entry& candidate = m_entries[it->second];
+            // A hash match alone isn't proof; compare against the bytes of the first file
+            if (candidate.file_size == contents.size() && LoadFileIntoString(candidate.path) == contents) {
+                m_by_path.emplace(key, it->second);
+                ++m_entries[it->second].references;
+                contents.clear();
+                return it->second;
+            }
+        }
+    }
+
+    uint32_t index = static_cast<uint32_t>(m_entries.size());
+    Entry entry;
+    entry.path = key;
+    entry.content_hash = hash;
+    entry.file_size = contents.size();
+    entry.references = 1;
+    m_entries.push_back(entry);
+
+    m_by_path.emplace(key, index);
+    if (!contents.empty())
+        m_by_content.emplace(hash, index);
+    is_new = true;
+    return index;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+/*
+* Deduplicates the scene's texture files.
+* Images are keyed by canonical path and, across different paths, by their
+* file contents (hash and size first, then the bytes), so every unique image
+* is decoded and uploaded once.
+* Registry indices match the order images are appended to Graphics::m_objText.
+*/
+class TextureRegistry
+{
+public:
+	struct Entry
+	{
+		std::string path;          // Canonical path of the first file registered
+		uint64_t content_hash = 0;
+		uint64_t file_size = 0;
+		uint32_t references = 0;  // Number of Register calls resolved to this entry
+	};
+
+	//Returns the shared index for the image at path.
+	//is_new is set when this is the first time the image is seen and the caller must load it;
+	//contents then holds the file's bytes, so it doesn't have to be read again to decode.
+	uint32_t Register(const std::string& path, bool& is_new, std::string& contents);
+
+	const std::vector<Entry>& GetEntries() const { return m_entries; }
+	uint32_t GetReferenceCount() const { return m_references; }
+private:
+	std::unordered_map<std::string, uint32_t> m_by_path;
+	std::unordered_multimap<uint64_t, uint32_t> m_by_content;
+	std::vector<Entry> m_entries;
+	uint32_t m_references = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <queue>
+#include <vector>
+
+/*
+* A minimal fixed size pool of worker threads.
+* Used for CPU heavy loading work (image decoding etc.)
+*/
+class ThreadPool
+{
+public:
+	//Spawns thread_count workers. 0 uses the hardware concurrency.
+	explicit ThreadPool(uint32_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//Queues a job and returns a future for its result.
+	template <typename F>
+	auto Submit(F&& job) -> std::future<decltype(job())> {
+		using Result = decltype(job());
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(job));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.emplace([task]() { (*task)(); });
+		}
+		m_condition.notify_one();
+		return result;
+	}
+
+	uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+private:
+	void WorkerLoop();
+
+	std::vector<std::thread> m_workers;
+	std::queue<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_stopping = false;
+};
@@ -1,12 +1,11 @@
 #include "Graphics.h"
 
 #include "TileMaxPass.h"
-#include "LightingPass.h"
 #include "DOFPass.h"
 
 void TileMaxPass::SetupBuffer() {
 	m_buffer.CreateTextureSampler();
-	m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+	p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::Tiles);
 }
 
 void TileMaxPass::SetupDescriptor() {
@@ -14,20 +13,17 @@ void TileMaxPass::SetupDescriptor() {
         {0, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {1, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {2, vk::DescriptorType::eStorageImage, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {3, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute}});
 }
 
 void TileMaxPass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantTileMax));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -49,9 +45,9 @@ void TileMaxPass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-TileMaxPass::TileMaxPass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx, _p_prev_pass),
+TileMaxPass::TileMaxPass(Graphics* _p_gfx) : RenderPass(_p_gfx),
 m_buffer(p_gfx->GetWindowSize().x/ tile_size, p_gfx->GetWindowSize().y / tile_size,
-    vk::Format::eR32G32B32A32Sfloat,
+    TargetFormat(TargetKind::Tiles),
     vk::ImageUsageFlagBits::eTransferDst |
     vk::ImageUsageFlagBits::eSampled |
     vk::ImageUsageFlagBits::eStorage |
@@ -59,12 +55,13 @@ m_buffer(p_gfx->GetWindowSize().x/ tile_size, p_gfx->GetWindowSize().y / tile_si
     vk::ImageUsageFlagBits::eColorAttachment,
     vk::ImageAspectFlagBits::eColor,
     vk::MemoryPropertyFlagBits::eDeviceLocal,
-    1, p_gfx), m_push_consts() {
+    1, p_gfx, false), m_push_consts() {
     SetupBuffer();
     SetupDescriptor();
 
     m_push_consts.tile_size = tile_size;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantTileMax));
 }
 
 TileMaxPass::~TileMaxPass() {
@@ -75,64 +72,52 @@ TileMaxPass::~TileMaxPass() {
     m_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void TileMaxPass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("tile_max", m_buffer);
+    p_velocity_buffer = &builder.Read("velocity", stages);
+    p_depth_buffer = &builder.Read("depth", stages);
+    builder.Write("tile_max", stages);
+    builder.AsyncCompute();
+}
+
+void TileMaxPass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x / tile_size, p_gfx->GetWindowSize().y / tile_size);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void TileMaxPass::Setup() {
-    m_descriptor.write(p_gfx->GetDeviceRef(), 0,
-        static_cast<LightingPass*>(p_prev_pass)->GetVeloDepthBufferRef().Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 0, p_velocity_buffer->Descriptor());
     m_descriptor.write(p_gfx->GetDeviceRef(), 1, m_buffer.Descriptor());
-    SetupPipeline();
+    m_descriptor.write(p_gfx->GetDeviceRef(), 2, p_depth_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 3, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantTileMax));
+    if (!m_pipeline)
+        SetupPipeline();
 }
 
-void TileMaxPass::Render() {
-    //Set the push consts based on DOF params
+void TileMaxPass::UpdateParams() {
+    //Set the params based on DOF params
     m_push_consts.coc_sample_scale = p_dof_pass->GetDOFParams().coc_sample_scale;
     m_push_consts.focal_length = p_dof_pass->GetDOFParams().focal_length;
     m_push_consts.focal_distance = p_dof_pass->GetDOFParams().focal_distance;
     m_push_consts.lens_diameter = p_dof_pass->GetDOFParams().lens_diameter;
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+}
 
-    LightingPass* p_prev_lighting_pass = static_cast<LightingPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_prev_lighting_pass->GetBufferRef().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
+void TileMaxPass::Render() {
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0,
-        sizeof(PushConstantTileMax),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
     p_gfx->GetCommandBuffer().dispatch(
-        (p_gfx->GetWindowSize().x / tile_size),
-        (p_gfx->GetWindowSize().y / tile_size), 1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
+        (p_gfx->GetRenderSize().x / tile_size),
+        (p_gfx->GetRenderSize().y / tile_size), 1);
 }
 
 void TileMaxPass::Teardown() {
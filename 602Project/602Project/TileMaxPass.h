@@ -16,13 +16,20 @@ private:
 	void SetupPipeline();
 
 	PushConstantTileMax m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 
 	DOFPass* p_dof_pass;
+
+	const ImageWrap* p_velocity_buffer = nullptr;
+	const ImageWrap* p_depth_buffer = nullptr;
 public:
-	TileMaxPass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	TileMaxPass(Graphics* _p_gfx);
 	~TileMaxPass();
 
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
@@ -0,0 +1,199 @@
+#include "TlsfAllocator.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+    uint32_t HighestBit(uint64_t value) {
+        uint32_t bit = 0;
+        while (value >>= 1)
+            ++bit;
+        return bit;
+    }
+
+    uint32_t LowestBit(uint64_t value) {
+        uint32_t bit = 0;
+        while (!(value & 1)) {
+            value >>= 1;
+            ++bit;
+        }
+        return bit;
+    }
+}
+
+TlsfAllocator::TlsfAllocator(uint64_t size) : m_size(size) {
+    for (auto& heads : m_heads)
+        std::fill(std::begin(heads), std::end(heads), invalid);
+    if (size == 0)
+        return;
+
+    uint32_t node = NewNode();
+    m_nodes[node].size = size;
+    InsertFree(node);
+}
+
+void TlsfAllocator::Mapping(uint64_t size, uint32_t& fl, uint32_t& sl) {
+    if (size < sl_count) {
+        fl = 0;
+        sl = static_cast<uint32_t>(size);
+    }
+    else {
+        uint32_t msb = HighestBit(size);
+        sl = static_cast<uint32_t>(size >> (msb - sl_log2)) ^ sl_count;
+        fl = msb - sl_log2 + 1;
+    }
+}
+
+uint32_t TlsfAllocator::NewNode() {
+    if (!m_unused_nodes.empty()) {
+        uint32_t node = m_unused_nodes.back();
+        m_unused_nodes.pop_back();
+        m_nodes[node] = Node();
+        return node;
+    }
+    m_nodes.emplace_back();
+    return static_cast<uint32_t>(m_nodes.size() - 1);
+}
+
+void TlsfAllocator::InsertFree(uint32_t node) {
+    uint32_t fl, sl;
+    Mapping(m_nodes[node].size, fl, sl);
+    Node& n = m_nodes[node];
+    n.free = true;
+    n.prev_free = invalid;
+    n.next_free = m_heads[fl][sl];
+    if (n.next_free != invalid)
+        m_nodes[n.next_free].prev_free = node;
+    m_heads[fl][sl] = node;
+    m_fl_bitmap |= 1ull << fl;
+    m_sl_bitmap[fl] |= 1u << sl;
+    ++m_free_count;
+}
+
+void TlsfAllocator::RemoveFree(uint32_t node) {
+    uint32_t fl, sl;
+    Mapping(m_nodes[node].size, fl, sl);
+    Node& n = m_nodes[node];
+    if (n.prev_free != invalid)
+        m_nodes[n.prev_free].next_free = n.next_free;
+    else
+        m_heads[fl][sl] = n.next_free;
+    if (n.next_free != invalid)
+        m_nodes[n.next_free].prev_free = n.prev_free;
+    if (m_heads[fl][sl] == invalid) {
+        m_sl_bitmap[fl] &= ~(1u << sl);
+        if (!m_sl_bitmap[fl])
+            m_fl_bitmap &= ~(1ull << fl);
+    }
+    n.free = false;
+    n.prev_free = n.next_free = invalid;
+    --m_free_count;
+}
+
+void TlsfAllocator::Split(uint32_t node, uint64_t size) {
+    uint32_t rest = NewNode();
+    Node& n = m_nodes[node];
+    Node& r = m_nodes[rest];
+    r.offset = n.offset + size;
+    r.size = n.size - size;
+    r.prev_phys = node;
+    r.next_phys = n.next_phys;
+    if (r.next_phys != invalid)
+        m_nodes[r.next_phys].prev_phys = rest;
+    n.next_phys = rest;
+    n.size = size;
+    InsertFree(rest);
+}
+
+void TlsfAllocator::Merge(uint32_t node, uint32_t next) {
+    Node& n = m_nodes[node];
+    Node& x = m_nodes[next];
+    n.size += x.size;
+    n.next_phys = x.next_phys;
+    if (n.next_phys != invalid)
+        m_nodes[n.next_phys].prev_phys = node;
+    m_unused_nodes.push_back(next);
+}
+
+uint64_t TlsfAllocator::GetFittingSize(uint64_t size, uint64_t alignment) {
+    if (size == 0)
+        size = 1;
+    uint64_t search = size + (alignment > 1 ? alignment - 1 : 0);
+    if (search >= sl_count)
+        search += (1ull << (HighestBit(search) - sl_log2)) - 1;
+    return search;
+}
+
+uint32_t TlsfAllocator::Allocate(uint64_t size, uint64_t alignment, uint64_t& offset) {
+    if (size == 0)
+        size = 1;
+    // Any range from the list we land in can hold the size plus worst case padding
+    uint64_t search = GetFittingSize(size, alignment);
+    if (search > m_size)
+        return invalid;
+
+    uint32_t fl, sl;
+    Mapping(search, fl, sl);
+    uint32_t sl_map = fl < fl_count ? m_sl_bitmap[fl] & (~0u << sl) : 0;
+    if (!sl_map) {
+        uint64_t fl_map = fl + 1 < 64 ? m_fl_bitmap & (~0ull << (fl + 1)) : 0;
+        if (!fl_map)
+            return invalid;
+        fl = LowestBit(fl_map);
+        sl_map = m_sl_bitmap[fl];
+    }
+    sl = LowestBit(sl_map);
+    uint32_t node = m_heads[fl][sl];
+    assert(node != invalid);
+    RemoveFree(node);
+
+    // Padding in front of the aligned offset goes back to the free lists
+    uint64_t aligned = (m_nodes[node].offset + alignment - 1) & ~(alignment - 1);
+    uint64_t padding = aligned - m_nodes[node].offset;
+    if (padding > 0) {
+        Split(node, padding);
+        uint32_t padNode = node;
+        node = m_nodes[padNode].next_phys;
+        RemoveFree(node);
+        InsertFree(padNode);
+    }
+    if (m_nodes[node].size > size)
+        Split(node, size);
+
+    offset = m_nodes[node].offset;
+    m_used += m_nodes[node].size;
+    ++m_allocation_count;
+    return node;
+}
+
+void TlsfAllocator::Free(uint32_t handle) {
+    assert(handle < m_nodes.size() && !m_nodes[handle].free);
+    m_used -= m_nodes[handle].size;
+    --m_allocation_count;
+
+    uint32_t node = handle;
+    uint32_t next = m_nodes[node].next_phys;
+    if (next != invalid && m_nodes[next].free) {
+        RemoveFree(next);
+        Merge(node, next);
+    }
+    uint32_t prev = m_nodes[node].prev_phys;
+    if (prev != invalid && m_nodes[prev].free) {
+        RemoveFree(prev);
+        Merge(prev, node);
+        node = prev;
+    }
+    InsertFree(node);
+}
+
+uint64_t TlsfAllocator::GetLargestFreeRange() const {
+    if (!m_fl_bitmap)
+        return 0;
+    // Only the highest non empty list can hold the largest range
+    uint32_t fl = HighestBit(m_fl_bitmap);
+    uint32_t sl = HighestBit(m_sl_bitmap[fl]);
+    uint64_t largest = 0;
+    for (uint32_t node = m_heads[fl][sl]; node != invalid; node = m_nodes[node].next_free)
+        largest = std::max(largest, m_nodes[node].size);
+    return largest;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/*
+* Two level segregated fit (TLSF) allocator over an abstract range of offsets.
+* Used to place resources inside one vk::DeviceMemory block; the bookkeeping
+* lives on the CPU. Allocation and free are O(1): free ranges are kept in
+* 32 lists per power of two, found through two bitmaps, and neighbours are
+* merged on free.
+*/
+class TlsfAllocator
+{
+public:
+	static constexpr uint32_t invalid = ~0u;
+
+	explicit TlsfAllocator(uint64_t size = 0);
+
+	//Returns a handle for Free, or invalid if no free range fits.
+	//alignment must be a power of two.
+	uint32_t Allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+	void Free(uint32_t handle);
+	//Smallest allocator that is sure to fit such an allocation when empty: the
+	//size plus worst case alignment padding, rounded up to the next size class
+	static uint64_t GetFittingSize(uint64_t size, uint64_t alignment);
+
+	uint64_t GetSize() const { return m_size; }
+	uint64_t GetUsed() const { return m_used; }
+	uint32_t GetAllocationCount() const { return m_allocation_count; }
+	uint32_t GetFreeRangeCount() const { return m_free_count; }
+	uint64_t GetLargestFreeRange() const;
+private:
+	static constexpr uint32_t sl_log2 = 5;
+	static constexpr uint32_t sl_count = 1u << sl_log2;
+	static constexpr uint32_t fl_count = 64 - sl_log2;
+
+	struct Node
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint32_t prev_phys = invalid;
+		uint32_t next_phys = invalid;
+		uint32_t prev_free = invalid;
+		uint32_t next_free = invalid;
+		bool free = false;
+	};
+
+	static void Mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+	uint32_t NewNode();
+	void InsertFree(uint32_t node);
+	void RemoveFree(uint32_t node);
+	//Splits size bytes off the front of node; the rest becomes a new free node
+	void Split(uint32_t node, uint64_t size);
+	void Merge(uint32_t node, uint32_t next);
+
+	uint64_t m_size;
+	uint64_t m_used = 0;
+	uint32_t m_allocation_count = 0;
+	uint32_t m_free_count = 0;
+
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_unused_nodes;
+	uint64_t m_fl_bitmap = 0;
+	uint32_t m_sl_bitmap[fl_count] = {};
+	uint32_t m_heads[fl_count][sl_count];
+};
@@ -0,0 +1,247 @@
+#include "Uploader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "Graphics.h"
+#include "ImageWrap.h"
+
+void Uploader::Init(Graphics* gfx, uint32_t transfer_family, uint32_t graphics_family,
+    vk::DeviceSize ring_size) {
+    p_gfx = gfx;
+    m_device = gfx->GetDeviceRef();
+    m_transfer_family = transfer_family;
+    m_graphics_family = graphics_family;
+    m_queue = m_device.getQueue(transfer_family, 0);
+    m_cmd_pool = m_device.createCommandPool(
+        vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, transfer_family));
+    m_timeline.Init(m_device);
+
+    DeviceAllocator::OwnerScope owner(gfx->GetAllocator(), "staging ring");
+    m_ring_buffer = gfx->CreateBufferWrap(ring_size, vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eHostVisible
+        | vk::MemoryPropertyFlagBits::eHostCoherent);
+    m_ring_data = m_ring_buffer.Mapped();
+    m_ring = StagingRing(ring_size);
+
+    // 16 covers the BC block sizes and the 4 byte rule for buffer copies
+    m_alignment = std::max<vk::DeviceSize>(16,
+        gfx->GetPhysicalDeviceRef().getProperties().limits.optimalBufferCopyOffsetAlignment);
+
+    printf("Uploader: %.0f MB staging ring on queue family %u%s\n", ring_size / (1024.0 * 1024.0),
+        transfer_family, UsesTransferQueue() ? " (transfer only)" : "");
+}
+
+void Uploader::Destroy() {
+    WaitIdle();
+
+    printf("Uploader: %llu uploads, %.1f MB in %llu batches, %llu overflow buffers\n",
+        (unsigned long long)m_upload_count, m_upload_bytes / (1024.0 * 1024.0),
+        (unsigned long long)m_batch_count, (unsigned long long)m_overflow_count);
+
+    m_timeline.Destroy();
+    m_device.destroyCommandPool(m_cmd_pool);
+    m_ring_buffer.destroy(m_device);
+    m_ring_data = nullptr;
+}
+
+Uploader::Batch& Uploader::Recording() {
+    if (m_recording)
+        return m_batch;
+
+    m_batch = Batch();
+    m_batch.ticket = m_next_ticket++;
+    if (m_free_cmds.empty()) {
+        m_batch.cmd = m_device.allocateCommandBuffers(
+            vk::CommandBufferAllocateInfo(m_cmd_pool, vk::CommandBufferLevel::ePrimary, 1)).front();
+    }
+    else {
+        m_batch.cmd = m_free_cmds.back();
+        m_free_cmds.pop_back();
+    }
+    m_batch.cmd.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    m_recording = true;
+    return m_batch;
+}
+
+vk::Buffer Uploader::Stage(const void* data, vk::DeviceSize size, vk::DeviceSize& offset) {
+    Batch& batch = Recording();
+    ++m_upload_count;
+    m_upload_bytes += size;
+
+    // Retire what we can before giving up on the ring
+    if (!m_ring.Allocate(size, m_alignment, offset)) {
+        Update();
+        if (!m_ring.Allocate(size, m_alignment, offset)) {
+            ++m_overflow_count;
+            DeviceAllocator::OwnerScope owner(p_gfx->GetAllocator(), "staging overflow");
+            BufferWrap overflow = p_gfx->CreateBufferWrap(size, vk::BufferUsageFlagBits::eTransferSrc,
+                vk::MemoryPropertyFlagBits::eHostVisible
+                | vk::MemoryPropertyFlagBits::eHostCoherent);
+            memcpy(overflow.Mapped(), data, size);
+            vk::Buffer src = overflow.buffer;
+            batch.overflow.push_back(std::move(overflow));
+            offset = 0;
+            return src;
+        }
+    }
+    memcpy(m_ring_data + offset, data, size);
+    batch.ring_head = m_ring.GetHead();
+    return m_ring_buffer.buffer;
+}
+
+Uploader::Ticket Uploader::UploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data,
+    vk::DeviceSize size, vk::PipelineStageFlags dst_stage, vk::AccessFlags dst_access) {
+    vk::DeviceSize srcOffset;
+    vk::Buffer src = Stage(data, size, srcOffset);
+    Batch& batch = m_batch;
+
+    batch.cmd.copyBuffer(src, dst, vk::BufferCopy(srcOffset, dst_offset, size));
+
+    vk::BufferMemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, dst_access,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, dst, dst_offset, size);
+    if (UsesTransferQueue()) {
+        // Release here, acquire on the graphics queue in RecordAcquires
+        barrier.setSrcQueueFamilyIndex(m_transfer_family);
+        barrier.setDstQueueFamilyIndex(m_graphics_family);
+        barrier.setDstAccessMask({});
+        batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), nullptr, barrier, nullptr);
+        barrier.setSrcAccessMask({});
+        barrier.setDstAccessMask(dst_access);
+        batch.acquire_buffers.push_back(barrier);
+        batch.acquire_stages |= dst_stage;
+    }
+    else {
+        batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dst_stage,
+            vk::DependencyFlags(), nullptr, barrier, nullptr);
+    }
+    return batch.ticket;
+}
+
+Uploader::Ticket Uploader::UploadImage(ImageWrap& image, const void* data, vk::DeviceSize size,
+    std::vector<vk::BufferImageCopy> regions, vk::ImageLayout final_layout,
+    vk::PipelineStageFlags dst_stage, vk::AccessFlags dst_access) {
+    vk::DeviceSize srcOffset;
+    vk::Buffer src = Stage(data, size, srcOffset);
+    Batch& batch = m_batch;
+
+    vk::ImageSubresourceRange range(image.GetAspect(), 0, image.GetMipLevels(), 0, 1);
+    vk::ImageMemoryBarrier toTransfer({}, vk::AccessFlagBits::eTransferWrite,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image.GetImage(), range);
+    batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+        vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+
+    for (auto& region : regions)
+        region.bufferOffset += srcOffset;
+    batch.cmd.copyBufferToImage(src, image.GetImage(), vk::ImageLayout::eTransferDstOptimal, regions);
+
+    // The layout change is part of the ownership transfer when there is one
+    vk::ImageMemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, dst_access,
+        vk::ImageLayout::eTransferDstOptimal, final_layout,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image.GetImage(), range);
+    if (UsesTransferQueue()) {
+        barrier.setSrcQueueFamilyIndex(m_transfer_family);
+        barrier.setDstQueueFamilyIndex(m_graphics_family);
+        barrier.setDstAccessMask({});
+        batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe,
+            vk::DependencyFlags(), nullptr, nullptr, barrier);
+        barrier.setSrcAccessMask({});
+        barrier.setDstAccessMask(dst_access);
+        batch.acquire_images.push_back(barrier);
+        batch.acquire_stages |= dst_stage;
+    }
+    else {
+        batch.cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dst_stage,
+            vk::DependencyFlags(), nullptr, nullptr, barrier);
+    }
+    image.SetLayout(final_layout);
+    return batch.ticket;
+}
+
+void Uploader::Submit() {
+    if (!m_recording)
+        return;
+    m_recording = false;
+    ++m_batch_count;
+
+    m_batch.cmd.end();
+    // Batches are submitted in ticket order, so the tickets are the timeline's values
+    uint64_t value = m_timeline.Advance();
+    assert(value == m_batch.ticket);
+    vk::Semaphore timeline = m_timeline.GetSemaphore();
+    vk::TimelineSemaphoreSubmitInfo timelineInfo(0, nullptr, 1, &value);
+    vk::SubmitInfo submitInfo;
+    submitInfo.setCommandBuffers(m_batch.cmd);
+    submitInfo.setSignalSemaphores(timeline);
+    submitInfo.setPNext(&timelineInfo);
+    m_queue.submit(submitInfo);
+
+    // On a single queue, later graphics submissions are ordered after the copies
+    if (!UsesTransferQueue())
+        m_acquired = m_batch.ticket;
+    m_in_flight.push_back(std::move(m_batch));
+}
+
+void Uploader::Update() {
+    // Batches on one queue finish in order, so stop at the first busy one
+    if (m_in_flight.empty())
+        return;
+    uint64_t completed = m_timeline.GetCompleted();
+    while (!m_in_flight.empty()) {
+        Batch& batch = m_in_flight.front();
+        if (batch.ticket > completed)
+            break;
+
+        batch.cmd.reset();
+        m_free_cmds.push_back(batch.cmd);
+        if (batch.ring_head)
+            m_ring.Release(batch.ring_head);
+        for (auto& overflow : batch.overflow)
+            overflow.destroy(m_device);
+
+        m_ready_buffers.insert(m_ready_buffers.end(), batch.acquire_buffers.begin(), batch.acquire_buffers.end());
+        m_ready_images.insert(m_ready_images.end(), batch.acquire_images.begin(), batch.acquire_images.end());
+        m_ready_stages |= batch.acquire_stages;
+        m_finished = std::max(m_finished, batch.ticket);
+        m_in_flight.pop_front();
+    }
+}
+
+void Uploader::RecordAcquires(vk::CommandBuffer cmd) {
+    if (HasPendingAcquires()) {
+        cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, m_ready_stages,
+            vk::DependencyFlags(), nullptr, m_ready_buffers, m_ready_images);
+        m_ready_buffers.clear();
+        m_ready_images.clear();
+        m_ready_stages = vk::PipelineStageFlags();
+    }
+    m_acquired = std::max(m_acquired, m_finished);
+}
+
+Uploader::Ticket Uploader::SubmitForAcquire() {
+    Submit();
+    if (m_in_flight.empty())
+        return 0;
+
+    // The graphics queue waits for them on the timeline, so they can be acquired unfinished.
+    // Update still frees their staging once they are done.
+    for (Batch& batch : m_in_flight) {
+        m_ready_buffers.insert(m_ready_buffers.end(), batch.acquire_buffers.begin(), batch.acquire_buffers.end());
+        m_ready_images.insert(m_ready_images.end(), batch.acquire_images.begin(), batch.acquire_images.end());
+        m_ready_stages |= batch.acquire_stages;
+        batch.acquire_buffers.clear();
+        batch.acquire_images.clear();
+        batch.acquire_stages = vk::PipelineStageFlags();
+    }
+    m_finished = m_in_flight.back().ticket;
+    return m_finished;
+}
+
+void Uploader::WaitIdle() {
+    Submit();
+    m_timeline.WaitIdle();
+    Update();
+}
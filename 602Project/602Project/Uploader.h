@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+#include "BufferWrap.h"
+#include "GpuTimeline.h"
+#include "StagingRing.h"
+
+class Graphics;
+class ImageWrap;
+
+/*
+* Streams data into device local buffers and images without blocking.
+* Source data is copied into a persistently mapped staging ring and the
+* copies are recorded on the transfer queue (a transfer-only family when the
+* device has one, else the graphics queue). Each batch's ticket is the value
+* it signals on the uploader's GpuTimeline; Update() reads the timeline once
+* and frees the ring regions of every batch it has passed. Uploads too large
+* for the free part of the ring get a temporary staging buffer that is freed
+* the same way.
+*
+* With a separate transfer family every upload ends in a queue ownership
+* release; the matching acquires are recorded on the graphics queue by
+* RecordAcquires() once the batch is seen to be complete, so frames never wait
+* on the transfer queue. Temporary command buffers can't wait for that and use
+* SubmitForAcquire() to wait on the GPU instead.
+*/
+class Uploader
+{
+public:
+	//Identifies the batch an upload went into
+	using Ticket = uint64_t;
+
+	void Init(Graphics* gfx, uint32_t transfer_family, uint32_t graphics_family,
+		vk::DeviceSize ring_size);
+	void Destroy();
+
+	//Copies size bytes of data into dst at dst_offset. dst_stage/dst_access
+	//describe the first use of the data on the graphics queue.
+	Ticket UploadBuffer(vk::Buffer dst, vk::DeviceSize dst_offset, const void* data, vk::DeviceSize size,
+		vk::PipelineStageFlags dst_stage = vk::PipelineStageFlagBits::eAllCommands,
+		vk::AccessFlags dst_access = vk::AccessFlagBits::eMemoryRead);
+
+	//Copies regions of data (bufferOffset relative to data) into every mip of
+	//an image in any layout, leaving it in final_layout
+	Ticket UploadImage(ImageWrap& image, const void* data, vk::DeviceSize size,
+		std::vector<vk::BufferImageCopy> regions, vk::ImageLayout final_layout,
+		vk::PipelineStageFlags dst_stage = vk::PipelineStageFlagBits::eFragmentShader,
+		vk::AccessFlags dst_access = vk::AccessFlagBits::eShaderRead);
+
+	//Submits the uploads recorded so far. Never waits.
+	void Submit();
+
+	//Retires the batches the timeline has passed. Never waits.
+	void Update();
+
+	//Records the ownership acquires of finished batches into a graphics command buffer
+	void RecordAcquires(vk::CommandBuffer cmd);
+
+	//Submits the uploads recorded so far and readies the acquires of every batch in
+	//flight, finished or not, for the next RecordAcquires. Returns the ticket the graphics
+	//submission holding them must wait for on GetTimeline(); 0 when nothing is in flight.
+	Ticket SubmitForAcquire();
+
+	//True once the upload can be used by graphics work recorded after RecordAcquires
+	bool IsAvailable(Ticket ticket) const { return ticket <= m_acquired; }
+
+	//Reached by the transfer queue as each ticket's batch finishes
+	GpuTimeline& GetTimeline() { return m_timeline; }
+
+	//Submits and blocks until every upload is finished; for loading and teardown only
+	void WaitIdle();
+
+	bool HasPendingAcquires() const { return !m_ready_buffers.empty() || !m_ready_images.empty(); }
+	bool UsesTransferQueue() const { return m_transfer_family != m_graphics_family; }
+private:
+	struct Batch
+	{
+		Ticket ticket = 0;  // Also the timeline value it signals
+		vk::CommandBuffer cmd;
+		uint64_t ring_head = 0;
+		std::vector<BufferWrap> overflow;
+		std::vector<vk::BufferMemoryBarrier> acquire_buffers;
+		std::vector<vk::ImageMemoryBarrier> acquire_images;
+		vk::PipelineStageFlags acquire_stages;
+	};
+
+	//Begins a batch if none is being recorded
+	Batch& Recording();
+	//Copies data into the ring (or an overflow buffer); returns the source buffer and offset
+	vk::Buffer Stage(const void* data, vk::DeviceSize size, vk::DeviceSize& offset);
+
+	Graphics* p_gfx = nullptr;
+	vk::Device m_device;
+	uint32_t m_transfer_family = 0;
+	uint32_t m_graphics_family = 0;
+	vk::Queue m_queue;
+	vk::CommandPool m_cmd_pool;
+
+	BufferWrap m_ring_buffer;
+	uint8_t* m_ring_data = nullptr;
+	StagingRing m_ring;
+	vk::DeviceSize m_alignment = 16;
+
+	bool m_recording = false;
+	Batch m_batch;
+	std::deque<Batch> m_in_flight;
+	std::vector<vk::CommandBuffer> m_free_cmds;
+	GpuTimeline m_timeline;
+	Ticket m_next_ticket = 1;
+	Ticket m_finished = 0;  // Last batch with its acquires ready
+	Ticket m_acquired = 0;  // Last batch acquired by the graphics queue
+
+	std::vector<vk::BufferMemoryBarrier> m_ready_buffers;
+	std::vector<vk::ImageMemoryBarrier> m_ready_images;
+	vk::PipelineStageFlags m_ready_stages;
+
+	// Stats printed by Destroy
+	uint64_t m_upload_count = 0;
+	uint64_t m_upload_bytes = 0;
+	uint64_t m_overflow_count = 0;
+	uint64_t m_batch_count = 0;
+};
@@ -3,13 +3,12 @@
 #include "Graphics.h"
 
 #include "UpscalePass.h"
-#include "MedianPass.h"
 #include "TileMaxPass.h"
 #include "DOFPass.h"
 
 void UpscalePass::SetupBuffer() {
 	m_buffer.CreateTextureSampler();
-	m_buffer.TransitionImageLayout(vk::ImageLayout::eGeneral);
+	p_gfx->GetRenderTargets().AddTransient(m_buffer, TargetKind::SceneColor);
 }
 
 void UpscalePass::SetupDescriptor() {
@@ -20,28 +19,23 @@ void UpscalePass::SetupDescriptor() {
          vk::ShaderStageFlagBits::eCompute},
         {2, vk::DescriptorType::eCombinedImageSampler, 1,
          vk::ShaderStageFlagBits::eCompute},
-        {3, vk::DescriptorType::eStorageImage, 1,
+        {3, vk::DescriptorType::eCombinedImageSampler, 1,
          vk::ShaderStageFlagBits::eCompute},
         {4, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {5, vk::DescriptorType::eStorageImage, 1,
          vk::ShaderStageFlagBits::eCompute},
         {6, vk::DescriptorType::eCombinedImageSampler, 1,
+         vk::ShaderStageFlagBits::eCompute},
+        {7, vk::DescriptorType::eStorageBufferDynamic, 1,
          vk::ShaderStageFlagBits::eCompute}
         });
 }
 
 void UpscalePass::SetupPipeline() {
-    vk::PushConstantRange pc_info;
-    pc_info.setStageFlags(vk::ShaderStageFlagBits::eCompute);
-    pc_info.setOffset(0);
-    pc_info.setSize(sizeof(PushConstantUpscale));
-
     vk::PipelineLayoutCreateInfo pl_create_info;
     pl_create_info.setSetLayoutCount(1);
     pl_create_info.setPSetLayouts(&m_descriptor.descSetLayout);
-    pl_create_info.setPushConstantRangeCount(1);
-    pl_create_info.setPPushConstantRanges(&pc_info);
     m_pipeline_layout = p_gfx->GetDeviceRef().createPipelineLayout(pl_create_info);
 
     vk::ComputePipelineCreateInfo cp_create_info;
@@ -63,9 +57,9 @@ void UpscalePass::SetupPipeline() {
     p_gfx->GetDeviceRef().destroyShaderModule(cp_create_info.stage.module, nullptr);
 }
 
-UpscalePass::UpscalePass(Graphics* _p_gfx, RenderPass* _p_prev_pass) : RenderPass(_p_gfx, _p_prev_pass),
+UpscalePass::UpscalePass(Graphics* _p_gfx) : RenderPass(_p_gfx),
 m_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
-    vk::Format::eR32G32B32A32Sfloat,
+    TargetFormat(TargetKind::SceneColor),
     vk::ImageUsageFlagBits::eTransferDst |
     vk::ImageUsageFlagBits::eSampled |
     vk::ImageUsageFlagBits::eStorage |
@@ -73,7 +67,7 @@ m_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
     vk::ImageUsageFlagBits::eColorAttachment,
     vk::ImageAspectFlagBits::eColor,
     vk::MemoryPropertyFlagBits::eDeviceLocal,
-    1, p_gfx), m_push_consts(), enabled(true) {
+    1, p_gfx, false), m_push_consts(), enabled(true) {
 
     m_push_consts.lens_diameter = 0.035f;
     m_push_consts.focal_length = 0.05f;
@@ -83,6 +77,7 @@ m_buffer(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y,
     m_push_consts.tile_size = TileMaxPass::tile_size;
     m_push_consts.enable_rt_mix = true;
     m_push_consts.alignmentTest = 1234;
+    m_params_region = p_gfx->AddPassParams(sizeof(PushConstantUpscale));
 
     SetupBuffer();
     SetupDescriptor();
@@ -96,73 +91,61 @@ UpscalePass::~UpscalePass() {
     m_buffer.destroy(p_gfx->GetDeviceRef());
 }
 
+void UpscalePass::Declare(RenderGraph::Builder& builder) {
+    const vk::PipelineStageFlags stages = vk::PipelineStageFlagBits::eComputeShader;
+    builder.Output("upscaled", m_buffer);
+    p_bg_buffer = &builder.Read("median_bg", stages);
+    p_fg_buffer = &builder.Read("median_fg", stages);
+    p_fullres_buffer = &builder.Read("color", stages);
+    p_fullres_depth_buffer = &builder.Read("depth", stages);
+    p_neighbour_max_buffer = &builder.Read("neighbour_max", stages);
+    builder.Write("upscaled", stages);
+}
+
+void UpscalePass::Resize() {
+    m_buffer.Resize(p_gfx->GetWindowSize().x, p_gfx->GetWindowSize().y);
+    p_gfx->RenewDescriptor(m_descriptor);
+}
+
 void UpscalePass::Setup() {
     m_descriptor.write(p_gfx->GetDeviceRef(), 0, m_buffer.Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 1,
-        static_cast<MedianPass*>(p_prev_pass)->GetBGBuffer().Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 2,
-        static_cast<MedianPass*>(p_prev_pass)->GetFGBuffer().Descriptor());
-    m_descriptor.write(p_gfx->GetDeviceRef(), 3, fullres_buffer_desc);
-    m_descriptor.write(p_gfx->GetDeviceRef(), 4, fullres_depth_buffer_desc);
-    m_descriptor.write(p_gfx->GetDeviceRef(), 5, neighbour_max_buffer_desc);
-    m_descriptor.write(p_gfx->GetDeviceRef(), 6, raycast_bg_buffer_desc);
-    SetupPipeline();
+    m_descriptor.write(p_gfx->GetDeviceRef(), 1, p_bg_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 2, p_fg_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 3, p_fullres_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 4, p_fullres_depth_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 5, p_neighbour_max_buffer->Descriptor());
+    // The raycast slot has always been given the median background
+    m_descriptor.write(p_gfx->GetDeviceRef(), 6, p_bg_buffer->Descriptor());
+    m_descriptor.write(p_gfx->GetDeviceRef(), 7, p_gfx->GetParamsBuffer().buffer, sizeof(PushConstantUpscale));
+    if (!m_pipeline)
+        SetupPipeline();
 }
 
-void UpscalePass::Render() {
-    if (not enabled)
-        return;
-
-    //Set the push consts based on DOF params
+void UpscalePass::UpdateParams() {
+    //Set the params based on DOF params
     m_push_consts.coc_sample_scale = p_dof_pass->GetDOFParams().coc_sample_scale;
     m_push_consts.focal_length = p_dof_pass->GetDOFParams().focal_length;
     m_push_consts.focal_distance = p_dof_pass->GetDOFParams().focal_distance;
     m_push_consts.lens_diameter = p_dof_pass->GetDOFParams().lens_diameter;
+    m_push_consts.render_scale = p_gfx->GetRenderScale();
+    p_gfx->WriteParams(m_params_region, m_push_consts);
+}
 
-    MedianPass* p_median_pass = static_cast<MedianPass*>(p_prev_pass);
-    vk::ImageSubresourceRange range;
-    range.setAspectMask(vk::ImageAspectFlagBits::eColor);
-    range.setBaseMipLevel(0);
-    range.setLayerCount(1);
-    range.setBaseArrayLayer(0);
-    range.setLevelCount(1);
-
-    vk::ImageMemoryBarrier img_mem_barrier;
-    img_mem_barrier.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite);
-    img_mem_barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
-    img_mem_barrier.setImage(p_median_pass->GetBGBuffer().GetImage());
-    img_mem_barrier.setOldLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setNewLayout(vk::ImageLayout::eGeneral);
-    img_mem_barrier.setSubresourceRange(range);
-
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
-
+void UpscalePass::Render() {
+    //The frame's slice; the command buffer is kept for this frame in flight
+    uint32_t params_offset = p_gfx->GetParamsOffset(m_params_region);
     p_gfx->GetCommandBuffer().bindPipeline(
         vk::PipelineBindPoint::eCompute,
         m_pipeline);
     p_gfx->GetCommandBuffer().bindDescriptorSets(
         vk::PipelineBindPoint::eCompute,
         m_pipeline_layout, 0, 1,
-        &m_descriptor.descSet, 0, nullptr);
-    p_gfx->GetCommandBuffer().pushConstants(m_pipeline_layout,
-        vk::ShaderStageFlagBits::eCompute, 0,
-        sizeof(PushConstantUpscale),
-        &m_push_consts);
+        &m_descriptor.descSet, 1, &params_offset);
 
+    // The output is always window sized, whatever size the scene was rendered at
     p_gfx->GetCommandBuffer().dispatch(
         (p_gfx->GetWindowSize().x),
         (p_gfx->GetWindowSize().y), 1);
-
-    img_mem_barrier.setImage(m_buffer.GetImage());
-    p_gfx->GetCommandBuffer().pipelineBarrier(
-        vk::PipelineStageFlagBits::eComputeShader,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eDeviceGroup,
-        0, nullptr, 0, nullptr, 1, &img_mem_barrier);
 }
 
 void UpscalePass::Teardown()
@@ -177,22 +160,6 @@ const ImageWrap& UpscalePass::GetBuffer() const {
     return m_buffer;
 }
 
-void UpscalePass::SetFullResBufferDesc(const ImageWrap& _buffer) {
-    fullres_buffer_desc = _buffer.Descriptor();
-}
-
-void UpscalePass::SetFullResDepthBufferDesc(const ImageWrap& _buffer) {
-    fullres_depth_buffer_desc = _buffer.Descriptor();
-}
-
-void UpscalePass::SetNeighbourBufferDesc(const ImageWrap& _buffer) {
-    neighbour_max_buffer_desc = _buffer.Descriptor();
-}
-
-void UpscalePass::SetRaycastBGBufferDesc(const ImageWrap& _buffer) {
-    raycast_bg_buffer_desc = _buffer.Descriptor();
-}
-
 void UpscalePass::SetDOFPass(DOFPass* _p_dof_pass) {
     p_dof_pass = _p_dof_pass;
 }
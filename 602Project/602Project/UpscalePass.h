@@ -16,32 +16,33 @@ private:
 	void SetupPipeline();
 
 	PushConstantUpscale m_push_consts;
+	uint32_t m_params_region;  // Of the parameter buffer
 
-	vk::DescriptorImageInfo neighbour_max_buffer_desc;
-	vk::DescriptorImageInfo fullres_buffer_desc;
-	vk::DescriptorImageInfo fullres_depth_buffer_desc;
-	vk::DescriptorImageInfo raycast_bg_buffer_desc;
+	const ImageWrap* p_bg_buffer = nullptr;
+	const ImageWrap* p_fg_buffer = nullptr;
+	const ImageWrap* p_fullres_buffer = nullptr;
+	const ImageWrap* p_fullres_depth_buffer = nullptr;
+	const ImageWrap* p_neighbour_max_buffer = nullptr;
 
 	DOFPass* p_dof_pass;
 
 	bool enabled;
 public:
-	UpscalePass(Graphics* _p_gfx, RenderPass* p_prev_pass = nullptr);
+	UpscalePass(Graphics* _p_gfx);
 	~UpscalePass();
 
+	void Declare(RenderGraph::Builder& builder) override;
+	void Resize() override;
 	void Setup() override;
+	void UpdateParams() override;
 	void Render() override;
 	void Teardown() override;
 
 	void DrawGUI();
+	bool IsEnabled() const override { return enabled; }
 
 	const ImageWrap& GetBuffer() const;
 
-	void SetFullResBufferDesc(const ImageWrap& _buffer);
-	void SetFullResDepthBufferDesc(const ImageWrap& _buffer);
-	void SetNeighbourBufferDesc(const ImageWrap& _buffer);
-	void SetRaycastBGBufferDesc(const ImageWrap& _buffer);
-
 	void SetDOFPass(DOFPass* _p_dof_pass);
 };
 
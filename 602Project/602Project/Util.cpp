@@ -15,3 +15,13 @@ std::string LoadFileIntoString(const std::string& filename) {
     result.assign((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
     return result;
 }
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -6,6 +6,9 @@
 
 std::string LoadFileIntoString(const std::string& filename);
 
+//64-bit FNV-1a hash of a block of bytes. Pass a previous result as seed to chain blocks.
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
 struct ObjData
 {
     uint32_t     nbIndices{ 0 };
@@ -13,16 +16,23 @@ struct ObjData
     glm::mat4 transform;      // Instance matrix of the object
     BufferWrap vertexBuffer;    // Device buffer of all 'Vertex'
     BufferWrap indexBuffer;     // Device buffer of the indices forming triangles
-    BufferWrap matColorBuffer;  // Device buffer of array of 'Wavefront material'
     BufferWrap matIndexBuffer;  // Device buffer of array of 'Wavefront material'
     BufferWrap lightBuffer;     // Device buffer of all the light triangle indeces.
+    uint32_t     nbMeshlets{ 0 };
+    BufferWrap meshletBuffer;          // Device buffer of all 'Meshlet'
+    BufferWrap meshletVertexBuffer;    // Device buffer of the meshlet vertex indices
+    BufferWrap meshletTriangleBuffer;  // Device buffer of the packed meshlet triangles
+    BufferWrap transformBuffer;        // BLAS position dequantization (VERTEX_LAYOUT_QUANTIZED only)
 
     void destroy(vk::Device& device) {
         vertexBuffer.destroy(device);
         indexBuffer.destroy(device);
-        matColorBuffer.destroy(device);
         matIndexBuffer.destroy(device);
         lightBuffer.destroy(device);
+        meshletBuffer.destroy(device);
+        meshletVertexBuffer.destroy(device);
+        meshletTriangleBuffer.destroy(device);
+        transformBuffer.destroy(device);
     }
 };
 
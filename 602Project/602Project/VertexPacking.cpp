@@ -0,0 +1,60 @@
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <cmath>
+
+vec2 OctEncode(vec3 n) {
+    n = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return e;
+}
+
+std::vector<GpuVertex> PackVertices(const std::vector<Vertex>& vertices, vec3& posOffset, vec3& posScale) {
+    posOffset = vec3(0.0f);
+    posScale = vec3(1.0f);
+
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
+    std::vector<GpuVertex> result(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+        result[i] = { vertices[i].pos, vertices[i].nrm, vertices[i].texCoord };
+    return result;
+#else
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+    if (!vertices.empty()) {
+        vec3 lo = vertices[0].pos;
+        vec3 hi = lo;
+        for (const auto& v : vertices) {
+            lo = glm::min(lo, v.pos);
+            hi = glm::max(hi, v.pos);
+        }
+        posOffset = (lo + hi) * 0.5f;
+        posScale = glm::max((hi - lo) * 0.5f, vec3(1e-6f));
+    }
+#endif
+
+    std::vector<GpuVertex> result(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const Vertex& v = vertices[i];
+        GpuVertex& g = result[i];
+
+        float len = glm::length(v.nrm);
+        vec3 nrm = len > 0.0f ? v.nrm / len : vec3(0.0f, 0.0f, 1.0f);
+        g.nrm = glm::packSnorm2x16(OctEncode(nrm));
+        g.texCoord = glm::packHalf2x16(v.texCoord);
+
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_PACKED
+        g.pos = v.pos;
+#else
+        vec3 q = (v.pos - posOffset) / posScale;
+        g.posXY = glm::packSnorm2x16(vec2(q.x, q.y));
+        g.posZW = glm::packSnorm2x16(vec2(q.z, 0.0f));
+#endif
+    }
+    return result;
+#endif
+}
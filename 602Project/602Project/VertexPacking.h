@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+
+#include "shaders/shared_structs.h"
+
+//Converts imported vertices to the GpuVertex layout selected by VERTEX_LAYOUT.
+//posOffset/posScale receive the position dequantization (identity unless quantized).
+std::vector<GpuVertex> PackVertices(const std::vector<Vertex>& vertices, vec3& posOffset, vec3& posScale);
+
+//Octahedral encoding of a unit normal into [-1,1]^2; inverse of OctDecode in the shaders
+vec2 OctEncode(vec3 n);
@@ -63,8 +63,16 @@ void Window::DrawGUI() {
         1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 }
 
-void WindowResize(GLFWwindow* window, int w, int h) {
+void Window::OnResize(int w, int h) {
+    width = w;
+    height = h;
+    // Graphics recreates the swapchain before its next frame
+    if (p_gfx)
+        p_gfx->RequestResize();
+}
 
+void WindowResize(GLFWwindow* window, int w, int h) {
+    static_cast<Window*>(glfwGetWindowUserPointer(window))->OnResize(w, h);
 }
 
 void KeyboardAction(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -35,6 +35,9 @@ public:
 	void SetupGraphics();
 	Graphics& Gfx() { return *p_gfx; }
 
+	//Called by the framebuffer size callback
+	void OnResize(int w, int h);
+
 	void DrawGUI();
 };
 
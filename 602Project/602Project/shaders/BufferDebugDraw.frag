@@ -11,7 +11,7 @@
 
 #include "shared_structs.h"
 
-layout(location = 0) in vec2 uv;
+layout(location = 0) in vec2 screen_uv;
 
 layout(location = 0) out vec4 fragColor;
 
@@ -23,6 +23,8 @@ layout(push_constant) uniform _PushConstantDrawBuffer
 };
 
 void main() {
+    vec2 uv = screen_uv * pcDebugBuffer.uv_scale;
+
     if (pcDebugBuffer.alignmentTest != 1234){
         fragColor = vec4(1, 1, 1, 1);
         return;
@@ -36,7 +38,7 @@ void main() {
     else if (pcDebugBuffer.draw_buffer == 2)
     {
         //Draw the depth buffer
-        float rel_depth = texture(renderedImage, uv).w;
+        float rel_depth = texture(renderedImage, uv).r;
         fragColor = vec4(vec3(rel_depth), 1.0f);
     }
     else if (pcDebugBuffer.draw_buffer == 3) 
@@ -6,9 +6,18 @@ layout(location = 0) out vec4 fragColor;
 
 layout(set=0, binding=0) uniform sampler2D renderedImage;
 
+// The scene fills this much of renderedImage, from its corner
+layout(push_constant) uniform _PushConstantPost
+{
+    vec2 uv_scale;
+};
+
 void main()
 {
+    // Kept half a texel inside so the filter doesn't reach past the scene
+    vec2 scene_uv = min(uv * uv_scale, uv_scale - 0.5 / vec2(textureSize(renderedImage, 0)));
+
     // The power exponent, 1/2.2 converts linear color space to SRGB
     // colorspace for proper display on a non-linear device.
-    fragColor   = pow(texture(renderedImage, uv).rgba, vec4(1.0/2.2));
+    fragColor   = pow(texture(renderedImage, scene_uv).rgba, vec4(1.0/2.2));
 }
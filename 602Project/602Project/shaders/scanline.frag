@@ -12,7 +12,13 @@
 
 const vec3 ambientIntensity = vec3(0.2);
 
-layout(push_constant) uniform _PushConstantRaster
+layout(push_constant) uniform _PushConstantInstance
+{
+  PushConstantInstance pcInstance;
+};
+
+// This frame's slice of the parameter buffer
+layout(binding = eRasterParams) readonly buffer _PushConstantRaster
 {
   PushConstantRaster pcRaster;
 };
@@ -28,9 +34,10 @@ layout(location=6) in vec4 prevPos;
 
 // Outgoing
 layout(location = 0) out vec4 fragColor;
-layout(location = 1) out vec4 fragVeloDepth;
+layout(location = 1) out vec2 fragVelocity;
+layout(location = 2) out float fragDepth;
 
-layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; };    // Positions of an object
+layout(buffer_reference, scalar) buffer Vertices {GpuVertex v[]; }; // Positions of an object
 layout(buffer_reference, scalar) buffer Indices {uint i[]; };       // Triangle indices
 layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of materials
 layout(buffer_reference, scalar) buffer MatIndices {int i[]; };     // Material ID for each triangle
@@ -42,7 +49,7 @@ float pi = 3.14159;
 void main()
 {
     // Material of the object
-    ObjDesc    obj = objDesc.i[pcRaster.objIndex];
+    ObjDesc    obj = objDesc.i[pcInstance.objIndex];
     MatIndices matIndices  = MatIndices(obj.materialIndexAddress);
     Materials  materials   = Materials(obj.materialAddress);
   
@@ -99,5 +106,6 @@ void main()
     vec2 half_pixel_size = 0.5f * pixel_size;
     vec2 out_velo = (velo * max(length(half_pixel_size), min(length(velo), pcRaster.tile_size))) 
                     / (length(velo) + epsilon); 
-    fragVeloDepth = vec4(vec3(out_velo, 0.0f) , worldPos.w);
+    fragVelocity = out_velo;
+    fragDepth = worldPos.w;
 }
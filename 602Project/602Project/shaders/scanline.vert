@@ -12,13 +12,24 @@ layout(binding = 0) uniform _MatrixUniforms
   MatrixUniforms mats;
 };
 
-layout(push_constant) uniform _PushConstantRaster
+layout(push_constant) uniform _PushConstantInstance
 {
-  PushConstantRaster pcRaster;
+  PushConstantInstance pcInstance;
 };
 
+layout(binding = eObjDescs, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
+
+// Attribute types follow VERTEX_LAYOUT (see GpuVertex)
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+layout(location = 0) in vec4 i_position;
+#else
 layout(location = 0) in vec3 i_position;
+#endif
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
 layout(location = 1) in vec3 i_normal;
+#else
+layout(location = 1) in vec2 i_normal;
+#endif
 layout(location = 2) in vec2 i_texCoord;
 
 
@@ -37,12 +48,25 @@ out gl_PerVertex
 
 void main()
 {
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_QUANTIZED
+  ObjDesc obj = objDesc.i[pcInstance.objIndex];
+  vec3 position = obj.posOffset + obj.posScale * i_position.xyz;
+#else
+  vec3 position = i_position;
+#endif
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
+  vec3 normal = i_normal;
+#else
+  vec3 normal = OctDecode(i_normal);
+#endif
+
   vec3 eye = vec3(mats.viewInverse * vec4(0, 0, 0, 1));
 
-  worldPos.xyz = vec3(pcRaster.modelMatrix * vec4(i_position, 1.0));
+  worldPos.xyz = vec3(pcInstance.modelMatrix * vec4(position, 1.0));
   viewDir  = vec3(eye - worldPos.xyz);
   texCoord = i_texCoord;
-  worldNrm = mat3(pcRaster.modelMatrix) * i_normal;
+  // Inverse transpose, which keeps normals right under non-uniform scale
+  worldNrm = normalize(transpose(inverse(mat3(pcInstance.modelMatrix))) * normal);
 
   gl_Position = mats.viewProj * vec4(worldPos.xyz, 1.0);
   prevPos = mats.priorViewProj * vec4(worldPos.xyz, 1.0);
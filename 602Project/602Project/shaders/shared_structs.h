@@ -8,6 +8,7 @@
 using vec2 = glm::vec2;
 using vec3 = glm::vec3;
 using vec4 = glm::vec4;
+using mat3 = glm::mat3;
 using mat4 = glm::mat4;
 using uint = unsigned int;
 #endif
@@ -32,7 +33,8 @@ using uint = unsigned int;
 START_ENUM(ScBindings)
   eMatrices  = 0,  // Global uniform containing camera matrices
   eObjDescs = 1,  // Access to the object descriptions
-  eTextures = 2   // Access to textures
+  eTextures = 2,  // Access to textures
+  eRasterParams = 3  // The raster's slice of the parameter buffer
 END_ENUM();
 
 START_ENUM(RtBindings)
@@ -44,15 +46,73 @@ END_ENUM();
 
 
 
+// GPU vertex layout, chosen at compile time for both C++ and the shaders:
+//   VERTEX_LAYOUT_FULL      : float position, normal and uv (32 bytes)
+//   VERTEX_LAYOUT_PACKED    : float position, octahedral 16 bit normal, half uv (20 bytes)
+//   VERTEX_LAYOUT_QUANTIZED : 16 bit position relative to the mesh bounds,
+//                             octahedral 16 bit normal, half uv (16 bytes)
+#define VERTEX_LAYOUT_FULL 0
+#define VERTEX_LAYOUT_PACKED 1
+#define VERTEX_LAYOUT_QUANTIZED 2
+#ifndef VERTEX_LAYOUT
+#define VERTEX_LAYOUT VERTEX_LAYOUT_PACKED
+#endif
+
+// Precision of the intermediate render targets, chosen at compile time for both
+// C++ (TargetFormats.h) and the shaders' image format qualifiers:
+//   TARGET_PRECISION_FULL    : 32 bit float channels everywhere, for debugging
+//   TARGET_PRECISION_REDUCED : half float colors, normals and CoC params,
+//                              rg16f velocity; depths stay 32 bit
+//   TARGET_PRECISION_PACKED  : as REDUCED with an r11g11b10 scene color
+#define TARGET_PRECISION_FULL 0
+#define TARGET_PRECISION_REDUCED 1
+#define TARGET_PRECISION_PACKED 2
+#ifndef TARGET_PRECISION
+#define TARGET_PRECISION TARGET_PRECISION_REDUCED
+#endif
+
+#ifndef __cplusplus
+// Format qualifiers; these must match TargetFormat() in TargetFormats.cpp
+#if TARGET_PRECISION == TARGET_PRECISION_FULL
+ #define FMT_SCENE_COLOR   rgba32f
+ #define FMT_VELOCITY      rg32f
+ #define FMT_COLOR         rgba32f
+ #define FMT_COC_PARAMS    rgba32f
+ #define FMT_NORMAL_DEPTH  rgba32f
+#else
+ #if TARGET_PRECISION == TARGET_PRECISION_PACKED
+  #define FMT_SCENE_COLOR  r11f_g11f_b10f
+ #else
+  #define FMT_SCENE_COLOR  rgba16f
+ #endif
+ #define FMT_VELOCITY      rg16f
+ #define FMT_COLOR         rgba16f
+ #define FMT_COC_PARAMS    rgba16f
+ #define FMT_NORMAL_DEPTH  rgba16f
+#endif
+// Depth comparisons use soft_z_extent down to 0.001, too fine for half floats
+#define FMT_DEPTH          r32f
+#define FMT_TILES          rgba32f
+#define FMT_COLOR_DEPTH    rgba32f
+#define FMT_EDGE           rg32f
+#define FMT_RAYMASK        rgba32f
+#endif
+
 // Information of a obj model when referenced in a shader
 struct ObjDesc
 {
   int      txtOffset;             // Texture index offset in the array of textures
+  uint     meshletCount;          // Number of meshlets built for the object
   uint64_t vertexAddress;         // Address of the Vertex buffer
   uint64_t indexAddress;          // Address of the index buffer
   uint64_t materialAddress;       // Address of the material buffer
   uint64_t materialIndexAddress;  // Address of the triangle material index buffer
   uint64_t lightTriangleIndexAddress;  // Address of the triangle material index buffer
+  uint64_t meshletAddress;        // Address of the 'Meshlet' buffer
+  uint64_t meshletVertexAddress;  // Address of the meshlet vertex index buffer
+  uint64_t meshletTriangleAddress;// Address of the packed meshlet local triangle buffer
+  vec3     posOffset;             // Dequantization of VERTEX_LAYOUT_QUANTIZED positions:
+  vec3     posScale;              //   pos = posOffset + posScale * quantized
 };
 
 // Uniform buffer set at each frame
@@ -64,22 +124,33 @@ struct MatrixUniforms
   mat4 projInverse;  // Camera inverse projection matrix
 };
 
-// Push constant structure for the raster
-struct PushConstantRaster
+// The PushConstant* structs below are the passes' parameters. Apart from
+// PushConstantInstance and PushConstantDrawBuffer they are no longer pushed but
+// written to each frame's slice of the parameter buffer (read as std430 storage
+// buffers, the same layout as push constants), so recorded commands can be reused.
+
+// Push constant structure for each raster draw
+struct PushConstantInstance
 {
   mat4  modelMatrix;  // matrix of the instance
+  uint  objIndex;
+};
+
+// Parameters of the raster
+struct PushConstantRaster
+{
   vec4 lightPosition;
   vec4 lightIntensity;
   vec4 ambientIntensity;
   vec2 window_size;
-  uint  objIndex;
   float exposure_time;
   float frame_rate;
   int tile_size;
+  BOOL(cone_culling); // Meshlet backface cone culling in the mesh shader path
 };
 
 
-// Push constant structure for the ray tracer
+// Parameters of the ray tracer
 struct PushConstantRay
 {
 	vec4 lightPosition;
@@ -93,15 +164,95 @@ struct PushConstantRay
 	uint frameSeed;
 	int ray_count_factor;
 	int clear;
+	uint emitterCount; // Entries in the emitter and emitter alias buffers
+	BOOL(emitter_sampling); // Light from sampled emitters instead of lightPosition
 	int alignmentTest;
 };
 
-struct Vertex  // Created by readModel; used in shaders
+struct Vertex  // Created by readModel; decoded from GpuVertex in shaders
+{
+  vec3 pos;
+  vec3 nrm;
+  vec2 texCoord;
+};
+
+// Vertex as stored in the vertex buffers; created by PackVertices
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
+struct GpuVertex
 {
   vec3 pos;
   vec3 nrm;
   vec2 texCoord;
 };
+#elif VERTEX_LAYOUT == VERTEX_LAYOUT_PACKED
+struct GpuVertex
+{
+  vec3 pos;
+  uint nrm;       // packSnorm2x16 of the octahedral normal
+  uint texCoord;  // packHalf2x16
+};
+#else
+struct GpuVertex
+{
+  uint posXY;     // packSnorm2x16 of the bounds relative position
+  uint posZW;
+  uint nrm;       // packSnorm2x16 of the octahedral normal
+  uint texCoord;  // packHalf2x16
+};
+#endif
+
+#ifndef __cplusplus
+vec3 OctDecode(vec2 e)
+{
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
+Vertex DecodeVertex(GpuVertex g, ObjDesc obj)
+{
+  Vertex v;
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_FULL
+  v.pos = g.pos;
+  v.nrm = g.nrm;
+  v.texCoord = g.texCoord;
+#else
+#if VERTEX_LAYOUT == VERTEX_LAYOUT_PACKED
+  v.pos = g.pos;
+#else
+  v.pos = obj.posOffset + obj.posScale * vec3(unpackSnorm2x16(g.posXY), unpackSnorm2x16(g.posZW).x);
+#endif
+  v.nrm = OctDecode(unpackSnorm2x16(g.nrm));
+  v.texCoord = unpackHalf2x16(g.texCoord);
+#endif
+  return v;
+}
+#endif
+
+// Meshlet limits; also the output sizes declared in scanline.mesh
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_TASK_GROUP_SIZE 32
+
+struct Meshlet  // Created by BuildMeshlets; used in the task and mesh shaders
+{
+  vec3  center;         // Bounding sphere in object space
+  float radius;
+  vec3  coneAxis;       // Average facing direction of the triangles
+  float coneCutoff;     // Sine of the normal cone's spread; 1 disables cone culling
+  uint  vertexOffset;   // First entry in the meshlet vertex index buffer
+  uint  triangleOffset; // First triangle, in the object's index buffer order
+  uint  vertexCount;
+  uint  triangleCount;
+};
+
+// Visible meshlets handed from the task shader to the mesh shader workgroups
+struct MeshletTaskPayload
+{
+  uint meshletIndices[MESHLET_TASK_GROUP_SIZE];
+};
 
 struct Material  // Created by readModel; used in shaders
 {
@@ -161,6 +312,7 @@ struct PushConstantUpscale
 	bool enable_rt_mix;
 	int tile_size;
 	int alignmentTest;
+	vec2 render_scale;  // Of the full resolution inputs, per axis (Graphics::GetRenderScale)
 };
 
 // Push constant structure for the Tile Max pass
@@ -187,6 +339,7 @@ struct PushConstantDrawBuffer
 	float dof_coc_sample_scale;
 	int tile_size;
 	int alignmentTest;
+	vec2 uv_scale;  // The part of the drawn buffer that holds the scene
 };
 
 struct RayPayload
@@ -198,6 +351,7 @@ struct RayPayload
 	int instanceIndex; // Index of the object instance hit (we have only one, so =0)
 	int primitiveIndex; // Index of the hit triangle primitive within object
 	vec3 bc; // Barycentric coordinates of the hit point within triangle
+	mat3 normalToWorld; // Inverse transpose of the hit instance's transform, for its normals
 	bool occluded;
 };
 
@@ -210,4 +364,12 @@ struct Emitter
 	uint index; // Not needed, but used for verification
 };
 
+// One slot of the emitter alias table (see AliasTable.h)
+struct EmitterAlias
+{
+	float prob; // Probability of keeping this slot rather than its alias
+	uint alias; // Emitter taken otherwise
+	float pdf; // Probability of selecting emitter i overall
+};
+
 #endif